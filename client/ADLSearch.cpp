@@ -190,29 +190,58 @@ int64_t ADLSearch::GetSizeBase() const
 	}
 }
 
+// Text without regex special characters: the case insensitive regex is a plain substring search then
+static bool isPlainText(const string& s)
+{
+	for (auto i = s.cbegin(); i != s.cend(); ++i)
+	{
+		if (uint8_t(*i) >= 0x80 || strchr("\\^$.|?*+()[]{}", *i))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
 void ADLSearch::prepare(StringMap& params)
 {
 	// Prepare quick search of substrings
-	stringSearches.clear();
-	
-	// Replace parameters such as %[nick]
-	const string s = Util::formatParams(searchString, params, false);
+	m_matcher.clear();
+	m_regex.reset();
 	
-	// Split into substrings
-	const StringTokenizer<string> st(s, ' ');
-	for (auto i = st.getTokens().cbegin(), iend = st.getTokens().cend(); i != iend; ++i)
+	if (isPlainText(searchString))
 	{
-		if (!i->empty())
+		m_matcher.add(searchString);
+	}
+	else
+	{
+		try
+		{
+			m_regex = std::make_shared<const std::regex>(searchString, std::regex_constants::icase);
+		}
+		catch (...) {}
+		
+		// Replace parameters such as %[nick]
+		const string s = Util::formatParams(searchString, params, false);
+		
+		// Split into substrings
+		const StringTokenizer<string> st(s, ' ');
+		for (auto i = st.getTokens().cbegin(), iend = st.getTokens().cend(); i != iend; ++i)
 		{
-			// Add substring search
-			stringSearches.emplace_back(StringSearch(*i));
+			if (!i->empty())
+			{
+				// Add substring search
+				m_matcher.add(*i);
+			}
 		}
 	}
+	m_matcher.compile();
 }
 
 inline void ADLSearch::unprepare()
 {
-	stringSearches.clear();
+	m_matcher.clear();
+	m_regex.reset();
 }
 
 bool ADLSearch::matchesFile(const string& f, const string& fp, int64_t size) const
@@ -269,25 +298,20 @@ bool ADLSearch::matchesDirectory(const string& d) const
 
 bool ADLSearch::searchAll(const string& s) const
 {
-	try
-	{
-		std::regex reg(searchString, std::regex_constants::icase);
-		return std::regex_search(s, reg);
-	}
-	catch (...) {}
-	
-	// Match all substrings
-	for (auto i = stringSearches.cbegin(), iend = stringSearches.cend(); i != iend; ++i)
+	if (m_regex)
 	{
-		if (!i->match(s))
+		try
 		{
-			return false;
+			return std::regex_search(s, *m_regex);
 		}
+		catch (...) {}
 	}
-	return !stringSearches.empty();
+	
+	// Match all substrings
+	return !m_matcher.empty() && m_matcher.match(s) == m_matcher.getMask();
 }
 
-ADLSearchManager::ADLSearchManager() : breakOnFirst(false), sentRaw(false)
+ADLSearchManager::ADLSearchManager() : breakOnFirst(false), sentRaw(false), m_arena(nullptr)
 {
 	load();
 }
@@ -446,7 +470,7 @@ void ADLSearchManager::matchesFile(DestDirList& destDirVector, DirectoryListing:
 	{
 		if (id->subdir != NULL)
 		{
-			auto copyFile = new DirectoryListing::File(*currentFile, true);
+			auto copyFile = new(*m_arena) DirectoryListing::File(*currentFile, true);
 			copyFile->setFlags(currentFile->getFlags());
 			dcassert(id->subdir->getAdls());
 			
@@ -471,7 +495,7 @@ void ADLSearchManager::matchesFile(DestDirList& destDirVector, DirectoryListing:
 		}
 		if (is->matchesFile(currentFile->getName(), filePath, currentFile->getSize()))
 		{
-			auto copyFile = new DirectoryListing::File(*currentFile, true);
+			auto copyFile = new(*m_arena) DirectoryListing::File(*currentFile, true);
 			copyFile->setFlags(currentFile->getFlags());
 #ifdef IRAINMAN_INCLUDE_USER_CHECK
 			if (is->isForbidden && !getSentRaw())
@@ -518,7 +542,7 @@ void ADLSearchManager::matchesDirectory(DestDirList& destDirVector, DirectoryLis
 		if (id->subdir != NULL)
 		{
 			DirectoryListing::Directory* newDir =
-			    new DirectoryListing::AdlDirectory(fullPath, id->subdir, currentDir->getName());
+			    new(*m_arena) DirectoryListing::AdlDirectory(fullPath, id->subdir, currentDir->getNameC());
 			id->subdir->directories.push_back(newDir);
 			id->subdir = newDir;
 		}
@@ -540,7 +564,7 @@ void ADLSearchManager::matchesDirectory(DestDirList& destDirVector, DirectoryLis
 		if (is->matchesDirectory(currentDir->getName()))
 		{
 			destDirVector[is->ddIndex].subdir =
-			    new DirectoryListing::AdlDirectory(fullPath, destDirVector[is->ddIndex].dir, currentDir->getName());
+			    new(*m_arena) DirectoryListing::AdlDirectory(fullPath, destDirVector[is->ddIndex].dir, currentDir->getNameC());
 			destDirVector[is->ddIndex].dir->directories.push_back(destDirVector[is->ddIndex].subdir);
 			if (breakOnFirst)
 			{
@@ -572,7 +596,7 @@ void ADLSearchManager::prepareDestinationDirectories(DestDirList& destDirVector,
 	destDirVector.clear();
 	auto id = destDirVector.emplace(destDirVector.end(), DestDir());
 	id->name = "ADLSearch";
-	id->dir  = new DirectoryListing::Directory(nullptr, root, "<<<" + id->name + ">>>", true, true, true);
+	id->dir  = new(*m_arena) DirectoryListing::Directory(nullptr, root, m_arena->intern("<<<" + id->name + ">>>"), true, true, true);
 	
 	// Scan all loaded searches
 	for (auto is = collection.begin(); is != collection.end(); ++is)
@@ -604,7 +628,7 @@ void ADLSearchManager::prepareDestinationDirectories(DestDirList& destDirVector,
 			// Add new destination directory
 			id = destDirVector.emplace(destDirVector.end(), DestDir());
 			id->name = is->destDir;
-			id->dir  = new DirectoryListing::Directory(nullptr, root, "<<<" + id->name + ">>>", true, true, true);
+			id->dir  = new(*m_arena) DirectoryListing::Directory(nullptr, root, m_arena->intern("<<<" + id->name + ">>>"), true, true, true);
 			is->ddIndex = ddIndex;
 		}
 	}
@@ -654,6 +678,7 @@ void ADLSearchManager::matchListing(DirectoryListing& aDirList) noexcept
 	}
 	setUser(aDirList.getUser());
 	setSentRaw(false);
+	m_arena = &aDirList.getArena();
 	
 	DestDirList destDirs;
 	prepareDestinationDirectories(destDirs, aDirList.getRoot(), params);
@@ -663,6 +688,8 @@ void ADLSearchManager::matchListing(DirectoryListing& aDirList) noexcept
 	matchRecurse(destDirs, aDirList.getRoot(), path);
 	
 	finalizeDestinationDirectories(destDirs, aDirList.getRoot());
+	aDirList.getArena().clearInternCache();
+	m_arena = nullptr;
 }
 
 void ADLSearchManager::matchRecurse(DestDirList &aDestList, DirectoryListing::Directory* aDir, const string &aPath)
@@ -25,6 +25,7 @@
 #if !defined(ADL_SEARCH_H)
 #define ADL_SEARCH_H
 
+#include <regex>
 #include "StringSearch.h"
 #include "DirectoryListing.h"
 
@@ -98,8 +99,10 @@ class ADLSearch
 		/// Search for directory match
 		bool matchesDirectory(const string& d) const;
 		
-		/// Substring searches
-		StringSearch::List stringSearches;
+		/// Case insensitive regular expression, null if searchString is not one or is plain text
+		std::shared_ptr<const std::regex> m_regex;
+		/// Substring searches, all of them in one pass
+		MultiStringSearch m_matcher;
 		bool searchAll(const string& s) const;
 };
 
@@ -153,6 +156,8 @@ class ADLSearchManager : public Singleton<ADLSearchManager>
 		void finalizeDestinationDirectories(DestDirList& destDirVector, DirectoryListing::Directory* root);
 		
 		static string getConfigFile();
+		
+		DirectoryListing::Arena* m_arena; // of the listing being matched, the copies are allocated there
 };
 
 #endif // !defined(ADL_SEARCH_H)
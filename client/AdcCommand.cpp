@@ -19,17 +19,17 @@
 #include "stdinc.h"
 #include "AdcCommand.h"
 
-AdcCommand::AdcCommand(uint32_t aCmd, char aType /* = TYPE_CLIENT */) : m_cmdInt(aCmd), m_from(0), m_type(aType), m_to(0)
+AdcCommand::AdcCommand(uint32_t aCmd, char aType /* = TYPE_CLIENT */) : m_cmdInt(aCmd), m_from(0), m_type(aType), m_to(0), m_is_index_full(false), m_is_parsed(false)
 {
 	dcassert(m_cmd[3] == 0);
 	m_cmd[3] = 0;
 }
-AdcCommand::AdcCommand(uint32_t aCmd, const uint32_t aTarget, char aType) : m_cmdInt(aCmd), m_from(0), m_to(aTarget), m_type(aType)
+AdcCommand::AdcCommand(uint32_t aCmd, const uint32_t aTarget, char aType) : m_cmdInt(aCmd), m_from(0), m_to(aTarget), m_type(aType), m_is_index_full(false), m_is_parsed(false)
 {
 	dcassert(m_cmd[3] == 0);
 	m_cmd[3] = 0;
 }
-AdcCommand::AdcCommand(Severity sev, Error err, const string& desc, char aType /* = TYPE_CLIENT */) : m_cmdInt(CMD_STA), m_from(0), m_type(aType), m_to(0)
+AdcCommand::AdcCommand(Severity sev, Error err, const string& desc, char aType /* = TYPE_CLIENT */) : m_cmdInt(CMD_STA), m_from(0), m_type(aType), m_to(0), m_is_index_full(false), m_is_parsed(false)
 {
 	addParam((sev == SEV_SUCCESS && err == SUCCESS) ? "000" : Util::toString(sev * 100 + err));
 	addParam(desc);
@@ -37,7 +37,7 @@ AdcCommand::AdcCommand(Severity sev, Error err, const string& desc, char aType /
 	m_cmd[3] = 0;
 }
 
-AdcCommand::AdcCommand(const string& aLine, bool nmdc /* = false */) : m_cmdInt(0), m_type(TYPE_CLIENT)
+AdcCommand::AdcCommand(const string& aLine, bool nmdc /* = false */) : m_cmdInt(0), m_type(TYPE_CLIENT), m_is_index_full(false), m_is_parsed(false)
 {
 	parse(aLine, nmdc);
 	dcassert(m_cmd[3] == 0);
@@ -80,110 +80,100 @@ void AdcCommand::parse(const string& aLine, bool nmdc /* = false */)
 		m_from = HUB_SID;
 	}
 	
-	string::size_type len = aLine.length();
-	const char* buf = aLine.c_str();
+	parameters.clear();
+	m_slices.clear();
+	m_line = aLine;
+	m_is_parsed = true;
+	m_is_index_full = false;
+	for (size_t j = 0; j < CODE_INDEX_SIZE; ++j)
+	{
+		m_code_index[j].m_pos = CODE_INDEX_EMPTY;
+	}
+	
+	const string::size_type len = m_line.length();
+	const char* buf = m_line.c_str();
 	string cur;
-	cur.reserve(128);
 	
 	bool toSet = false;
 	bool featureSet = false;
 	bool fromSet = nmdc; // $ADCxxx never have a from CID...
 	
-	while (i < len)
+	auto addToken = [&](string::size_type p_pos, string::size_type p_len, bool p_is_escaped)
 	{
-		switch (buf[i])
+		const bool l_is_header = ((m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE) && !fromSet) ||
+		                         ((m_type == TYPE_DIRECT || m_type == TYPE_ECHO) && !toSet) ||
+		                         (m_type == TYPE_FEATURE && !featureSet);
+		if (!l_is_header)
 		{
-			case '\\':
-				++i;
-				if (i == len)
-					throw ParseException("Escape at eol");
-				if (buf[i] == 's')
-					cur += ' ';
-				else if (buf[i] == 'n')
-					cur += '\n';
-				else if (buf[i] == '\\')
-					cur += '\\';
-				else if (buf[i] == ' ' && nmdc) // $ADCGET escaping, leftover from old specs
-					cur += ' ';
-				else
-					throw ParseException("Unknown escape");
-				break;
-			case ' ':
-				// New parameter...
-			{
-				if ((m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE) && !fromSet)
-				{
-					if (cur.length() != 4)
-					{
-						throw ParseException("Invalid SID length");
-					}
-					m_from = toSID(cur);
-					fromSet = true;
-				}
-				else if ((m_type == TYPE_DIRECT || m_type == TYPE_ECHO) && !toSet)
-				{
-					if (cur.length() != 4)
-					{
-						throw ParseException("Invalid SID length");
-					}
-					m_to = toSID(cur);
-					toSet = true;
-				}
-				else if (m_type == TYPE_FEATURE && !featureSet)
-				{
-					if (cur.length() % 5 != 0)
-					{
-						throw ParseException("Invalid feature length");
-					}
-					// Skip...
-					featureSet = true;
-				}
-				else
-				{
-					parameters.push_back(cur);
-				}
-				cur.clear();
-			}
-			break;
-			default:
-				cur += buf[i];
+			addSlice(uint32_t(p_pos), uint32_t(p_len), p_is_escaped);
+			return;
+		}
+		std::string_view l_value(buf + p_pos, p_len);
+		if (p_is_escaped)
+		{
+			unescape(buf + p_pos, p_len, cur);
+			l_value = cur;
 		}
-		++i;
-	}
-	if (!cur.empty())
-	{
 		if ((m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE) && !fromSet)
 		{
-			if (cur.length() != 4)
+			if (l_value.length() != 4)
 			{
 				throw ParseException("Invalid SID length");
 			}
-			m_from = toSID(cur);
+			m_from = toSID(l_value);
 			fromSet = true;
 		}
 		else if ((m_type == TYPE_DIRECT || m_type == TYPE_ECHO) && !toSet)
 		{
-			if (cur.length() != 4)
+			if (l_value.length() != 4)
 			{
 				throw ParseException("Invalid SID length");
 			}
-			m_to = toSID(cur);
+			m_to = toSID(l_value);
 			toSet = true;
 		}
-		else if (m_type == TYPE_FEATURE && !featureSet)
+		else
 		{
-			if (cur.length() % 5 != 0)
+			if (l_value.length() % 5 != 0)
 			{
 				throw ParseException("Invalid feature length");
 			}
 			// Skip...
 			featureSet = true;
 		}
-		else
+	};
+	
+	// Only the escapes are checked here, the values are unescaped when somebody reads them
+	string::size_type l_start = i;
+	bool l_is_escaped = false;
+	for (; i < len; ++i)
+	{
+		switch (buf[i])
 		{
-			parameters.push_back(cur);
+			case '\\':
+			{
+				++i;
+				if (i == len)
+					throw ParseException("Escape at eol");
+				if (!(buf[i] == 's' || buf[i] == 'n' || buf[i] == '\\' || (buf[i] == ' ' && nmdc))) // $ADCGET escaping, leftover from old specs
+					throw ParseException("Unknown escape");
+				l_is_escaped = true;
+				break;
+			}
+			case ' ':
+			{
+				// New parameter...
+				addToken(l_start, i - l_start, l_is_escaped);
+				l_start = i + 1;
+				l_is_escaped = false;
+				break;
+			}
 		}
 	}
+	if (l_start < len)
+	{
+		addToken(l_start, len - l_start, l_is_escaped);
+	}
 	
 	if ((m_type == TYPE_BROADCAST || m_type == TYPE_DIRECT || m_type == TYPE_ECHO || m_type == TYPE_FEATURE) && !fromSet)
 	{
@@ -201,6 +191,125 @@ void AdcCommand::parse(const string& aLine, bool nmdc /* = false */)
 	}
 }
 
+void AdcCommand::unescape(const char* p_value, size_t p_len, string& p_result)
+{
+	p_result.clear();
+	p_result.reserve(p_len);
+	for (size_t i = 0; i < p_len; ++i)
+	{
+		if (p_value[i] == '\\' && i + 1 < p_len)
+		{
+			++i;
+			p_result += p_value[i] == 's' ? ' ' : p_value[i] == 'n' ? '\n' : p_value[i]; // the rest stand for themselves
+		}
+		else
+		{
+			p_result += p_value[i];
+		}
+	}
+}
+
+void AdcCommand::addSlice(uint32_t p_pos, uint32_t p_len, bool p_is_escaped)
+{
+	const size_t l_index = m_slices.size();
+	m_slices.push_back(Slice{ p_pos, p_len, p_is_escaped });
+	if (m_is_index_full)
+		return;
+	// An escape inside the code hides it, such a line is searched the slow way
+	if (l_index >= CODE_INDEX_EMPTY || (p_len >= 2 && (m_line[p_pos] == '\\' || m_line[p_pos + 1] == '\\')))
+	{
+		m_is_index_full = true;
+		return;
+	}
+	if (p_len < 2)
+		return;
+	const uint16_t l_code = toCode(m_line.c_str() + p_pos);
+	for (size_t i = getCodeHash(l_code), j = 0; j < CODE_INDEX_SIZE; i = (i + 1) % CODE_INDEX_SIZE, ++j)
+	{
+		auto& l_item = m_code_index[i];
+		if (l_item.m_pos == CODE_INDEX_EMPTY)
+		{
+			l_item.m_code = l_code;
+			l_item.m_pos = uint8_t(l_index);
+			return;
+		}
+		if (l_item.m_code == l_code)
+			return; // The first one wins
+	}
+	m_is_index_full = true;
+}
+
+size_t AdcCommand::findParam(uint16_t p_code, size_t p_start) const
+{
+	dcassert(m_is_parsed);
+	size_t l_pos = p_start;
+	if (!m_is_index_full)
+	{
+		l_pos = m_slices.size();
+		for (size_t i = getCodeHash(p_code), j = 0; j < CODE_INDEX_SIZE; i = (i + 1) % CODE_INDEX_SIZE, ++j)
+		{
+			const auto& l_item = m_code_index[i];
+			if (l_item.m_pos == CODE_INDEX_EMPTY)
+				break;
+			if (l_item.m_code == p_code)
+			{
+				l_pos = l_item.m_pos;
+				break;
+			}
+		}
+		if (l_pos >= p_start)
+			return l_pos;
+		// The first one is before p_start
+		l_pos = p_start;
+	}
+	string l_buffer;
+	for (; l_pos < m_slices.size(); ++l_pos)
+	{
+		const std::string_view l_value = getParamView(l_pos, l_buffer);
+		if (l_value.size() >= 2 && toCode(l_value.data()) == p_code)
+			return l_pos;
+	}
+	return l_pos;
+}
+
+void AdcCommand::materialize() const
+{
+	dcassert(m_is_parsed);
+	parameters.clear();
+	parameters.reserve(m_slices.size());
+	for (auto i = m_slices.cbegin(); i != m_slices.cend(); ++i)
+	{
+		if (i->m_is_escaped)
+		{
+			parameters.push_back(string());
+			unescape(m_line.c_str() + i->m_pos, i->m_len, parameters.back());
+		}
+		else
+		{
+			parameters.push_back(m_line.substr(i->m_pos, i->m_len));
+		}
+	}
+	m_slices.clear();
+	m_is_parsed = false;
+}
+
+std::string_view AdcCommand::getParamView(size_t n, string& p_buffer) const
+{
+	if (!m_is_parsed)
+	{
+		dcassert(n < parameters.size());
+		return parameters[n];
+	}
+	dcassert(n < m_slices.size());
+	const Slice& l_slice = m_slices[n];
+	if (!l_slice.m_is_escaped)
+	{
+		return std::string_view(m_line.c_str() + l_slice.m_pos, l_slice.m_len);
+	}
+	unescape(m_line.c_str() + l_slice.m_pos, l_slice.m_len, p_buffer);
+	return p_buffer;
+}
+
 string AdcCommand::toString(const CID& aCID, bool nmdc /* = false */) const
 {
 	return getHeaderString(aCID) + getParamString(nmdc);
@@ -309,6 +418,23 @@ string AdcCommand::getParamString(bool nmdc) const
 
 bool AdcCommand::getParam(const char* name, size_t start, string& ret) const
 {
+	if (m_is_parsed)
+	{
+		const size_t i = findParam(toCode(name), start);
+		if (i == m_slices.size())
+			return false;
+		const Slice& l_slice = m_slices[i];
+		if (l_slice.m_is_escaped)
+		{
+			unescape(m_line.c_str() + l_slice.m_pos, l_slice.m_len, ret);
+			ret.erase(0, 2);
+		}
+		else
+		{
+			ret.assign(m_line, l_slice.m_pos + 2, l_slice.m_len - 2);
+		}
+		return true;
+	}
 	for (string::size_type i = start; i < getParameters().size(); ++i)
 	{
 		if (toCode(name) == toCode(getParameters()[i].c_str()))
@@ -322,6 +448,16 @@ bool AdcCommand::getParam(const char* name, size_t start, string& ret) const
 
 bool AdcCommand::hasFlag(const char* name, size_t start) const
 {
+	if (m_is_parsed)
+	{
+		// Flags are never escaped: "XX1"
+		for (size_t i = findParam(toCode(name), start); i < m_slices.size(); i = findParam(toCode(name), i + 1))
+		{
+			if (m_slices[i].m_len == 3 && m_line[m_slices[i].m_pos + 2] == '1')
+				return true;
+		}
+		return false;
+	}
 	for (string::size_type i = start; i < getParameters().size(); ++i)
 	{
 		if (getParameters()[i].size() == 3 &&
@@ -20,6 +20,7 @@
 #ifndef DCPLUSPLUS_DCPP_ADC_COMMAND_H
 #define DCPLUSPLUS_DCPP_ADC_COMMAND_H
 
+#include <string_view>
 #include "Util.h"
 #include "CID.h"
 
@@ -163,31 +164,49 @@ class AdcCommand
 		
 		StringList& getParameters()
 		{
+			if (m_is_parsed)
+				materialize();
 			return parameters;
 		}
 		const StringList& getParameters() const
 		{
+			if (m_is_parsed)
+				materialize();
 			return parameters;
 		}
+		size_t getParamCount() const
+		{
+			return m_is_parsed ? m_slices.size() : parameters.size();
+		}
+		/** The parameter n without a copy if it has no escapes, unescaped into p_buffer otherwise */
+		std::string_view getParamView(size_t n, string& p_buffer) const;
 		
 		string toString(const CID& aCID, bool nmdc = false) const;
 		string toString(uint32_t sid, bool nmdc = false) const;
 		
 		AdcCommand& addParam(const string& name, const string& value)
 		{
+			if (m_is_parsed)
+				materialize();
 			parameters.push_back(name);
 			parameters.back() += value;
 			return *this;
 		}
 		AdcCommand& addParam(const string& str)
 		{
+			if (m_is_parsed)
+				materialize();
 			parameters.push_back(str);
 			return *this;
 		}
 		const string getParam(size_t n) const //   -  .
 		{
-			dcassert(getParameters().size() > n);
-			return getParameters().size() > n ? getParameters()[n] : BaseUtil::emptyString;
+			dcassert(getParamCount() > n);
+			if (getParamCount() <= n)
+				return BaseUtil::emptyString;
+			string l_buffer;
+			const std::string_view l_value = getParamView(n, l_buffer);
+			return l_value.data() == l_buffer.data() ? l_buffer : string(l_value);
 		}
 		/** Return a named parameter where the name is a two-letter code */
 		bool getParam(const char* name, size_t start, string& ret) const;
@@ -229,7 +248,7 @@ class AdcCommand
 			}
 			return l_nick;
 		}
-		static uint32_t toSID(const string& aSID)
+		static uint32_t toSID(std::string_view aSID)
 		{
 			return *reinterpret_cast<const uint32_t*>(aSID.data());
 		}
@@ -243,7 +262,38 @@ class AdcCommand
 	private:
 		string getHeaderString(const CID& cid) const;
 		string getHeaderString(uint32_t sid, bool nmdc) const;
-		StringList parameters;
+		
+		// A parsed line keeps its parameters as slices of m_line, they are unescaped when read.
+		// getParameters() turns them into the plain list for the code that wants the strings.
+		struct Slice
+		{
+			uint32_t m_pos;
+			uint32_t m_len;
+			bool m_is_escaped;
+		};
+		// First parameter by its two-letter code, open addressing
+		struct CodeIndex
+		{
+			uint16_t m_code;
+			uint8_t m_pos;
+		};
+		static const size_t CODE_INDEX_SIZE = 64;
+		static const uint8_t CODE_INDEX_EMPTY = 0xFF;
+		static size_t getCodeHash(uint16_t p_code)
+		{
+			return (p_code * 0x9E3779B1u) >> 26;
+		}
+		void addSlice(uint32_t p_pos, uint32_t p_len, bool p_is_escaped);
+		size_t findParam(uint16_t p_code, size_t p_start) const;
+		void materialize() const;
+		static void unescape(const char* p_value, size_t p_len, string& p_result);
+		
+		mutable StringList parameters;
+		mutable std::vector<Slice> m_slices;
+		string m_line;
+		CodeIndex m_code_index[CODE_INDEX_SIZE];
+		bool m_is_index_full;
+		mutable bool m_is_parsed;
 		string features;
 		union
 		{
@@ -230,7 +230,7 @@ void AdcHub::clearUsers()
 
 void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 	{
 		dcassert(0);
 		return;
@@ -287,65 +287,69 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 	auto& u = ou->getUser();
 	string l_ip4;
 	string l_ip6;
-	for (auto i = c.getParameters().cbegin(); i != c.getParameters().cend(); ++i)
+	string l_buffer;
+	for (size_t i = 0; i < c.getParamCount(); ++i)
 	{
-		if (i->length() < 2)
+		const std::string_view l_param = c.getParamView(i, l_buffer);
+		if (l_param.length() < 2)
 		{
 			dcassert(0);
 			continue;
 		}
-		switch (*(short*)i->c_str())
+		// Numbers are read in place: the slice ends with a space or with the end of the line
+		const char* l_value = l_param.data() + 2;
+		switch (*(short*)l_param.data())
 		{
 			case TAG('S', 'L'):
 			{
-				id.setSlots(Util::toInt(i->c_str() + 2));
+				id.setSlots(Util::toInt(l_value));
 				break;
 			}
 			case TAG('F', 'S'):
 			{
-				id.setFreeSlots(Util::toInt(i->c_str() + 2));
+				id.setFreeSlots(Util::toInt(l_value));
 				break;
 			}
 			case TAG('S', 'S'):
 			{
-				changeBytesSharedL(id, Util::toInt64(i->c_str() + 2));
+				changeBytesSharedL(id, Util::toInt64(l_value));
 				break;
 			}
 			
 			case TAG('S', 'U'):
 			{
-				AdcSupports::setSupports(id, i->substr(2));
+				AdcSupports::setSupports(id, string(l_param.substr(2)));
 				break;
 			}
 			case TAG('S', 'F'):
 			{
-				id.setSharedFiles(Util::toInt(i->c_str() + 2));
+				id.setSharedFiles(Util::toInt(l_value));
 				break;
 			}
 			case TAG('I', '4'):
 			{
-				l_ip4 = i->substr(2);
+				l_ip4 = string(l_param.substr(2));
 				break;
 			}
 			case TAG('U', '4'):
 			case TAG('U', '6'):
 			{
-				id.setUdpPort(Util::toInt(i->substr(2)));
+				id.setUdpPort(Util::toInt(l_value));
 				break;
 			}
 			case TAG('I', '6'):
 			{
-				l_ip6 = i->substr(2);
+				l_ip6 = string(l_param.substr(2));
 				break;
 			}
 			case TAG('E', 'M'):
 			{
-				id.setEmail(i->substr(2));
+				id.setEmail(string(l_param.substr(2)));
 				break;
 			}
 			case TAG('D', 'E'):
 			{
-				id.setDescription(i->substr(2));
+				id.setDescription(string(l_param.substr(2)));
 				break;
 			}
 			case TAG('C', 'O'):
@@ -361,7 +365,7 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 			}
 			case TAG('D', 'S'):
 			{
-				id.setDownloadSpeed(Util::toUInt32(i->c_str() + 2));
+				id.setDownloadSpeed(Util::toUInt32(l_value));
 				break;
 			}
 			case TAG('O', 'P'):
@@ -373,32 +377,32 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 			
 			case TAG('C', 'T'):
 			{
-				id.setClientType(Util::toInt(i->c_str() + 2));
+				id.setClientType(Util::toInt(l_value));
 				break;
 			}
 			case TAG('U', 'S'):
 			{
-				id.setLimit(Util::toUInt32(i->c_str() + 2));
+				id.setLimit(Util::toUInt32(l_value));
 				break;
 			}
 			case TAG('H', 'N'):
 			{
-				id.setHubNormal(i->c_str() + 2);
+				id.setHubNormal(l_value);
 				break;
 			}
 			case TAG('H', 'R'):
 			{
-				id.setHubRegister(i->c_str() + 2);
+				id.setHubRegister(l_value);
 				break;
 			}
 			case TAG('H', 'O'):
 			{
-				id.setHubOperator(i->c_str() + 2);
+				id.setHubOperator(l_value);
 				break;
 			}
 			case TAG('N', 'I'):
 			{
-				id.setNick(i->substr(2));
+				id.setNick(string(l_param.substr(2)));
 				break;
 			}
 			case TAG('A', 'W'):
@@ -409,18 +413,19 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 #ifdef _DEBUG
 			case TAG('V', 'E'):
 			{
-				id.setStringParam("VE", i->substr(2));
+				id.setStringParam("VE", string(l_param.substr(2)));
 				break;
 			}
 			case TAG('A', 'P'):
 			{
-				id.setStringParam("AP", i->substr(2));
+				id.setStringParam("AP", string(l_param.substr(2)));
 				break;
 			}
 #endif
 			default:
 			{
-				id.setStringParam(i->c_str(), i->substr(2));
+				const char l_code[3] = { l_param[0], l_param[1], 0 };
+				id.setStringParam(l_code, string(l_param.substr(2)));
 			}
 		}
 	}
@@ -20,6 +20,7 @@
 #include "BZUtils.h"
 #include "Exception.h"
 #include "ResourceManager.h"
+#include "CompatibilityManager.h"
 
 BZFilter::BZFilter()
 {
@@ -109,14 +110,301 @@ bool UnBZFilter::operator()(const void* in, size_t& insize, void* out, size_t& o
 		dcassert(l_ret == BZ_OK);
 		l_ret = BZ2_bzDecompressInit(&zs, 0, 0);
 		dcassert(l_ret == BZ_OK);
-		if (insize == 0)
-			return false;
-		else
-			return true;
+		// Another stream may follow even if this chunk ended with the stream (pbzip2, own file list);
+		// the end of the input is the call with insize == 0
+		return true;
 	}
 	return err == BZ_OK;
 }
 
+// bzip2 stream layout: "BZh9", per block the 48 bit magic 0x314159265359 and the block CRC,
+// at the end the magic 0x177245385090, the combined CRC and padding to a whole byte
+static const uint64_t g_bz_block_magic = 0x314159265359ULL;
+static const uint64_t g_bz_end_magic = 0x177245385090ULL;
+
+static uint64_t readBits(const uint8_t* p_src, uint64_t p_pos, unsigned p_count)
+{
+	uint64_t l_value = 0;
+	for (unsigned i = 0; i < p_count; ++i, ++p_pos)
+	{
+		l_value = (l_value << 1) | ((p_src[p_pos / 8] >> (7 - p_pos % 8)) & 1);
+	}
+	return l_value;
+}
+
+void BZBlocks::appendBits(const uint8_t* p_src, uint64_t p_begin, uint64_t p_count)
+{
+	if (p_count == 0)
+		return;
+	const unsigned l_dst_shift = unsigned(m_bits % 8);
+	const unsigned l_src_shift = unsigned(p_begin % 8);
+	m_data.resize(size_t((m_bits + p_count + 7) / 8)); // the bits behind m_bits are zero
+	uint8_t* l_dst = &m_data[size_t(m_bits / 8)];
+	const uint8_t* l_src = p_src + size_t(p_begin / 8);
+	for (uint64_t l_left = p_count; l_left > 0; ++l_src, ++l_dst)
+	{
+		const unsigned l_count = l_left < 8 ? unsigned(l_left) : 8;
+		uint8_t l_byte = uint8_t(l_src[0] << l_src_shift);
+		if (l_src_shift && l_count > 8 - l_src_shift)
+			l_byte |= l_src[1] >> (8 - l_src_shift);
+		l_byte &= uint8_t(0xFF << (8 - l_count));
+		l_dst[0] |= l_byte >> l_dst_shift;
+		if (l_dst_shift && l_count > 8 - l_dst_shift)
+			l_dst[1] |= uint8_t(l_byte << (8 - l_dst_shift));
+		l_left -= l_count;
+	}
+	m_bits += p_count;
+}
+
+void BZBlocks::compressBlock(const char* p_in, size_t p_len)
+{
+	// The worst case of bzip2: 1% and 600 bytes over the input
+	string l_out;
+	unsigned int l_size = p_len + p_len / 100 + 600;
+	l_out.resize(l_size);
+	if (BZ2_bzBuffToBuffCompress(&l_out[0], &l_size, const_cast<char*>(p_in), p_len, 9, 0, 30) != BZ_OK)
+		throw Exception(STRING(COMPRESSION_ERROR));
+	const uint8_t* l_stream = reinterpret_cast<const uint8_t*>(l_out.data());
+	const uint64_t l_bits = uint64_t(l_size) * 8;
+	// A stream of one block: its combined CRC is the CRC of the block
+	if (l_size < 4 + 6 + 4 + 6 + 4 || memcmp(l_stream, "BZh9", 4) != 0 || readBits(l_stream, 32, 48) != g_bz_block_magic)
+		throw Exception(STRING(COMPRESSION_ERROR));
+	const uint32_t l_block_crc = uint32_t(readBits(l_stream, 80, 32));
+	for (uint64_t l_end = l_bits - 80; l_end + 87 >= l_bits && l_end > 112; --l_end)
+	{
+		if (readBits(l_stream, l_end, 48) == g_bz_end_magic && uint32_t(readBits(l_stream, l_end + 48, 32)) == l_block_crc)
+		{
+			appendBits(l_stream, 32, l_end - 32);
+			m_crc = ((m_crc << 1) | (m_crc >> 31)) ^ l_block_crc;
+			++m_count;
+			return;
+		}
+	}
+	throw Exception(STRING(COMPRESSION_ERROR));
+}
+
+void BZBlocks::compress(const void* p_in, size_t p_len)
+{
+	const char* l_in = static_cast<const char*>(p_in);
+	while (p_len > 0)
+	{
+		const size_t l_len = std::min(p_len, MAX_INPUT);
+		compressBlock(l_in, l_len);
+		l_in += l_len;
+		p_len -= l_len;
+	}
+}
+
+void BZBlocks::append(const BZBlocks& p_blocks)
+{
+	const unsigned l_rotate = p_blocks.m_count % 32;
+	if (l_rotate)
+		m_crc = (m_crc << l_rotate) | (m_crc >> (32 - l_rotate));
+	m_crc ^= p_blocks.m_crc;
+	m_count += p_blocks.m_count;
+	if (!p_blocks.m_data.empty())
+		appendBits(&p_blocks.m_data[0], 0, p_blocks.m_bits);
+}
+
+void BZBlocks::finish()
+{
+	uint8_t l_end[10];
+	for (int i = 0; i < 6; ++i)
+	{
+		l_end[i] = uint8_t(g_bz_end_magic >> (40 - i * 8));
+	}
+	for (int i = 0; i < 4; ++i)
+	{
+		l_end[6 + i] = uint8_t(m_crc >> (24 - i * 8));
+	}
+	appendBits(l_end, 0, 80);
+	m_bits = (m_bits + 7) & ~uint64_t(7);
+}
+
+size_t BZBlocks::write(OutputStream* p_stream)
+{
+	const size_t l_len = size_t(m_bits / 8);
+	if (l_len == 0)
+		return 0;
+	const size_t l_written = p_stream->write(&m_data[0], l_len);
+	m_data.erase(m_data.begin(), m_data.begin() + l_len);
+	m_bits %= 8;
+	return l_written;
+}
+
+size_t BZBlocks::writeHeader(OutputStream* p_stream)
+{
+	return p_stream->write("BZh9", 4);
+}
+
+ParallelBZStream::ParallelBZStream(OutputStream* aStream) : m_stream(aStream), m_target(&m_out), m_is_stopping(false), m_is_error(false), m_is_flushed(false), m_is_header_written(false)
+{
+}
+
+ParallelBZStream::ParallelBZStream(BZBlocks& p_target) : m_stream(nullptr), m_target(&p_target), m_is_stopping(false), m_is_error(false), m_is_flushed(false), m_is_header_written(false)
+{
+}
+
+ParallelBZStream::~ParallelBZStream()
+{
+	if (!m_workers.empty())
+	{
+		m_is_stopping = true;
+		for (size_t i = 0; i < m_workers.size(); ++i)
+		{
+			m_queue_sem.signal();
+		}
+		for (auto i = m_workers.cbegin(); i != m_workers.cend(); ++i)
+		{
+			(*i)->join();
+		}
+	}
+}
+
+void ParallelBZStream::compress(Block& p_block)
+{
+	p_block.m_out.compress(p_block.m_in.data(), p_block.m_in.size());
+	string().swap(p_block.m_in);
+}
+
+int ParallelBZStream::Worker::run()
+{
+	for (;;)
+	{
+		m_owner.m_queue_sem.wait();
+		if (m_owner.m_is_stopping)
+			break;
+		Block* l_block;
+		{
+			CFlyLock(m_owner.m_cs);
+			dcassert(!m_owner.m_queue.empty());
+			l_block = m_owner.m_queue.front();
+			m_owner.m_queue.pop_front();
+		}
+		try
+		{
+			compress(*l_block);
+		}
+		catch (const Exception&)
+		{
+			m_owner.m_is_error = true;
+		}
+		l_block->m_is_done = true;
+		m_owner.m_done_sem.signal();
+	}
+	return 0;
+}
+
+void ParallelBZStream::submitBlock()
+{
+	std::unique_ptr<Block> l_block(new Block);
+	l_block->m_in.swap(m_block);
+	if (m_workers.empty())
+	{
+		// The first full block: the input is big enough to be worth the threads
+		const size_t l_count = std::max(size_t(1), CompatibilityManager::getProcessorsCount());
+		for (size_t i = 0; i < l_count; ++i)
+		{
+			m_workers.push_back(std::unique_ptr<Worker>(new Worker(*this)));
+			m_workers.back()->start(0, "ParallelBZ");
+		}
+	}
+	{
+		CFlyLock(m_cs);
+		m_queue.push_back(l_block.get());
+	}
+	m_blocks.push_back(std::move(l_block));
+	m_queue_sem.signal();
+}
+
+size_t ParallelBZStream::writeBlocks(bool p_is_wait)
+{
+	size_t l_written = 0;
+	while (!m_blocks.empty())
+	{
+		Block& l_block = *m_blocks.front();
+		if (!l_block.m_is_done)
+		{
+			// Two blocks per core keep the workers busy and the memory bounded
+			if (!p_is_wait && m_blocks.size() < m_workers.size() * 2)
+				break;
+			m_done_sem.wait();
+			continue;
+		}
+		if (m_is_error)
+			throw Exception(STRING(COMPRESSION_ERROR));
+		m_target->append(l_block.m_out);
+		m_blocks.pop_front();
+		l_written += writeOut();
+	}
+	return l_written;
+}
+
+size_t ParallelBZStream::writeOut()
+{
+	if (!m_stream)
+		return 0;
+	size_t l_written = 0;
+	if (!m_is_header_written)
+	{
+		m_is_header_written = true;
+		l_written += BZBlocks::writeHeader(m_stream);
+	}
+	return l_written + m_out.write(m_stream);
+}
+
+size_t ParallelBZStream::write(const void* p_buf, size_t p_len)
+{
+	if (m_is_flushed)
+		throw Exception("No filtered writes after flush");
+	const char* l_buf = static_cast<const char*>(p_buf);
+	size_t l_written = 0;
+	while (p_len > 0)
+	{
+		if (m_block.empty())
+		{
+			m_block.reserve(BZBlocks::MAX_INPUT);
+		}
+		const size_t l_len = std::min(p_len, BZBlocks::MAX_INPUT - m_block.size());
+		m_block.append(l_buf, l_len);
+		l_buf += l_len;
+		p_len -= l_len;
+		if (m_block.size() == BZBlocks::MAX_INPUT)
+		{
+			submitBlock();
+			l_written += writeBlocks(false);
+		}
+	}
+	return l_written;
+}
+
+size_t ParallelBZStream::flushBuffers(bool aForce)
+{
+	if (m_is_flushed)
+		return 0;
+	m_is_flushed = true;
+	size_t l_written = 0;
+	if (!m_block.empty())
+	{
+		if (m_workers.empty())
+		{
+			m_target->compress(m_block.data(), m_block.size());
+			string().swap(m_block);
+		}
+		else
+		{
+			submitBlock();
+		}
+	}
+	l_written += writeBlocks(true);
+	if (!m_stream)
+		return l_written;
+	// An empty input still gets a valid (empty) stream, as with BZFilter
+	m_out.finish();
+	l_written += writeOut();
+	return l_written + m_stream->flushBuffers(aForce);
+}
+
 /**
  * @file
  * $Id: BZUtils.cpp 568 2011-07-24 18:28:43Z bigmuscle $
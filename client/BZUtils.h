@@ -23,6 +23,8 @@
 #define BZ_UTILS_H
 
 #include <bzlib.h>
+#include "Streams.h"
+#include "Semaphore.h"
 
 class BZFilter
 {
@@ -60,6 +62,116 @@ class UnBZFilter
 		bz_stream zs;
 };
 
+/**
+ * Compressed bzip2 blocks without the stream header and the end of stream mark.
+ * Blocks are bit aligned, so they are joined bit by bit, and the combined CRC of the stream
+ * is updated as bzip2 does it. Runs compressed apart thus make one stream, which every
+ * bzip2 decoder reads completely (UnBZFilter of DC++ stops at the first end of stream mark).
+ */
+class BZBlocks
+{
+	public:
+		BZBlocks() : m_bits(0), m_crc(0), m_count(0)
+		{
+		}
+		/// The input of one block: bzip2 -9 takes 900k after its run length encoding, which grows the input by 1/4 at most
+		static const size_t MAX_INPUT = 700 * 1000;
+		/**
+		* Compress data and append the blocks.
+		* @param p_len Input size, pieces of MAX_INPUT are compressed one by one.
+		*/
+		void compress(const void* p_in, size_t p_len);
+		void append(const BZBlocks& p_blocks);
+		/// Append the end of stream mark with the combined CRC, nothing may be appended after it
+		void finish();
+		/// Write the complete bytes, the last incomplete one is kept for the next blocks
+		size_t write(OutputStream* p_stream);
+		static size_t writeHeader(OutputStream* p_stream);
+		bool empty() const
+		{
+			return m_count == 0;
+		}
+	private:
+		void compressBlock(const char* p_in, size_t p_len);
+		void appendBits(const uint8_t* p_src, uint64_t p_begin, uint64_t p_count);
+		std::vector<uint8_t> m_data;
+		uint64_t m_bits; // in m_data
+		uint32_t m_crc;
+		unsigned m_count;
+};
+
+/**
+ * bzip2 on all cores: the input is cut into pieces of BZBlocks::MAX_INPUT, the workers compress
+ * them into blocks and the blocks are joined in order into one stream, which any bzip2 decoder reads.
+ * Input shorter than one piece is compressed in the caller's thread, no worker is started then.
+ */
+class ParallelBZStream : public OutputStream
+{
+	public:
+		using OutputStream::write;
+		
+		explicit ParallelBZStream(OutputStream* aStream);
+		/// The blocks are only appended to p_target, without the stream header and the end of stream mark
+		explicit ParallelBZStream(BZBlocks& p_target);
+		~ParallelBZStream();
+		
+		size_t write(const void* p_buf, size_t p_len) override;
+		size_t flushBuffers(bool aForce) override;
+		
+	protected:
+		OutputStream* m_stream;
+		
+	private:
+		struct Block
+		{
+			Block() : m_is_done(false)
+			{
+			}
+			string m_in;
+			BZBlocks m_out;
+			volatile bool m_is_done;
+		};
+		class Worker : public Thread
+		{
+			public:
+				explicit Worker(ParallelBZStream& p_owner) : m_owner(p_owner)
+				{
+				}
+			private:
+				int run() override;
+				ParallelBZStream& m_owner;
+		};
+		static void compress(Block& p_block);
+		void submitBlock();
+		size_t writeBlocks(bool p_is_wait);
+		size_t writeOut();
+		
+		string m_block;
+		std::deque<std::unique_ptr<Block>> m_blocks; // in the order of the output
+		std::deque<Block*> m_queue; // not taken by a worker yet
+		CriticalSection m_cs;
+		Semaphore m_queue_sem;
+		Semaphore m_done_sem;
+		std::vector<std::unique_ptr<Worker>> m_workers;
+		BZBlocks m_out;
+		BZBlocks* m_target; // m_out or the target of the blocks only
+		volatile bool m_is_stopping;
+		volatile bool m_is_error;
+		bool m_is_flushed;
+		bool m_is_header_written;
+};
+
+template<bool managed>
+class ParallelBZOutputStream : public ParallelBZStream
+{
+	public:
+		explicit ParallelBZOutputStream(OutputStream* aStream) : ParallelBZStream(aStream) { }
+		~ParallelBZOutputStream()
+		{
+			if (managed) delete m_stream;
+		}
+};
+
 #endif // !defined(BZ_UTILS_H)
 
 /**
@@ -23,16 +23,244 @@
 #include "ShareManager.h"
 #include "SSLSocket.h"
 #include "UserConnection.h"
+#include "CompatibilityManager.h"
 #include "../FlyFeatures/flyServer.h"
 
+#include <mswsock.h>
+
 // Polling is used for tasks...should be fixed...
 static const uint64_t POLL_TIMEOUT = 250;
 #ifdef FLYLINKDC_USE_SOCKET_COUNTER
 std::atomic<long> BufferedSocket::g_sockets(0);
 #endif
 
+/**
+ * Sockets that sit between commands don't need a thread each: they are multiplexed with
+ * WSAPoll over a small fixed set of reactor threads, which also run their line parsing and
+ * listener callbacks. Phases that block (connect/accept handshake, file sends, throttled
+ * data mode) still run on the socket's own thread, which hands the socket back when done.
+ */
+class BufferedSocket::Reactor : public Thread
+{
+	public:
+		Reactor();
+		~Reactor();
+		
+		static Reactor* get();
+		static void shutdown();
+		
+		void attach(BufferedSocket* p_socket);
+		void wakeup();
+		
+	private:
+		int run() override;
+		void stop();
+		
+		FastCriticalSection m_cs;
+		std::vector<BufferedSocket*> m_attached; // handed over, not yet picked up by run()
+		std::vector<BufferedSocket*> m_sockets;  // reactor thread only
+		SOCKET m_wakeup_sock;
+		std::atomic<bool> m_is_wakeup_pending;
+		volatile bool m_stop;
+		
+		static FastCriticalSection g_cs;
+		static std::vector<std::unique_ptr<Reactor>> g_reactors;
+		static size_t g_next_reactor;
+};
+
+FastCriticalSection BufferedSocket::Reactor::g_cs;
+std::vector<std::unique_ptr<BufferedSocket::Reactor>> BufferedSocket::Reactor::g_reactors;
+size_t BufferedSocket::Reactor::g_next_reactor = 0;
+
+BufferedSocket::Reactor::Reactor() : m_wakeup_sock(INVALID_SOCKET), m_is_wakeup_pending(false), m_stop(false)
+{
+	// A datagram socket connected to itself lets other threads break WSAPoll when they queue a task.
+	// Without it tasks are still picked up, only POLL_TIMEOUT later.
+	SOCKET l_sock = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (l_sock != INVALID_SOCKET)
+	{
+		sockaddr_in l_addr = { 0 };
+		l_addr.sin_family = AF_INET;
+		l_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		int l_len = sizeof(l_addr);
+		u_long l_non_blocking = 1;
+		if (::bind(l_sock, (sockaddr*)&l_addr, sizeof(l_addr)) == 0 &&
+		        ::getsockname(l_sock, (sockaddr*)&l_addr, &l_len) == 0 &&
+		        ::connect(l_sock, (sockaddr*)&l_addr, sizeof(l_addr)) == 0 &&
+		        ::ioctlsocket(l_sock, FIONBIO, &l_non_blocking) == 0)
+		{
+			m_wakeup_sock = l_sock;
+		}
+		else
+		{
+			dcdebug("BufferedSocket::Reactor can't create wakeup socket, error = %d\n", ::WSAGetLastError());
+			::closesocket(l_sock);
+		}
+	}
+}
+
+BufferedSocket::Reactor::~Reactor()
+{
+	dcassert(m_sockets.empty() && m_attached.empty());
+	if (m_wakeup_sock != INVALID_SOCKET)
+	{
+		::closesocket(m_wakeup_sock);
+	}
+}
+
+BufferedSocket::Reactor* BufferedSocket::Reactor::get()
+{
+	CFlyFastLock(g_cs);
+	if (g_reactors.empty())
+	{
+		const size_t l_count = std::max(size_t(2), std::min(CompatibilityManager::getProcessorsCount(), size_t(4)));
+		for (size_t i = 0; i < l_count; ++i)
+		{
+			g_reactors.push_back(std::make_unique<Reactor>());
+			g_reactors.back()->start(256, "BufferedSocket::Reactor");
+		}
+	}
+	return g_reactors[g_next_reactor++ % g_reactors.size()].get();
+}
+
+void BufferedSocket::Reactor::shutdown()
+{
+	CFlyFastLock(g_cs);
+	for (auto i = g_reactors.cbegin(); i != g_reactors.cend(); ++i)
+	{
+		(*i)->stop();
+	}
+	g_reactors.clear();
+}
+
+void BufferedSocket::Reactor::stop()
+{
+	m_stop = true;
+	wakeup();
+	join();
+}
+
+void BufferedSocket::Reactor::attach(BufferedSocket* p_socket)
+{
+	{
+		CFlyFastLock(m_cs);
+		m_attached.push_back(p_socket);
+	}
+	wakeup();
+}
+
+void BufferedSocket::Reactor::wakeup()
+{
+	if (m_wakeup_sock != INVALID_SOCKET && !m_is_wakeup_pending.exchange(true))
+	{
+		const char l_byte = 0;
+		::send(m_wakeup_sock, &l_byte, 1, 0);
+	}
+}
+
+int BufferedSocket::Reactor::run()
+{
+	std::vector<WSAPOLLFD> l_fds;
+	std::vector<int> l_fd_index; // m_sockets[i] -> l_fds[i] or -1 when the socket isn't polled
+	std::vector<char> l_is_ready;
+	while (!m_stop)
+	{
+		{
+			CFlyFastLock(m_cs);
+			m_sockets.insert(m_sockets.end(), m_attached.cbegin(), m_attached.cend());
+			m_attached.clear();
+		}
+		l_fds.clear();
+		l_fd_index.resize(m_sockets.size());
+		l_is_ready.resize(m_sockets.size());
+		bool l_has_ready = false;
+		if (m_wakeup_sock != INVALID_SOCKET)
+		{
+			const WSAPOLLFD l_fd = { m_wakeup_sock, POLLRDNORM, 0 };
+			l_fds.push_back(l_fd);
+		}
+		for (size_t i = 0; i < m_sockets.size(); ++i)
+		{
+			bool l_ready = false;
+			const short l_events = m_sockets[i]->getPollEvents(l_ready);
+			l_is_ready[i] = l_ready;
+			l_has_ready |= l_ready;
+			l_fd_index[i] = -1;
+			if (l_events)
+			{
+				l_fd_index[i] = int(l_fds.size());
+				const WSAPOLLFD l_fd = { m_sockets[i]->sock->m_sock, l_events, 0 };
+				l_fds.push_back(l_fd);
+			}
+		}
+		const INT l_timeout = l_has_ready ? 0 : INT(POLL_TIMEOUT);
+		if (l_fds.empty())
+		{
+			sleep(l_timeout);
+		}
+		else if (::WSAPoll(&l_fds[0], ULONG(l_fds.size()), l_timeout) == SOCKET_ERROR)
+		{
+			dcdebug("BufferedSocket::Reactor WSAPoll error = %d\n", ::WSAGetLastError());
+			for (auto i = l_fds.begin(); i != l_fds.end(); ++i)
+			{
+				i->revents = 0;
+			}
+			sleep(l_timeout);
+		}
+		if (m_wakeup_sock != INVALID_SOCKET && l_fds[0].revents)
+		{
+			m_is_wakeup_pending = false;
+			char l_buf[64];
+			while (::recv(m_wakeup_sock, l_buf, sizeof(l_buf), 0) > 0)
+			{
+			}
+		}
+		
+		size_t l_keep = 0;
+		for (size_t i = 0; i < m_sockets.size(); ++i)
+		{
+			BufferedSocket* l_socket = m_sockets[i];
+			const short l_revents = l_fd_index[i] >= 0 ? l_fds[l_fd_index[i]].revents : 0;
+			ReactorStep l_step = REACTOR_KEEP;
+			if (l_is_ready[i] || l_revents)
+			{
+				l_step = l_socket->reactorStep((l_revents & (POLLRDNORM | POLLHUP | POLLERR | POLLNVAL)) != 0, (l_revents & POLLWRNORM) != 0);
+			}
+			switch (l_step)
+			{
+				case REACTOR_KEEP:
+					m_sockets[l_keep++] = l_socket;
+					break;
+				case REACTOR_DETACH:
+					try
+					{
+						l_socket->start(64, "BufferedSocket");
+					}
+					catch (const ThreadException& e)
+					{
+						// No thread for the blocking phase: the connection fails, running it here
+						// would stall the other sockets of the reactor until it ends.
+						LogManager::message("BufferedSocket::Reactor: " + e.getError());
+						l_socket->m_state = RUNNING; // fail() reports a connect/accept too
+						l_socket->fail(e.getError());
+						m_sockets[l_keep++] = l_socket;
+					}
+					break;
+				case REACTOR_DESTROY:
+					delete l_socket;
+					break;
+			}
+		}
+		m_sockets.resize(l_keep);
+	}
+	return 0;
+}
+
 BufferedSocket::BufferedSocket(char aSeparator, UserConnection* p_connection) :
 	m_connection(p_connection),
+	m_reactor(nullptr),
+	m_sendPos(0),
+	m_is_send_blocked(false),
 	m_separator(aSeparator),
 	m_mode(MODE_LINE),
 	m_dataBytes(0),
@@ -44,10 +272,11 @@ BufferedSocket::BufferedSocket(char aSeparator, UserConnection* p_connection) :
 	m_is_all_my_info_loaded(false),
 	m_is_hide_share(false)
 {
-	start(64, "BufferedSocket");
 #ifdef FLYLINKDC_USE_SOCKET_COUNTER
 	++g_sockets;
 #endif
+	m_reactor = Reactor::get();
+	m_reactor->attach(this);
 }
 
 BufferedSocket::~BufferedSocket()
@@ -263,7 +492,7 @@ void BufferedSocket::threadAccept()
 	}
 }
 
-bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separator, const string& p_line,
+bool BufferedSocket::all_search_parser(std::string_view p_line,
                                        CFlySearchArrayTTH& p_tth_search,
                                        CFlySearchArrayFile& p_file_search)
 {
@@ -287,31 +516,24 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 	}
 	if (p_line.compare(2, 6, "earch ", 6) == 0)
 	{
-#ifndef _DEBUG
-		const
-#endif
-		string l_line_item = p_line.substr(0, p_pos_next_separator);
-#ifdef _DEBUG
-		//l_line_item = "$Search 176.100.102.17:6817 F?T?0?9?TTH:QMBSPUHEM2G6KNUCMFLYKVONBLIRH5KEP46GEOI\t\t";
-#endif
-		auto l_marker_tth = l_line_item.find("?0?9?TTH:");
+		auto l_marker_tth = p_line.find("?0?9?TTH:");
 		// TODO      
 		// "x.x.x.x:yyy T?F?57671680?9?TTH:A3VSWSWKCVC4N6EP2GX47OEMGT5ZL52BOS2LAHA"
 		// "$Search 176.100.102.17:6817 F?T?0?9?TTH:QMBSPUHEM2G6KNUCMFLYKVONBLIRH5KEP46GEOI\t\t"
-		if (l_marker_tth != string::npos &&
+		if (l_marker_tth != std::string_view::npos &&
 		        l_marker_tth > 5 &&
-		        l_line_item[l_marker_tth - 4] == ' ' &&
-		        l_line_item.size() >= l_marker_tth + 9 + 39
+		        p_line[l_marker_tth - 4] == ' ' &&
+		        p_line.size() >= l_marker_tth + 9 + 39
 		   ) //      F?T?0?9?TTH:  F?F?0?9?TTH:  T?T?0?9?TTH:
 		{
-			dcassert(l_line_item.size() == l_marker_tth + 9 + 39 ||
-			         l_line_item.size() == l_marker_tth + 9 + 40
+			dcassert(p_line.size() == l_marker_tth + 9 + 39 ||
+			         p_line.size() == l_marker_tth + 9 + 40
 			        );
 			l_marker_tth -= 4;
 #ifdef _DEBUG
 			static FastCriticalSection g_stat_cs;
 			static std::unordered_map<TTHValue, unsigned> g_tth_count;
-			const string l_tth_str = l_line_item.substr(l_marker_tth + 13, 39);
+			const string l_tth_str(p_line.substr(l_marker_tth + 13, 39));
 			const TTHValue l_tth_orig(l_tth_str);
 			unsigned l_count_tth = 0;
 			if (DebugManager::g_isCMDDebug)
@@ -320,11 +542,11 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 				l_count_tth = ++g_tth_count[l_tth_orig];
 			}
 #endif
-			const TTHValue l_tth(l_line_item.c_str() + l_marker_tth + 13, 39);
+			const TTHValue l_tth(p_line.data() + l_marker_tth + 13, 39);
 			//dcassert(l_tth == l_tth_orig);
 			if (ShareManager::isUnknownTTH(l_tth) == false)
 			{
-				const string l_search_str = l_line_item.substr(8, l_marker_tth - 8);
+				const string l_search_str(p_line.substr(8, l_marker_tth - 8));
 				dcassert(l_search_str.size() > 4);
 				if (l_search_str.size() > 4)
 				{
@@ -339,13 +561,15 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 				++g_count_skip;
 				if (DebugManager::g_isCMDDebug)
 				{
-					l_line_item = "[count All = " + Util::toString(g_count_skip) + "] "
-					              + "[count TTH = " + Util::toString(l_count_tth) + "] "
-					              + "[size_map = "   + Util::toString(g_tth_count.size()) + "] "
-					              + l_line_item;
+					const string l_line_item = "[count All = " + Util::toString(g_count_skip) + "] "
+					                           + "[count TTH = " + Util::toString(l_count_tth) + "] "
+					                           + "[size_map = "   + Util::toString(g_tth_count.size()) + "] "
+					                           + string(p_line);
+					COMMAND_DEBUG("[TTH][FastSkip]" + l_line_item, DebugTask::HUB_IN, getServerAndPort());
 				}
+#else
+				COMMAND_DEBUG("[TTH][FastSkip]" + string(p_line), DebugTask::HUB_IN, getServerAndPort());
 #endif
-				COMMAND_DEBUG("[TTH][FastSkip]" + l_line_item, DebugTask::HUB_IN, getServerAndPort());
 #ifdef _DEBUG
 				//  LogManager::message("BufferedSocket::all_search_parser Skip unknown TTH = " + l_tth.toBase32());
 #endif
@@ -353,6 +577,10 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 		}
 		else
 		{
+#ifndef _DEBUG
+			const
+#endif
+			string l_line_item(p_line);
 			if (Util::isValidSearch(l_line_item) == false)
 			{
 				if (!m_count_search_ddos)
@@ -461,26 +689,22 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 	{
 		if (p_line.size() >= 45 && p_line[3] == ' ' && (p_line[2] == 'P' || p_line[2] == 'A') && p_line[43] == ' ')
 		{
-			const TTHValue l_tth(p_line.c_str() + 4, 39);
+			const TTHValue l_tth(p_line.data() + 4, 39);
 			if (ShareManager::isUnknownTTH(l_tth) == false)
 			{
-				const auto l_end_cmd = p_line.find('|', 43);
-				if (l_end_cmd != string::npos)
+				// The view ends at the separator
+				string l_search_str(p_line.substr(44));
+				if (p_line[2] == 'P')
+					l_search_str = "Hub:" + l_search_str;
+				dcassert(l_search_str.size() > 4);
+				if (l_search_str.size() > 4)
 				{
-					string l_search_str = p_line.substr(44, l_end_cmd - 44);
-					if (p_line[2] == 'P')
-						l_search_str = "Hub:" + l_search_str;
-					dcassert(l_search_str.size() > 4);
-					if (l_search_str.size() > 4)
-					{
-						p_tth_search.emplace_back(CFlySearchItemTTH(l_tth, l_search_str));
-					}
+					p_tth_search.emplace_back(CFlySearchItemTTH(l_tth, l_search_str));
 				}
 			}
 			else
 			{
-				string l_line_item = p_line.substr(0, p_pos_next_separator);
-				COMMAND_DEBUG("[TTHS][FastSkip]" + l_line_item, DebugTask::HUB_IN, getServerAndPort());
+				COMMAND_DEBUG("[TTHS][FastSkip]" + string(p_line), DebugTask::HUB_IN, getServerAndPort());
 #ifdef _DEBUG
 				//  LogManager::message("BufferedSocket::all_search_parser Skip unknown TTH = " + l_tth.toBase32());
 #endif
@@ -491,10 +715,10 @@ bool BufferedSocket::all_search_parser(const string::size_type p_pos_next_separa
 	}
 	return false;
 }
-void BufferedSocket::all_myinfo_parser(const string::size_type p_pos_next_separator, const string& p_line, StringList& p_all_myInfo, bool p_is_zon)
+void BufferedSocket::all_myinfo_parser(std::string_view p_line, StringList& p_all_myInfo, bool p_is_zon)
 {
 	const bool l_is_MyINFO = m_is_all_my_info_loaded == false ? p_line.compare(0, 8, "$MyINFO ", 8) == 0 : false;
-	const string l_line_item = l_is_MyINFO ? p_line.substr(8, p_pos_next_separator - 8) : p_line.substr(0, p_pos_next_separator);
+	const std::string_view l_line_item = l_is_MyINFO ? p_line.substr(8) : p_line;
 	if (m_is_all_my_info_loaded == false)
 	{
 		if (l_is_MyINFO)
@@ -503,7 +727,7 @@ void BufferedSocket::all_myinfo_parser(const string::size_type p_pos_next_separa
 			if (!l_line_item.empty())
 			{
 				++m_myInfoCount;
-				p_all_myInfo.push_back(l_line_item);
+				p_all_myInfo.emplace_back(l_line_item);
 			}
 		}
 		else if (m_myInfoCount)
@@ -536,7 +760,7 @@ void BufferedSocket::all_myinfo_parser(const string::size_type p_pos_next_separa
 			{
 				if (!(l_line_item[0] == '<' || l_line_item[0] == '$' || l_line_item[l_line_item.length() - 1] == '|'))
 				{
-					LogManager::message("OnLine: " + l_line_item);
+					LogManager::message("OnLine: " + string(l_line_item));
 				}
 			}
 #endif
@@ -545,7 +769,7 @@ void BufferedSocket::all_myinfo_parser(const string::size_type p_pos_next_separa
 				//dcassert(m_is_disconnecting == false)
 				if (m_is_disconnecting == false)
 				{
-					fly_fire1(BufferedSocketListener::Line(), l_line_item); // TODO -     l     inbuf
+					fly_fire1(BufferedSocketListener::Line(), string(l_line_item)); // TODO -     l     inbuf
 				}
 			}
 		}
@@ -682,17 +906,20 @@ void BufferedSocket::threadRead()
 						StringList l_all_myInfo;
 						CFlySearchArrayTTH l_tth_search;
 						CFlySearchArrayFile l_file_search;
-						while ((l_zpos = l.find(m_separator)) != string::npos)
+						string::size_type l_zbegin = 0;
+						while ((l_zpos = l.find(m_separator, l_zbegin)) != string::npos)
 						{
-							if (l_zpos > 0) // check empty (only pipe) command and don't waste cpu with it ;o)
+							if (l_zpos > l_zbegin) // check empty (only pipe) command and don't waste cpu with it ;o)
 							{
-								if (all_search_parser(l_zpos, l, l_tth_search, l_file_search) == false)
+								const std::string_view l_line(l.data() + l_zbegin, l_zpos - l_zbegin);
+								if (all_search_parser(l_line, l_tth_search, l_file_search) == false)
 								{
-									all_myinfo_parser(l_zpos, l, l_all_myInfo, true);
+									all_myinfo_parser(l_line, l_all_myInfo, true);
 								}
 							}
-							l.erase(0, l_zpos + 1 /* separator char */);
+							l_zbegin = l_zpos + 1 /* separator char */;
 						}
+						l.erase(0, l_zbegin);
 						parseMyINfo(l_all_myInfo);
 						parseSearch(l_tth_search, l_file_search);
 #else
@@ -736,7 +963,8 @@ void BufferedSocket::threadRead()
 					//   -    
 					//   -   UDP (  ?)
 					//======================================================================
-					l = m_line + string((char*)& m_inbuf[l_bufpos], l_left);
+					l = m_line;
+					l.append((char*)& m_inbuf[l_bufpos], l_left);
 					//dcassert(isalnum(l[0]) || isalpha(l[0]) || isascii(l[0]));
 #if 0
 					int l_count_separator = 0;
@@ -750,7 +978,8 @@ void BufferedSocket::threadRead()
 						StringList l_all_myInfo;
 						CFlySearchArrayTTH l_tth_search;
 						CFlySearchArrayFile l_file_search;
-						while ((l_pos = l.find(m_separator)) != string::npos)
+						string::size_type l_begin = 0;
+						while ((l_pos = l.find(m_separator, l_begin)) != string::npos)
 						{
 #if 0
 							if (l_count_separator++ && l.length() > 0 && BOOLSETTING(LOG_PROTOCOL))
@@ -765,18 +994,18 @@ void BufferedSocket::threadRead()
 								m_line.clear();
 								throw SocketException(STRING(COMMAND_SHUTDOWN_IN_PROGRESS));
 							}
-							if (l_pos > 0) // check empty (only pipe) command and don't waste cpu with it ;o)
+							if (l_pos > l_begin) // check empty (only pipe) command and don't waste cpu with it ;o)
 							{
-								if (all_search_parser(l_pos, l, l_tth_search, l_file_search) == false)
+								const std::string_view l_line(l.data() + l_begin, l_pos - l_begin);
+								if (all_search_parser(l_line, l_tth_search, l_file_search) == false)
 								{
-									all_myinfo_parser(l_pos, l, l_all_myInfo, false);
+									all_myinfo_parser(l_line, l_all_myInfo, false);
 								}
 							}
-							l.erase(0, l_pos + 1 /* separator char */);
-							// TODO - erase  .
-							if (l.length() < (size_t)l_left)
+							l_begin = l_pos + 1 /* separator char */;
+							if (l.length() - l_begin < (size_t)l_left)
 							{
-								l_left = l.length();
+								l_left = l.length() - l_begin;
 							}
 							//dcassert(mode == MODE_LINE);
 							if (m_mode != MODE_LINE)
@@ -785,10 +1014,13 @@ void BufferedSocket::threadRead()
 								// TOOD ? m_myInfoStop = true;
 								// we changed mode; remainder of l is invalid.
 								l.clear();
+								l_begin = 0;
 								l_bufpos = l_total - l_left;
 								break;
 							}
 						}
+						// The consumed commands are dropped at once, not one by one
+						l.erase(0, l_begin);
 						parseMyINfo(l_all_myInfo);
 						parseSearch(l_tth_search, l_file_search);
 					}
@@ -898,16 +1130,12 @@ boost::asio::ip::address_v4 BufferedSocket::getIp4() const
 	}
 }
 
-void BufferedSocket::putBufferedSocket(BufferedSocket*& p_sock, bool p_delete /*= false*/)
+void BufferedSocket::putBufferedSocket(BufferedSocket*& p_sock)
 {
 	if (p_sock)
 	{
 		p_sock->m_connection = nullptr;
-		p_sock->shutdown();
-		if (p_delete)
-		{
-			delete p_sock;
-		}
+		p_sock->shutdown(); // deleted by its reactor (or thread) once SHUTDOWN is processed
 		p_sock = nullptr;
 	}
 }
@@ -919,9 +1147,103 @@ void BufferedSocket::waitShutdown()
 	{
 		sleep(10);
 	}
+	Reactor::shutdown();
 }
 #endif
 
+static const DWORD TRANSMIT_FILE_CHUNK = 1024 * 1024;
+
+/**
+ * Zero-copy path of threadSendFile for plain sockets: the file goes out with TransmitFile straight
+ * from the system cache, chunk by chunk so that ThrottleManager still meters it.
+ * @return false if the stream isn't a plain file range or TransmitFile failed - threadSendFile
+ *         goes on with read() + send() from where this stopped.
+ */
+bool BufferedSocket::threadTransmitFile(InputStream* p_file)
+{
+	HANDLE l_file = INVALID_HANDLE_VALUE;
+	int64_t l_pos = 0;
+	int64_t l_left = 0;
+	if (sock->isSecure() || !Socket::isTransmitFileEnabled() || !p_file->getFileRange(l_file, l_pos, l_left))
+		return false;
+		
+	LPFN_TRANSMITFILE l_transmit_file = nullptr;
+	GUID l_guid = WSAID_TRANSMITFILE;
+	DWORD l_size = 0;
+	if (::WSAIoctl(sock->m_sock, SIO_GET_EXTENSION_FUNCTION_POINTER, &l_guid, sizeof(l_guid),
+	               &l_transmit_file, sizeof(l_transmit_file), &l_size, nullptr, nullptr) == SOCKET_ERROR || !l_transmit_file)
+		return false;
+		
+	OVERLAPPED l_ov = { 0 };
+	l_ov.hEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	if (!l_ov.hEvent)
+		return false;
+		
+	bool l_is_done = true;
+	dcdebug("Starting threadTransmitFile\n");
+	while (l_left > 0 && !socketIsDisconnecting())
+	{
+		size_t l_len = size_t(std::min(l_left, int64_t(TRANSMIT_FILE_CHUNK)));
+		if (!ThrottleManager::getInstance()->acquireUpload(sock.get(), l_len))
+		{
+			continue; // acquireUpload has slept until the next refill
+		}
+		if (l_len == 0)
+		{
+			ThrottleManager::waitForTokens();
+			continue;
+		}
+		LARGE_INTEGER l_offset;
+		l_offset.QuadPart = l_pos;
+		l_ov.Offset = l_offset.LowPart;
+		l_ov.OffsetHigh = l_offset.HighPart;
+		::ResetEvent(l_ov.hEvent);
+		if (!l_transmit_file(sock->m_sock, l_file, DWORD(l_len), 0, &l_ov, nullptr, 0))
+		{
+			const int l_error = ::WSAGetLastError();
+			if (l_error != WSA_IO_PENDING)
+			{
+				dcdebug("TransmitFile error = %d\n", l_error);
+				l_is_done = false;
+				break;
+			}
+		}
+		while (::WaitForSingleObject(l_ov.hEvent, POLL_TIMEOUT) == WAIT_TIMEOUT)
+		{
+			if (socketIsDisconnecting())
+			{
+				::CancelIoEx(reinterpret_cast<HANDLE>(sock->m_sock), &l_ov);
+			}
+		}
+		DWORD l_sent = 0;
+		DWORD l_flags = 0;
+		if (!::WSAGetOverlappedResult(sock->m_sock, &l_ov, &l_sent, FALSE, &l_flags) || l_sent == 0)
+		{
+			dcdebug("TransmitFile result error = %d\n", ::WSAGetLastError());
+			l_is_done = socketIsDisconnecting();
+			break;
+		}
+		p_file->skipFileRange(l_sent);
+		l_pos += l_sent;
+		l_left -= l_sent;
+		Socket::g_stats.m_tcp.totalUp += l_sent;
+		dcassert(m_connection);
+		if (m_connection)
+		{
+			m_connection->fireBytesSent(l_sent, l_sent);
+		}
+	}
+	::CloseHandle(l_ov.hEvent);
+	
+	if (!l_is_done)
+		return false;
+	if (!socketIsDisconnecting())
+	{
+		fly_fire(BufferedSocketListener::TransmitDone());
+	}
+	return true;
+}
+
 void BufferedSocket::threadSendFile(InputStream* p_file)
 {
 	if (m_state != RUNNING)
@@ -931,6 +1253,9 @@ void BufferedSocket::threadSendFile(InputStream* p_file)
 		return;
 	dcassert(p_file != NULL);
 	
+	if (threadTransmitFile(p_file))
+		return;
+		
 	const size_t l_sockSize = MAX_SOCKET_BUFFER_SIZE; //   size_t(sock->getSocketOptInt(SO_SNDBUF));
 	static size_t g_bufSize = 0;
 	if (g_bufSize == 0)
@@ -1128,51 +1453,65 @@ void BufferedSocket::write(const char* aBuf, size_t aLen)
 	m_writeBuf.insert(m_writeBuf.end(), aBuf, aBuf + aLen); // [1] std::bad_alloc
 }
 
-void BufferedSocket::threadSendData()
+/**
+ * Sends m_sendBuf, refilling it from m_writeBuf when it is empty.
+ * @param p_is_blocking Wait for the socket until everything is sent (own thread),
+ *                      otherwise stop at the first write that would block (reactor).
+ * @return false if data is left to send once the socket becomes writable.
+ */
+bool BufferedSocket::threadSendData(bool p_is_blocking)
 {
 	if (m_state != RUNNING)
-		return;
-	ByteVector l_sendBuf;
+		return true;
+	if (m_sendBuf.empty())
 	{
 		CFlyFastLock(cs);
 		if (m_writeBuf.empty())
 		{
-			dcassert(!m_writeBuf.empty());
-			return;
+			return true;
 		}
-		m_writeBuf.swap(l_sendBuf);
+		m_writeBuf.swap(m_sendBuf);
+		m_sendPos = 0;
 	}
 	
-	size_t left = l_sendBuf.size();
-	size_t done = 0;
-	while (left > 0)
+	while (m_sendPos < m_sendBuf.size())
 	{
 		if (ClientManager::isBeforeShutdown())
 		{
 #ifdef _DEBUG
-			LogManager::message("[ClientManager::isBeforeShutdown()]Skip BufferedSocket::threadSendData Data = " + string((const char*)&l_sendBuf[0], l_sendBuf.size()));
+			LogManager::message("[ClientManager::isBeforeShutdown()]Skip BufferedSocket::threadSendData Data = " + string((const char*)&m_sendBuf[0], m_sendBuf.size()));
 #endif
 		}
 		if (socketIsDisconnecting())
 		{
-			return;
-		}
-		
-		const auto w = sock->wait(POLL_TIMEOUT, true, true);
-		
-		if (w.first) {
-			threadRead();
+			break;
 		}
 		
-		if (w.second) {
-			// TODO - find ("||")
-			int n = sock->write(&l_sendBuf[done], left);  // adguard
-			if (n > 0) {
-				left -= n;
-				done += n;
+		if (p_is_blocking)
+		{
+			const auto w = sock->wait(POLL_TIMEOUT, true, true);
+			
+			if (w.first) {
+				threadRead();
+			}
+			
+			if (!w.second) {
+				continue;
 			}
 		}
+		// TODO - find ("||")
+		// OpenSSL wants a retry with the same buffer, m_sendBuf isn't touched until it is sent
+		const int n = sock->write(&m_sendBuf[m_sendPos], int(m_sendBuf.size() - m_sendPos));  // adguard
+		if (n > 0) {
+			m_sendPos += n;
+		}
+		else if (!p_is_blocking) {
+			return false;
+		}
 	}
+	m_sendBuf.clear();
+	m_sendPos = 0;
+	return true;
 }
 
 bool BufferedSocket::checkEvents()
@@ -1203,7 +1542,7 @@ bool BufferedSocket::checkEvents()
 			}
 			else if (p.first == SEND_DATA)
 			{
-				threadSendData();
+				threadSendData(true);
 			}
 			else if (p.first == SEND_FILE)
 			{
@@ -1266,9 +1605,100 @@ void BufferedSocket::checkSocket() {
 	}
 }
 
+short BufferedSocket::getPollEvents(bool& p_is_ready)
+{
+	// sock is only read once RUNNING: while STARTING connect()/accept() may still be setting it
+	const bool l_is_running = m_state == RUNNING && hasSocket() && sock->m_sock != INVALID_SOCKET;
+	{
+		CFlyFastLock(cs);
+		p_is_ready = !m_tasks.empty() &&
+		             !(l_is_running && m_is_send_blocked && m_tasks.front().first == SEND_DATA && !socketIsDisconnecting());
+	}
+	if (!l_is_running)
+		return 0;
+	if (sock->hasPendingRead())
+		p_is_ready = true;
+	return m_is_send_blocked ? POLLRDNORM | POLLWRNORM : POLLRDNORM;
+}
 
 /**
- * Main task dispatcher for the buffered socket abstraction.
+ * Reactor counterpart of run(): reads what the socket has and runs the tasks that can't block.
+ * Stops at the first task that needs the socket's own thread.
+ */
+BufferedSocket::ReactorStep BufferedSocket::reactorStep(bool p_is_readable, bool p_is_writable)
+{
+	try
+	{
+		if (m_state == RUNNING && (p_is_readable || sock->hasPendingRead()))
+		{
+			threadRead();
+			if (!canUseReactor())
+				return REACTOR_DETACH;
+		}
+		while (true)
+		{
+			Tasks l_task;
+			{
+				CFlyFastLock(cs);
+				if (m_tasks.empty())
+					break;
+				l_task = m_tasks.front().first;
+			}
+			if ((m_state == STARTING && l_task != SHUTDOWN) || (m_state == RUNNING && l_task == SEND_FILE))
+			{
+				return REACTOR_DETACH;
+			}
+			if (m_state == RUNNING && l_task == SEND_DATA)
+			{
+				if (m_is_send_blocked && !p_is_writable && !socketIsDisconnecting())
+					break; // the socket buffer is still full
+				m_is_send_blocked = !threadSendData(false);
+				if (m_is_send_blocked)
+					break; // SEND_DATA stays queued until POLLWRNORM
+			}
+			{
+				CFlyFastLock(cs);
+				m_tasks.pop_front();
+			}
+			m_socket_semaphore.wait(0);
+			if (l_task == SHUTDOWN)
+			{
+				return REACTOR_DESTROY;
+			}
+			if (m_state == RUNNING)
+			{
+				if (l_task == UPDATED)
+				{
+					fly_fire(BufferedSocketListener::Updated());
+				}
+				else if (l_task == DISCONNECT)
+				{
+					fail(STRING(DISCONNECTED));
+				}
+				else if (l_task != SEND_DATA)
+				{
+					dcdebug("%d unexpected in RUNNING state\n", l_task);
+				}
+			}
+			else
+			{
+				dcdebug("%d unexpected in FAILED state\n", l_task);
+			}
+		}
+	}
+	catch (const Exception& e)
+	{
+#ifdef _DEBUG
+		LogManager::message("BufferedSocket::reactorStep(), error = " + e.getError());
+#endif
+		fail(e.getError());
+	}
+	return REACTOR_KEEP;
+}
+
+/**
+ * Task dispatcher for the blocking phases of the buffered socket abstraction,
+ * the socket goes back to its reactor as soon as they are over.
  * @todo Fix the polling...
  */
 int BufferedSocket::run()
@@ -1294,6 +1724,12 @@ int BufferedSocket::run()
 #endif
 			fail(e.getError());
 		}
+		if (canUseReactor())
+		{
+			dcdebug("BufferedSocket::run() back to reactor %p\n", (void*)this);
+			m_reactor->attach(this);
+			return 0;
+		}
 	}
 	dcdebug("BufferedSocket::run() end %p\n", (void*)this);
 	delete this;
@@ -1380,6 +1816,7 @@ void BufferedSocket::addTaskL(Tasks p_task, TaskData* p_data)
 	
 	m_tasks.push_back(std::make_pair(p_task, std::unique_ptr<TaskData>(p_data)));
 	m_socket_semaphore.signal();
+	m_reactor->wakeup();
 }
 
 /**
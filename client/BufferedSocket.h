@@ -23,6 +23,7 @@
 #define DCPLUSPLUS_DCPP_BUFFERED_SOCKET_H
 
 #include <atomic>
+#include <string_view>
 #include <boost/asio/ip/address_v4.hpp>
 
 #include "BufferedSocketListener.h"
@@ -60,7 +61,7 @@ class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread
 			return l_sock;
 		}
 		
-		static void putBufferedSocket(BufferedSocket*& p_sock, bool p_delete = false);
+		static void putBufferedSocket(BufferedSocket*& p_sock);
 		
 #ifdef FLYLINKDC_USE_SOCKET_COUNTER
 		static void waitShutdown();
@@ -144,10 +145,10 @@ class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread
 			if (hasSocket())
 				sock->setMaxSpeed(maxSpeed);
 		}
-		void updateSocketBucket(unsigned int p_numberOfUserConnection) const
+		void setUploadBucket(const std::shared_ptr<TokenBucket>& p_bucket)
 		{
 			if (hasSocket())
-				sock->updateSocketBucket(p_numberOfUserConnection);
+				sock->setUploadBucket(p_bucket);
 		}
 		void write(const string& aData)
 		{
@@ -205,8 +206,9 @@ class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread
 			return getIp() + ':' + Util::toString(getPort());
 		}
 		
-		void all_myinfo_parser(const string::size_type p_pos_next_separator, const string& p_line, StringList& p_all_myInfo, bool p_is_zon);
-		bool all_search_parser(const string::size_type p_pos_next_separator, const string& p_line,
+		// p_line is one command without the separator, a view into the receive buffer
+		void all_myinfo_parser(std::string_view p_line, StringList& p_all_myInfo, bool p_is_zon);
+		bool all_search_parser(std::string_view p_line,
 		                       CFlySearchArrayTTH& p_tth_search,
 		                       CFlySearchArrayFile& p_file_search);
 		char m_separator;
@@ -250,6 +252,16 @@ class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread
 			InputStream* m_stream;
 		};
 		
+		enum ReactorStep
+		{
+			REACTOR_KEEP,    // Stays on the reactor
+			REACTOR_DETACH,  // Needs a blocking phase on its own thread
+			REACTOR_DESTROY  // SHUTDOWN processed, the socket is gone
+		};
+		
+		class Reactor;
+		Reactor* m_reactor;
+		
 		explicit BufferedSocket(char aSeparator, UserConnection* p_connection);
 		
 		~BufferedSocket();
@@ -264,6 +276,9 @@ class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread
 		bool   m_is_hide_share;
 		void resizeInBuf();
 		ByteVector m_writeBuf;
+		ByteVector m_sendBuf; // taken from m_writeBuf, may be partially sent
+		size_t m_sendPos;
+		bool m_is_send_blocked;
 		string m_line;
 		int64_t m_dataBytes;
 		size_t m_rollback;
@@ -282,7 +297,8 @@ class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread
 		void threadAccept();
 		void threadRead();
 		void threadSendFile(InputStream* is);
-		void threadSendData();
+		bool threadTransmitFile(InputStream* p_file);
+		bool threadSendData(bool p_is_blocking);
 		
 		void fail(const string& aError);
 #ifdef FLYLINKDC_USE_SOCKET_COUNTER
@@ -291,6 +307,13 @@ class BufferedSocket : public Speaker<BufferedSocketListener>, private Thread
 		bool checkEvents();
 		void checkSocket();
 		
+		short getPollEvents(bool& p_is_ready);
+		ReactorStep reactorStep(bool p_is_readable, bool p_is_writable);
+		bool canUseReactor() const
+		{
+			return m_state != RUNNING || m_mode != MODE_DATA;
+		}
+		
 		void setSocket(std::unique_ptr<Socket> && s);
 		void shutdown();
 		void addTask(Tasks task, TaskData* data);
@@ -3,6 +3,7 @@
 //-----------------------------------------------------------------------------
 #include "stdinc.h"
 #include <Shellapi.h>
+#include <chrono>
 
 #include "ShareManager.h"
 #include "QueueManager.h"
@@ -18,7 +19,7 @@ using sqlite3x::sqlite3_reader;
 
 //bool g_DisableUserStat = false;
 bool g_DisableSQLJournal    = false;
-bool g_UseWALJournal        = false;
+bool g_UseWALJournal        = false; // /sqlite_use_wal, also enables the read connection pool
 bool g_EnableSQLtrace       = false; // http://www.sqlite.org/c3ref/profile.html
 bool g_UseSynchronousOff    = false;
 int g_DisableSQLtrace      = 0;
@@ -335,7 +336,7 @@ void CFlylinkDBManager::errorDB(const string& p_txt)
 	}
 }
 //========================================================================================================
-CFlylinkDBManager::CFlylinkDBManager()
+CFlylinkDBManager::CFlylinkDBManager() : m_writer(this), m_commit_count(0), m_commit_total_usec(0), m_commit_last_usec(0), m_commit_max_usec(0)
 {
 #ifdef FLYLINKDC_USE_ANTIVIRUS_DB
 	m_virus_cs = std::unique_ptr<webrtc::RWLockWrapper>(webrtc::RWLockWrapper::CreateRWLock());
@@ -446,6 +447,12 @@ CFlylinkDBManager::CFlylinkDBManager()
 #ifdef FLYLINKDC_USE_ANTIVIRUS_DB
 				m_flySQLiteDB.executenonquery("attach database 'FlylinkDC_antivirus.sqlite' as antivirus_db");
 #endif
+				// Readers see committed data alongside the writer only in WAL mode, and the base is
+				// switched to WAL by /sqlite_use_wal only: by default check_tth and load_dir still share m_cs
+				if (!g_DisableSQLJournal && !BOOLSETTING(SQLITE_USE_JOURNAL_MEMORY) && g_UseWALJournal)
+				{
+					open_read_pool();
+				}
 				
 #ifdef FLYLINKDC_USE_LEVELDB
 				//    .      levelDB    .
@@ -849,6 +856,140 @@ CFlylinkDBManager::CFlylinkDBManager()
 	{
 		errorDB("SQLite - CFlylinkDBManager: " + e.getError());
 	}
+	m_writer.start(0, "CFlyDBWriter");
+}
+//========================================================================================================
+void CFlylinkDBManager::open_read_pool()
+{
+	static const size_t g_read_pool_size = 3; // hasher, share refresh and one spare
+	try
+	{
+		for (size_t i = 0; i < g_read_pool_size; ++i)
+		{
+			std::unique_ptr<CFlyReadConnection> l_conn(new CFlyReadConnection);
+			l_conn->m_db.open("FlylinkDC.sqlite");
+			l_conn->m_db.setbusytimeout(1000);
+			l_conn->m_db.executenonquery("PRAGMA query_only=1");
+			l_conn->m_db.executenonquery("PRAGMA temp_store=MEMORY");
+			m_read_free.push_back(l_conn.get());
+			m_read_connections.push_back(std::move(l_conn));
+		}
+	}
+	catch (const database_error& e)
+	{
+		// Without the pool lookups simply go through the main connection
+		LogManager::message("[SQLite] open_read_pool: " + e.getError(), true);
+	}
+}
+//========================================================================================================
+CFlylinkDBManager::CFlyReadConnection* CFlylinkDBManager::acquire_reader()
+{
+	CFlyFastLock(m_read_pool_cs);
+	if (m_read_free.empty())
+		return nullptr;
+	CFlyReadConnection* l_conn = m_read_free.back();
+	m_read_free.pop_back();
+	return l_conn;
+}
+//========================================================================================================
+void CFlylinkDBManager::release_reader(CFlyReadConnection* p_conn)
+{
+	CFlyFastLock(m_read_pool_cs);
+	m_read_free.push_back(p_conn);
+}
+//========================================================================================================
+void CFlylinkDBManager::CFlyDBWriter::post(CFlyWriteJob&& p_job)
+{
+	bool l_is_first;
+	{
+		CFlyFastLock(m_queue_cs);
+		l_is_first = m_queue.empty();
+		m_queue.push_back(std::move(p_job));
+		++m_queue_depth;
+	}
+	if (l_is_first)
+	{
+		m_semaphore.signal();
+	}
+}
+//========================================================================================================
+void CFlylinkDBManager::CFlyDBWriter::takeAll(CFlyWriteJobArray& p_jobs)
+{
+	CFlyFastLock(m_queue_cs);
+	p_jobs.swap(m_queue);
+	m_queue_depth -= p_jobs.size();
+}
+//========================================================================================================
+int CFlylinkDBManager::CFlyDBWriter::run()
+{
+	setThreadPriority(Thread::LOW);
+	for (;;)
+	{
+		m_semaphore.wait();
+		if (m_stop)
+			break;
+		// Let the burst that woke us up grow a little, so it lands in one transaction
+		sleep(20);
+		m_db->flush_writer();
+	}
+	return 0;
+}
+//========================================================================================================
+void CFlylinkDBManager::flush_writer()
+{
+	CFlyWriteJobArray l_jobs;
+	// m_cs is taken before the queue is drained, so the writer thread and a synchronous
+	// flush never commit batches out of order
+	CFlyLock(m_cs);
+	m_writer.takeAll(l_jobs);
+	if (!l_jobs.empty())
+	{
+		execute_write_batchL(l_jobs);
+	}
+}
+//========================================================================================================
+void CFlylinkDBManager::execute_write_batchL(CFlyWriteJobArray& p_jobs)
+{
+	const auto l_start = std::chrono::steady_clock::now();
+	try
+	{
+		sqlite3_transaction l_trans(m_flySQLiteDB, p_jobs.size() > 1);
+		for (auto i = p_jobs.begin(); i != p_jobs.end(); ++i)
+		{
+			try
+			{
+				(*i)();
+			}
+			catch (const database_error& e)
+			{
+				errorDB("SQLite - execute_write_batchL: " + e.getError());
+			}
+		}
+		l_trans.commit();
+	}
+	catch (const database_error& e)
+	{
+		errorDB("SQLite - execute_write_batchL [commit]: " + e.getError());
+	}
+	const uint64_t l_usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - l_start).count();
+	m_commit_last_usec = l_usec;
+	m_commit_total_usec += l_usec;
+	++m_commit_count;
+	if (l_usec > m_commit_max_usec)
+	{
+		m_commit_max_usec = l_usec; // only the writer and flush_writer under m_cs get here
+	}
+}
+//========================================================================================================
+CFlylinkDBManager::CFlyWriterStat CFlylinkDBManager::get_writer_stat() const
+{
+	CFlyWriterStat l_stat;
+	l_stat.m_queue_depth = m_writer.getQueueDepth();
+	l_stat.m_commit_count = m_commit_count;
+	l_stat.m_last_commit_usec = m_commit_last_usec;
+	l_stat.m_max_commit_usec = m_commit_max_usec;
+	l_stat.m_avg_commit_usec = l_stat.m_commit_count ? m_commit_total_usec / l_stat.m_commit_count : 0;
+	return l_stat;
 }
 //========================================================================================================
 void CFlylinkDBManager::load_all_hub_into_cacheL()
@@ -1207,8 +1348,7 @@ void CFlylinkDBManager::push_event_statistic(const std::string& p_event_type, co
                                              const string& p_tth
                                             )
 {
-	CFlyLock(m_cs);
-	try
+	post_write([ = ]()
 	{
 		m_insert_event_stat.init(m_flySQLiteDB,
 		                         "insert into stat_db.fly_event(type,event_key,event_value,ip,port,hub,tth,event_time) values(?,?,?,?,?,?,?,strftime('%d.%m.%Y %H:%M:%S','now','localtime'))");
@@ -1220,11 +1360,7 @@ void CFlylinkDBManager::push_event_statistic(const std::string& p_event_type, co
 		m_insert_event_stat->bind(6, p_hub, SQLITE_STATIC);
 		m_insert_event_stat->bind(7, p_tth, SQLITE_STATIC);
 		m_insert_event_stat->executenonquery();
-	}
-	catch (const database_error& e)
-	{
-		errorDB("SQLite - push_event_statistic: " + e.getError());
-	}
+	});
 }
 
 
@@ -1234,8 +1370,7 @@ void CFlylinkDBManager::push_dc_command_statistic(const std::string& p_hub, cons
 	dcassert(!p_hub.empty() && !p_command.empty());
 	if (!p_hub.empty() && !p_command.empty())
 	{
-		CFlyLock(m_cs);
-		try
+		post_write([ = ]()
 		{
 			__int64 l_counter = 0;
 			{
@@ -1258,11 +1393,7 @@ void CFlylinkDBManager::push_dc_command_statistic(const std::string& p_hub, cons
 			m_insert_statistic_dc_command->bind(5, p_sender_nick, SQLITE_STATIC);
 			m_insert_statistic_dc_command->bind(6, l_counter + 1);
 			m_insert_statistic_dc_command->executenonquery();
-		}
-		catch (const database_error& e)
-		{
-			errorDB("SQLite - push_dc_command_statistic: " + e.getError());
-		}
+		});
 	}
 	else
 	{
@@ -1276,8 +1407,7 @@ void CFlylinkDBManager::push_json_statistic(const std::string& p_value, const st
 {
 	if (!p_value.empty() && BOOLSETTING(USE_FLY_SERVER_STATICTICS_SEND))
 	{
-		CFlyLock(m_cs);
-		try
+		post_write([ = ]()
 		{
 			m_insert_statistic_json.init(m_flySQLiteDB, "insert into stat_db.fly_statistic(stat_value_json,stat_time,type) values(?,strftime('%s','now','localtime'), ?)");
 			// TODO stat_time   ,    :)
@@ -1285,11 +1415,7 @@ void CFlylinkDBManager::push_json_statistic(const std::string& p_value, const st
 			m_insert_statistic_json->bind(2, p_type, SQLITE_STATIC);
 			m_insert_statistic_json->executenonquery();
 			++m_count_json_stat;
-		}
-		catch (const database_error& e)
-		{
-			errorDB("SQLite - push_json_statistic: " + e.getError());
-		}
+		});
 	}
 }
 //========================================================================================================
@@ -1372,26 +1498,58 @@ string CFlylinkDBManager::is_p2p_guard(const uint32_t& p_ip)
 {
 	// dcassert(Util::isPrivateIp(p_ip) == false);
 	dcassert(p_ip && p_ip != INADDR_NONE);
-	string l_p2p_guard_text;
 	if (p_ip && p_ip != INADDR_NONE)
 	{
+		auto l_table = std::atomic_load(&m_p2p_guard_table);
+		if (!l_table)
 		{
-			CFlyFastLock(m_cache_location_cs);
-			const auto l_p2p = m_ip_info_cache.find(p_ip);
-			if (l_p2p != m_ip_info_cache.end())
-				return l_p2p->second.m_description_p2p_guard;
+			l_table = load_p2p_guard_table();
+		}
+		uint32_t l_note;
+		if (l_table->m_ranges.find(p_ip, &l_note))
+		{
+			return l_table->m_notes[l_note];
 		}
-		uint16_t l_country_index;
-#ifdef FLYLINKDC_USE_CUSTOM_LOCATIONS
-		uint32_t l_location_index;
-#endif
-		l_p2p_guard_text = load_country_locations_p2p_guard_from_db(p_ip, l_country_index
-#ifdef FLYLINKDC_USE_CUSTOM_LOCATIONS
-		                                                            , l_location_index
-#endif
-		                                                           );
 	}
-	return l_p2p_guard_text;
+	return BaseUtil::emptyString;
+}
+//========================================================================================================
+std::shared_ptr<const CFlylinkDBManager::CFlyP2PGuardTable> CFlylinkDBManager::load_p2p_guard_table()
+{
+	CFlyLock(m_cs);
+	if (auto l_table = std::atomic_load(&m_p2p_guard_table))
+	{
+		return l_table; // built by another thread
+	}
+	auto l_table = std::make_shared<CFlyP2PGuardTable>();
+	try
+	{
+		std::unordered_map<string, uint32_t> l_note_index;
+		m_select_p2p_guard.init(m_flySQLiteDB, "select start_ip,stop_ip,note from location_db.fly_p2pguard_ip");
+		sqlite3_reader l_q = m_select_p2p_guard->executereader();
+		while (l_q.read())
+		{
+			const auto l_index = l_note_index.insert(std::make_pair(l_q.getstring(2), uint32_t(l_table->m_notes.size())));
+			if (l_index.second)
+			{
+				l_table->m_notes.push_back(l_index.first->first);
+			}
+			const uint32_t l_start = uint32_t(l_q.getint64(0));
+			const uint32_t l_stop = uint32_t(l_q.getint64(1));
+			if (l_start <= l_stop)
+			{
+				l_table->m_ranges.add(l_start, l_stop, l_index.first->second);
+			}
+		}
+		l_table->m_ranges.build();
+	}
+	catch (const database_error& e)
+	{
+		errorDB("SQLite - load_p2p_guard_table: " + e.getError());
+	}
+	std::shared_ptr<const CFlyP2PGuardTable> l_result = l_table;
+	std::atomic_store(&m_p2p_guard_table, l_result);
+	return l_result;
 }
 #endif
 //========================================================================================================
@@ -1409,6 +1567,7 @@ void CFlylinkDBManager::remove_manual_p2p_guard(const string& p_ip)
 		
 			m_delete_manual_p2p_guard->bind(1, l_ip_boost.to_ulong());
 			m_delete_manual_p2p_guard->executenonquery();
+			std::atomic_store(&m_p2p_guard_table, std::shared_ptr<const CFlyP2PGuardTable>());
 		}
 	}
 	catch (const database_error& e)
@@ -1442,10 +1601,6 @@ void CFlylinkDBManager::save_p2p_guard(const CFlyP2PGuardArray& p_p2p_guard_ip,
 	CFlyLock(m_cs);
 	try
 	{
-		{
-			CFlyFastLock(m_cache_location_cs);
-			m_ip_info_cache.clear();
-		}
 		CFlyBusy l_disable_log(g_DisableSQLtrace);
 		sqlite3_transaction l_trans(m_flySQLiteDB);
 		if (p_manual_marker.empty())
@@ -1465,6 +1620,8 @@ void CFlylinkDBManager::save_p2p_guard(const CFlyP2PGuardArray& p_p2p_guard_ip,
 			m_insert_p2p_guard->executenonquery();
 		}
 		l_trans.commit();
+		// the compiled table is rebuilt on the next check
+		std::atomic_store(&m_p2p_guard_table, std::shared_ptr<const CFlyP2PGuardTable>());
 	}
 	catch (const database_error& e)
 	{
@@ -3263,6 +3420,7 @@ void CFlylinkDBManager::update_last_ip_and_message_count(uint32_t p_hub_id, cons
 //========================================================================================================
 void CFlylinkDBManager::flush()
 {
+	flush_writer();
 	flush_all_last_ip_and_message_count();
 }
 //========================================================================================================
@@ -3673,6 +3831,7 @@ size_t CFlylinkDBManager::get_count_folders()
 //========================================================================================================
 void CFlylinkDBManager::sweep_db()
 {
+	flush_writer();
 	CFlyLock(m_cs);
 	try
 	{
@@ -3966,23 +4125,85 @@ void CFlylinkDBManager::sweep_files(__int64 p_path_id, const CFlyDirMap& p_sweep
 }
 #endif
 //========================================================================================================
+bool CFlylinkDBManager::read_file_info(sqlite3_reader& p_q, int p_first_column, const string& p_name, CFlyFileInfo& p_info, bool p_is_no_mediainfo)
+{
+	// Columns from p_first_column: size,stamp,tth,name,hit,stamp_share,ftype[,bitrate,media_x,media_y,media_video,media_audio]
+	p_info.m_recalc_ftype = false;
+	p_info.m_size   = p_q.getint64(p_first_column + 0);
+	p_info.m_TimeStamp  = p_q.getint64(p_first_column + 1);
+	p_info.m_StampShare  = p_q.getint64(p_first_column + 5);
+	if (!p_info.m_StampShare)
+		p_info.m_StampShare = p_info.m_TimeStamp;
+	p_info.m_hit = uint32_t(p_q.getint(p_first_column + 4));
+	const int l_ftype = p_q.getint(p_first_column + 6);
+	if (l_ftype == -1)
+	{
+		p_info.m_recalc_ftype = true;
+		p_info.m_ftype = char(ShareManager::getFType(p_name));
+	}
+	else
+	{
+		p_info.m_ftype = char(Search::TypeModes(l_ftype));
+	}
+	if (!p_is_no_mediainfo) //    .
+	{
+		const string& l_audio = p_q.getstring(p_first_column + 11); // TODO      "4mn 26s | MPEG, 2.0, 128 Kbps"
+		const string& l_video = p_q.getstring(p_first_column + 10);
+		if (!l_audio.empty() || !l_video.empty())
+		{
+			p_info.m_media_ptr = std::make_shared<CFlyMediaInfo>();
+			p_info.m_media_ptr->m_bitrate = uint16_t(p_q.getint(p_first_column + 7));
+			p_info.m_media_ptr->m_mediaX  = uint16_t(p_q.getint(p_first_column + 8));
+			p_info.m_media_ptr->m_mediaY  = uint16_t(p_q.getint(p_first_column + 9));
+			p_info.m_media_ptr->m_video   = l_video;
+			p_info.m_media_ptr->m_audio   = l_audio;
+			p_info.m_media_ptr->calcEscape();
+		}
+	}
+	else
+	{
+		dcassert(p_info.m_media_ptr == nullptr);
+		p_info.m_media_ptr = nullptr;
+	}
+	const auto l_is_tth_ok = p_q.getblob(p_first_column + 2, &p_info.m_tth, 24);
+	dcassert(l_is_tth_ok);
+	dcassert(p_info.m_tth != TTHValue());
+	return p_info.m_recalc_ftype;
+}
+//========================================================================================================
 void CFlylinkDBManager::load_dir(__int64 p_path_id, CFlyDirMap& p_dir_map, bool p_is_no_mediainfo)
+{
+	CFlyReadLease l_reader(this);
+	if (l_reader.get())
+	{
+		load_dir_internal(l_reader.get()->m_db, l_reader.get()->m_load_dir_sql, l_reader.get()->m_load_dir_sql_without_mediainfo,
+		                  p_path_id, p_dir_map, p_is_no_mediainfo);
+	}
+	else
+	{
+		CFlyLock(m_cs);
+		load_dir_internal(m_flySQLiteDB, m_load_dir_sql, m_load_dir_sql_without_mediainfo, p_path_id, p_dir_map, p_is_no_mediainfo);
+	}
+}
+//========================================================================================================
+void CFlylinkDBManager::load_dir_internal(sqlite3_connection& p_db, CFlySQLCommand& p_sql_media, CFlySQLCommand& p_sql_without_mediainfo,
+                                          __int64 p_path_id, CFlyDirMap& p_dir_map, bool p_is_no_mediainfo)
 {
 	try
 	{
 		sqlite3_command* l_sql;
 		if (!p_is_no_mediainfo)
 		{
-			m_load_dir_sql.init(m_flySQLiteDB, "select size,stamp,tth,name,hit,stamp_share,ftype,bitrate,media_x,media_y,media_video,media_audio from fly_file ff,fly_hash_block fhb where "
-			                    "ff.dic_path=? and ff.tth_id=fhb.tth_id");
-			l_sql = m_load_dir_sql.get_sql();
+			p_sql_media.init(p_db, "select size,stamp,tth,name,hit,stamp_share,ftype,bitrate,media_x,media_y,media_video,media_audio from fly_file ff,fly_hash_block fhb where "
+			                 "ff.dic_path=? and ff.tth_id=fhb.tth_id");
+			l_sql = p_sql_media.get_sql();
 		}
 		else
 		{
-			m_load_dir_sql_without_mediainfo.init(m_flySQLiteDB, "select size,stamp,tth,name,hit,stamp_share,ftype from fly_file ff,fly_hash_block fhb where "
-			                                      "ff.dic_path=? and ff.tth_id=fhb.tth_id");
-			                                      
-			l_sql = m_load_dir_sql_without_mediainfo.get_sql();
+			p_sql_without_mediainfo.init(p_db, "select size,stamp,tth,name,hit,stamp_share,ftype from fly_file ff,fly_hash_block fhb where "
+			                             "ff.dic_path=? and ff.tth_id=fhb.tth_id");
+			                             
+			l_sql = p_sql_without_mediainfo.get_sql();
 		}
 		l_sql->bind(1, p_path_id);
 		// TODO -      -     
@@ -3997,68 +4218,36 @@ void CFlylinkDBManager::load_dir(__int64 p_path_id, CFlyDirMap& p_dir_map, bool
 #ifdef FLYLINKDC_USE_ONLINE_SWEEP_DB
 			l_info.m_is_found = false;
 #endif
-			l_info.m_recalc_ftype = false;
-			l_info.m_size   = l_q.getint64(0);
-			l_info.m_TimeStamp  = l_q.getint64(1);
-			l_info.m_StampShare  = l_q.getint64(5);
-			if (!l_info.m_StampShare)
-				l_info.m_StampShare = l_info.m_TimeStamp;
-			l_info.m_hit = uint32_t(l_q.getint(4));
-			const int l_ftype = l_q.getint(6);
-			if (l_ftype == -1)
+			if (read_file_info(l_q, 0, l_name, l_info, p_is_no_mediainfo))
 			{
-				l_info.m_recalc_ftype = true;
 				l_calc_ftype = true;
-				l_info.m_ftype = char(ShareManager::getFType(l_name));
-			}
-			else
-			{
-				l_info.m_ftype = char(Search::TypeModes(l_ftype));
 			}
-			if (!p_is_no_mediainfo) //    .
-			{
-				const string& l_audio = l_q.getstring(11); // TODO      "4mn 26s | MPEG, 2.0, 128 Kbps"
-				const string& l_video = l_q.getstring(10);
-				if (!l_audio.empty() || !l_video.empty())
-				{
-					l_info.m_media_ptr = std::make_shared<CFlyMediaInfo>();
-					l_info.m_media_ptr->m_bitrate = uint16_t(l_q.getint(7));
-					l_info.m_media_ptr->m_mediaX  = uint16_t(l_q.getint(8));
-					l_info.m_media_ptr->m_mediaY  = uint16_t(l_q.getint(9));
-					l_info.m_media_ptr->m_video   = l_video;
-					l_info.m_media_ptr->m_audio   = l_audio;
-					l_info.m_media_ptr->calcEscape();
-				}
-			}
-			else
-			{
-				dcassert(l_info.m_media_ptr == nullptr);
-				l_info.m_media_ptr = nullptr;
-			}
-			const auto l_is_tth_ok = l_q.getblob(2, &l_info.m_tth, 24);
-			dcassert(l_is_tth_ok);
-			dcassert(l_info.m_tth != TTHValue());
 		}
 		// ...
 		if (l_calc_ftype && m_convert_ftype_stop_key < 200)
 		{
 			// TODO -    
-			CFlyLock(m_cs);
-			m_set_ftype.init(m_flySQLiteDB, "update fly_file set ftype=? where name=? and dic_path=? and ftype=-1");
-			sqlite3_transaction l_trans(m_flySQLiteDB, p_dir_map.size() > 1);
-			const auto &l_set_ftype_get = m_set_ftype.get_sql();
-			l_set_ftype_get->bind(3, p_path_id);
+			auto l_ftypes = std::make_shared<std::vector<std::pair<string, char>>>();
 			for (auto i = p_dir_map.cbegin(); i != p_dir_map.cend(); ++i)
 			{
 				if (i->second.m_recalc_ftype)
 				{
 					m_convert_ftype_stop_key++;
-					l_set_ftype_get->bind(1, i->second.m_ftype);
+					l_ftypes->push_back(std::make_pair(i->first, i->second.m_ftype));
+				}
+			}
+			post_write([this, p_path_id, l_ftypes]()
+			{
+				m_set_ftype.init(m_flySQLiteDB, "update fly_file set ftype=? where name=? and dic_path=? and ftype=-1");
+				const auto &l_set_ftype_get = m_set_ftype.get_sql();
+				l_set_ftype_get->bind(3, p_path_id);
+				for (auto i = l_ftypes->cbegin(); i != l_ftypes->cend(); ++i)
+				{
+					l_set_ftype_get->bind(1, i->second);
 					l_set_ftype_get->bind(2, i->first, SQLITE_STATIC);
 					l_set_ftype_get->executenonquery();
 				}
-			}
-			l_trans.commit();
+			});
 		}
 	}
 	catch (const database_error& e)
@@ -4067,6 +4256,105 @@ void CFlylinkDBManager::load_dir(__int64 p_path_id, CFlyDirMap& p_dir_map, bool
 	}
 }
 //========================================================================================================
+void CFlylinkDBManager::load_root_snapshot(const string& p_lower_root, CFlyRootSnapshot& p_snapshot, bool p_is_with_files /*= true */)
+{
+	CFlyReadLease l_reader(this);
+	if (l_reader.get())
+	{
+		load_root_snapshot_internal(l_reader.get()->m_db, l_reader.get()->m_load_root_path_sql, l_reader.get()->m_load_root_file_sql, p_lower_root, p_snapshot, p_is_with_files);
+	}
+	else
+	{
+		CFlyLock(m_cs);
+		load_root_snapshot_internal(m_flySQLiteDB, m_load_root_path_sql, m_load_root_file_sql, p_lower_root, p_snapshot, p_is_with_files);
+	}
+}
+//========================================================================================================
+void CFlylinkDBManager::load_root_snapshot_internal(sqlite3_connection& p_db, CFlySQLCommand& p_sql_path, CFlySQLCommand& p_sql_file,
+                                                    const string& p_lower_root, CFlyRootSnapshot& p_snapshot, bool p_is_with_files)
+{
+	dcassert(!p_lower_root.empty() && p_lower_root.back() == PATH_SEPARATOR);
+	if (p_lower_root.empty())
+		return;
+	// fly_path.name is unique, so [root, root + 1) is an index range over the whole subtree
+	string l_upper_bound = p_lower_root;
+	++l_upper_bound.back();
+	try
+	{
+		std::unordered_map<__int64, CFlyRootDir*> l_by_id;
+		p_sql_path.init(p_db, "select id,name from fly_path where name>=? and name<?");
+		p_sql_path->bind(1, p_lower_root, SQLITE_STATIC);
+		p_sql_path->bind(2, l_upper_bound, SQLITE_STATIC);
+		{
+			sqlite3_reader l_q = p_sql_path->executereader();
+			while (l_q.read())
+			{
+				CFlyRootDir& l_dir = p_snapshot[l_q.getstring(1)];
+				l_dir.m_path_id = l_q.getint64(0);
+				l_by_id[l_dir.m_path_id] = &l_dir;
+			}
+		}
+		if (l_by_id.empty() || !p_is_with_files)
+			return;
+		p_sql_file.init(p_db, "select ff.dic_path,size,stamp,tth,ff.name,hit,stamp_share,ftype,bitrate,media_x,media_y,media_video,media_audio "
+		                "from fly_path fp,fly_file ff,fly_hash_block fhb where fp.name>=? and fp.name<? and ff.dic_path=fp.id and ff.tth_id=fhb.tth_id");
+		p_sql_file->bind(1, p_lower_root, SQLITE_STATIC);
+		p_sql_file->bind(2, l_upper_bound, SQLITE_STATIC);
+		sqlite3_reader l_q = p_sql_file->executereader();
+		while (l_q.read())
+		{
+			const auto l_dir = l_by_id.find(l_q.getint64(0));
+			if (l_dir == l_by_id.end())
+				continue;
+			const string l_name = l_q.getstring(4);
+			read_file_info(l_q, 1, l_name, l_dir->second->m_files[l_name], false);
+		}
+	}
+	catch (const database_error& e)
+	{
+		errorDB("SQLite - load_root_snapshot: " + e.getError());
+	}
+}
+//========================================================================================================
+void CFlylinkDBManager::apply_share_diff(const std::shared_ptr<CFlyShareDiff>& p_diff)
+{
+	if (p_diff->empty())
+		return;
+	post_write([this, p_diff]()
+	{
+		if (!p_diff->m_ftypes.empty())
+		{
+			m_set_ftype.init(m_flySQLiteDB, "update fly_file set ftype=? where name=? and dic_path=? and ftype=-1");
+			for (auto i = p_diff->m_ftypes.cbegin(); i != p_diff->m_ftypes.cend(); ++i)
+			{
+				m_set_ftype->bind(1, i->m_ftype);
+				m_set_ftype->bind(2, i->m_name, SQLITE_STATIC);
+				m_set_ftype->bind(3, i->m_path_id);
+				m_set_ftype->executenonquery();
+			}
+		}
+		if (!p_diff->m_sweep_files.empty())
+		{
+			m_sweep_dir_sql.init(m_flySQLiteDB, "delete from fly_file where dic_path=? and name=?");
+			for (auto i = p_diff->m_sweep_files.cbegin(); i != p_diff->m_sweep_files.cend(); ++i)
+			{
+				m_sweep_dir_sql->bind(1, i->m_path_id);
+				m_sweep_dir_sql->bind(2, i->m_name, SQLITE_STATIC);
+				m_sweep_dir_sql->executenonquery();
+			}
+		}
+		if (!p_diff->m_sweep_dirs.empty())
+		{
+			m_sweep_path_file.init(m_flySQLiteDB, "delete from fly_file where dic_path=?");
+			for (auto i = p_diff->m_sweep_dirs.cbegin(); i != p_diff->m_sweep_dirs.cend(); ++i)
+			{
+				m_sweep_path_file->bind(1, *i);
+				m_sweep_path_file->executenonquery();
+			}
+		}
+	});
+}
+//========================================================================================================
 void CFlylinkDBManager::update_file_infoL(const string& p_fname, __int64 p_path_id,
                                           int64_t p_Size, int64_t p_TimeStamp, __int64 p_tth_id)
 {
@@ -4085,19 +4373,30 @@ void CFlylinkDBManager::update_file_infoL(const string& p_fname, __int64 p_path_
 bool CFlylinkDBManager::check_tth(const string& p_fname, __int64 p_path_id,
                                   int64_t p_Size, int64_t p_TimeStamp, TTHValue& p_out_tth)
 {
+	CFlyReadLease l_reader(this);
+	if (l_reader.get())
+	{
+		return check_tth_internal(l_reader.get()->m_db, l_reader.get()->m_check_tth_sql, p_fname, p_path_id, p_Size, p_TimeStamp, p_out_tth);
+	}
 	CFlyLock(m_cs);
+	return check_tth_internal(m_flySQLiteDB, m_check_tth_sql, p_fname, p_path_id, p_Size, p_TimeStamp, p_out_tth);
+}
+//========================================================================================================
+bool CFlylinkDBManager::check_tth_internal(sqlite3_connection& p_db, CFlySQLCommand& p_sql, const string& p_fname, __int64 p_path_id,
+                                           int64_t p_Size, int64_t p_TimeStamp, TTHValue& p_out_tth)
+{
 	try
 	{
-		m_check_tth_sql.init(m_flySQLiteDB,
-		                     "select size,stamp,tth from fly_file ff,fly_hash_block fhb where "
-		                     "fhb.tth_id=ff.tth_id and ff.name=? and ff.dic_path=?");
+		p_sql.init(p_db,
+		           "select size,stamp,tth from fly_file ff,fly_hash_block fhb where "
+		           "fhb.tth_id=ff.tth_id and ff.name=? and ff.dic_path=?");
 		// TODO -    tth_id  ?
 		//    tth  fly_hash_block 
 		//
 		dcassert(p_fname == Text::toLower(p_fname));
-		m_check_tth_sql->bind(1, p_fname, SQLITE_STATIC);
-		m_check_tth_sql->bind(2, p_path_id);
-		sqlite3_reader l_q = m_check_tth_sql->executereader();
+		p_sql->bind(1, p_fname, SQLITE_STATIC);
+		p_sql->bind(2, p_path_id);
+		sqlite3_reader l_q = p_sql->executereader();
 		if (l_q.read())
 		{
 			const int64_t l_size   = l_q.getint64(0);
@@ -4106,7 +4405,10 @@ bool CFlylinkDBManager::check_tth(const string& p_fname, __int64 p_path_id,
 			if (l_stamp != p_TimeStamp || l_size != p_Size)
 			{
 				l_q.close();
-				update_file_infoL(p_fname, p_path_id, -1, -1, -1);
+				post_write([ = ]()
+				{
+					update_file_infoL(p_fname, p_path_id, -1, -1, -1);
+				});
 				return false;
 			}
 			return true; //-V612
@@ -4171,6 +4473,11 @@ bool CFlylinkDBManager::get_tree(const TTHValue& p_root, TigerTree& p_tt, __int6
 				return true;
 			}
 		}
+		if (m_writer.getQueueDepth())
+		{
+			// The tree may still wait in the writer queue if the cache was cleared meanwhile
+			flush_writer();
+		}
 		CFlyLock(m_cs); // TODO -     -    
 		m_get_tree.init(m_flySQLiteDB, "select tiger_tree,file_size,block_size from fly_hash_block where tth=?");
 		m_get_tree->bind(1, p_root.data, 24, SQLITE_STATIC);
@@ -4295,7 +4602,18 @@ void CFlylinkDBManager::add_file(__int64 p_path_id, const string& p_file_name, i
 	}
 	if (l_size_cache > 100)
 	{
-		flush_hash();
+		auto l_local_map = std::make_shared<CFlyHashCacheMap>();
+		{
+			CFlyFastLock(m_cache_hash_files_cs);
+			l_local_map->swap(m_cache_hash_files);
+		}
+		if (!l_local_map->empty())
+		{
+			post_write([this, l_local_map]()
+			{
+				flush_hashL(*l_local_map);
+			});
+		}
 	}
 }
 //========================================================================================================
@@ -4304,43 +4622,37 @@ void CFlylinkDBManager::flush_hash()
 	CFlyHashCacheMap l_local_map;
 	{
 		CFlyFastLock(m_cache_hash_files_cs);
-		if (m_cache_hash_files.empty())
-		{
-			return;
-		}
-		else
-		{
-			l_local_map.swap(m_cache_hash_files);
-		}
+		l_local_map.swap(m_cache_hash_files);
 	}
-	try
+	if (!l_local_map.empty())
 	{
-		if (!l_local_map.empty())
+		post_write([this, &l_local_map]()
 		{
-			CFlyLock(m_cs);
-			sqlite3_transaction l_trans(m_flySQLiteDB, l_local_map.size() > 1);
-			for (auto i = l_local_map.begin(); i != l_local_map.end(); ++i)
-			{
-				const string l_name = Text::toLower(Util::getFileName(i->first));
-				dcassert(!l_name.empty());
-				string l_path;
-				if (i->second.m_path_id == 0)
-				{
-					l_path = Text::toLower(Util::getFilePath(i->first));
-					dcassert(!l_path.empty());
-				}
-				const int64_t l_tth_id = merge_fileL(l_path, l_name, i->second.m_time_stamp, i->second.m_tth, false, i->second.m_path_id);
-				if (i->second.m_out_media.isMedia())
-				{
-					merge_mediainfoL(l_tth_id, i->second.m_path_id, l_name, i->second.m_out_media); //    -    
-				}
-			}
-			l_trans.commit();
-		}
+			flush_hashL(l_local_map);
+		});
 	}
-	catch (const database_error& e)
+	// Callers rely on the files being in the base once flush_hash returns,
+	// including the batches add_file has already handed to the writer
+	flush_writer();
+}
+//========================================================================================================
+void CFlylinkDBManager::flush_hashL(CFlyHashCacheMap& p_local_map)
+{
+	for (auto i = p_local_map.begin(); i != p_local_map.end(); ++i)
 	{
-		errorDB("SQLite - flush_hash: " + e.getError());
+		const string l_name = Text::toLower(Util::getFileName(i->first));
+		dcassert(!l_name.empty());
+		string l_path;
+		if (i->second.m_path_id == 0)
+		{
+			l_path = Text::toLower(Util::getFilePath(i->first));
+			dcassert(!l_path.empty());
+		}
+		const int64_t l_tth_id = merge_fileL(l_path, l_name, i->second.m_time_stamp, i->second.m_tth, false, i->second.m_path_id);
+		if (i->second.m_out_media.isMedia())
+		{
+			merge_mediainfoL(l_tth_id, i->second.m_path_id, l_name, i->second.m_out_media); //    -    
+		}
 	}
 }
 //========================================================================================================
@@ -4439,10 +4751,24 @@ __int64 CFlylinkDBManager::merge_fileL(const string& p_Path, const string& p_fil
 	return l_tth_id;
 }
 //========================================================================================================
+void CFlylinkDBManager::cache_tree(const TigerTree& p_tt)
+{
+	CFlyFastLock(g_tth_cache_cs);
+	if (g_tiger_tree_cache.size() > g_tth_cache_limit)
+	{
+		clear_and_reset_capacity(g_tiger_tree_cache);
+	}
+	g_tiger_tree_cache[p_tt.getRoot()] = p_tt;
+}
+//========================================================================================================
 void CFlylinkDBManager::add_tree(const TigerTree& p_tt)
 {
-	CFlyLock(m_cs);
-	add_treeL(p_tt);
+	// get_tree finds the tree in the cache until the writer has committed it
+	cache_tree(p_tt);
+	post_write([ = ]()
+	{
+		add_treeL(p_tt);
+	});
 }
 //========================================================================================================
 void CFlylinkDBManager::add_tree_internal_bind_and_executeL(sqlite3_command* p_sql, const TigerTree& p_tt)
@@ -4465,10 +4791,7 @@ void CFlylinkDBManager::add_tree_internal_bind_and_executeL(sqlite3_command* p_s
 //========================================================================================================
 __int64 CFlylinkDBManager::add_treeL(const TigerTree& p_tt)
 {
-	{
-		CFlyFastLock(g_tth_cache_cs);
-		g_tiger_tree_cache.erase(p_tt.getRoot()); //  ,      .
-	}
+	cache_tree(p_tt);
 	try
 	{
 		sqlite3_command* l_sql = nullptr;
@@ -4583,6 +4906,8 @@ CFlylinkDBManager::~CFlylinkDBManager()
 		dcassert(g_tiger_tree_cache.empty());
 	}
 	dcassert(m_cache_hash_files.empty());
+	m_writer.shutdown();
+	m_writer.join();
 	flush();
 #ifdef _DEBUG
 	{
@@ -8,12 +8,18 @@
 #define CFlylinkDBManager_H
 
 #include <memory>
+#include <atomic>
+#include <functional>
 #include "QueueItem.h"
 #include "Singleton.h"
+#include "Semaphore.h"
 #include "sqlite/sqlite3x.hpp"
 #include "CFlyMediaInfo.h"
 //#include "LogManager.h"
 #include "FinishedManagerListener.h"
+#ifdef FLYLINKDC_USE_P2P_GUARD
+#include "iplist.h"
+#endif
 
 #define FLYLINKDC_USE_LEVELDB
 #define FLYLINKDC_USE_CACHE_HUB_URLS
@@ -229,12 +235,47 @@ struct CFlyFileInfo
 	bool     m_found;
 #endif
 	bool     m_recalc_ftype;
+	bool     m_is_seen; // the file is still on disk (set by the share refresh)
 	char     m_ftype;
-	CFlyFileInfo()
+	CFlyFileInfo() : m_is_seen(false)
 	{
 	}
 };
 typedef std::unordered_map<string, CFlyFileInfo> CFlyDirMap;
+// All of fly_file below one share root, keyed by the lower-case directory path
+struct CFlyRootDir
+{
+	__int64 m_path_id;
+	CFlyDirMap m_files;
+	bool m_is_seen;   // the refresh met this directory on disk
+	bool m_is_listed; // and enumerated its content
+	CFlyRootDir() : m_path_id(0), m_is_seen(false), m_is_listed(false)
+	{
+	}
+};
+typedef std::unordered_map<string, CFlyRootDir> CFlyRootSnapshot;
+// Everything one root refresh changes in fly_file, applied in a single transaction
+struct CFlyShareDiff
+{
+	struct FType
+	{
+		__int64 m_path_id;
+		string  m_name;
+		char    m_ftype;
+	};
+	struct File
+	{
+		__int64 m_path_id;
+		string  m_name;
+	};
+	std::vector<FType> m_ftypes;
+	std::vector<File> m_sweep_files;
+	std::vector<__int64> m_sweep_dirs;
+	bool empty() const
+	{
+		return m_ftypes.empty() && m_sweep_files.empty() && m_sweep_dirs.empty();
+	}
+};
 struct CFlyPathItem
 {
 	__int64 m_path_id;
@@ -324,6 +365,16 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		static void shutdown_engine();
 		void flush();
 		
+		struct CFlyWriterStat
+		{
+			size_t   m_queue_depth;
+			uint64_t m_commit_count;
+			uint64_t m_last_commit_usec;
+			uint64_t m_max_commit_usec;
+			uint64_t m_avg_commit_usec;
+		};
+		CFlyWriterStat get_writer_stat() const;
+		
 		void push_download_tth(const TTHValue& p_tth);
 		void push_add_share_tth(const TTHValue& p_tth);
 		void push_add_virus_database_tth(const TTHValue& p_tth);
@@ -393,6 +444,7 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		__int64 get_path_id(string p_path, bool p_create, bool p_case_convet, bool& p_is_no_mediainfo, bool p_sweep_path);
 		void add_tree(const TigerTree& p_tt);
 	private:
+		static void cache_tree(const TigerTree& p_tt);
 		void prepare_scan_folder(const tstring& p_path);
 		bool merge_mediainfoL(const __int64 p_tth_id, const __int64 p_path_id, const string& p_file_name, const CFlyMediaInfo& p_media);
 		__int64 merge_fileL(const string& p_path, const string& p_file_name, const int64_t p_time_stamp,
@@ -432,6 +484,9 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		size_t get_count_folders();
 		void sweep_db();
 		void load_dir(__int64 p_path_id, CFlyDirMap& p_dir_map, bool p_is_no_mediainfo);
+		// p_is_with_files = false: only the directories of the subtree, without their fly_file rows
+		void load_root_snapshot(const string& p_lower_root, CFlyRootSnapshot& p_snapshot, bool p_is_with_files = true);
+		void apply_share_diff(const std::shared_ptr<CFlyShareDiff>& p_diff);
 #ifdef FLYLINKDC_USE_ONLINE_SWEEP_DB
 		void sweep_files(__int64 p_path_id, const CFlyDirMap& p_sweep_files);
 #endif
@@ -549,7 +604,95 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		// If two threads share such an object, they must protect access to it using their own locking protocol.
 		// More details are available in the public header files.
 		sqlite3_connection m_flySQLiteDB;
+		
+		// Writes are queued and applied by one thread, a whole batch per transaction (group commit).
+		// Jobs run under m_cs inside that transaction, so they must not open their own.
+		typedef std::function<void()> CFlyWriteJob;
+		typedef std::vector<CFlyWriteJob> CFlyWriteJobArray;
+		class CFlyDBWriter : public Thread, private CFlyStopThread
+		{
+			public:
+				explicit CFlyDBWriter(CFlylinkDBManager* p_db) : m_db(p_db), m_queue_depth(0)
+				{
+				}
+				void post(CFlyWriteJob&& p_job);
+				void takeAll(CFlyWriteJobArray& p_jobs);
+				size_t getQueueDepth() const
+				{
+					return m_queue_depth;
+				}
+				void shutdown()
+				{
+					stopThread();
+					m_semaphore.signal();
+				}
+			private:
+				int run() override;
+				CFlylinkDBManager* m_db;
+				FastCriticalSection m_queue_cs;
+				CFlyWriteJobArray m_queue;
+				std::atomic<size_t> m_queue_depth;
+				Semaphore m_semaphore;
+		};
+		friend class CFlyDBWriter;
+		CFlyDBWriter m_writer;
+		std::atomic<uint64_t> m_commit_count;
+		std::atomic<uint64_t> m_commit_total_usec;
+		std::atomic<uint64_t> m_commit_last_usec;
+		std::atomic<uint64_t> m_commit_max_usec;
+		void post_write(CFlyWriteJob&& p_job)
+		{
+			m_writer.post(std::move(p_job));
+		}
+		void flush_writer();
+		void execute_write_batchL(CFlyWriteJobArray& p_jobs);
+		
+		// Read-only connections for check_tth/load_dir: with WAL they neither take m_cs nor wait for the writer.
+		// Opened with /sqlite_use_wal only, without it the lookups go through the main connection under m_cs
+		struct CFlyReadConnection
+		{
+			sqlite3_connection m_db;
+			CFlySQLCommand m_check_tth_sql;
+			CFlySQLCommand m_load_dir_sql;
+			CFlySQLCommand m_load_dir_sql_without_mediainfo;
+			CFlySQLCommand m_load_root_path_sql;
+			CFlySQLCommand m_load_root_file_sql;
+		};
+		class CFlyReadLease
+		{
+			public:
+				explicit CFlyReadLease(CFlylinkDBManager* p_db) : m_db(p_db), m_conn(p_db->acquire_reader())
+				{
+				}
+				~CFlyReadLease()
+				{
+					if (m_conn)
+						m_db->release_reader(m_conn);
+				}
+				CFlyReadConnection* get() const
+				{
+					return m_conn;
+				}
+			private:
+				CFlylinkDBManager* m_db;
+				CFlyReadConnection* m_conn;
+		};
+		std::vector<std::unique_ptr<CFlyReadConnection>> m_read_connections;
+		std::vector<CFlyReadConnection*> m_read_free;
+		FastCriticalSection m_read_pool_cs;
+		void open_read_pool();
+		CFlyReadConnection* acquire_reader();
+		void release_reader(CFlyReadConnection* p_conn);
+		bool check_tth_internal(sqlite3_connection& p_db, CFlySQLCommand& p_sql, const string& p_fname, __int64 p_path_id,
+		                        int64_t p_Size, int64_t p_TimeStamp, TTHValue& p_out_tth);
+		void load_dir_internal(sqlite3_connection& p_db, CFlySQLCommand& p_sql_media, CFlySQLCommand& p_sql_without_mediainfo,
+		                       __int64 p_path_id, CFlyDirMap& p_dir_map, bool p_is_no_mediainfo);
+		void load_root_snapshot_internal(sqlite3_connection& p_db, CFlySQLCommand& p_sql_path, CFlySQLCommand& p_sql_file,
+		                                 const string& p_lower_root, CFlyRootSnapshot& p_snapshot, bool p_is_with_files);
+		static bool read_file_info(sqlite3_reader& p_q, int p_first_column, const string& p_name, CFlyFileInfo& p_info, bool p_is_no_mediainfo);
+		                       
 		typedef std::unordered_map<string, CFlyHashCacheItem> CFlyHashCacheMap;
+		void flush_hashL(CFlyHashCacheMap& p_local_map);
 		CFlyHashCacheMap m_cache_hash_files;
 		FastCriticalSection  m_cache_hash_files_cs;
 #ifdef FLYLINKDC_USE_LEVELDB
@@ -644,6 +787,8 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		CFlySQLCommand m_check_tth_sql;
 		CFlySQLCommand m_load_dir_sql;
 		CFlySQLCommand m_load_dir_sql_without_mediainfo;
+		CFlySQLCommand m_load_root_path_sql;
+		CFlySQLCommand m_load_root_file_sql;
 		CFlySQLCommand m_set_ftype;
 		CFlySQLCommand m_load_path_cache_one_dir;
 		CFlySQLCommand m_sweep_dir_sql;
@@ -692,6 +837,16 @@ class CFlylinkDBManager : public Singleton<CFlylinkDBManager>
 		CFlySQLCommand m_delete_manual_p2p_guard;
 		CFlySQLCommand m_delete_p2p_guard;
 		CFlySQLCommand m_insert_p2p_guard;
+		CFlySQLCommand m_select_p2p_guard;
+		
+		// fly_p2pguard_ip compiled in memory, the value of a range is the index of its note
+		struct CFlyP2PGuardTable
+		{
+			IPRangeTable m_ranges;
+			StringList m_notes;
+		};
+		std::shared_ptr<const CFlyP2PGuardTable> m_p2p_guard_table; // nullptr - rebuild on the next check
+		std::shared_ptr<const CFlyP2PGuardTable> load_p2p_guard_table();
 #endif
 		
 #ifdef FLYLINKDC_USE_GATHER_STATISTICS
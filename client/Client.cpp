@@ -760,7 +760,7 @@ void Client::on(Second, uint64_t aTick) noexcept
 		}
 	}
 }
-bool Client::isFloodCommand(const string& p_command, const string& p_line)
+bool Client::isFloodCommand(const string& p_command, std::string_view p_line)
 {
 	if (is_all_my_info_loaded() && CFlyServerConfig::g_interval_flood_command)
 	{
@@ -777,7 +777,7 @@ bool Client::isFloodCommand(const string& p_command, const string& p_line)
 				l_result.m_tick = l_item.m_tick;
 				if (BOOLSETTING(LOG_FLOOD_TRACE))
 				{
-					l_result.m_flood_command.push_back(make_pair(p_line, GET_TICK() - l_result.m_start_tick));
+					l_result.m_flood_command.push_back(make_pair(string(p_line), GET_TICK() - l_result.m_start_tick));
 				}
 				const auto l_delta = l_result.m_tick - l_result.m_start_tick;
 				if (l_delta > CFlyServerConfig::g_interval_flood_command * 1000)
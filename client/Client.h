@@ -47,7 +47,7 @@ class ClientBase
 		bool m_is_detect_active_connection;
 #endif
 	public:
-		ClientBase() : m_type(DIRECT_CONNECT), m_is_detect_active_connection(false)
+		ClientBase() : m_type(DIRECT_CONNECT), m_is_detect_active_connection(false), m_user_table(new HubUserTable)
 			//  , m_isActivMode(false)
 		{ }
 		virtual ~ClientBase() {} // [cppcheck]
@@ -55,7 +55,12 @@ class ClientBase
 		enum P2PType { DIRECT_CONNECT };
 	protected:
 		P2PType m_type;
+		boost::intrusive_ptr<HubUserTable> m_user_table;
 	public:
+		HubUserTable* getUserTable() const
+		{
+			return m_user_table.get();
+		}
 #ifdef RIP_USE_CONNECTION_AUTODETECT
 		bool isDetectActiveConnection() const
 		{
@@ -396,7 +401,7 @@ class Client : public ClientBase, public Speaker<ClientListener>, public Buffere
 		typedef std::unordered_map<string, CFlyFloodCommand> CFlyFloodCommandMap;
 		CFlyFloodCommandMap m_flood_detect;
 	protected:
-		bool isFloodCommand(const string& p_command, const string& p_line);
+		bool isFloodCommand(const string& p_command, std::string_view p_line);
 		
 		OnlineUserPtr m_myOnlineUser;
 		OnlineUserPtr m_hubOnlineUser;
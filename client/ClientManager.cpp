@@ -918,6 +918,60 @@ void ClientManager::send(AdcCommand& cmd, const CID& cid)
 		}
 	}
 }
+
+void ClientManager::send(vector<AdcCommand>& p_commands, const CID& cid)
+{
+	string l_ip;
+	uint16_t l_port = 0;
+	OnlineUserPtr u;
+	{
+		CFlyReadLock(*g_csOnlineUsers);
+		const auto i = g_onlineUsers.find(cid);
+		if (i == g_onlineUsers.end())
+			return;
+		u = i->second;
+		if (u->getIdentity().isUdpActive())
+		{
+			l_ip = u->getIdentity().getIpAsString();
+			l_port = u->getIdentity().getUdpPort();
+		}
+		else if (u->getUser()->isNMDC())
+		{
+			return;
+		}
+	}
+	if (l_port == 0 || l_ip.empty())
+	{
+		// Passive user: the commands go through the hub
+		for (auto i = p_commands.begin(); i != p_commands.end(); ++i)
+		{
+			if (i->getType() == AdcCommand::TYPE_UDP)
+			{
+				i->setType(AdcCommand::TYPE_DIRECT);
+				i->setTo(u->getIdentity().getSID());
+			}
+			u->getClient().send(*i);
+		}
+		return;
+	}
+	StringList l_packets;
+	l_packets.reserve(p_commands.size());
+	for (auto i = p_commands.cbegin(); i != p_commands.cend(); ++i)
+	{
+		l_packets.push_back(i->toString(getMyCID()));
+	}
+	try
+	{
+		Socket l_udp;
+		l_udp.writeBatchTo(l_ip, l_port, l_packets);
+	}
+	catch (const SocketException& e)
+	{
+		dcdebug("Socket exception sending ADC UDP command\n");
+		LogManager::message("ClientManager::send - Socket exception sending ADC UDP command " + e.getError());
+	}
+}
+
 void ClientManager::infoUpdated(Client* p_client)
 {
 	dcassert(p_client);
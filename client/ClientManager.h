@@ -23,6 +23,7 @@
 #define DCPLUSPLUS_DCPP_CLIENT_MANAGER_H
 
 #include "Client.h"
+#include "OnlineUserIndex.h"
 #include "AdcSupports.h"
 #include "DirectoryListing.h"
 
@@ -202,6 +203,8 @@ class ClientManager : public Speaker<ClientManagerListener>,
 	
 	
 		static void send(AdcCommand& c, const CID& to);
+		/// UDP commands for one user, the datagrams go out in one batch
+		static void send(vector<AdcCommand>& p_commands, const CID& to);
 		static void upnp_error_force_passive();
 		static void resend_ext_json();
 		void connect(const HintedUser& user, const string& p_token, bool p_is_force_passive, bool& p_is_active_client);
@@ -270,7 +273,8 @@ class ClientManager : public Speaker<ClientManagerListener>,
 		static UserMap g_users;
 		
 		static std::unique_ptr<webrtc::RWLockWrapper> g_csUsers;
-		typedef std::multimap<CID, OnlineUserPtr> OnlineMap;
+		// equal_range walks the users with the same CID, as with the multimap
+		typedef OnlineUserIndex OnlineMap;
 		typedef OnlineMap::iterator OnlineIter;
 		typedef OnlineMap::const_iterator OnlineIterC;
 		typedef pair<OnlineIter, OnlineIter> OnlinePair;
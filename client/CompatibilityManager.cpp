@@ -38,6 +38,7 @@
 #include "UploadManager.h"
 #include "CompatibilityManager.h"
 #include "ShareManager.h"
+#include "UploadCache.h"
 #include "../FlyFeatures/flyServer.h"
 
 #include <iphlpapi.h>
@@ -683,14 +684,19 @@ string CompatibilityManager::generateFullSystemStatusMessage()
 
 string CompatibilityManager::generateNetworkStats()
 {
+	const Socket::BatchStatsItem& l_read = Socket::g_stats.m_udp_read;
+	const Socket::BatchStatsItem& l_write = Socket::g_stats.m_udp_write;
 	std::vector<char> l_buf(1024);
 	sprintf_s(l_buf.data(), l_buf.size(),
 	          "-=[ TCP: Downloaded: %s. Uploaded: %s ]=-\r\n"
 	          "-=[ UDP: Downloaded: %s. Uploaded: %s ]=-\r\n"
+	          "-=[ UDP packets: received %I64u (%.1f per wake-up), sent %I64u (%.1f per call) ]=-\r\n"
 	          // TODO "-=[ Torrent: Downloaded: %s. Uploaded: %s ]=-\r\n"
 	          "-=[ SSL: Downloaded: %s. Uploaded: %s ]=-\r\n",
 	          Util::formatBytes(Socket::g_stats.m_tcp.totalDown).c_str(), Util::formatBytes(Socket::g_stats.m_tcp.totalUp).c_str(),
 	          Util::formatBytes(Socket::g_stats.m_udp.totalDown).c_str(), Util::formatBytes(Socket::g_stats.m_udp.totalUp).c_str(),
+	          l_read.m_packets, l_read.m_calls ? double(l_read.m_packets) / l_read.m_calls : 0.0,
+	          l_write.m_packets, l_write.m_calls ? double(l_write.m_packets) / l_write.m_calls : 0.0,
 	          // TODO Util::formatBytes(Socket::g_stats.m_dht.totalDown).c_str(), Util::formatBytes(Socket::g_stats.m_dht.totalUp).c_str(),
 	          Util::formatBytes(Socket::g_stats.m_ssl.totalDown).c_str(), Util::formatBytes(Socket::g_stats.m_ssl.totalUp).c_str()
 	         );
@@ -732,6 +738,18 @@ string CompatibilityManager::generateProgramStats() // moved form WinUtil.
 				const int digit_procs = getProcessorsCount();
 				if (digit_procs > 1)
 					l_procs = " x" + Util::toString(getProcessorsCount()) + " core(s)";
+				const UploadCache::Stats l_upload_cache = UploadCache::getStats();
+				const uint64_t l_upload_cache_requests = l_upload_cache.m_hits + l_upload_cache.m_misses;
+				string l_hash_file;
+				int64_t l_hash_bytes_left = 0;
+				size_t l_hash_files_left = 0;
+				HashManager::HashReadStats l_hash_read[HashManager::HASH_READ_LAST];
+				HashManager::getInstance()->getStats(l_hash_file, l_hash_bytes_left, l_hash_files_left, l_hash_read);
+				CFlylinkDBManager::CFlyWriterStat l_db_writer = {0};
+				if (CFlylinkDBManager::isValidInstance())
+				{
+					l_db_writer = CFlylinkDBManager::getInstance()->get_writer_stat();
+				}
 #ifdef FLYLINKDC_USE_LASTIP_AND_USER_RATIO
 				dcassert(CFlylinkDBManager::isValidInstance());
 				if (CFlylinkDBManager::isValidInstance())
@@ -749,6 +767,9 @@ string CompatibilityManager::generateProgramStats() // moved form WinUtil.
 				          "\t-=[ GDI units (peak): %d (%d). Handle (peak): %d (%d) ]=-\r\n"
 				          "\t-=[ Share: %s. Files in share: %u. Total users: %u on hubs: %u ]=-\r\n"
 				          "\t-=[ TigerTree cache: %u Search not exists cache: %u Search exists cache: %u]=-\r\n"
+				          "\t-=[ Upload cache: %s of %s in %u entries. Hits: %u%% of %I64u (%s). Rejected: %I64u ]=-\r\n"
+				          "\t-=[ Hash reads: overlapped %s/s (%u files), mapped %s/s (%u files), buffered %s/s (%u files) ]=-\r\n"
+				          "\t-=[ DB writer queue: %u. Commits: %I64u, last %I64u us, avg %I64u us, max %I64u us ]=-\r\n"
 #ifdef FLYLINKDC_USE_LASTIP_AND_USER_RATIO
 				          "\t-=[ Total download: %s. Total upload: %s ]=-\r\n"
 #endif
@@ -778,6 +799,24 @@ string CompatibilityManager::generateProgramStats() // moved form WinUtil.
 				          CFlylinkDBManager::get_tth_cache_size(),
 				          ShareManager::get_cache_size_file_not_exists_set(),
 				          ShareManager::get_cache_file_map(),
+				          Util::formatBytes(l_upload_cache.m_size).c_str(),
+				          Util::formatBytes(l_upload_cache.m_max_size).c_str(),
+				          unsigned(l_upload_cache.m_count),
+				          unsigned(l_upload_cache_requests ? l_upload_cache.m_hits * 100 / l_upload_cache_requests : 0),
+				          l_upload_cache_requests,
+				          Util::formatBytes(int64_t(l_upload_cache.m_hit_bytes)).c_str(),
+				          l_upload_cache.m_rejected,
+				          Util::formatBytes(l_hash_read[HashManager::HASH_READ_OVERLAPPED].getSpeed()).c_str(),
+				          unsigned(l_hash_read[HashManager::HASH_READ_OVERLAPPED].m_files),
+				          Util::formatBytes(l_hash_read[HashManager::HASH_READ_MAPPED].getSpeed()).c_str(),
+				          unsigned(l_hash_read[HashManager::HASH_READ_MAPPED].m_files),
+				          Util::formatBytes(l_hash_read[HashManager::HASH_READ_BUFFERED].getSpeed()).c_str(),
+				          unsigned(l_hash_read[HashManager::HASH_READ_BUFFERED].m_files),
+				          unsigned(l_db_writer.m_queue_depth),
+				          l_db_writer.m_commit_count,
+				          l_db_writer.m_last_commit_usec,
+				          l_db_writer.m_avg_commit_usec,
+				          l_db_writer.m_max_commit_usec,
 #ifdef FLYLINKDC_USE_LASTIP_AND_USER_RATIO
 				          Util::formatBytes(CFlylinkDBManager::getInstance()->m_global_ratio.get_download()).c_str(),
 				          Util::formatBytes(CFlylinkDBManager::getInstance()->m_global_ratio.get_upload()).c_str(),
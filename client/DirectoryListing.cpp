@@ -28,7 +28,7 @@
 std::unordered_map<string, DirectoryListing::CFlyStatExt> DirectoryListing::g_ext_stat;
 #endif
 DirectoryListing::DirectoryListing(const HintedUser& aUser) :
-	hintedUser(aUser), abort(false), root(new Directory(this, nullptr, BaseUtil::emptyString, false, false, true)),
+	hintedUser(aUser), abort(false), root(new(m_arena) Directory(this, nullptr, m_arena.intern(Util::emptyString), false, false, true)),
 	includeSelf(false), m_is_mediainfo(false), m_is_own_list(false)
 {
 }
@@ -38,6 +38,60 @@ DirectoryListing::~DirectoryListing()
 	delete root;
 }
 
+DirectoryListing::Arena::~Arena()
+{
+	for (auto i = m_dtors; i; i = i->m_next)
+	{
+		i->m_dtor(i->m_obj);
+	}
+	for (auto i = m_blocks.cbegin(); i != m_blocks.cend(); ++i)
+	{
+		::operator delete(*i);
+	}
+}
+
+void* DirectoryListing::Arena::alloc(size_t p_size, size_t p_align)
+{
+	char* l_pos = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(m_pos) + p_align - 1) & ~uintptr_t(p_align - 1));
+	if (!m_pos || l_pos + p_size > m_end)
+	{
+		// blocks grow with the list, so a small partial list stays small
+		const size_t l_block_size = std::max(m_next_block_size, p_size + p_align);
+		m_next_block_size = std::min(m_next_block_size * 2, MAX_BLOCK_SIZE);
+		char* l_block = static_cast<char*>(::operator new(l_block_size));
+		m_blocks.push_back(l_block);
+		m_allocated += l_block_size;
+		m_end = l_block + l_block_size;
+		l_pos = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(l_block) + p_align - 1) & ~uintptr_t(p_align - 1));
+	}
+	m_pos = l_pos + p_size;
+	return l_pos;
+}
+
+const DirectoryListing::Arena::EmptyName DirectoryListing::Arena::g_empty_name = { 0, "" };
+
+const char* DirectoryListing::Arena::intern(const string& p_str)
+{
+	if (p_str.empty())
+		return g_empty_name.m_str;
+	if (m_intern_cache.empty())
+	{
+		m_intern_cache.resize(INTERN_CACHE_SIZE);
+	}
+	// "folder.jpg", "Thumbs.db", "CD1"... repeat all over a list, an unique name just replaces the slot
+	const char*& l_slot = m_intern_cache[std::hash<string>()(p_str) & (INTERN_CACHE_SIZE - 1)];
+	if (l_slot && strcmp(l_slot, p_str.c_str()) == 0)
+	{
+		return l_slot;
+	}
+	uint32_t* l_length = static_cast<uint32_t*>(alloc(sizeof(uint32_t) + p_str.size() + 1, alignof(uint32_t)));
+	*l_length = uint32_t(p_str.size());
+	char* l_copy = reinterpret_cast<char*>(l_length + 1);
+	memcpy(l_copy, p_str.c_str(), p_str.size() + 1);
+	l_slot = l_copy;
+	return l_copy;
+}
+
 UserPtr DirectoryListing::getUserFromFilename(const string& fileName)
 {
 	// General file list name format: [username].[CID].[xml|xml.bz2]
@@ -188,8 +242,17 @@ string DirectoryListing::loadXML(InputStream& is, bool updating, bool p_is_own_l
 	CFlyLog l_log("[loadXML]");
 	ListLoader ll(this, getRoot(), updating, getUser(), p_is_own_list);
 	//l_log.step("start parse");
-	SimpleXMLReader(&ll).parse(is);
-	l_log.step("Stop parse file:" + m_file);
+	try
+	{
+		SimpleXMLReader(&ll).parse(is);
+	}
+	catch (const Exception&)
+	{
+		m_arena.clearInternCache();
+		throw;
+	}
+	m_arena.clearInternCache();
+	l_log.step("Stop parse file:" + m_file + " memory: " + Util::formatBytes(int64_t(m_arena.getAllocated())));
 	m_is_mediainfo = ll.isMediainfoList();
 	m_is_own_list = p_is_own_list;
 	return ll.getBase();
@@ -257,14 +320,14 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 		{
 			dcassert(attribs.size() >= 3); //   Shared - 4- .
 			//    .        TS.   64  
-			const string l_name = getAttrib(attribs, g_SName, 0);
+			const string& l_name = getAttrib(attribs, g_SName, 0);
 			if (l_name.empty())
 			{
 				dcassert(0);
 				return;
 			}
 			
-			const string l_s = getAttrib(attribs, g_SSize, 1);
+			const string& l_s = getAttrib(attribs, g_SSize, 1);
 			if (l_s.empty())
 			{
 				dcassert(0);
@@ -272,7 +335,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 			}
 			const auto l_size = Util::toInt64(l_s);
 			
-			const string l_h = getAttrib(attribs, g_STTH, 2);
+			const string& l_h = getAttrib(attribs, g_STTH, 2);
 			
 			if (l_h.empty() || (m_is_own_list == false && l_h.compare(0, 39, "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", 39) == 0))
 			{
@@ -289,16 +352,16 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 				{
 					auto& file = **i;
 					/// @todo comparisons should be case-insensitive but it takes too long - add a cache
-					if (file.getName() == l_name || file.getTTH() == l_tth)
+					if (strcmp(file.getNameC(), l_name.c_str()) == 0 || file.getTTH() == l_tth)
 					{
-						file.setName(l_name);
+						file.setName(m_list->m_arena.intern(l_name));
 						file.setSize(l_size);
 						file.setTTH(l_tth);
 						return;
 					}
 				}
 			}
-			std::shared_ptr<CFlyMediaInfo> l_mediaXY;
+			const CFlyMediaInfo* l_mediaXY = nullptr;
 			uint32_t l_i_ts = 0;
 			int l_i_hit     = 0;
 			string l_hit;
@@ -316,7 +379,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 				if (attribs.size() == 4 ||
 				        attribs.size() >= 11)  //     http://p2p.toom.su/fs/hms/FCYECUWQ7F5A2FABW32UTMCT6MEMI3GPXBZDQCQ/)
 				{
-					const string l_sharedGL = getAttrib(attribs, g_SShared, 4);
+					const string& l_sharedGL = getAttrib(attribs, g_SShared, 4);
 					if (!l_sharedGL.empty())
 					{
 						const int64_t tmp_ts = _atoi64(l_sharedGL.c_str()) - 116444736000000000L ;
@@ -353,7 +416,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 						if (!l_audio.empty() || !l_video.empty())
 						{
 							const string& l_br = getAttrib(attribs, g_SBR, 4);
-							l_mediaXY = std::make_shared<CFlyMediaInfo>(getAttrib(attribs, g_SWH, 3),
+							l_mediaXY = m_list->m_arena.make<CFlyMediaInfo>(getAttrib(attribs, g_SWH, 3),
 							                                            atoi(l_br.c_str()),
 							                                            l_audio,
 							                                            l_video
@@ -400,7 +463,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 				}
 				l_i_hit = l_hit.empty() ? 0 : atoi(l_hit.c_str());
 			}
-			auto f = new DirectoryListing::File(m_cur, l_name, l_size, l_tth, l_i_hit, l_i_ts, l_mediaXY);
+			auto f = new(m_list->m_arena) DirectoryListing::File(m_cur, m_list->m_arena.intern(l_name), l_size, l_tth, l_i_hit, l_i_ts, l_mediaXY);
 			m_cur->m_virus_detect.add(l_name, l_size);
 			m_cur->m_files.push_back(f);
 			if (l_size)
@@ -423,7 +486,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 						}
 						// TODO if(l_size >= 100 * 1024 *1024)
 						{
-							if (!CFlyServerConfig::isParasitFile(f->getName())) // TODO -   
+							if (!CFlyServerConfig::isParasitFile(l_name)) // TODO -   
 							{
 								f->setFlag(DirectoryListing::FLAG_NOT_SHARED);
 								const auto l_status_file = CFlylinkDBManager::getInstance()->get_status_file(f->getTTH()); // TODO -    ?
@@ -454,7 +517,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 				for (auto i  = m_cur->directories.cbegin(); i != m_cur->directories.cend(); ++i)
 				{
 					/// @todo comparisons should be case-insensitive but it takes too long - add a cache
-					if ((*i)->getName() == l_file_name)
+					if (strcmp((*i)->getNameC(), l_file_name.c_str()) == 0)
 					{
 						d = *i;
 						if (!d->getComplete())
@@ -467,7 +530,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 			}
 			if (d == nullptr)
 			{
-				d = new DirectoryListing::Directory(m_list, m_cur, l_file_name, false, !incomp, isMediainfoList());
+				d = new(m_list->m_arena) DirectoryListing::Directory(m_list, m_cur, m_list->m_arena.intern(l_file_name), false, !incomp, isMediainfoList());
 				m_cur->directories.push_back(d);
 			}
 			m_cur = d;
@@ -494,7 +557,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 				DirectoryListing::Directory* d = nullptr;
 				for (auto j = m_cur->directories.cbegin(); j != m_cur->directories.cend(); ++j)
 				{
-					if ((*j)->getName() == *i)
+					if (strcmp((*j)->getNameC(), i->c_str()) == 0)
 					{
 						d = *j;
 						break;
@@ -502,7 +565,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 				}
 				if (d == nullptr)
 				{
-					d = new DirectoryListing::Directory(m_list, m_cur, *i, false, false, isMediainfoList());
+					d = new(m_list->m_arena) DirectoryListing::Directory(m_list, m_cur, m_list->m_arena.intern(*i), false, false, isMediainfoList());
 					m_cur->directories.push_back(d);
 				}
 				m_cur = d;
@@ -559,13 +622,14 @@ string DirectoryListing::getPath(const Directory* d) const
 		
 	string dir;
 	dir.reserve(128);
-	dir.append(d->getName());
+	dir.append(d->getNameC());
 	dir.append(1, '\\');
 	
 	Directory* cur = d->getParent();
 	while (cur != root)
 	{
-		dir.insert(0, cur->getName() + '\\');
+		dir.insert(0, 1, '\\');
+		dir.insert(0, cur->getNameC(), cur->getNameLength());
 		cur = cur->getParent();
 	}
 	return dir;
@@ -573,7 +637,7 @@ string DirectoryListing::getPath(const Directory* d) const
 
 void DirectoryListing::download(Directory* aDir, const string& aTarget, bool highPrio, QueueItem::Priority prio, bool p_first_file)
 {
-	string target = (aDir == getRoot()) ? aTarget : aTarget + aDir->getName() + PATH_SEPARATOR;
+	string target = (aDir == getRoot()) ? aTarget : aTarget + aDir->getNameC() + PATH_SEPARATOR;
 	if (!aDir->getComplete())
 	{
 		// folder is not completed (partial list?), so we need to download it first
@@ -595,7 +659,7 @@ void DirectoryListing::download(Directory* aDir, const string& aTarget, bool hig
 			const File* file = *i;
 			try
 			{
-				download(file, target + file->getName(), false, highPrio, prio, false, p_first_file);
+				download(file, target + file->getNameC(), false, highPrio, prio, false, p_first_file);
 				p_first_file = false;
 			}
 			catch (const QueueException& e)
@@ -710,7 +774,7 @@ DirectoryListing::Directory::~Directory()
 		l_file_list.m_time = GET_TIME();
 		for (auto j = m_files.begin(); j != m_files.end(); ++j)
 		{
-			if (CFlyVirusDetector::is_virus_file((*j)->getName(), (*j)->getSize()))
+			if (CFlyVirusDetector::is_virus_file((*j)->getNameView(), (*j)->getSize()))
 			{
 				CFlyTTHKey l_key((*j)->getTTH(), (*j)->getSize());
 				l_file_list.m_files[l_key].push_back((*j)->getName());
@@ -718,8 +782,9 @@ DirectoryListing::Directory::~Directory()
 		}
 		CFlyServerJSON::addAntivirusCounter(l_file_list);
 	}
+	// files are trivially destructible and their memory goes away with the arena
+	static_assert(std::is_trivially_destructible<File>::value, "DirectoryListing::File must not own anything");
 	for_each(directories.begin(), directories.end(), DeleteFunction());
-	for_each(m_files.begin(), m_files.end(), DeleteFunction());
 }
 
 bool DirectoryListing::CFlyVirusDetector::is_virus_dir() const
@@ -738,7 +803,7 @@ bool DirectoryListing::CFlyVirusDetector::is_virus_dir() const
 	return false;
 }
 
-bool DirectoryListing::CFlyVirusDetector::is_virus_file(const string& p_file, int64_t p_size)
+bool DirectoryListing::CFlyVirusDetector::is_virus_file(std::string_view p_file, int64_t p_size)
 {
 	const auto l_len = p_file.size();
 	if (l_len >= 4 && p_size && p_size < 1024 * 1024 * 30) // TODO config
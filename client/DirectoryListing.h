@@ -22,6 +22,7 @@
 #ifndef DCPLUSPLUS_DCPP_DIRECTORY_LISTING_H
 #define DCPLUSPLUS_DCPP_DIRECTORY_LISTING_H
 
+#include <string_view>
 #include "QueueItem.h"
 #include "CFlyMediaInfo.h"
 #include "UserInfoBase.h"
@@ -47,6 +48,75 @@ class DirectoryListing : public UserInfoBase
 			FLAG_QUEUE = 1 << 8,
 		};
 		
+		/**
+		 * Bump allocator for the nodes of one listing: a list of millions of files
+		 * is built from a few large blocks instead of millions of small heap allocations
+		 * and freed in one shot with the listing.
+		 */
+		class Arena
+		{
+			public:
+				Arena() : m_pos(nullptr), m_end(nullptr), m_next_block_size(MIN_BLOCK_SIZE), m_allocated(0), m_dtors(nullptr)
+				{
+				}
+				~Arena();
+				Arena(const Arena&) = delete;
+				Arena& operator=(const Arena&) = delete;
+				
+				void* alloc(size_t p_size, size_t p_align);
+				/** Copy of the string in the arena, equal recently seen names share one copy */
+				const char* intern(const string& p_str);
+				/** Length of a string returned by intern(), it is stored in front of the characters */
+				static size_t length(const char* p_str)
+				{
+					return reinterpret_cast<const uint32_t*>(p_str)[-1];
+				}
+				/** Object with a non-trivial destructor, destroyed together with the arena */
+				template<class T, class... Args> T* make(Args&& ... p_args)
+				{
+					T* l_obj = new(alloc(sizeof(T), alignof(T))) T(std::forward<Args>(p_args)...);
+					auto l_node = new(alloc(sizeof(DtorNode), alignof(DtorNode))) DtorNode;
+					l_node->m_obj = l_obj;
+					l_node->m_dtor = [](void * p) { static_cast<T*>(p)->~T(); };
+					l_node->m_next = m_dtors;
+					m_dtors = l_node;
+					return l_obj;
+				}
+				/** The intern cache is only needed while a list is being parsed */
+				void clearInternCache()
+				{
+					std::vector<const char*>().swap(m_intern_cache);
+				}
+				size_t getAllocated() const
+				{
+					return m_allocated;
+				}
+			private:
+				static const size_t MIN_BLOCK_SIZE = 16 * 1024;
+				static const size_t MAX_BLOCK_SIZE = 1024 * 1024;
+				static const size_t INTERN_CACHE_SIZE = 1 << 16;
+				
+				struct DtorNode
+				{
+					void* m_obj;
+					void (*m_dtor)(void*);
+					DtorNode* m_next;
+				};
+				struct EmptyName
+				{
+					uint32_t m_length;
+					char m_str[4];
+				};
+				static const EmptyName g_empty_name;
+				std::vector<char*> m_blocks;
+				char* m_pos;
+				char* m_end;
+				size_t m_next_block_size;
+				size_t m_allocated;
+				DtorNode* m_dtors;
+				std::vector<const char*> m_intern_cache; // direct mapped by the name hash
+		};
+		
 		class File : public Flags
 		{
 			public:
@@ -55,31 +125,62 @@ class DirectoryListing : public UserInfoBase
 				{
 					bool operator()(const Ptr& a, const Ptr& b) const
 					{
-						return _stricmp(a->getName().c_str(), b->getName().c_str()) < 0;
+						return _stricmp(a->getNameC(), b->getNameC()) < 0;
 					}
 				};
 				typedef vector<Ptr> List;
 				
-				File(Directory* p_Dir, const string& p_Name, int64_t p_Size, const TTHValue& p_TTH, uint32_t p_Hit, uint32_t p_ts, std::shared_ptr<CFlyMediaInfo>& p_media) noexcept :
-					name(p_Name), size(p_Size), parent(p_Dir), tthRoot(p_TTH), hit(p_Hit), ts(p_ts), m_media(p_media), adls(false)
+				File(Directory* p_Dir, const char* p_Name, int64_t p_Size, const TTHValue& p_TTH, uint32_t p_Hit, uint32_t p_ts, const CFlyMediaInfo* p_media) noexcept :
+					m_name(p_Name), size(p_Size), parent(p_Dir), tthRoot(p_TTH), hit(p_Hit), ts(p_ts), m_media(p_media), adls(false)
 				{
 				}
-				File(const File& rhs, bool _adls = false) : name(rhs.name), size(rhs.size), parent(rhs.parent), tthRoot(rhs.tthRoot),
+				File(const File& rhs, bool _adls = false) : m_name(rhs.m_name), size(rhs.size), parent(rhs.parent), tthRoot(rhs.tthRoot),
 					hit(rhs.hit), ts(rhs.ts), adls(_adls), m_media(rhs.m_media)
 				{
 				}
-				~File()
+				
+				// Files live in the arena of their listing and own nothing, so they are never destroyed one by one
+				static void* operator new(size_t p_size, Arena& p_arena)
+				{
+					return p_arena.alloc(p_size, alignof(File));
+				}
+				static void operator delete(void*, Arena&)
 				{
 				}
+				static void operator delete(void*)
+				{
+				}
+				static void* operator new(size_t) = delete;
 				
-				GETSET(string, name, Name);
+				string getName() const
+				{
+					return string(m_name, getNameLength());
+				}
+				const char* getNameC() const
+				{
+					return m_name;
+				}
+				size_t getNameLength() const
+				{
+					return Arena::length(m_name);
+				}
+				std::string_view getNameView() const
+				{
+					return std::string_view(m_name, getNameLength());
+				}
+				void setName(const char* p_name)
+				{
+					m_name = p_name;
+				}
 				GETSET(int64_t, size, Size);
 				GETSET(Directory*, parent, Parent);
 				GETSET(TTHValue, tthRoot, TTH);
 				GETSET(uint64_t, hit, Hit);
 				GETSET(int64_t, ts, TS);
-				std::shared_ptr<CFlyMediaInfo> m_media;
+				const CFlyMediaInfo* m_media; // owned by the arena
 				GETSET(bool, adls, Adls);
+			private:
+				const char* m_name; // interned in the arena
 		};
 		class CFlyVirusDetector
 		{
@@ -94,7 +195,7 @@ class DirectoryListing : public UserInfoBase
 				int64_t m_sum_size_exe;
 				
 				bool is_virus_dir() const;
-				static bool is_virus_file(const string& p_file, int64_t p_size);
+				static bool is_virus_file(std::string_view p_file, int64_t p_size);
 				void add(const string& p_file, int64_t p_size);
 		};
 		
@@ -106,7 +207,7 @@ class DirectoryListing : public UserInfoBase
 				{
 					bool operator()(const Ptr& a, const Ptr& b) const
 					{
-						return _stricmp(a->getName().c_str(), b->getName().c_str()) < 0;
+						return _stricmp(a->getNameC(), b->getNameC()) < 0;
 					}
 				};
 				typedef vector<Ptr> List;
@@ -123,13 +224,26 @@ class DirectoryListing : public UserInfoBase
 					return m_files.size();
 				}
 				
-				Directory(DirectoryListing* p_directory_list, Directory* aParent, const string& aName, bool _adls, bool aComplete, bool p_is_mediainfo)
-					: name(aName), parent(aParent), adls(_adls), complete(aComplete), m_is_mediainfo(p_is_mediainfo), m_directory_list(p_directory_list)
+				Directory(DirectoryListing* p_directory_list, Directory* aParent, const char* aName, bool _adls, bool aComplete, bool p_is_mediainfo)
+					: m_name(aName), parent(aParent), adls(_adls), complete(aComplete), m_is_mediainfo(p_is_mediainfo), m_directory_list(p_directory_list)
 				{
 				}
 				
 				virtual ~Directory();
 				
+				// The memory belongs to the arena, delete only runs the destructor
+				static void* operator new(size_t p_size, Arena& p_arena)
+				{
+					return p_arena.alloc(p_size, alignof(std::max_align_t));
+				}
+				static void operator delete(void*, Arena&)
+				{
+				}
+				static void operator delete(void*)
+				{
+				}
+				static void* operator new(size_t) = delete;
+				
 				size_t   getTotalFileCount(bool adls = false) const;
 				size_t   getTotalFolderCount() const;
 				uint64_t getTotalSize(bool adls = false) const;
@@ -147,22 +261,39 @@ class DirectoryListing : public UserInfoBase
 				void checkDupes(const DirectoryListing* lst);
 				bool isDVD() const
 				{
-					return (name.size() == 4 && name[0] == 'B' && name[1] == 'D') || // "BDMV"
-					       (name.size() == 8 && name[5] == '_' && name[2] == 'D'); //  "VIDEO_TS" "AUDIO_TS"
+					const size_t l_len = getNameLength();
+					return (l_len == 4 && m_name[0] == 'B' && m_name[1] == 'D') || // "BDMV"
+					       (l_len == 8 && m_name[5] == '_' && m_name[2] == 'D'); //  "VIDEO_TS" "AUDIO_TS"
 				}
 				
-				GETC(string, name, Name);
+				string getName() const
+				{
+					return string(m_name, getNameLength());
+				}
+				const char* getNameC() const
+				{
+					return m_name;
+				}
+				size_t getNameLength() const
+				{
+					return Arena::length(m_name);
+				}
+				std::string_view getNameView() const
+				{
+					return std::string_view(m_name, getNameLength());
+				}
 				GETSET(Directory*, parent, Parent);
 				GETSET(bool, adls, Adls);
 				GETSET(bool, complete, Complete);
 			private:
+				const char* m_name; // interned in the arena
 				bool m_is_mediainfo;
 		};
 		
 		class AdlDirectory : public Directory
 		{
 			public:
-				AdlDirectory(const string& aFullPath, Directory* aParent, const string& aName) : Directory(nullptr, aParent, aName, true, true, true), fullPath(aFullPath) { }
+				AdlDirectory(const string& aFullPath, Directory* aParent, const char* aName) : Directory(nullptr, aParent, aName, true, true, true), fullPath(aFullPath) { }
 				
 				GETSET(string, fullPath, FullPath);
 		};
@@ -226,6 +357,10 @@ class DirectoryListing : public UserInfoBase
 		}
 		
 		void checkDupes();
+		Arena& getArena()
+		{
+			return m_arena;
+		}
 		static UserPtr getUserFromFilename(const string& fileName);
 		
 		const UserPtr getUser() const
@@ -241,6 +376,7 @@ class DirectoryListing : public UserInfoBase
 		friend class ListLoader;
 		friend class DirectoryListingFrame;
 		
+		Arena m_arena; // must outlive root
 		Directory* root;
 		bool m_is_mediainfo;
 		bool m_is_own_list;
@@ -251,11 +387,11 @@ class DirectoryListing : public UserInfoBase
 
 inline bool operator==(const DirectoryListing::Directory::Ptr a, const std::string& b)
 {
-	return stricmp(a->getName().c_str(), b.c_str()) == 0;
+	return stricmp(a->getNameC(), b.c_str()) == 0;
 }
 inline bool operator==(const DirectoryListing::File::Ptr a, const std::string& b)
 {
-	return stricmp(a->getName().c_str(), b.c_str()) == 0;
+	return stricmp(a->getNameC(), b.c_str()) == 0;
 }
 
 #endif // !defined(DIRECTORY_LISTING_H)
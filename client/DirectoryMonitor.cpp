@@ -0,0 +1,284 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+
+#include "DirectoryMonitor.h"
+#include "File.h"
+#include "LogManager.h"
+
+/**
+ * ReadDirectoryChangesW on every root, all completions go to one port served by one thread.
+ * A closed watch stays allocated until its aborted read comes back through the port.
+ */
+class DirectoryMonitorWin32 : public DirectoryMonitor, private Thread
+{
+	public:
+		DirectoryMonitorWin32();
+		~DirectoryMonitorWin32();
+		
+		bool addDirectory(const string& p_path) override;
+		void removeDirectory(const string& p_path) override;
+		StringList getDirectories() const override;
+		void takeEvents(EventList& p_events) override;
+		
+	private:
+		struct Watch
+		{
+			Watch() : m_dir(INVALID_HANDLE_VALUE)
+			{
+				memzero(&m_overlapped, sizeof(m_overlapped));
+			}
+			OVERLAPPED m_overlapped;
+			HANDLE m_dir;
+			string m_path;
+			DWORD m_buffer[16 * 1024]; // 64K is the limit for the network shares
+		};
+		int run() override;
+		bool readL(Watch* p_watch);
+		void closeL(Watch* p_watch);
+		void parseL(const Watch& p_watch, DWORD p_size);
+		
+		HANDLE m_port;
+		mutable FastCriticalSection m_cs;
+		std::unordered_map<string, Watch*> m_watches; // by the lower path
+		size_t m_pending; // watches with a read in flight
+		bool m_is_stopping;
+		EventList m_events;
+};
+
+DirectoryMonitor* DirectoryMonitor::create()
+{
+	return new DirectoryMonitorWin32();
+}
+
+// The owner is asleep or swamped: one overflow per root says more than the rest
+static const size_t g_max_pending_events = 64 * 1024;
+
+DirectoryMonitorWin32::DirectoryMonitorWin32() : m_pending(0), m_is_stopping(false)
+{
+	m_port = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+	dcassert(m_port);
+	if (m_port)
+	{
+		start(0, "DirectoryMonitor");
+	}
+}
+
+DirectoryMonitorWin32::~DirectoryMonitorWin32()
+{
+	if (!m_port)
+		return;
+	{
+		CFlyFastLock(m_cs);
+		m_is_stopping = true;
+		for (auto i = m_watches.cbegin(); i != m_watches.cend(); ++i)
+		{
+			closeL(i->second);
+		}
+		m_watches.clear();
+	}
+	::PostQueuedCompletionStatus(m_port, 0, 0, NULL);
+	join();
+	::CloseHandle(m_port);
+}
+
+bool DirectoryMonitorWin32::addDirectory(const string& p_path)
+{
+	dcassert(!p_path.empty() && p_path.back() == PATH_SEPARATOR);
+	if (!m_port || p_path.empty())
+		return false;
+	const string l_lower_path = Text::toLower(p_path);
+	{
+		CFlyFastLock(m_cs);
+		if (m_watches.find(l_lower_path) != m_watches.end())
+			return true;
+	}
+	const HANDLE l_dir = ::CreateFile(File::formatPath(Text::toT(p_path)).c_str(), FILE_LIST_DIRECTORY,
+	                                  FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+	                                  FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (l_dir == INVALID_HANDLE_VALUE)
+	{
+		LogManager::message("DirectoryMonitor: error open " + p_path + " error = " + Util::translateError());
+		return false;
+	}
+	std::unique_ptr<Watch> l_watch(new Watch);
+	l_watch->m_dir = l_dir;
+	l_watch->m_path = p_path;
+	if (!::CreateIoCompletionPort(l_dir, m_port, reinterpret_cast<ULONG_PTR>(l_watch.get()), 0))
+	{
+		::CloseHandle(l_dir);
+		return false;
+	}
+	CFlyFastLock(m_cs);
+	if (m_is_stopping || m_watches.find(l_lower_path) != m_watches.end())
+	{
+		::CloseHandle(l_dir);
+		return !m_is_stopping;
+	}
+	if (!readL(l_watch.get()))
+	{
+		// ERROR_INVALID_FUNCTION: the file system does not report changes
+		LogManager::message("DirectoryMonitor: error watch " + p_path + " error = " + Util::translateError());
+		::CloseHandle(l_dir);
+		return false;
+	}
+	m_watches[l_lower_path] = l_watch.release();
+	return true;
+}
+
+void DirectoryMonitorWin32::removeDirectory(const string& p_path)
+{
+	CFlyFastLock(m_cs);
+	const auto i = m_watches.find(Text::toLower(p_path));
+	if (i != m_watches.end())
+	{
+		closeL(i->second);
+		m_watches.erase(i);
+	}
+}
+
+StringList DirectoryMonitorWin32::getDirectories() const
+{
+	StringList l_result;
+	CFlyFastLock(m_cs);
+	l_result.reserve(m_watches.size());
+	for (auto i = m_watches.cbegin(); i != m_watches.cend(); ++i)
+	{
+		l_result.push_back(i->second->m_path);
+	}
+	return l_result;
+}
+
+void DirectoryMonitorWin32::takeEvents(EventList& p_events)
+{
+	CFlyFastLock(m_cs);
+	if (p_events.empty())
+	{
+		p_events.swap(m_events);
+	}
+	else
+	{
+		p_events.insert(p_events.end(), m_events.begin(), m_events.end());
+		m_events.clear();
+	}
+}
+
+bool DirectoryMonitorWin32::readL(Watch* p_watch)
+{
+	const DWORD l_filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE;
+	if (!::ReadDirectoryChangesW(p_watch->m_dir, p_watch->m_buffer, sizeof(p_watch->m_buffer), TRUE, l_filter, NULL, &p_watch->m_overlapped, NULL))
+		return false;
+	++m_pending;
+	return true;
+}
+
+void DirectoryMonitorWin32::closeL(Watch* p_watch)
+{
+	// The read in flight completes with ERROR_OPERATION_ABORTED, run() frees the watch then
+	::CloseHandle(p_watch->m_dir);
+	p_watch->m_dir = INVALID_HANDLE_VALUE;
+}
+
+void DirectoryMonitorWin32::parseL(const Watch& p_watch, DWORD p_size)
+{
+	const uint8_t* l_pos = reinterpret_cast<const uint8_t*>(p_watch.m_buffer);
+	const uint8_t* l_end = l_pos + p_size;
+	wstring l_name;
+	string l_tmp;
+	while (l_pos + sizeof(FILE_NOTIFY_INFORMATION) <= l_end)
+	{
+		const FILE_NOTIFY_INFORMATION* l_info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(l_pos);
+		l_name.assign(l_info->FileName, l_info->FileNameLength / sizeof(WCHAR));
+		Action l_action;
+		switch (l_info->Action)
+		{
+			case FILE_ACTION_ADDED:
+				l_action = ACTION_ADDED;
+				break;
+			case FILE_ACTION_REMOVED:
+				l_action = ACTION_REMOVED;
+				break;
+			case FILE_ACTION_RENAMED_OLD_NAME:
+				l_action = ACTION_RENAMED_OLD;
+				break;
+			case FILE_ACTION_RENAMED_NEW_NAME:
+				l_action = ACTION_RENAMED_NEW;
+				break;
+			default:
+				l_action = ACTION_MODIFIED;
+				break;
+		}
+		if (m_events.size() >= g_max_pending_events)
+		{
+			if (m_events.back().m_action != ACTION_OVERFLOW || m_events.back().m_path != p_watch.m_path)
+			{
+				m_events.push_back(Event(ACTION_OVERFLOW, p_watch.m_path));
+			}
+			break;
+		}
+		m_events.push_back(Event(l_action, p_watch.m_path + Text::wideToUtf8(l_name, l_tmp)));
+		if (l_info->NextEntryOffset == 0)
+			break;
+		l_pos += l_info->NextEntryOffset;
+	}
+}
+
+int DirectoryMonitorWin32::run()
+{
+	for (;;)
+	{
+		DWORD l_size = 0;
+		ULONG_PTR l_key = 0;
+		OVERLAPPED* l_overlapped = nullptr;
+		const bool l_is_ok = ::GetQueuedCompletionStatus(m_port, &l_size, &l_key, &l_overlapped, INFINITE) != FALSE;
+		CFlyFastLock(m_cs);
+		if (!l_overlapped)
+		{
+			// Wake-up from the destructor
+			if (m_is_stopping && m_pending == 0)
+				break;
+			continue;
+		}
+		--m_pending;
+		Watch* l_watch = reinterpret_cast<Watch*>(l_key);
+		if (l_watch->m_dir == INVALID_HANDLE_VALUE)
+		{
+			delete l_watch;
+			if (m_is_stopping && m_pending == 0)
+				break;
+			continue;
+		}
+		if (l_is_ok && l_size != 0)
+		{
+			parseL(*l_watch, l_size);
+		}
+		else
+		{
+			// Zero bytes: the buffer overflowed (ERROR_NOTIFY_ENUM_DIR)
+			m_events.push_back(Event(ACTION_OVERFLOW, l_watch->m_path));
+		}
+		if (!l_is_ok || !readL(l_watch))
+		{
+			// The root is gone or unreachable, the owner finds out on the rescan
+			dcdebug("DirectoryMonitor: watch %s stopped, error = %d\n", l_watch->m_path.c_str(), int(::GetLastError()));
+			m_watches.erase(Text::toLower(l_watch->m_path));
+			::CloseHandle(l_watch->m_dir);
+			delete l_watch;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_DIRECTORY_MONITOR_H
+#define DCPLUSPLUS_DCPP_DIRECTORY_MONITOR_H
+
+#include "typedefs.h"
+
+/**
+ * Change notifications for a set of directory trees.
+ * The backend collects the events in the background, the owner takes them in batches.
+ * Paths are full real paths in UTF-8. ACTION_OVERFLOW means that the events for the tree
+ * under m_path were lost and the whole tree has to be rescanned.
+ */
+class DirectoryMonitor
+{
+	public:
+		enum Action
+		{
+			ACTION_ADDED,
+			ACTION_REMOVED,
+			ACTION_MODIFIED,
+			ACTION_RENAMED_OLD,
+			ACTION_RENAMED_NEW,
+			ACTION_OVERFLOW
+		};
+		struct Event
+		{
+			Event(Action p_action, const string& p_path) : m_action(p_action), m_path(p_path)
+			{
+			}
+			Action m_action;
+			string m_path;
+		};
+		typedef std::vector<Event> EventList;
+		
+		virtual ~DirectoryMonitor()
+		{
+		}
+		/// @param p_path Root of the tree with the trailing separator
+		/// @return false if the tree can not be watched, the owner has to rescan it by itself then
+		virtual bool addDirectory(const string& p_path) = 0;
+		virtual void removeDirectory(const string& p_path) = 0;
+		virtual StringList getDirectories() const = 0;
+		/// Appends the pending events to p_events
+		virtual void takeEvents(EventList& p_events) = 0;
+		
+		/// The backend of this platform
+		static DirectoryMonitor* create();
+};
+
+#endif // !defined(DCPLUSPLUS_DCPP_DIRECTORY_MONITOR_H)
@@ -765,6 +765,7 @@ void FavoriteManager::save_favorites()
 				xml.addChildAttrib("HideShare", (*i)->getHideShare()); // Save paramethers always IRAINMAN_INCLUDE_HIDE_SHARE_MOD
 				xml.addChildAttrib("ShowJoins", (*i)->getShowJoins()); // Show joins
 				xml.addChildAttrib("ExclChecks", (*i)->getExclChecks()); // Excl. from client checking
+				xml.addChildAttrib("UploadLimit", (*i)->getUploadLimit());
 //				xml.addChildAttrib("ExclusiveHub", (*i)->getExclusiveHub()); // Exclusive Hub
 				xml.addChildAttrib("SuppressChatAndPM", (*i)->getSuppressChatAndPM());
 				xml.addChildAttrib("UserListState", (*i)->getUserListState());
@@ -1385,6 +1386,7 @@ void FavoriteManager::load(SimpleXML& aXml
 					e->setHideShare(aXml.getBoolChildAttrib("HideShare")); // Hide Share Mod
 					e->setShowJoins(aXml.getBoolChildAttrib("ShowJoins")); // Show joins
 					e->setExclChecks(aXml.getBoolChildAttrib("ExclChecks")); // Excl. from client checking
+					e->setUploadLimit(aXml.getIntChildAttrib("UploadLimit"));
 //					e->setExclusiveHub(aXml.getBoolChildAttrib("ExclusiveHub")); // Exclusive Hub Mod
 					e->setHeaderOrder(aXml.getChildAttrib("HeaderOrder", SETTING(HUBFRAME_ORDER)));
 					e->setHeaderWidths(aXml.getChildAttrib("HeaderWidths", SETTING(HUBFRAME_WIDTHS)));
@@ -69,7 +69,8 @@ void File::init(const tstring& aFileName, int access, int mode, bool isAbsoluteP
 	
 	const tstring outPath = isAbsolutePath ? formatPath(aFileName) : aFileName;
 	
-	h = ::CreateFile(outPath.c_str(), access, shared, nullptr, m, mode & NO_CACHE_HINT ? 0 : FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	m_is_overlapped = (mode & OVERLAPPED) != 0;
+	h = ::CreateFile(outPath.c_str(), access, shared, nullptr, m, (mode & NO_CACHE_HINT ? 0 : FILE_FLAG_SEQUENTIAL_SCAN) | (m_is_overlapped ? FILE_FLAG_OVERLAPPED : 0), nullptr);
 	
 	if (h == INVALID_HANDLE_VALUE)
 	{
@@ -251,6 +252,70 @@ size_t File::write(const void* buf, size_t len)
 	}
 	return x;
 }
+/**
+ * The offset goes in OVERLAPPED. A synchronous handle does the I/O right in ReadFile/WriteFile,
+ * an overlapped one is waited on with an event of this call: the handle itself is signaled by any I/O.
+ */
+class PositionalIO : public OVERLAPPED
+{
+	public:
+		PositionalIO(int64_t p_pos, bool p_is_overlapped)
+		{
+			memzero(static_cast<OVERLAPPED*>(this), sizeof(OVERLAPPED));
+			LARGE_INTEGER l_offset;
+			l_offset.QuadPart = p_pos;
+			Offset = l_offset.LowPart;
+			OffsetHigh = l_offset.HighPart;
+			if (p_is_overlapped)
+			{
+				hEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+				if (!hEvent)
+					throw FileException(BaseUtil::translateError());
+			}
+		}
+		~PositionalIO()
+		{
+			if (hEvent)
+				::CloseHandle(hEvent);
+		}
+		/// @return 0 or the error code
+		DWORD complete(HANDLE p_file, BOOL p_result, DWORD& p_size)
+		{
+			if (!p_result)
+			{
+				if (::GetLastError() != ERROR_IO_PENDING)
+					return ::GetLastError();
+				if (!::GetOverlappedResult(p_file, this, &p_size, TRUE))
+					return ::GetLastError();
+			}
+			return 0;
+		}
+};
+
+size_t File::readAt(void* p_buf, size_t p_len, int64_t p_pos)
+{
+	PositionalIO l_io(p_pos, m_is_overlapped);
+	DWORD x = 0;
+	const DWORD l_error = l_io.complete(h, ::ReadFile(h, p_buf, DWORD(p_len), &x, &l_io), x);
+	if (l_error == ERROR_HANDLE_EOF)
+		return 0;
+	if (l_error)
+		throw FileException(BaseUtil::translateError(l_error));
+	return x;
+}
+
+size_t File::writeAt(const void* p_buf, size_t p_len, int64_t p_pos)
+{
+	PositionalIO l_io(p_pos, m_is_overlapped);
+	DWORD x = 0;
+	const DWORD l_error = l_io.complete(h, ::WriteFile(h, p_buf, DWORD(p_len), &x, &l_io), x);
+	if (l_error)
+		throw FileException(BaseUtil::translateError(l_error));
+	if (x != p_len)
+		throw FileException("Error in File::writeAt x != len");
+	return x;
+}
+
 void File::setEOF()
 {
 	dcassert(isOpen());
@@ -387,7 +452,7 @@ size_t File::bz2CompressFile(const wstring & p_file, const wstring & p_file_bz2)
 		if (l_read_size == static_cast<uint64_t>(l_size))
 		{
 			unique_ptr<OutputStream> l_outFilePtr(new File(p_file_bz2, File::WRITE, File::TRUNCATE | File::CREATE, false));
-			FilteredOutputStream<BZFilter, false> l_outFile(l_outFilePtr.get());
+			ParallelBZOutputStream<false> l_outFile(l_outFilePtr.get());
 			l_outSize += l_outFile.write(l_inData.get(), l_size);
 			l_outSize += l_outFile.flushBuffers(true);
 		}
@@ -35,7 +35,8 @@ class File : public IOStream
 			CREATE = 0x02,
 			TRUNCATE = 0x04, //-V112
 			SHARED = 0x08,
-			NO_CACHE_HINT = 0x10
+			NO_CACHE_HINT = 0x10,
+			OVERLAPPED = 0x20 // Only the positional readAt()/writeAt() may be used, they run in parallel
 		};
 		
 		enum
@@ -44,7 +45,7 @@ class File : public IOStream
 			WRITE = GENERIC_WRITE,
 			RW = READ | WRITE
 		};
-		File(): h(INVALID_HANDLE_VALUE)
+		File(): h(INVALID_HANDLE_VALUE), m_is_overlapped(false)
 		{
 		}
 		File(const tstring& aFileName, int access, int mode, bool isAbsolutePath = true)
@@ -73,6 +74,22 @@ class File : public IOStream
 		
 		size_t read(void* buf, size_t& len);
 		size_t write(const void* buf, size_t len);
+		/** Read/write at p_pos without touching the file pointer, any number of threads at once */
+		size_t readAt(void* p_buf, size_t p_len, int64_t p_pos);
+		size_t writeAt(const void* p_buf, size_t p_len, int64_t p_pos);
+		bool getFileRange(HANDLE& p_file, int64_t& p_pos, int64_t& p_left) override
+		{
+			if (!isOpen())
+				return false;
+			p_file = h;
+			p_pos = getPos();
+			p_left = getSize() - p_pos;
+			return true;
+		}
+		void skipFileRange(int64_t p_len) override
+		{
+			movePos(p_len);
+		}
 		// This has no effect if aForce is false
 		// Generally the operating system should decide when the buffered data is written on disk
 		size_t flushBuffers(bool aForce = true) override;
@@ -172,6 +189,7 @@ class File : public IOStream
 		
 	protected:
 		HANDLE h;
+		bool m_is_overlapped;
 };
 
 class FileFindIter
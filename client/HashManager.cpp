@@ -23,6 +23,8 @@
 #include "ShareManager.h"
 #include "../FlyFeatures/flyServer.h"
 
+#include <winioctl.h>
+
 #ifdef IRAINMAN_NTFS_STREAM_TTH
 
 const string HashManager::StreamStore::g_streamName(".gltth");
@@ -278,19 +280,88 @@ void HashManager::addFile(__int64 p_path_id, const string& p_file_name, int64_t
 	CFlylinkDBManager::getInstance()->add_file(p_path_id, p_file_name, p_time_stamp, p_tth, p_size, p_out_media);
 }
 
+HashManager::Hasher::~Hasher()
+{
+	stopWorkers();
+}
+
+string HashManager::Hasher::getDiskKey(const string& p_file_name)
+{
+	// "C:\dir\file" -> "c:", "\\server\share\file" -> "\\server"
+	string l_volume;
+	if (p_file_name.size() >= 2 && p_file_name[1] == ':')
+	{
+		l_volume = Text::toLower(p_file_name.substr(0, 2));
+	}
+	else if (p_file_name.compare(0, 2, "\\\\") == 0)
+	{
+		l_volume = Text::toLower(p_file_name.substr(0, p_file_name.find(PATH_SEPARATOR, 2)));
+	}
+	else
+	{
+		return Util::emptyString;
+	}
+	static FastCriticalSection g_cs_disk;
+	static std::unordered_map<string, string> g_disk_by_volume;
+	{
+		CFlyFastLock(g_cs_disk);
+		const auto i = g_disk_by_volume.find(l_volume);
+		if (i != g_disk_by_volume.end())
+		{
+			return i->second;
+		}
+	}
+	// Partitions of one physical disk share the same reader limit.
+	string l_disk = l_volume;
+	if (l_volume[1] == ':')
+	{
+		const HANDLE h = ::CreateFile(Text::toT("\\\\.\\" + l_volume).c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+		if (h != INVALID_HANDLE_VALUE)
+		{
+			VOLUME_DISK_EXTENTS l_extents = { 0 };
+			DWORD l_bytes = 0;
+			if (::DeviceIoControl(h, IOCTL_VOLUME_GET_VOLUME_DISK_EXTENTS, nullptr, 0, &l_extents, sizeof(l_extents), &l_bytes, nullptr) &&
+			        l_extents.NumberOfDiskExtents > 0)
+			{
+				l_disk = "disk" + Util::toString(l_extents.Extents[0].DiskNumber);
+			}
+			::CloseHandle(h);
+		}
+	}
+	CFlyFastLock(g_cs_disk);
+	g_disk_by_volume[l_volume] = l_disk;
+	return l_disk;
+}
+
+size_t HashManager::Hasher::getWorkerCount()
+{
+	const int l_threads = SETTING(HASH_THREADS);
+	if (l_threads > 0)
+	{
+		// More workers than cores only add buffers: the hashing itself is CPU bound
+		return std::min(size_t(l_threads), std::max(size_t(1), std::min(CompatibilityManager::getProcessorsCount(), size_t(16))));
+	}
+	return std::max(size_t(1), std::min(CompatibilityManager::getProcessorsCount(), size_t(4)));
+}
+
 void HashManager::Hasher::hashFile(__int64 p_path_id, const string& fileName, int64_t size)
 {
+	const string l_disk = getDiskKey(fileName);
 	CFlyFastLock(cs);
 	CFlyHashTaskItem l_task_item;
 	l_task_item.m_file_size = size;
 	l_task_item.m_path_id   = p_path_id;
 	
-	if (w.insert(make_pair(fileName, l_task_item)). second)
+	if (m_disk_queue[l_disk].m_files.insert(make_pair(fileName, l_task_item)).second)
 	{
+		++m_queued_files;
 		m_CurrentBytesLeft += size;
-		if (m_paused > 0)
-			m_paused++;
-		else
+		if (!m_running)
+		{
+			uiStartTime = GET_TICK();
+			m_running = true;
+		}
+		if (!m_paused)
 			m_hash_semaphore.signal();
 			
 		int64_t bytesLeft;
@@ -308,53 +379,107 @@ void HashManager::Hasher::hashFile(__int64 p_path_id, const string& fileName, in
 bool HashManager::Hasher::pause()
 {
 	CFlyFastLock(cs);
-	return m_paused++ > 0;
+	const bool l_is_paused = m_paused;
+	m_paused = true;
+	return l_is_paused;
 }
 
 void HashManager::Hasher::resume()
 {
-	CFlyFastLock(cs);
-	while (--m_paused > 0)
 	{
-		m_hash_semaphore.signal();
+		CFlyFastLock(cs);
+		m_paused = false;
+		for (; m_paused_workers > 0; --m_paused_workers)
+		{
+			m_pause_semaphore.signal();
+		}
 	}
+	signal(); // dispatch the files queued while paused
 }
 
 bool HashManager::Hasher::isPaused() const
 {
 	CFlyFastLock(cs);
-	return m_paused > 0;
+	return m_paused;
 }
 
-void HashManager::Hasher::stopHashing(const string& baseDir)
+void HashManager::Hasher::setThreadPriority(Priority p)
 {
+	Thread::setThreadPriority(p);
 	CFlyFastLock(cs);
-	if (baseDir.empty())
+	m_priority = p;
+	for (auto i = m_workers.cbegin(); i != m_workers.cend(); ++i)
 	{
-		w.clear();
-		m_CurrentBytesLeft = 0;
+		(*i)->setThreadPriority(p);
 	}
-	else
+}
+
+void HashManager::Hasher::stopHashing(const string& baseDir)
+{
+	CFlyFastLock(cs);
+	for (auto i = m_disk_queue.begin(); i != m_disk_queue.end();)
 	{
-		for (auto i = w.cbegin(); i != w.cend();)
+		WorkMap& l_files = i->second.m_files;
+		for (auto j = l_files.cbegin(); j != l_files.cend();)
 		{
-			if (strnicmp(baseDir, i->first, baseDir.length()) == 0) // TODO  ID ?
+			if (baseDir.empty() || strnicmp(baseDir, j->first, baseDir.length()) == 0) // TODO compare by path id?
 			{
-				m_CurrentBytesLeft -= i->second.m_file_size;
-				w.erase(i++);
+				m_CurrentBytesLeft -= j->second.m_file_size;
+				--m_queued_files;
+				l_files.erase(j++);
 			}
 			else
 			{
-				++i;
+				++j;
 			}
 		}
+		if (l_files.empty() && i->second.m_readers == 0)
+		{
+			m_disk_queue.erase(i++);
+		}
+		else
+		{
+			++i;
+		}
+	}
+	for (auto i = m_workers.cbegin(); i != m_workers.cend(); ++i)
+	{
+		CFlyHashJob& l_job = (*i)->m_job;
+		if ((*i)->m_is_busy && (baseDir.empty() || strnicmp(baseDir, l_job.m_file_name, baseDir.length()) == 0))
+		{
+			l_job.m_is_cancel = true;
+		}
+	}
+	if (m_queued_files == 0 && m_busy_workers == 0)
+	{
+		resetStatsL();
+	}
+	else
+	{
+		// restart the progress from what is left
+		getBytesAndFileLeft(iMaxBytes, dwMaxFiles);
 	}
+}
+
+void HashManager::Hasher::resetStatsL()
+{
 	m_running = false;
-	dwMaxFiles = 0;
 	iMaxBytes = 0;
-	m_fname.erase();
+	dwMaxFiles = 0;
+	m_CurrentBytesLeft = 0;
 	m_currentSize = 0;
-	m_path_id = 0;
+}
+
+string HashManager::Hasher::getCurrentFileL() const
+{
+	for (auto i = m_workers.cbegin(); i != m_workers.cend(); ++i)
+	{
+		if ((*i)->m_is_busy)
+		{
+			return (*i)->m_job.m_file_name;
+		}
+	}
+	return Util::emptyString;
 }
 
 void HashManager::Hasher::instantPause()
@@ -362,22 +487,186 @@ void HashManager::Hasher::instantPause()
 	bool wait = false;
 	{
 		CFlyFastLock(cs);
-		if (m_paused > 0)
+		if (m_paused && !isShutdown())
 		{
-			m_paused++;
+			m_paused_workers++;
 			wait = true;
 		}
 	}
 	if (wait)
 	{
-		m_hash_semaphore.wait();
+		m_pause_semaphore.wait();
 	}
 }
 
+int64_t HashManager::Hasher::getMaxHashBytesPerWorker() const
+{
+	const int l_max_speed = GetMaxHashSpeed();
+	if (l_max_speed <= 0)
+		return 0;
+	// MAX_HASH_SPEED limits the whole hasher, split it between the active workers.
+	return std::max(l_max_speed * 1024LL * 1024LL / int64_t(std::max(m_busy_workers, size_t(1))), 1LL);
+}
+
+void HashManager::Hasher::addProgress(HashWorker& p_worker, int64_t p_len)
+{
+	CFlyFastLock(cs);
+	const int64_t l_len = std::min(p_len, p_worker.m_job.m_size_left);
+	p_worker.m_job.m_size_left -= l_len;
+	m_currentSize -= l_len;
+}
+
+void HashManager::Hasher::addReadStats(HashReadBackend p_backend, int64_t p_bytes, uint64_t p_time)
+{
+	CFlyFastLock(cs);
+	HashReadStats& l_stats = m_read_stats[p_backend];
+	l_stats.m_bytes += p_bytes;
+	l_stats.m_time += p_time;
+	++l_stats.m_files;
+}
+
+void HashManager::Hasher::dispatchJobsL()
+{
+	if (m_paused || isShutdown())
+		return;
+	if (m_queued_files == 0)
+	{
+		if (m_busy_workers == 0)
+		{
+			resetStatsL();
+		}
+		return;
+	}
+	const size_t l_worker_count = getWorkerCount();
+	while (m_workers.size() < l_worker_count)
+	{
+		std::unique_ptr<HashWorker> l_worker(new HashWorker(*this));
+		l_worker->start(0, "HashWorker");
+		l_worker->setThreadPriority(m_priority);
+		m_workers.push_back(std::move(l_worker));
+	}
+	const unsigned l_readers_per_disk = std::max(1, SETTING(HASH_READERS_PER_DISK));
+	for (size_t i = 0; i < l_worker_count && m_queued_files > 0; ++i)
+	{
+		HashWorker& l_worker = *m_workers[i];
+		if (l_worker.m_is_busy)
+			continue;
+		// the least loaded disk first - all disks are read at the same time
+		auto l_disk = m_disk_queue.end();
+		for (auto j = m_disk_queue.begin(); j != m_disk_queue.end(); ++j)
+		{
+			if (!j->second.m_files.empty() && j->second.m_readers < l_readers_per_disk &&
+			        (l_disk == m_disk_queue.end() || j->second.m_readers < l_disk->second.m_readers))
+			{
+				l_disk = j;
+			}
+		}
+		if (l_disk == m_disk_queue.end())
+			break;
+		const auto l_file = l_disk->second.m_files.begin();
+		CFlyHashJob& l_job = l_worker.m_job;
+		l_job.m_file_name = l_file->first;
+		l_job.m_disk = l_disk->first;
+		l_job.m_file_size = l_file->second.m_file_size;
+		l_job.m_size_left = l_file->second.m_file_size;
+		l_job.m_path_id = l_file->second.m_path_id;
+		l_job.m_is_cancel = false;
+		l_disk->second.m_files.erase(l_file);
+		l_disk->second.m_readers++;
+		--m_queued_files;
+		m_CurrentBytesLeft -= l_job.m_file_size;
+		m_currentSize += l_job.m_file_size;
+		l_worker.m_is_busy = true;
+		++m_busy_workers;
+		l_worker.signal();
+	}
+}
+
+bool HashManager::Hasher::jobDone(HashWorker& p_worker, CFlyHashResult* p_result)
+{
+	bool l_is_last;
+	{
+		CFlyFastLock(cs);
+		CFlyHashJob& l_job = p_worker.m_job;
+		m_currentSize -= l_job.m_size_left;
+		l_job.m_size_left = 0;
+		const auto l_disk = m_disk_queue.find(l_job.m_disk);
+		if (l_disk != m_disk_queue.end())
+		{
+			dcassert(l_disk->second.m_readers);
+			if (--l_disk->second.m_readers == 0 && l_disk->second.m_files.empty())
+			{
+				m_disk_queue.erase(l_disk);
+			}
+		}
+		if (p_result && !l_job.m_is_cancel)
+		{
+			m_results.push_back(std::move(*p_result));
+		}
+		l_job.m_file_name.clear();
+		p_worker.m_is_busy = false;
+		--m_busy_workers;
+		l_is_last = m_queued_files == 0;
+	}
+	signal();
+	return l_is_last;
+}
+
+void HashManager::Hasher::processResults()
+{
+	std::vector<CFlyHashResult> l_results;
+	{
+		CFlyFastLock(cs);
+		l_results.swap(m_results);
+	}
+	for (auto i = l_results.cbegin(); i != l_results.cend() && !isShutdown(); ++i)
+	{
+		HashManager::getInstance()->hashDone(i->m_path_id, i->m_file_name, i->m_time_stamp, *i->m_tree, i->m_speed, i->m_is_ntfs, i->m_size);
+	}
+}
+
+void HashManager::Hasher::stopWorkers()
+{
+	{
+		CFlyFastLock(cs);
+		for (auto i = m_workers.cbegin(); i != m_workers.cend(); ++i)
+		{
+			(*i)->shutdown();
+		}
+		for (; m_paused_workers > 0; --m_paused_workers)
+		{
+			m_pause_semaphore.signal();
+		}
+	}
+	for (auto i = m_workers.cbegin(); i != m_workers.cend(); ++i)
+	{
+		(*i)->join();
+	}
+	m_workers.clear();
+}
+
 static size_t g_HashBufferSize = 16 * 1024 * 1024;
+static const size_t HASH_READS_IN_FLIGHT = 4; // fastHash splits the worker buffer into this many reads
+static const size_t HASH_BUFFERS_TOTAL = 128 * 1024 * 1024; // the buffers of all the workers, Win32 has 2 GiB of address space
+static const int64_t HASH_MAP_VIEW_SIZE = 64 * 1024 * 1024; // multiple of the allocation granularity
+
+bool HashManager::Hasher::HashWorker::readFile(HashReadBackend p_backend, const string& fname, TigerTree& tth, int64_t& p_size, bool p_is_link)
+{
+	switch (p_backend)
+	{
+		case HASH_READ_OVERLAPPED:
+			return fastHash(fname, tth, p_size, p_is_link);
+		case HASH_READ_MAPPED:
+			return mappedHash(fname, tth, p_size);
+		default:
+			return slowHash(fname, tth);
+	}
+}
 
-bool HashManager::Hasher::fastHash(const string& fname, uint8_t* buf, unsigned p_buf_size, TigerTree& tth, int64_t& p_size, bool p_is_link)
+bool HashManager::Hasher::HashWorker::fastHash(const string& fname, TigerTree& tth, int64_t& p_size, bool p_is_link)
 {
+	uint8_t* buf = m_buf;
+	const size_t l_slot_size = m_buf_size / HASH_READS_IN_FLIGHT;
 	int64_t l_size = p_size;
 	HANDLE h = INVALID_HANDLE_VALUE;
 	DWORD l_sector_size = 0;
@@ -412,7 +701,7 @@ bool HashManager::Hasher::fastHash(const string& fname, uint8_t* buf, unsigned p
 	}
 	else
 	{
-		if ((g_HashBufferSize % l_sector_size) != 0)
+		if ((l_slot_size % l_sector_size) != 0)
 		{
 			dcassert(0);
 			return false;
@@ -444,127 +733,95 @@ bool HashManager::Hasher::fastHash(const string& fname, uint8_t* buf, unsigned p
 			}
 		}
 	}
-	DWORD hn = 0;
-	DWORD rn = 0;
-	uint8_t* hbuf = buf + g_HashBufferSize;
-	uint8_t* rbuf = buf;
-	
-	OVERLAPPED over = { 0 };
-	BOOL res = TRUE;
-	over.hEvent = CreateEvent(NULL, FALSE, TRUE, NULL);
-	
-	bool ok = false;
-	
-	if (l_size == 0)
-	{
-		ok = true;
-		goto cleanup; // TODO  fix goto
-	}
-	
-	uint64_t lastRead = GET_TICK();
-	if (!::ReadFile(h, hbuf, g_HashBufferSize, &hn, &over))
+	bool ok = true;
+	if (l_size > 0)
 	{
-		m_last_error =   GetLastError();
-		if (m_last_error == ERROR_HANDLE_EOF)
+		// Keep HASH_READS_IN_FLIGHT unbuffered reads queued on the disk and hash them in file order
+		OVERLAPPED l_over[HASH_READS_IN_FLIGHT];
+		memzero(l_over, sizeof(l_over));
+		for (size_t i = 0; i < HASH_READS_IN_FLIGHT; ++i)
 		{
-			hn = 0;
+			l_over[i].hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 		}
-		else if (m_last_error == ERROR_IO_PENDING)
+		size_t l_head = 0; // the oldest read in flight
+		size_t l_in_flight = 0;
+		int64_t l_next_offset = 0;
+		uint64_t lastRead = GET_TICK();
+		while (!isCanceled())
 		{
-			if (!GetOverlappedResult(h, &over, &hn, TRUE))
+			while (l_in_flight < HASH_READS_IN_FLIGHT && l_next_offset < l_size)
 			{
-				m_last_error_overlapped =   GetLastError();
-				if (m_last_error_overlapped == ERROR_HANDLE_EOF)
+				const size_t l_slot = (l_head + l_in_flight) % HASH_READS_IN_FLIGHT;
+				OVERLAPPED& l_read = l_over[l_slot];
+				l_read.Offset = DWORD(l_next_offset);
+				l_read.OffsetHigh = DWORD(l_next_offset >> 32);
+				if (!::ReadFile(h, buf + l_slot * l_slot_size, DWORD(l_slot_size), nullptr, &l_read))
 				{
-					hn = 0;
-				}
-				else
-				{
-					goto cleanup;
+					m_last_error = GetLastError();
+					if (m_last_error == ERROR_HANDLE_EOF)
+					{
+						l_size = l_next_offset; // the file was truncated
+						break;
+					}
+					if (m_last_error != ERROR_IO_PENDING)
+					{
+						dcdebug("Error 0x%x: %s\n", m_last_error, Util::translateError(m_last_error).c_str());
+						ok = false;
+						break;
+					}
 				}
+				l_next_offset += l_slot_size;
+				++l_in_flight;
 			}
-		}
-		else
-		{
-			goto cleanup;
-		}
-	}
-	
-	over.Offset = hn;
-	l_size -= hn;
-	dcassert(l_size >= 0);
-	while (!isShutdown() && m_running && l_size >= 0)
-	{
-		if (l_size > 0)
-		{
-			// Start a new overlapped read
-			ResetEvent(over.hEvent);
-			if (GetMaxHashSpeed() > 0)
+			if (!ok || l_in_flight == 0)
+				break;
+				
+			DWORD l_len = 0;
+			if (!GetOverlappedResult(h, &l_over[l_head], &l_len, TRUE))
 			{
-				const uint64_t now = GET_TICK();
-				const uint64_t minTime = hn * 1000LL / (GetMaxHashSpeed() * 1024LL * 1024LL);
-				if (lastRead + minTime > now)
+				m_last_error_overlapped = GetLastError();
+				if (m_last_error_overlapped != ERROR_HANDLE_EOF)
 				{
-					const uint64_t diff = now - lastRead;
-					sleep(minTime - diff);
+					dcdebug("Error 0x%x: %s\n", m_last_error_overlapped, Util::translateError(m_last_error_overlapped).c_str());
+					ok = false;
+					break;
 				}
-				lastRead = lastRead + minTime;
+				l_len = 0;
 			}
-			else
+			--l_in_flight;
+			if (l_len < l_slot_size)
 			{
-				lastRead = GET_TICK();
+				l_size = 0; // end of file, hash what is left in flight and stop
 			}
-			res = ReadFile(h, rbuf, g_HashBufferSize, &rn, &over);
-		}
-		else
-		{
-			rn = 0;
+			
+			tth.update(buf + l_head * l_slot_size, l_len);
+			m_hasher.addProgress(*this, l_len);
+			throttle(lastRead, l_len);
+			l_head = (l_head + 1) % HASH_READS_IN_FLIGHT;
+			
+			m_hasher.instantPause();
 		}
-		
-		tth.update(hbuf, hn);
-		
+		if (isCanceled())
 		{
-			CFlyFastLock(cs);
-			m_currentSize = std::max(m_currentSize - hn, _LL(0));
+			ok = false;
 		}
-		
-		if (l_size == 0)
+		if (l_in_flight)
 		{
-			ok = true;
-			break;
+			// The buffer must not be reused while the kernel still writes into it
+			CancelIoEx(h, nullptr);
+			for (; l_in_flight; --l_in_flight, l_head = (l_head + 1) % HASH_READS_IN_FLIGHT)
+			{
+				DWORD l_len;
+				GetOverlappedResult(h, &l_over[l_head], &l_len, TRUE);
+			}
 		}
-		
-		if (!res)
+		for (size_t i = 0; i < HASH_READS_IN_FLIGHT; ++i)
 		{
-			// deal with the error code
-			switch (GetLastError())
+			if (!::CloseHandle(l_over[i].hEvent))
 			{
-				case ERROR_IO_PENDING:
-					if (!GetOverlappedResult(h, &over, &rn, TRUE))
-					{
-						dcdebug("Error 0x%x: %s\n", GetLastError(), Util::translateError().c_str());
-						goto cleanup;
-					}
-					break;
-				default:
-					dcdebug("Error 0x%x: %s\n", GetLastError(), Util::translateError().c_str());
-					goto cleanup;
+				LogManager::message("CloseHandle(over.hEvent) error: " + Util::translateError());
 			}
 		}
-		
-		instantPause();
-		
-		*((uint64_t*)&over.Offset) += rn;
-		l_size -= rn;
-		
-		std::swap(rbuf, hbuf);
-		std::swap(rn, hn);
-	}
-	
-cleanup:
-	if (!::CloseHandle(over.hEvent))
-	{
-		LogManager::message("CloseHandle(over.hEvent) error: " + Util::translateError());
 	}
 	if (!::CloseHandle(h))
 	{
@@ -573,244 +830,347 @@ cleanup:
 	return ok;
 }
 
-int HashManager::Hasher::run()
+// The views are read by page faults, PrefetchVirtualMemory (Windows 8+) queues the read-ahead of a whole window.
+struct CFlyMemoryRangeEntry
 {
-	setThreadPriority(Thread::IDLE);
-	
-	uint8_t* l_buf = nullptr;
-	unsigned l_buf_size = 0;
-	bool l_is_virtualBuf = true;
-	bool l_is_last = false;
-	for (;;)
+	PVOID VirtualAddress;
+	SIZE_T NumberOfBytes;
+};
+typedef BOOL (WINAPI* PrefetchVirtualMemoryFunc)(HANDLE, ULONG_PTR, CFlyMemoryRangeEntry*, ULONG);
+
+static const uint8_t* mapHashView(HANDLE p_map, int64_t p_offset, size_t p_len)
+{
+	static const PrefetchVirtualMemoryFunc g_prefetch = (PrefetchVirtualMemoryFunc)GetProcAddress(GetModuleHandle(_T("kernel32.dll")), "PrefetchVirtualMemory");
+	const uint8_t* l_view = (const uint8_t*)MapViewOfFile(p_map, FILE_MAP_READ, DWORD(p_offset >> 32), DWORD(p_offset), p_len);
+	if (l_view && g_prefetch)
 	{
-		m_hash_semaphore.wait();
-		if (isShutdown())
-			break;
-		if (m_rebuild)
+		CFlyMemoryRangeEntry l_range = { const_cast<uint8_t*>(l_view), p_len };
+		g_prefetch(GetCurrentProcess(), 1, &l_range, 0);
+	}
+	return l_view;
+}
+
+// A read error in a mapped view is raised as EXCEPTION_IN_PAGE_ERROR instead of a failed ReadFile
+static bool updateHashView(TigerTree& p_tth, const uint8_t* p_data, size_t p_len)
+{
+	__try
+	{
+		p_tth.update(p_data, p_len);
+	}
+	__except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		return false;
+	}
+	return true;
+}
+
+bool HashManager::Hasher::HashWorker::mappedHash(const string& fname, TigerTree& tth, int64_t& p_size)
+{
+	HANDLE h = ::CreateFile(File::formatPath(Text::toT(fname), true).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+	                        FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (h == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER x = {0};
+	if (!::GetFileSizeEx(h, &x))
+	{
+		::CloseHandle(h);
+		return false;
+	}
+	p_size = x.QuadPart;
+	if (p_size == 0)
+	{
+		::CloseHandle(h);
+		return true;
+	}
+	HANDLE l_map = ::CreateFileMapping(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (l_map == nullptr)
+	{
+		m_last_error = GetLastError();
+		::CloseHandle(h);
+		return false;
+	}
+	uint64_t lastRead = GET_TICK();
+	int64_t l_offset = 0;
+	size_t l_len = size_t(std::min(p_size, HASH_MAP_VIEW_SIZE));
+	const uint8_t* l_view = mapHashView(l_map, 0, l_len);
+	bool ok = l_view != nullptr;
+	while (l_view)
+	{
+		// Map the next window before hashing this one so that its read-ahead overlaps the hashing
+		const int64_t l_next_offset = l_offset + l_len;
+		const size_t l_next_len = size_t(std::min(p_size - l_next_offset, HASH_MAP_VIEW_SIZE));
+		const uint8_t* l_next_view = l_next_len && !isCanceled() ? mapHashView(l_map, l_next_offset, l_next_len) : nullptr;
+		
+		for (size_t l_pos = 0; ok && l_pos < l_len && !isCanceled();)
 		{
-			HashManager::getInstance()->doRebuild();
-			m_rebuild = false;
-			LogManager::message(STRING(HASH_REBUILT));
-			continue;
+			const size_t n = std::min(l_len - l_pos, g_HashBufferSize);
+			ok = updateHashView(tth, l_view + l_pos, n);
+			l_pos += n;
+			m_hasher.addProgress(*this, n);
+			throttle(lastRead, n);
+			m_hasher.instantPause();
 		}
+		::UnmapViewOfFile(l_view);
+		if (!ok || isCanceled())
 		{
-			CFlyFastLock(cs);
-			if (!w.empty())
-			{
-				m_fname = w.begin()->first;
-				m_currentSize = w.begin()->second.m_file_size;
-				m_path_id = w.begin()->second.m_path_id;
-				m_CurrentBytesLeft -= m_currentSize;
-				w.erase(w.begin());
-				l_is_last = w.empty();
-				if (!m_running)
-				{
-					uiStartTime = GET_TICK();
-					m_running = true;
-				}
-			}
-			else
-			{
-				m_currentSize = 0;
-				l_is_last = true;
-				m_fname.clear();
-				m_running = false;
-				iMaxBytes = 0;
-				dwMaxFiles = 0;
-				m_CurrentBytesLeft = 0;
-			}
+			if (l_next_view)
+				::UnmapViewOfFile(l_next_view);
+			break;
 		}
-		string l_fname;
+		if (l_next_len && !l_next_view)
 		{
-			CFlyFastLock(cs);
-			l_fname = m_fname;
+			m_last_error = GetLastError();
+			ok = false;
 		}
-		if (!l_fname.empty())
+		l_view = l_next_view;
+		l_offset = l_next_offset;
+		l_len = l_next_len;
+	}
+	::CloseHandle(l_map);
+	::CloseHandle(h);
+	return ok && !isCanceled();
+}
+
+void HashManager::Hasher::HashWorker::throttle(uint64_t& p_last_read, size_t p_len)
+{
+	const int64_t l_max_speed = m_hasher.getMaxHashBytesPerWorker();
+	if (l_max_speed > 0)
+	{
+		const uint64_t now = GET_TICK();
+		const uint64_t minTime = p_len * 1000LL / l_max_speed;
+		if (p_last_read + minTime > now)
 		{
-			int64_t l_size = 0;
-			int64_t l_outFiletime = 0;
-			bool l_is_link = false;
-			File::isExist(l_fname, l_size, l_outFiletime, l_is_link); // TODO -   isLink
-			int64_t l_sizeLeft = l_size;
+			sleep(minTime - (now - p_last_read));
+		}
+		p_last_read = p_last_read + minTime;
+	}
+	else
+	{
+		p_last_read = GET_TICK();
+	}
+}
+
+void HashManager::Hasher::HashWorker::allocBuffer()
+{
+	if (m_buf)
+		return;
 #ifdef _WIN32
-			if (l_buf == NULL)
-			{
-				l_is_virtualBuf = true;
-				l_buf_size = g_HashBufferSize * 2;
-				l_buf = (uint8_t*)VirtualAlloc(NULL, l_buf_size, MEM_COMMIT, PAGE_READWRITE);  //   *2!
-				// - %%%    fastHash
-			}
+	m_is_virtual_buf = true;
+	// fastHash keeps HASH_READS_IN_FLIGHT reads in it, every read stays a multiple of 64 KiB for the unbuffered I/O
+	const size_t l_granularity = HASH_READS_IN_FLIGHT * 64 * 1024;
+	m_buf_size = std::min(g_HashBufferSize * 2, HASH_BUFFERS_TOTAL / getWorkerCount()) / l_granularity * l_granularity;
+	m_buf_size = std::max(m_buf_size, l_granularity);
+	m_buf = (uint8_t*)VirtualAlloc(NULL, m_buf_size, MEM_COMMIT, PAGE_READWRITE);
 #endif
-			if (l_buf == NULL)
+	if (m_buf == nullptr)
+	{
+		m_is_virtual_buf = false;
+		bool l_is_bad_alloc;
+		do
+		{
+			try
 			{
-				l_is_virtualBuf = false;
-				bool l_is_bad_alloc;
-				do
-				{
-					try
-					{
-						dcassert(g_HashBufferSize);
-						l_is_bad_alloc = false;
-						l_buf = new uint8_t[g_HashBufferSize];
-					}
-					catch (std::bad_alloc&)
-					{
-						ShareManager::tryFixBadAlloc();
-						l_buf = nullptr;
-						g_HashBufferSize /= 2;
-						l_is_bad_alloc = g_HashBufferSize > 128;
-						if (l_is_bad_alloc == false)
-						{
-							throw;
-						}
-					}
-				}
-				while (l_is_bad_alloc == true);
-				l_buf_size = g_HashBufferSize;
+				dcassert(g_HashBufferSize);
+				l_is_bad_alloc = false;
+				m_buf = new uint8_t[g_HashBufferSize];
 			}
-			try
+			catch (std::bad_alloc&)
 			{
-				if (l_size == 0) //  && l_is_link -     aux.h
-					// https://msdn.microsoft.com/en-us/library/aa365247.aspx
-					//  = 0
+				ShareManager::tryFixBadAlloc();
+				m_buf = nullptr;
+				g_HashBufferSize /= 2;
+				l_is_bad_alloc = g_HashBufferSize > 128;
+				if (l_is_bad_alloc == false)
 				{
-					File f(l_fname, File::READ, File::OPEN);
-					l_size = f.getSize(); // fix https://github.com/pavel-pimenov/flylinkdc-r5xx/issues/15
+					throw;
 				}
-				const int64_t bs = TigerTree::getMaxBlockSize(l_size);
-				const uint64_t start = GET_TICK();
-				const int64_t timestamp = l_outFiletime;
-				int64_t speed = 0;
-				size_t n = 0;
-				TigerTree fastTTH(bs);
-				TigerTree slowTTH(bs);
-				TigerTree* tth = &fastTTH;
-				bool l_is_ntfs = false;
-#ifdef IRAINMAN_NTFS_STREAM_TTH
-				if (l_size > 0 && HashManager::getInstance()->m_streamstore.loadTree(l_fname, fastTTH, l_size))
-				{
-					l_is_ntfs = true;
-					LogManager::message(STRING(LOAD_TTH_FROM_NTFS) + ' ' + l_fname);
-				}
-#endif
-#ifdef _WIN32
+			}
+		}
+		while (l_is_bad_alloc == true);
+		m_buf_size = g_HashBufferSize;
+	}
+}
+
+void HashManager::Hasher::HashWorker::freeBuffer()
+{
+	if (m_buf)
+	{
+		if (m_is_virtual_buf)
+			VirtualFree(m_buf, 0, MEM_RELEASE);
+		else
+			delete [] m_buf;
+		m_buf = nullptr;
+		m_buf_size = 0;
+	}
+}
+
+bool HashManager::Hasher::HashWorker::slowHash(const string& fname, TigerTree& tth)
+{
+	uint64_t lastRead = GET_TICK();
+	size_t n = 0;
+	File l_slow_file_reader(fname, File::READ, File::OPEN);
+	do
+	{
+		size_t bufSize = std::min(m_buf_size, g_HashBufferSize);
+		throttle(lastRead, n);
+		n = l_slow_file_reader.read(m_buf, bufSize);
+		if (n > 0)
+		{
+			tth.update(m_buf, n);
+			m_hasher.addProgress(*this, n);
+			m_hasher.instantPause();
+		}
+	}
+	while (!isCanceled() && n > 0);
+	return !isCanceled();
+}
+
+void HashManager::Hasher::HashWorker::hashJob()
+{
+	// m_job is changed by the hasher only while the worker is idle
+	const string& l_fname = m_job.m_file_name;
+	CFlyHashResult l_result;
+	bool l_is_done = false;
+	try
+	{
+		int64_t l_size = 0;
+		int64_t l_outFiletime = 0;
+		bool l_is_link = false;
+		File::isExist(l_fname, l_size, l_outFiletime, l_is_link);
+		allocBuffer();
+		if (l_size == 0)
+		{
+			File f(l_fname, File::READ, File::OPEN);
+			l_size = f.getSize(); // fix https://github.com/pavel-pimenov/flylinkdc-r5xx/issues/15
+		}
+		const int64_t bs = TigerTree::getMaxBlockSize(l_size);
+		const uint64_t start = GET_TICK();
+		std::unique_ptr<TigerTree> l_tth(new TigerTree(bs));
+		bool l_is_ntfs = false;
+		bool l_is_ok = true;
 #ifdef IRAINMAN_NTFS_STREAM_TTH
-				if (!l_is_ntfs)
-				{
+		if (l_size > 0 && HashManager::getInstance()->m_streamstore.loadTree(l_fname, *l_tth, l_size))
+		{
+			l_is_ntfs = true;
+			LogManager::message(STRING(LOAD_TTH_FROM_NTFS) + ' ' + l_fname);
+		}
+		else
 #endif
-					if (l_is_virtualBuf == false || !BOOLSETTING(FAST_HASH) || !fastHash(l_fname, l_buf, l_buf_size, fastTTH, l_size, l_is_link))
-					{
-#else
-				if (!BOOLSETTING(FAST_HASH) || !fastHash(fname, 0, fastTTH, l_size))
+		{
+			HashReadBackend l_backend = HASH_READ_BUFFERED;
+			if (BOOLSETTING(FAST_HASH))
+			{
+				switch (SETTING(HASH_READ_BACKEND))
 				{
-#endif
-						if (m_running)
-						{
-							tth = &slowTTH;
-							uint64_t lastRead = GET_TICK();
-							File l_slow_file_reader(l_fname, File::READ, File::OPEN);
-							do
-							{
-								size_t bufSize = g_HashBufferSize;
-								
-								if (GetMaxHashSpeed() > 0)
-								{
-									const uint64_t now = GET_TICK();
-									const uint64_t minTime = n * 1000LL / (GetMaxHashSpeed() * 1024LL * 1024LL);
-									if (lastRead + minTime > now)
-									{
-										sleep(minTime - (now - lastRead));
-									}
-									lastRead = lastRead + minTime;
-								}
-								else
-								{
-									lastRead = GET_TICK();
-								}
-								n = l_slow_file_reader.read(l_buf, bufSize);
-								if (n > 0)
-								{
-									tth->update(l_buf, n);
-									{
-										CFlyFastLock(cs);
-										m_currentSize = std::max(static_cast<uint64_t>(m_currentSize - n), static_cast<uint64_t>(0)); // TODO - max  0  ?
-									}
-									l_sizeLeft -= n;
-									
-									instantPause();
-								}
-							}
-							while (!isShutdown() && m_running && n > 0);
-						}
-						else
-							tth = nullptr;
-					}
-					else
-					{
-						l_sizeLeft = 0; // Variable 'l_sizeLeft' is assigned a value that is never used.
-					}
-#ifdef IRAINMAN_NTFS_STREAM_TTH
+					case HASH_READ_MAPPED:
+						l_backend = HASH_READ_MAPPED;
+						break;
+					case HASH_READ_BUFFERED:
+						break;
+					default:
+						if (m_is_virtual_buf) // unbuffered reads need the page aligned buffer
+							l_backend = HASH_READ_OVERLAPPED;
+						break;
 				}
-#endif
-				const uint64_t end = GET_TICK();
-				if (end > start) // TODO: Why is not possible?
+			}
+			uint64_t l_read_start = GET_TICK();
+			if (!readFile(l_backend, l_fname, *l_tth, l_size, l_is_link))
+			{
+				if (isCanceled() || l_backend == HASH_READ_BUFFERED)
 				{
-					speed = l_size * _LL(1000) / (end - start);
+					l_is_ok = false;
 				}
-				if (m_running)
+				else
 				{
-					if (m_path_id == 0)
-					{
-						//dcassert(m_path_id);
-						const auto l_path = Text::toLower(Util::getFilePath(l_fname));
-						dcassert(!l_path.empty());
-						bool l_is_no_mediainfo;
-						m_path_id = CFlylinkDBManager::getInstance()->get_path_id(l_path, true, false, l_is_no_mediainfo, false);
-						dcassert(m_path_id);
-					}
-#ifdef IRAINMAN_NTFS_STREAM_TTH
-					if (l_is_ntfs)
-					{
-						HashManager::getInstance()->hashDone(m_path_id, l_fname, timestamp, *tth, speed, l_is_ntfs, l_size);
-					}
-					else
-#endif
-						if (tth)
-						{
-							tth->finalize();
-							HashManager::getInstance()->hashDone(m_path_id, l_fname, timestamp, *tth, speed, l_is_ntfs, l_size);
-						}
+					l_tth.reset(new TigerTree(bs));
+					l_backend = HASH_READ_BUFFERED;
+					l_read_start = GET_TICK();
+					l_is_ok = slowHash(l_fname, *l_tth);
 				}
 			}
-			catch (const FileException& e)
+			if (l_is_ok)
 			{
-				LogManager::message(STRING(ERROR_HASHING) + ' ' + l_fname + ": " + e.getError());
+				l_tth->finalize();
+				m_hasher.addReadStats(l_backend, l_size, GET_TICK() - l_read_start);
 			}
 		}
+		if (l_is_ok && !isCanceled())
 		{
-			CFlyFastLock(cs);
-			m_fname.clear();
-			m_currentSize = 0;
-			m_path_id = 0;
-			
-			if (w.empty())
+			const uint64_t end = GET_TICK();
+			int64_t speed = 0;
+			if (end > start) // TODO: Why is not possible?
 			{
-				m_running = false;
-				iMaxBytes = 0;
-				dwMaxFiles = 0;
-				m_CurrentBytesLeft = 0;
+				speed = l_size * _LL(1000) / (end - start);
 			}
+			int64_t l_path_id = m_job.m_path_id;
+			if (l_path_id == 0)
+			{
+				const auto l_path = Text::toLower(Util::getFilePath(l_fname));
+				dcassert(!l_path.empty());
+				bool l_is_no_mediainfo;
+				l_path_id = CFlylinkDBManager::getInstance()->get_path_id(l_path, true, false, l_is_no_mediainfo, false);
+				dcassert(l_path_id);
+			}
+			l_result.m_path_id = l_path_id;
+			l_result.m_file_name = l_fname;
+			l_result.m_time_stamp = l_outFiletime;
+			l_result.m_speed = speed;
+			l_result.m_size = l_size;
+			l_result.m_is_ntfs = l_is_ntfs;
+			l_result.m_tree = std::move(l_tth);
+			l_is_done = true;
 		}
-		
-		if (l_buf != NULL && (l_is_last || isShutdown()))
+	}
+	catch (const FileException& e)
+	{
+		LogManager::message(STRING(ERROR_HASHING) + ' ' + l_fname + ": " + e.getError());
+	}
+	if (m_hasher.jobDone(*this, l_is_done ? &l_result : nullptr))
+	{
+		freeBuffer();
+	}
+}
+
+int HashManager::Hasher::HashWorker::run()
+{
+	for (;;)
+	{
+		m_task_semaphore.wait();
+		if (isShutdown())
+			break;
+		hashJob();
+	}
+	freeBuffer();
+	return 0;
+}
+
+int HashManager::Hasher::run()
+{
+	setThreadPriority(Thread::IDLE);
+	
+	for (;;)
+	{
+		m_hash_semaphore.wait();
+		if (isShutdown())
+			break;
+		if (m_rebuild)
 		{
-			if (l_is_virtualBuf)
-				VirtualFree(l_buf, 0, MEM_RELEASE);
-			else
-				delete [] l_buf;
-			l_buf = nullptr;
+			HashManager::getInstance()->doRebuild();
+			m_rebuild = false;
+			LogManager::message(STRING(HASH_REBUILT));
+			continue;
+		}
+		// Workers read and hash the files, the finished trees are stored here,
+		// so hashDone and the listeners are still called from one thread.
+		processResults();
+		{
+			CFlyFastLock(cs);
+			dispatchJobsL();
 		}
 	}
+	stopWorkers();
 	return 0;
 }
 
@@ -22,6 +22,7 @@
 #ifndef DCPLUSPLUS_DCPP_HASH_MANAGER_H
 #define DCPLUSPLUS_DCPP_HASH_MANAGER_H
 
+#include <atomic>
 #include "Semaphore.h"
 #include "TimerManager.h"
 #include "SettingsManager.h"
@@ -102,6 +103,34 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 			hasher.getStats(curFile, bytesLeft, filesLeft);
 		}
 		
+		/**
+		 * How a hash worker reads a file (SettingsManager::HASH_READ_BACKEND).
+		 * Any backend that fails on a file falls back to HASH_READ_BUFFERED.
+		 */
+		enum HashReadBackend
+		{
+			HASH_READ_OVERLAPPED, // FILE_FLAG_NO_BUFFERING, several overlapped reads in flight
+			HASH_READ_MAPPED,     // mapped views with read-ahead of the next window
+			HASH_READ_BUFFERED,   // plain File::read
+			HASH_READ_LAST
+		};
+		struct HashReadStats
+		{
+			HashReadStats() : m_bytes(0), m_time(0), m_files(0) { }
+			int64_t m_bytes;
+			uint64_t m_time; // ms spent reading and hashing
+			size_t m_files;
+			int64_t getSpeed() const
+			{
+				return m_time ? m_bytes * 1000 / int64_t(m_time) : 0;
+			}
+		};
+		/// @param p_read_stats throughput of every read backend since startup
+		void getStats(string& curFile, int64_t& bytesLeft, size_t& filesLeft, HashReadStats(&p_read_stats)[HASH_READ_LAST])
+		{
+			hasher.getStats(curFile, bytesLeft, filesLeft, p_read_stats);
+		}
+		
 		/**
 		 * Rebuild hash data file
 		 */
@@ -236,15 +265,21 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 		{
 			return hasher.GetMaxHashSpeed();
 		}
+		/// Key of the physical disk holding p_file_name, empty if unknown
+		static string getDiskKey(const string& p_file_name)
+		{
+			return Hasher::getDiskKey(p_file_name);
+		}
 		
 	private:
 		class Hasher : public Thread, private CFlyStopThread
 		{
 			public:
-				Hasher() : m_running(false), m_paused(0), m_rebuild(false), m_currentSize(0), m_path_id(0),
-					m_CurrentBytesLeft(0),
-					m_ForceMaxHashSpeed(0), dwMaxFiles(0), iMaxBytes(0), uiStartTime(0), m_last_error(0), m_last_error_overlapped(0) { }
-					
+				Hasher() : m_running(false), m_paused(false), m_rebuild(false), m_currentSize(0),
+					m_CurrentBytesLeft(0), m_queued_files(0), m_busy_workers(0), m_paused_workers(0), m_priority(Thread::IDLE),
+					m_ForceMaxHashSpeed(0), dwMaxFiles(0), iMaxBytes(0), uiStartTime(0) { }
+				~Hasher();
+				
 				void hashFile(__int64 p_path_id, const string& fileName, int64_t size);
 				
 				/// @return whether hashing was already paused
@@ -254,20 +289,22 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 				
 				void stopHashing(const string& baseDir);
 				int run() override;
-				bool fastHash(const string& fname, uint8_t* buf, unsigned p_buf_size, TigerTree& tth, int64_t& size, bool p_is_link);
 				void getStats(string& curFile, int64_t& bytesLeft, size_t& filesLeft)
 				{
 					CFlyFastLock(cs);
-					curFile = m_fname;
+					curFile = getCurrentFileL();
 					getBytesAndFileLeft(bytesLeft, filesLeft);
 				}
+				void getStats(string& curFile, int64_t& bytesLeft, size_t& filesLeft, HashReadStats(&p_read_stats)[HASH_READ_LAST])
+				{
+					CFlyFastLock(cs);
+					curFile = getCurrentFileL();
+					getBytesAndFileLeft(bytesLeft, filesLeft);
+					std::copy(m_read_stats, m_read_stats + HASH_READ_LAST, p_read_stats);
+				}
 				
 				void signal()
 				{
-					if (m_paused)
-					{
-						m_hash_semaphore.signal();
-					}
 					m_hash_semaphore.signal();
 				}
 				void shutdown()
@@ -280,6 +317,7 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 					m_rebuild = true;
 					signal();
 				}
+				void setThreadPriority(Priority p);
 				int GetMaxHashSpeed() const
 				{
 					return m_ForceMaxHashSpeed != 0 ? m_ForceMaxHashSpeed : SETTING(MAX_HASH_SPEED);
@@ -287,13 +325,11 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 			private:
 				void getBytesAndFileLeft(int64_t& bytesLeft, size_t& filesLeft) const
 				{
-					filesLeft = w.size();
-					if (m_running)
-						filesLeft++;
-						
+					filesLeft = m_queued_files + m_busy_workers;
 					bytesLeft = m_currentSize + m_CurrentBytesLeft;
 				}
 			public:
+				static string getDiskKey(const string& p_file_name);
 				void EnableForceMinHashSpeed(int iMinHashSpeed)
 				{
 					m_ForceMaxHashSpeed = iMinHashSpeed;
@@ -361,26 +397,120 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 					int64_t m_file_size;
 					int64_t m_path_id;
 				};
-				void instantPause();
 				typedef std::map<string, CFlyHashTaskItem> WorkMap;
 				
-				WorkMap w;
+				// Files are queued per physical disk, so that a spinning disk is not read
+				// by more than HASH_READERS_PER_DISK workers at the same time.
+				struct CFlyDiskQueue
+				{
+					CFlyDiskQueue() : m_readers(0) { }
+					WorkMap m_files;
+					unsigned m_readers;
+				};
+				typedef std::map<string, CFlyDiskQueue> DiskQueueMap;
+				
+				struct CFlyHashJob
+				{
+					CFlyHashJob() : m_file_size(0), m_size_left(0), m_path_id(0), m_is_cancel(false) { }
+					string m_file_name;
+					string m_disk;
+					int64_t m_file_size;
+					int64_t m_size_left;
+					int64_t m_path_id;
+					std::atomic<bool> m_is_cancel; // the worker reads it without the lock
+				};
+				
+				// A finished tree, handed back to the hasher thread which calls hashDone.
+				struct CFlyHashResult
+				{
+					int64_t m_path_id;
+					string m_file_name;
+					int64_t m_time_stamp;
+					int64_t m_speed;
+					int64_t m_size;
+					bool m_is_ntfs;
+					std::unique_ptr<TigerTree> m_tree;
+				};
+				
+				class HashWorker : public Thread, private CFlyStopThread
+				{
+					public:
+						explicit HashWorker(Hasher& p_hasher) : m_is_busy(false), m_hasher(p_hasher),
+							m_buf(nullptr), m_buf_size(0), m_is_virtual_buf(false), m_last_error(0), m_last_error_overlapped(0) { }
+						~HashWorker()
+						{
+							freeBuffer();
+						}
+						void signal()
+						{
+							m_task_semaphore.signal();
+						}
+						void shutdown()
+						{
+							stopThread();
+							signal();
+						}
+						
+						CFlyHashJob m_job; // protected by Hasher::cs
+						bool m_is_busy;
+					private:
+						int run() override;
+						void hashJob();
+						bool readFile(HashReadBackend p_backend, const string& fname, TigerTree& tth, int64_t& size, bool p_is_link);
+						bool fastHash(const string& fname, TigerTree& tth, int64_t& size, bool p_is_link);
+						bool mappedHash(const string& fname, TigerTree& tth, int64_t& size);
+						bool slowHash(const string& fname, TigerTree& tth);
+						void allocBuffer();
+						void freeBuffer();
+						void throttle(uint64_t& p_last_read, size_t p_len);
+						bool isCanceled() const
+						{
+							return m_job.m_is_cancel || isShutdown();
+						}
+						
+						Hasher& m_hasher;
+						Semaphore m_task_semaphore;
+						uint8_t* m_buf;
+						size_t m_buf_size;
+						bool m_is_virtual_buf;
+						DWORD m_last_error;
+						DWORD m_last_error_overlapped;
+				};
+				friend class HashWorker;
+				
+				static size_t getWorkerCount();
+				string getCurrentFileL() const;
+				void dispatchJobsL();
+				void processResults();
+				void stopWorkers();
+				void resetStatsL();
+				void addProgress(HashWorker& p_worker, int64_t p_len);
+				bool jobDone(HashWorker& p_worker, CFlyHashResult* p_result);
+				void addReadStats(HashReadBackend p_backend, int64_t p_bytes, uint64_t p_time);
+				int64_t getMaxHashBytesPerWorker() const;
+				void instantPause();
+				
+				DiskQueueMap m_disk_queue;
+				std::vector<std::unique_ptr<HashWorker>> m_workers;
+				std::vector<CFlyHashResult> m_results;
+				HashReadStats m_read_stats[HASH_READ_LAST];
 				mutable FastCriticalSection cs;
 				Semaphore m_hash_semaphore;
+				Semaphore m_pause_semaphore;
 				
 				volatile bool m_running;
-				int64_t m_paused;
+				bool m_paused;
 				volatile bool m_rebuild;
 				int64_t m_currentSize;
-				__int64 m_path_id;
+				int64_t m_CurrentBytesLeft;
+				size_t m_queued_files;
+				size_t m_busy_workers;
+				size_t m_paused_workers;
+				Priority m_priority;
 				int m_ForceMaxHashSpeed;
 				size_t dwMaxFiles;
 				int64_t iMaxBytes;
 				uint64_t uiStartTime;
-				int64_t m_CurrentBytesLeft;
-				string m_fname;
-				DWORD m_last_error;
-				DWORD m_last_error_overlapped;
 		};
 		
 		friend class Hasher;
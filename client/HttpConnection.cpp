@@ -168,7 +168,7 @@ void HttpConnection::on(BufferedSocketListener::Line, const string & aLine) noex
 			}
 			else
 			{
-				socket_cleanup(false);
+				socket_cleanup();
 #ifdef RIP_USE_CORAL
 				if (SETTING(CORAL) && coralizeState != CST_NOCORALIZE)
 				{
@@ -191,7 +191,7 @@ void HttpConnection::on(BufferedSocketListener::Line, const string & aLine) noex
 	else if (moved302 && Util::findSubString(aLine, "Location") != string::npos)
 	{
 		dcassert(m_http_socket);
-		socket_cleanup(false);
+		socket_cleanup();
 		string location302 = aLine.substr(10, aLine.length() - 11);
 		// make sure we can also handle redirects with relative paths
 		// if (Util::isHttpLink(location302)) [-] IRainman fix: support for part-time redirect URL.
@@ -244,7 +244,7 @@ void HttpConnection::on(BufferedSocketListener::Line, const string & aLine) noex
 
 void HttpConnection::on(BufferedSocketListener::Failed, const string & aLine) noexcept
 {
-	socket_cleanup(false);
+	socket_cleanup();
 #ifdef RIP_USE_CORAL
 	if (SETTING(CORAL) && coralizeState == CST_DEFAULT)
 	{
@@ -261,7 +261,7 @@ void HttpConnection::on(BufferedSocketListener::Failed, const string & aLine) no
 
 void HttpConnection::on(BufferedSocketListener::ModeChange) noexcept
 {
-	socket_cleanup(false);
+	socket_cleanup();
 	fly_fire1(HttpConnectionListener::Complete(), this, currentUrl
 #ifdef RIP_USE_CORAL
 	          , BOOLSETTING(CORAL) && coralizeState != CST_NOCORALIZE
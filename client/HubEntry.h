@@ -180,7 +180,7 @@ class FavoriteHubEntry
 #endif
 			hideShare(false),
 			//exclusiveHub(false),
-			showJoins(false), exclChecks(false), mode(0),
+			showJoins(false), exclChecks(false), uploadLimit(0), mode(0),
 			searchInterval(SETTING(MINIMUM_SEARCH_INTERVAL)),
 			searchIntervalPassive(SETTING(MINIMUM_SEARCH_PASSIVE_INTERVAL)),
 #ifdef FLYLINKDC_USE_MIMICRYTAG
@@ -231,6 +231,7 @@ class FavoriteHubEntry
 		GETSET(bool, autobanAntivirusIP, AutobanAntivirusIP);
 		GETSET(bool, autobanAntivirusNick, AutobanAntivirusNick);
 		GETSET(bool, exclChecks, ExclChecks); // Excl. from client checking
+		GETSET(int, uploadLimit, UploadLimit); // KiB/s for all users of the hub, 0 - global limit only
 //		GETSET(bool, exclusiveHub, ExclusiveHub); // Exclusive Hub Mod
 		GETSET(bool, suppressChatAndPM, SuppressChatAndPM);
 		GETSET(string, rawOne, RawOne);
@@ -0,0 +1,252 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include "stdinc.h"
+#include "HubUserTable.h"
+#include "OnlineUser.h"
+
+HubUserTable::HubUserTable() : m_next_slot(0), m_count(0), m_online_end(0)
+{
+	for (size_t i = 0; i < g_max_pages; ++i)
+	{
+		m_pages[i].store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+HubUserTable::~HubUserTable()
+{
+	dcassert(m_count == 0);
+	for (size_t i = 0; i < g_max_pages; ++i)
+	{
+		delete m_pages[i].load(std::memory_order_relaxed);
+	}
+}
+
+HubUserTable* HubUserTable::getDetached()
+{
+	// Never released: g_iflylinkdc and other static identities may outlive any other static
+	static HubUserTable* g_detached = []
+	{
+		HubUserTable* l_table = new HubUserTable;
+		l_table->inc();
+		return l_table;
+	}();
+	return g_detached;
+}
+
+HubUserTable::Slot HubUserTable::acquire()
+{
+	CFlyFastLock(m_cs_rows);
+	Slot l_slot;
+	if (!m_free_slots.empty())
+	{
+		l_slot = m_free_slots.back();
+		m_free_slots.pop_back();
+	}
+	else
+	{
+		l_slot = m_next_slot;
+		if ((l_slot >> g_page_bits) >= g_max_pages)
+		{
+			dcassert(0);
+			throw std::bad_alloc();
+		}
+		auto& l_page = m_pages[l_slot >> g_page_bits];
+		if (!l_page.load(std::memory_order_relaxed))
+		{
+			l_page.store(new Page, std::memory_order_release);
+		}
+		++m_next_slot;
+	}
+	Page* l_page = getPage(l_slot);
+	const Slot i = l_slot & g_page_mask;
+	l_page->m_share[i] = 0;
+	l_page->m_ip[i] = 0;
+	l_page->m_nick_hash[i] = 0;
+	l_page->m_slots[i] = 0;
+	l_page->m_flags[i] = 0;
+	return l_slot;
+}
+
+void HubUserTable::release(Slot p_slot)
+{
+	CFlyFastLock(m_cs_rows);
+	dcassert(!getPage(p_slot)->m_online[p_slot & g_page_mask]);
+	m_free_slots.push_back(p_slot);
+}
+
+uint32_t HubUserTable::getNickHash(const string& p_nick)
+{
+	// FNV-1a
+	uint32_t l_hash = 2166136261U;
+	for (auto i = p_nick.cbegin(); i != p_nick.cend(); ++i)
+	{
+		l_hash = (l_hash ^ uint8_t(*i)) * 16777619U;
+	}
+	return l_hash;
+}
+
+size_t HubUserTable::findPos(const string& p_nick, uint32_t p_hash) const
+{
+	if (m_nick_index.empty())
+		return size_t(-1);
+	const size_t l_mask = m_nick_index.size() - 1;
+	for (size_t l_pos = p_hash & l_mask;; l_pos = (l_pos + 1) & l_mask)
+	{
+		const Slot l_entry = m_nick_index[l_pos];
+		if (l_entry == 0)
+			return size_t(-1);
+		const Slot l_slot = l_entry - 1;
+		const Page* l_page = getPage(l_slot);
+		if (l_page->m_nick_hash[l_slot & g_page_mask] == p_hash && l_page->m_online[l_slot & g_page_mask]->getIdentity().getNick() == p_nick)
+			return l_pos;
+	}
+}
+
+OnlineUserPtr HubUserTable::find(const string& p_nick) const
+{
+	const size_t l_pos = findPos(p_nick, getNickHash(p_nick));
+	if (l_pos == size_t(-1))
+		return OnlineUserPtr();
+	const Slot l_slot = m_nick_index[l_pos] - 1;
+	return getPage(l_slot)->m_online[l_slot & g_page_mask];
+}
+
+void HubUserTable::growIndex()
+{
+	std::vector<Slot> l_index(std::max(size_t(64), m_nick_index.size() * 2), 0);
+	const size_t l_mask = l_index.size() - 1;
+	for (auto i = m_nick_index.cbegin(); i != m_nick_index.cend(); ++i)
+	{
+		if (*i)
+		{
+			size_t l_pos = getPage(*i - 1)->m_nick_hash[(*i - 1) & g_page_mask] & l_mask;
+			while (l_index[l_pos])
+			{
+				l_pos = (l_pos + 1) & l_mask;
+			}
+			l_index[l_pos] = *i;
+		}
+	}
+	m_nick_index.swap(l_index);
+}
+
+OnlineUserPtr HubUserTable::insert(const string& p_nick, const OnlineUserPtr& p_user)
+{
+	dcassert(p_user->getIdentity().getNick() == p_nick);
+	const uint32_t l_hash = getNickHash(p_nick);
+	const size_t l_found = findPos(p_nick, l_hash);
+	if (l_found != size_t(-1))
+	{
+		const Slot l_slot = m_nick_index[l_found] - 1;
+		return getPage(l_slot)->m_online[l_slot & g_page_mask];
+	}
+	const Slot l_slot = p_user->getIdentity().getSlot();
+	Page* l_page = getPage(l_slot);
+	if (l_page->m_online[l_slot & g_page_mask])
+	{
+		// Our own nick was changed while we are in the hub: the old entry goes away
+		dcassert(l_page->m_online[l_slot & g_page_mask] == p_user);
+		size_t l_pos = l_page->m_nick_hash[l_slot & g_page_mask] & (m_nick_index.size() - 1);
+		while (m_nick_index[l_pos] != l_slot + 1)
+		{
+			l_pos = (l_pos + 1) & (m_nick_index.size() - 1);
+		}
+		erasePos(l_pos);
+	}
+	// At most half full: the probe sequences stay short
+	if ((m_count + 1) * 2 > m_nick_index.size())
+	{
+		growIndex();
+	}
+	l_page->m_nick_hash[l_slot & g_page_mask] = l_hash;
+	l_page->m_online[l_slot & g_page_mask] = p_user;
+	const size_t l_mask = m_nick_index.size() - 1;
+	size_t l_pos = l_hash & l_mask;
+	while (m_nick_index[l_pos])
+	{
+		l_pos = (l_pos + 1) & l_mask;
+	}
+	m_nick_index[l_pos] = l_slot + 1;
+	++m_count;
+	m_online_end = std::max(m_online_end, l_slot + 1);
+	return OnlineUserPtr();
+}
+
+OnlineUserPtr HubUserTable::erase(const string& p_nick)
+{
+	const size_t l_pos = findPos(p_nick, getNickHash(p_nick));
+	if (l_pos == size_t(-1))
+		return OnlineUserPtr();
+	return erasePos(l_pos);
+}
+
+OnlineUserPtr HubUserTable::erasePos(size_t p_pos)
+{
+	size_t l_pos = p_pos;
+	const Slot l_slot = m_nick_index[l_pos] - 1;
+	OnlineUserPtr l_user;
+	l_user.swap(getPage(l_slot)->m_online[l_slot & g_page_mask]);
+	--m_count;
+	// Linear probing without tombstones: the entries behind the hole move back if their home allows it
+	const size_t l_mask = m_nick_index.size() - 1;
+	m_nick_index[l_pos] = 0;
+	for (size_t l_next = (l_pos + 1) & l_mask; m_nick_index[l_next]; l_next = (l_next + 1) & l_mask)
+	{
+		const Slot l_moved = m_nick_index[l_next] - 1;
+		const size_t l_home = getPage(l_moved)->m_nick_hash[l_moved & g_page_mask] & l_mask;
+		if (((l_next - l_home) & l_mask) >= ((l_next - l_pos) & l_mask))
+		{
+			m_nick_index[l_pos] = m_nick_index[l_next];
+			m_nick_index[l_next] = 0;
+			l_pos = l_next;
+		}
+	}
+	return l_user;
+}
+
+void HubUserTable::clear(OnlineUserList* p_users)
+{
+	if (p_users)
+	{
+		p_users->reserve(p_users->size() + m_count);
+	}
+	for (Slot i = 0; i < m_online_end; ++i)
+	{
+		OnlineUserPtr& l_user = getPage(i)->m_online[i & g_page_mask];
+		if (l_user)
+		{
+			if (p_users)
+			{
+				p_users->push_back(std::move(l_user));
+			}
+			l_user.reset();
+		}
+	}
+	std::vector<Slot>().swap(m_nick_index);
+	m_count = 0;
+	m_online_end = 0;
+}
+
+void HubUserTable::getUsers(OnlineUserList& p_users) const
+{
+	p_users.reserve(p_users.size() + m_count);
+	forEach([&p_users](const OnlineUserPtr & p_user)
+	{
+		p_users.push_back(p_user);
+	});
+}
@@ -0,0 +1,151 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_HUB_USER_TABLE_H
+#define DCPLUSPLUS_DCPP_HUB_USER_TABLE_H
+
+#include <atomic>
+#include "forward.h"
+#include "Pointer.h"
+#include "CFlyThread.h"
+
+/**
+ * The users of one hub, column by column. Every Identity takes a row (slot) for its whole life
+ * and reads share, slots, IP and client type flags from the columns, so a pass over the users
+ * touches only the column it needs. Rows are kept in pages that never move: a view held after
+ * the user has left the hub still reads its own row, a slot is reused only after its Identity is gone.
+ *
+ * The nicks of the users online in the hub are found by a flat open addressing index of slots,
+ * the nick itself is not copied: the index compares with the nick of the Identity.
+ * Only our own nick may change while we are in the hub, insert moves our entry then.
+ * The index is guarded by the lock of the hub, the rows by their owners as the fields of Identity were.
+ */
+class HubUserTable : public intrusive_ptr_base<HubUserTable>
+{
+	public:
+		typedef uint32_t Slot;
+		
+		HubUserTable();
+		~HubUserTable();
+		
+		/// Rows of the identities outside of any hub
+		static HubUserTable* getDetached();
+		
+		Slot acquire();
+		void release(Slot p_slot);
+		
+		int64_t getShare(Slot p_slot) const
+		{
+			return getPage(p_slot)->m_share[p_slot & g_page_mask];
+		}
+		void setShare(Slot p_slot, int64_t p_share)
+		{
+			getPage(p_slot)->m_share[p_slot & g_page_mask] = p_share;
+		}
+		uint32_t getIp(Slot p_slot) const
+		{
+			return getPage(p_slot)->m_ip[p_slot & g_page_mask];
+		}
+		void setIp(Slot p_slot, uint32_t p_ip)
+		{
+			getPage(p_slot)->m_ip[p_slot & g_page_mask] = p_ip;
+		}
+		uint8_t getSlots(Slot p_slot) const
+		{
+			return getPage(p_slot)->m_slots[p_slot & g_page_mask];
+		}
+		void setSlots(Slot p_slot, uint8_t p_slots)
+		{
+			getPage(p_slot)->m_slots[p_slot & g_page_mask] = p_slots;
+		}
+		uint8_t getFlags(Slot p_slot) const
+		{
+			return getPage(p_slot)->m_flags[p_slot & g_page_mask];
+		}
+		void setFlags(Slot p_slot, uint8_t p_flags)
+		{
+			getPage(p_slot)->m_flags[p_slot & g_page_mask] = p_flags;
+		}
+		
+		// The users online in the hub, by nick
+		OnlineUserPtr find(const string& p_nick) const;
+		/// Returns the user already online under this nick, p_user is not added then
+		OnlineUserPtr insert(const string& p_nick, const OnlineUserPtr& p_user);
+		OnlineUserPtr erase(const string& p_nick);
+		void clear(OnlineUserList* p_users = nullptr);
+		size_t size() const
+		{
+			return m_count;
+		}
+		bool empty() const
+		{
+			return m_count == 0;
+		}
+		void getUsers(OnlineUserList& p_users) const;
+		template<class T> void forEach(const T& p_func) const
+		{
+			for (Slot i = 0; i < m_online_end; ++i)
+			{
+				const OnlineUserPtr& l_user = getPage(i)->m_online[i & g_page_mask];
+				if (l_user)
+				{
+					p_func(l_user);
+				}
+			}
+		}
+		
+	private:
+		static const unsigned g_page_bits = 10;
+		static const Slot g_page_size = Slot(1) << g_page_bits;
+		static const Slot g_page_mask = g_page_size - 1;
+		static const size_t g_max_pages = 1024; // a million rows
+		
+		struct Page
+		{
+			int64_t  m_share[g_page_size];
+			uint32_t m_ip[g_page_size];
+			uint32_t m_nick_hash[g_page_size];
+			uint8_t  m_slots[g_page_size];
+			uint8_t  m_flags[g_page_size];
+			OnlineUserPtr m_online[g_page_size]; // set while the user is in the nick index
+		};
+		std::atomic<Page*> m_pages[g_max_pages];
+		Page* getPage(Slot p_slot) const
+		{
+			const auto l_page = m_pages[p_slot >> g_page_bits].load(std::memory_order_acquire);
+			dcassert(l_page);
+			return l_page;
+		}
+		
+		FastCriticalSection m_cs_rows;
+		Slot m_next_slot;
+		std::vector<Slot> m_free_slots;
+		
+		std::vector<Slot> m_nick_index; // slot + 1, 0 is empty; the size is a power of two
+		size_t m_count;
+		Slot m_online_end; // no user in the index at this slot and above
+		
+		static uint32_t getNickHash(const string& p_nick);
+		size_t findPos(const string& p_nick, uint32_t p_hash) const;
+		void growIndex();
+		OnlineUserPtr erasePos(size_t p_pos);
+};
+
+#endif // !defined(DCPLUSPLUS_DCPP_HUB_USER_TABLE_H)
@@ -57,11 +57,14 @@ void IpGrant::load()
 		l_IPGrant_log.step("parse IPGrant.ini");
 		{
 			CFlyFastLock(g_cs);
-			g_ipList.clear();
 			if (!l_data.empty())
 			{
 				g_ipList.addData(l_data, l_IPGrant_log);
 			}
+			else
+			{
+				g_ipList.clear();
+			}
 		}
 		l_IPGrant_log.step("parse IPGrant.ini done");
 	}
@@ -71,7 +74,6 @@ bool IpGrant::check(uint32_t p_ip4)
 {
 	if (p_ip4 == INADDR_NONE)
 		return false;
-	CFlyFastLock(g_cs);
 	return g_ipList.checkIp(p_ip4);
 }
 
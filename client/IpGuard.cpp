@@ -96,11 +96,15 @@ void IpGuard::load()
 		}
 		
 		l_IPGuard_log.step("parse IPGuard.ini");
-		g_ipGuardList.clear();
+		// the old ranges stay in use until the new table is built
 		if (!l_sIPGuard.empty())
 		{
 			g_ipGuardList.addData(l_sIPGuard, l_IPGuard_log);
 		}
+		else
+		{
+			g_ipGuardList.clear();
+		}
 		l_IPGuard_log.step("parse IPGuard.ini done");
 	}
 	else
@@ -138,19 +138,25 @@ class MerkleTree
 				
 			do
 			{
+				const size_t l_full_leaves = (len - i) / BASE_BLOCK_SIZE;
+				if (BASE_BLOCK_SIZE == Hasher::LEAF_SIZE && l_full_leaves > 1)
+				{
+					// Base leaves are independent - hash a batch of them at once
+					uint8_t l_hashes[LEAF_BATCH * BYTES];
+					const size_t l_count = std::min(l_full_leaves, size_t(LEAF_BATCH));
+					Hasher::hashLeaves(buf + i, l_count, l_hashes);
+					for (size_t j = 0; j < l_count; ++j)
+					{
+						addLeaf(MerkleValue(l_hashes + j * BYTES));
+					}
+					i += l_count * BASE_BLOCK_SIZE;
+					continue;
+				}
 				size_t n = std::min(size_t(BASE_BLOCK_SIZE), len - i);
 				Hasher h;
 				h.update(&zero, 1);
-				h.update(buf + i, n); 
-				if ((int64_t)BASE_BLOCK_SIZE < blockSize)
-				{
-					blocks.emplace_back(MerkleBlock(MerkleValue(h.finalize()), BASE_BLOCK_SIZE));
-					reduceBlocks();
-				}
-				else
-				{
-					leaves.emplace_back(MerkleValue(h.finalize()));
-				}
+				h.update(buf + i, n);
+				addLeaf(MerkleValue(h.finalize()));
 				i += n;
 			}
 			while (i < len);
@@ -273,6 +279,9 @@ class MerkleTree
 		}
 		
 	protected:
+		/** Number of base leaves passed to Hasher::hashLeaves at once */
+		static const size_t LEAF_BATCH = 64;
+		
 		typedef std::pair<MerkleValue, int64_t> MerkleBlock;
 		typedef std::vector<MerkleBlock> MBList;
 		
@@ -327,6 +336,18 @@ class MerkleTree
 		}
 		
 	protected:
+		void addLeaf(const MerkleValue& p_hash)
+		{
+			if ((int64_t)BASE_BLOCK_SIZE < blockSize)
+			{
+				blocks.emplace_back(MerkleBlock(p_hash, BASE_BLOCK_SIZE));
+				reduceBlocks();
+			}
+			else
+			{
+				leaves.emplace_back(p_hash);
+			}
+		}
 		void reduceBlocks()
 		{
 		
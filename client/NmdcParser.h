@@ -0,0 +1,397 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_NMDC_PARSER_H
+#define DCPLUSPLUS_DCPP_NMDC_PARSER_H
+
+#include <string_view>
+#include <algorithm>
+#include <cstdint>
+
+/**
+ * NMDC commands are parsed in place: the fields are views into the received line,
+ * a field becomes a string only when it is kept.
+ */
+class NmdcCommand
+{
+	public:
+		enum Type
+		{
+			CMD_UNKNOWN,
+			CMD_BAD_NICK,
+			CMD_BAD_PASS,
+			CMD_BOT_LIST,
+			CMD_CONNECT_TO_ME,
+			CMD_EXT_JSON,
+			CMD_FORCE_MOVE,
+			CMD_GET_HUB_URL,
+			CMD_GET_PASS,
+			CMD_HELLO,
+			CMD_HUB_IS_FULL,
+			CMD_HUB_NAME,
+			CMD_HUB_TOPIC,
+			CMD_LOCK,
+			CMD_LOGED_IN,
+			CMD_MY_INFO,
+			CMD_NICK_LIST,
+			CMD_NICK_RULE,
+			CMD_OP_LIST,
+			CMD_QUIT,
+			CMD_REV_CONNECT_TO_ME,
+			CMD_SEARCH,
+			CMD_SEARCH_RULE,
+			CMD_SR,
+			CMD_SUPPORTS,
+			CMD_TO,
+			CMD_USER_COMMAND,
+			CMD_USER_IP,
+			CMD_VALIDATE_DENIDE,
+			CMD_ZON,
+			CMD_BROKEN // "UserComman", "myinfo": cut or mangled by a broken hub plugin
+		};
+		
+		/// @param p_line The whole line with the leading '$'
+		explicit NmdcCommand(std::string_view p_line)
+		{
+			const auto l_space = p_line.find(' ');
+			m_name = p_line.substr(1, l_space == std::string_view::npos ? std::string_view::npos : l_space - 1);
+			if (l_space != std::string_view::npos)
+			{
+				m_param = p_line.substr(l_space + 1);
+				m_is_param = true;
+			}
+			else
+			{
+				m_is_param = false;
+			}
+			m_type = getType(m_name);
+		}
+		
+		static Type getType(std::string_view p_name)
+		{
+			struct Item
+			{
+				std::string_view m_name;
+				Type m_type;
+			};
+			// Sorted by name (byte order) for the binary search
+			static const Item g_commands[] =
+			{
+				{ "BadNick", CMD_BAD_NICK },
+				{ "BadPass", CMD_BAD_PASS },
+				{ "BotList", CMD_BOT_LIST },
+				{ "ConnectToMe", CMD_CONNECT_TO_ME },
+				{ "ExtJSON", CMD_EXT_JSON },
+				{ "ForceMove", CMD_FORCE_MOVE },
+				{ "GetHubURL", CMD_GET_HUB_URL },
+				{ "GetPass", CMD_GET_PASS },
+				{ "Hello", CMD_HELLO },
+				{ "HubIsFull", CMD_HUB_IS_FULL },
+				{ "HubName", CMD_HUB_NAME },
+				{ "HubTopic", CMD_HUB_TOPIC },
+				{ "Lock", CMD_LOCK },
+				{ "LogedIn", CMD_LOGED_IN },
+				{ "MyINFO", CMD_MY_INFO },
+				{ "NickList", CMD_NICK_LIST },
+				{ "NickRule", CMD_NICK_RULE },
+				{ "OpList", CMD_OP_LIST },
+				{ "Quit", CMD_QUIT },
+				{ "RevConnectToMe", CMD_REV_CONNECT_TO_ME },
+				{ "SR", CMD_SR },
+				{ "Search", CMD_SEARCH },
+				{ "SearchRule", CMD_SEARCH_RULE },
+				{ "Supports", CMD_SUPPORTS },
+				{ "To:", CMD_TO },
+				{ "UserComman", CMD_BROKEN },
+				{ "UserCommand", CMD_USER_COMMAND },
+				{ "UserIP", CMD_USER_IP },
+				{ "ValidateDenide", CMD_VALIDATE_DENIDE }, // Mind the spelling...
+				{ "ZOn", CMD_ZON },
+				{ "myinfo", CMD_BROKEN }
+			};
+			const auto l_end = g_commands + _countof(g_commands);
+			const auto i = std::lower_bound(g_commands, l_end, p_name, [](const Item & p_item, std::string_view p_value)
+			{
+				return p_item.m_name < p_value;
+			});
+			return i != l_end && i->m_name == p_name ? i->m_type : CMD_UNKNOWN;
+		}
+		/// Leading digits with an optional sign, as atoi
+		static int64_t toInt64(std::string_view p_value)
+		{
+			int64_t l_result = 0;
+			auto i = p_value.cbegin();
+			const bool l_is_negative = i != p_value.cend() && *i == '-';
+			if (l_is_negative)
+				++i;
+			for (; i != p_value.cend() && *i >= '0' && *i <= '9'; ++i)
+			{
+				l_result = l_result * 10 + (*i - '0');
+			}
+			return l_is_negative ? -l_result : l_result;
+		}
+		
+		Type m_type;
+		std::string_view m_name;
+		std::string_view m_param;
+		bool m_is_param;
+};
+
+/**
+ * $MyINFO $ALL <nick> <description><<tag>>$<mode>$<connection><status>$<e-mail>$<share>$
+ * (the "$MyINFO " prefix is already stripped). The text fields are still escaped.
+ * A line cut short is parsed as far as it goes, m_fields tells how far.
+ */
+class NmdcMyInfo
+{
+	public:
+		enum Fields
+		{
+			FIELDS_NONE,
+			FIELDS_DESCRIPTION, // nick, description, tag, mode
+			FIELDS_CONNECTION, // connection, status
+			FIELDS_EMAIL,
+			FIELDS_SHARE
+		};
+		
+		NmdcMyInfo() : m_fields(FIELDS_NONE), m_is_tag(false), m_mode(0), m_status(0)
+		{
+		}
+		
+		bool parse(std::string_view p_param)
+		{
+			const std::string_view::size_type l_nick_pos = 5; // "$ALL "
+			auto j = p_param.find(' ', l_nick_pos);
+			if (j == std::string_view::npos || j == l_nick_pos)
+				return false;
+			m_nick = p_param.substr(l_nick_pos, j - l_nick_pos);
+			auto i = j + 1;
+			
+			j = p_param.find('$', i);
+			if (j == std::string_view::npos)
+				return false;
+			m_description = p_param.substr(i, j - i);
+			if (!m_description.empty() && m_description.back() == '>')
+			{
+				const auto x = m_description.rfind('<');
+				if (x != std::string_view::npos)
+				{
+					m_is_tag = true;
+					m_tag = m_description.substr(x + 1, m_description.size() - x - 2);
+					m_description = m_description.substr(0, x);
+				}
+			}
+			if (p_param.size() > j + 3)
+			{
+				m_mode = p_param[j + 1];
+			}
+			m_fields = FIELDS_DESCRIPTION;
+			
+			i = j + 3; // "$<mode>$"
+			if (i > p_param.size())
+				return true;
+			j = p_param.find('$', i);
+			if (j == std::string_view::npos)
+				return true;
+			// The last byte is the status, no connection means a bot
+			m_status = p_param[j - 1];
+			if (j > i + 1)
+			{
+				m_connection = p_param.substr(i, j - i - 1);
+			}
+			m_fields = FIELDS_CONNECTION;
+			
+			i = j + 1;
+			j = p_param.find('$', i);
+			if (j == std::string_view::npos)
+				return true;
+			m_email = p_param.substr(i, j - i);
+			m_fields = FIELDS_EMAIL;
+			
+			i = j + 1;
+			j = p_param.find('$', i);
+			if (j == std::string_view::npos)
+				return true;
+			m_share = p_param.substr(i, j - i);
+			m_fields = FIELDS_SHARE;
+			return true;
+		}
+		/// Some hubs send -1
+		int64_t getShare() const
+		{
+			return NmdcCommand::toInt64(m_share);
+		}
+		
+		Fields m_fields;
+		std::string_view m_nick;
+		std::string_view m_description;
+		std::string_view m_tag;
+		bool m_is_tag;
+		char m_mode;
+		std::string_view m_connection;
+		char m_status;
+		std::string_view m_email;
+		std::string_view m_share;
+};
+
+/**
+ * $ConnectToMe <remote nick> <ip>:<port>[S][N|R] [<sender nick>]
+ * (the "$ConnectToMe " prefix is already stripped). S asks for TLS,
+ * N and R are the two sides of the NAT traversal, N comes with the sender nick.
+ */
+class NmdcConnectToMe
+{
+	public:
+		NmdcConnectToMe() : m_port(0), m_is_secure(false), m_nat(0)
+		{
+		}
+		
+		bool parse(std::string_view p_param)
+		{
+			auto i = p_param.find(' ');
+			if (i == std::string_view::npos || i + 1 >= p_param.size())
+				return false;
+			++i;
+			const auto j = p_param.find(':', i);
+			if (j == std::string_view::npos || j + 1 >= p_param.size())
+				return false;
+			m_server = p_param.substr(i, j - i);
+			i = p_param.find(' ', j + 1);
+			std::string_view l_port;
+			if (i == std::string_view::npos)
+			{
+				l_port = p_param.substr(j + 1);
+			}
+			else
+			{
+				l_port = p_param.substr(j + 1, i - j - 1);
+				m_sender_nick = p_param.substr(i + 1);
+			}
+			if (!l_port.empty() && l_port.back() == 'S')
+			{
+				m_is_secure = true;
+				l_port.remove_suffix(1);
+			}
+			if (!l_port.empty() && (l_port.back() == 'N' || l_port.back() == 'R'))
+			{
+				m_nat = l_port.back();
+				l_port.remove_suffix(1);
+			}
+			if (l_port.empty())
+				return false;
+			m_port = static_cast<uint16_t>(NmdcCommand::toInt64(l_port));
+			return true;
+		}
+		
+		std::string_view m_server;
+		uint16_t m_port;
+		bool m_is_secure;
+		char m_nat; // 'N', 'R' or 0
+		std::string_view m_sender_nick;
+};
+
+/**
+ * Directories: $SR <nick> <directory> <free slots>/<total slots><0x05><hub name> (<hub ip:port>)
+ * Files:       $SR <nick> <file><0x05><size> <free slots>/<total slots><0x05><hub name> (<hub ip:port>)
+ * A TTH search gets "TTH:<tth>" in place of the hub name. m_file of a directory has no trailing backslash.
+ */
+class NmdcSearchResult
+{
+	public:
+		NmdcSearchResult() : m_is_directory(false), m_size(0), m_free_slots(0), m_slots(0)
+		{
+		}
+		
+		/// @param p_line The whole line with "$SR "
+		bool parse(std::string_view p_line)
+		{
+			auto i = std::string_view::size_type(4);
+			auto j = p_line.find(' ', i);
+			if (j == std::string_view::npos)
+				return false;
+			m_nick = p_line.substr(i, j - i);
+			i = j + 1;
+			
+			// A file has two 0x05, a directory only one
+			const auto l_find_05_first = p_line.find(0x05, j);
+			if (l_find_05_first == std::string_view::npos)
+				return false;
+			if (p_line.find(0x05, l_find_05_first + 1) == std::string_view::npos)
+			{
+				// The directory may contain spaces: the slots are after the last space before 0x05
+				m_is_directory = true;
+				j = p_line.rfind(' ', l_find_05_first - 1);
+				if (j == std::string_view::npos || j < i + 1)
+					return false;
+				m_file = p_line.substr(i, j - i);
+			}
+			else
+			{
+				m_file = p_line.substr(i, l_find_05_first - i);
+				i = l_find_05_first + 1;
+				j = p_line.find(' ', i);
+				if (j == std::string_view::npos)
+					return false;
+				m_size = NmdcCommand::toInt64(p_line.substr(i, j - i));
+			}
+			i = j + 1;
+			
+			j = p_line.find('/', i);
+			if (j == std::string_view::npos)
+				return false;
+			m_free_slots = static_cast<uint8_t>(NmdcCommand::toInt64(p_line.substr(i, j - i)));
+			i = j + 1;
+			j = p_line.find(0x05, i);
+			if (j == std::string_view::npos)
+				return false;
+			m_slots = static_cast<uint8_t>(NmdcCommand::toInt64(p_line.substr(i, j - i)));
+			i = j + 1;
+			j = p_line.rfind(" (");
+			if (j == std::string_view::npos || j < i)
+				return false;
+			m_hub_name_or_tth = p_line.substr(i, j - i);
+			i = j + 2;
+			j = p_line.rfind(')');
+			if (j == std::string_view::npos || j < i)
+				return false;
+			m_hub_ip_port = p_line.substr(i, j - i);
+			return true;
+		}
+		bool isTTH() const
+		{
+			return m_hub_name_or_tth.size() == 43 && m_hub_name_or_tth.compare(0, 4, "TTH:") == 0;
+		}
+		/// Only if isTTH()
+		std::string_view getTTH() const
+		{
+			return m_hub_name_or_tth.substr(4);
+		}
+		
+		std::string_view m_nick;
+		std::string_view m_file;
+		bool m_is_directory;
+		int64_t m_size;
+		uint8_t m_free_slots;
+		uint8_t m_slots;
+		std::string_view m_hub_name_or_tth;
+		std::string_view m_hub_ip_port;
+};
+
+#endif // !defined(DCPLUSPLUS_DCPP_NMDC_PARSER_H)
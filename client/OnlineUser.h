@@ -23,6 +23,8 @@
 
 #include "UserInfoBase.h"
 #include "UserInfoColumns.h"
+#include "StringDictionary.h"
+#include "HubUserTable.h"
 
 class ClientBase;
 class NmdcHub;
@@ -108,27 +110,27 @@ class Identity
 			CT_USE_IP6 = 0x80
 		};
 		
-		Identity()
+		Identity() : m_table(HubUserTable::getDetached())
 		{
+			m_slot = m_table->acquire();
 			memzero(&m_bits_info, sizeof(m_bits_info));
 #ifdef FLYLINKDC_USE_P2P_GUARD
 			m_is_p2p_guard_calc = false;
 #endif
 			m_is_real_user_ip_from_hub = false;
-			m_bytes_shared = 0;
 			m_is_ext_json = false;
 #ifdef FLYLINKDC_USE_ANTIVIRUS_DB
 			m_virus_type = 0;
 #endif
 		}
-		Identity(const UserPtr& ptr, uint32_t aSID) : user(ptr)
+		Identity(const UserPtr& ptr, uint32_t aSID, HubUserTable* p_table) : user(ptr), m_table(p_table)
 		{
+			m_slot = m_table->acquire();
 			memzero(&m_bits_info, sizeof(m_bits_info));
 #ifdef FLYLINKDC_USE_P2P_GUARD
 			m_is_p2p_guard_calc = false;
 #endif
 			m_is_real_user_ip_from_hub = false;
-			m_bytes_shared = 0;
 			m_is_ext_json = false;
 #ifdef FLYLINKDC_USE_ANTIVIRUS_DB
 			m_virus_type = 0;
@@ -147,15 +149,11 @@ class Identity
 			, BAD_LIST    = 0x08
 		};
 #endif
-		enum NotEmptyString
-		{
-			EM = 0x01,
-			DE = 0x02
-		};
 		
 #ifndef IRAINMAN_IDENTITY_IS_NON_COPYABLE
-		Identity(const Identity& rhs)
+		Identity(const Identity& rhs) : m_table(HubUserTable::getDetached())
 		{
+			m_slot = m_table->acquire();
 			*this = rhs; // Use operator= since we have to lock before reading...
 		}
 		Identity& operator=(const Identity& rhs)
@@ -170,7 +168,10 @@ class Identity
 			m_is_p2p_guard_calc = rhs.m_is_p2p_guard_calc;
 #endif
 			m_is_real_user_ip_from_hub = rhs.m_is_real_user_ip_from_hub;
-			m_bytes_shared = rsh.m_bytes_shared;
+			m_table->setShare(m_slot, rhs.m_table->getShare(rhs.m_slot));
+			m_table->setIp(m_slot, rhs.m_table->getIp(rhs.m_slot));
+			m_table->setSlots(m_slot, rhs.m_table->getSlots(rhs.m_slot));
+			m_table->setFlags(m_slot, rhs.m_table->getFlags(rhs.m_slot));
 			m_is_ext_json = rhs.m_is_ext_json;
 			
 			memcpy(&m_bits_info, &rhs.m_bits_info, sizeof(m_bits_info));
@@ -235,52 +236,55 @@ class Identity
 		}
 		void setSlots(uint8_t slots) // "SL"
 		{
+			m_table->setSlots(m_slot, slots);
 			getUser()->setSlots(slots);
 			change(CHANGES_SLOTS);
 		}
 		const uint8_t getSlots() const// "SL"
 		{
-			return getUser()->getSlots();
+			return m_table->getSlots(m_slot);
 		}
 		void setBytesShared(const int64_t bytes) // "SS"
 		{
-			// CFlyWriteLock(*g_rw_cs);
 			dcassert(bytes >= 0);
-			m_bytes_shared = bytes;
+			m_table->setShare(m_slot, bytes);
 			getUser()->setBytesShared(bytes);
 			change(CHANGES_SHARED | CHANGES_EXACT_SHARED);
 		}
 		const int64_t getBytesShared() const // "SS"
 		{
-			// CFlyReadLock(*g_rw_cs);
-			return m_bytes_shared;
-			//return getUser()->getBytesShared();
+			return m_table->getShare(m_slot);
 		}
 		
 		void setIp(const string& p_ip);
 		bool isFantomIP() const;
 		boost::asio::ip::address_v4 getIpRAW() const
 		{
-			return m_ip;
+			return boost::asio::ip::address_v4(m_table->getIp(m_slot));
 		}
 		boost::asio::ip::address_v4 getIp() const
 		{
-			if (!m_ip.is_unspecified())
-				return m_ip;
+			if (isIPValid())
+				return getIpRAW();
 			else
 				return getUser()->getIP();
 		}
 		bool isIPValid() const
 		{
-			return !m_ip.is_unspecified();
+			return m_table->getIp(m_slot) != 0;
 		}
 		string getCountry() const;
 		string getIpAsString() const;
+		HubUserTable::Slot getSlot() const
+		{
+			return m_slot;
+		}
 	private:
 		string m_user_nick;
 		tstring m_user_nickT;
-		boost::asio::ip::address_v4 m_ip; // "I4"
-		int64_t m_bytes_shared;
+		// Share, slots, "I4" and "CT" live in the columns of the hub user table
+		boost::intrusive_ptr<HubUserTable> m_table;
+		HubUserTable::Slot m_slot;
 	public:
 		bool m_is_real_user_ip_from_hub;
 #ifdef FLYLINKDC_USE_P2P_GUARD
@@ -388,7 +392,6 @@ class Identity
 	
 		enum eTypeUint8Attr
 		{
-			e_ClientType, // 7 
 #ifdef FLYLINKDC_USE_DETECT_CHEATING
 			e_FakeCard,   // 6 
 #endif
@@ -397,11 +400,18 @@ class Identity
 			e_FreeSlots,
 			e_KnownSupports, // 1   ADC, 0  NMDC
 			e_KnownUcSupports, // 7  .
-			e_NotEmptyString, // 2 
 			e_TypeUInt8AttrLast
 		};
 		GSUINTBITS(8);
-		GSUINTBIT(8, ClientType);
+		bool getClientTypeBit(const uint8_t p_bit_mask) const
+		{
+			return (m_table->getFlags(m_slot) & p_bit_mask) != 0;
+		}
+		void setClientTypeBit(const uint8_t p_bit_mask, bool p_is_set)
+		{
+			const uint8_t l_flags = m_table->getFlags(m_slot);
+			m_table->setFlags(m_slot, p_is_set ? l_flags | p_bit_mask : l_flags & ~p_bit_mask);
+		}
 		
 	public:
 	
@@ -410,7 +420,14 @@ class Identity
 		GSUINT(8, FileListDisconnects); // "FD"
 		GC_INC_UINT(8, FileListDisconnects); // "FD"
 		GSUINT(8, FreeSlots); // "FS"
-		GSUINT(8, ClientType); // "CT"
+		uint8_t getClientType() const // "CT"
+		{
+			return m_table->getFlags(m_slot);
+		}
+		void setClientType(uint8_t p_val) // "CT"
+		{
+			m_table->setFlags(m_slot, p_val);
+		}
 		GSUINT(8, KnownSupports); // "SU"
 		GSUINT(8, KnownUcSupports); // "SU"
 		
@@ -478,23 +495,16 @@ class Identity
 		GSUINTBIT(8, FakeCard);
 #endif
 		
-		GSUINTBIT(8, NotEmptyString);
-		GSUINT(8, NotEmptyString);
-		
 //////////////////// uint16 ///////////////////
 	private:
 		enum eTypeUint16Attr
 		{
 			e_UdpPort,
-			e_DicVE, // "VE"
-			e_DicAP, // "AP"
 			e_TypeUInt16AttrLast
 		};
 		GSUINTBITS(16);
 	public:
 		GSUINT(16, UdpPort); // "U4"
-		GSUINT(16, DicVE); // "VE"
-		GSUINT(16, DicAP); // "AP"
 		
 //////////////////// uint32 ///////////////////
 	private:
@@ -521,6 +531,10 @@ class Identity
 			e_ExtJSONTimesStartCore,
 			e_ExtJSONTimesStartGUI,
 			//e_ExtJSONGDI,
+			e_DicVE, // "VE"
+			e_DicAP, // "AP"
+			e_DicDE, // "DE"
+			e_DicEM, // "EM"
 			e_TypeUInt32AttrLast
 		};
 		GSUINTBITS(32);
@@ -555,6 +569,10 @@ class Identity
 	public:
 	
 		GSUINT(32, SID); // "SI"
+		GSUINT(32, DicVE); // "VE"
+		GSUINT(32, DicAP); // "AP"
+		GSUINT(32, DicDE); // "DE"
+		GSUINT(32, DicEM); // "EM"
 		string getSIDString() const
 		{
 			const uint32_t sid = getSID();
@@ -838,22 +856,15 @@ class Identity
 		}
 		bool setExtJSON(const string& p_ExtJSON);
 		
-		typedef std::unordered_map<short, string> InfMap;
+		// A few tags per user at most: a sorted vector allocates nothing while empty, a hash table does
+		typedef std::vector<std::pair<short, string>> InfMap;
 		
 		mutable FastCriticalSection m_si_fcs;
 		InfMap m_stringInfo;
+		InfMap::const_iterator findStringInfoL(short p_tag) const;
 		
-		typedef vector<string> StringDictionaryReductionPointers;
-		typedef std::unordered_map<string, uint16_t> StringDictionaryIndex;
-		
-		static StringDictionaryReductionPointers g_infoDic;
-		static StringDictionaryIndex g_infoDicIndex;
-		
-#ifndef _DEBUG
-		static
-#endif
-		uint32_t mergeDicId(const string& p_val);
-		static string getDicVal(uint16_t p_index);
+		// The values repeated across users (client, version, description, e-mail) are kept once
+		static StringDictionary g_dictionary;
 		
 #pragma pack(push,1)
 		struct
@@ -864,8 +875,6 @@ class Identity
 			uint8_t  info_uint8 [e_TypeUInt8AttrLast];
 		} m_bits_info;
 #pragma pack(pop)
-		
-		static std::unique_ptr<webrtc::RWLockWrapper> g_rw_cs;
 };
 class OnlineUser :  public UserInfoBase
 {
@@ -917,13 +926,7 @@ class OnlineUser :  public UserInfoBase
 			}
 		};
 		
-		OnlineUser(const UserPtr& p_user, ClientBase& p_client, uint32_t p_sid)
-			: m_identity(p_user, p_sid), m_client(p_client), m_is_first_find(true)
-		{
-#ifdef _DEBUG
-			g_online_user_counts++;
-#endif
-		}
+		OnlineUser(const UserPtr& p_user, ClientBase& p_client, uint32_t p_sid);
 		
 		virtual ~OnlineUser() noexcept
 		{
@@ -0,0 +1,234 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_ONLINE_USER_INDEX_H
+#define DCPLUSPLUS_DCPP_ONLINE_USER_INDEX_H
+
+#include <iterator>
+#include "CID.h"
+#include "forward.h"
+
+/**
+ * The online users of all hubs by CID: a flat open addressing multi-hash in place of
+ * std::unordered_multimap, no node is allocated per user. One control byte per slot keeps
+ * 7 bits of the hash, so a probe compares the CID only on a likely match.
+ * The users with the same CID are found along the probe sequence, equal_range returns
+ * an iterator that walks it. erase leaves a tombstone, insert and erase invalidate the iterators.
+ */
+class OnlineUserIndex
+{
+	public:
+		typedef std::pair<CID, OnlineUserPtr> value_type;
+		
+		class const_iterator
+		{
+			public:
+				typedef std::forward_iterator_tag iterator_category;
+				typedef OnlineUserIndex::value_type value_type;
+				typedef std::ptrdiff_t difference_type;
+				typedef const value_type* pointer;
+				typedef const value_type& reference;
+				
+				const_iterator() : m_index(nullptr), m_pos(0), m_is_probe(false)
+				{
+				}
+				reference operator*() const
+				{
+					return m_index->m_values[m_pos];
+				}
+				pointer operator->() const
+				{
+					return &m_index->m_values[m_pos];
+				}
+				const_iterator& operator++()
+				{
+					m_pos = m_is_probe ? m_index->nextMatch(m_pos, m_key) : m_index->nextUsed(m_pos + 1);
+					return *this;
+				}
+				const_iterator operator++(int)
+				{
+					const_iterator l_tmp = *this;
+					++*this;
+					return l_tmp;
+				}
+				bool operator==(const const_iterator& p_rhs) const
+				{
+					return m_pos == p_rhs.m_pos;
+				}
+				bool operator!=(const const_iterator& p_rhs) const
+				{
+					return m_pos != p_rhs.m_pos;
+				}
+			private:
+				friend class OnlineUserIndex;
+				const_iterator(const OnlineUserIndex* p_index, size_t p_pos) : m_index(p_index), m_pos(p_pos), m_is_probe(false)
+				{
+				}
+				const_iterator(const OnlineUserIndex* p_index, size_t p_pos, const CID& p_key) : m_index(p_index), m_pos(p_pos), m_key(p_key), m_is_probe(true)
+				{
+				}
+				const OnlineUserIndex* m_index;
+				size_t m_pos;
+				CID m_key;
+				bool m_is_probe;
+		};
+		typedef const_iterator iterator;
+		
+		OnlineUserIndex() : m_count(0), m_erased(0)
+		{
+		}
+		
+		const_iterator cbegin() const
+		{
+			return const_iterator(this, nextUsed(0));
+		}
+		const_iterator cend() const
+		{
+			return const_iterator(this, m_ctrl.size());
+		}
+		const_iterator begin() const
+		{
+			return cbegin();
+		}
+		const_iterator end() const
+		{
+			return cend();
+		}
+		size_t size() const
+		{
+			return m_count;
+		}
+		bool empty() const
+		{
+			return m_count == 0;
+		}
+		
+		const_iterator find(const CID& p_cid) const
+		{
+			if (m_ctrl.empty())
+				return cend();
+			const size_t l_hash = std::hash<CID>()(p_cid);
+			const size_t l_pos = l_hash & (m_ctrl.size() - 1);
+			if (m_ctrl[l_pos] == g_empty)
+				return cend();
+			if (isMatch(l_pos, p_cid, getTag(l_hash)))
+				return const_iterator(this, l_pos, p_cid);
+			return const_iterator(this, nextMatch(l_pos, p_cid), p_cid);
+		}
+		std::pair<const_iterator, const_iterator> equal_range(const CID& p_cid) const
+		{
+			return std::make_pair(find(p_cid), cend());
+		}
+		
+		const_iterator insert(const value_type& p_value)
+		{
+			// The tombstones count too: a probe always ends on an empty slot
+			if ((m_count + m_erased + 1) * 8 > m_ctrl.size() * 7)
+			{
+				rehash((m_count + 1) * 2 > m_ctrl.size() ? std::max(size_t(16), m_ctrl.size() * 2) : m_ctrl.size());
+			}
+			const size_t l_hash = std::hash<CID>()(p_value.first);
+			const size_t l_mask = m_ctrl.size() - 1;
+			size_t l_pos = l_hash & l_mask;
+			while (m_ctrl[l_pos] & g_used)
+			{
+				l_pos = (l_pos + 1) & l_mask;
+			}
+			if (m_ctrl[l_pos] == g_erased)
+			{
+				--m_erased;
+			}
+			m_ctrl[l_pos] = getTag(l_hash);
+			m_values[l_pos] = p_value;
+			++m_count;
+			return const_iterator(this, l_pos, p_value.first);
+		}
+		void erase(const_iterator p_pos)
+		{
+			dcassert(p_pos.m_index == this && (m_ctrl[p_pos.m_pos] & g_used));
+			m_ctrl[p_pos.m_pos] = g_erased;
+			m_values[p_pos.m_pos].second.reset();
+			--m_count;
+			++m_erased;
+		}
+		void clear()
+		{
+			std::vector<uint8_t>().swap(m_ctrl);
+			std::vector<value_type>().swap(m_values);
+			m_count = 0;
+			m_erased = 0;
+		}
+		
+	private:
+		static const uint8_t g_empty = 0;
+		static const uint8_t g_erased = 1;
+		static const uint8_t g_used = 0x80;
+		
+		std::vector<uint8_t> m_ctrl; // g_empty, g_erased or g_used | 7 bits of the hash; the size is a power of two
+		std::vector<value_type> m_values;
+		size_t m_count;
+		size_t m_erased;
+		
+		static uint8_t getTag(size_t p_hash)
+		{
+			return uint8_t(g_used | (p_hash >> (sizeof(size_t) * 8 - 7)));
+		}
+		bool isMatch(size_t p_pos, const CID& p_cid, uint8_t p_tag) const
+		{
+			return m_ctrl[p_pos] == p_tag && m_values[p_pos].first == p_cid;
+		}
+		size_t nextMatch(size_t p_pos, const CID& p_cid) const
+		{
+			const uint8_t l_tag = getTag(std::hash<CID>()(p_cid));
+			const size_t l_mask = m_ctrl.size() - 1;
+			for (size_t l_pos = (p_pos + 1) & l_mask; m_ctrl[l_pos] != g_empty; l_pos = (l_pos + 1) & l_mask)
+			{
+				if (isMatch(l_pos, p_cid, l_tag))
+					return l_pos;
+			}
+			return m_ctrl.size();
+		}
+		size_t nextUsed(size_t p_pos) const
+		{
+			while (p_pos < m_ctrl.size() && !(m_ctrl[p_pos] & g_used))
+			{
+				++p_pos;
+			}
+			return p_pos;
+		}
+		void rehash(size_t p_size)
+		{
+			std::vector<uint8_t> l_ctrl(p_size, g_empty);
+			std::vector<value_type> l_values(p_size);
+			l_ctrl.swap(m_ctrl);
+			l_values.swap(m_values);
+			m_count = 0;
+			m_erased = 0;
+			for (size_t i = 0; i < l_ctrl.size(); ++i)
+			{
+				if (l_ctrl[i] & g_used)
+				{
+					insert(l_values[i]);
+				}
+			}
+		}
+};
+
+#endif // !defined(DCPLUSPLUS_DCPP_ONLINE_USER_INDEX_H)
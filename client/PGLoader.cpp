@@ -120,8 +120,6 @@ void PGLoader::load(const string& p_data /*= BaseUtil::emptyString*/)
 	
 	CFlyFastLock(g_cs);
 	l_IPTrust_log.step("parse IPTrust.ini");
-	g_ipTrustListAllow.clear();
-	g_ipTrustListBlock.clear();
 	
 	if (!l_data.empty())
 	{
@@ -138,12 +136,16 @@ void PGLoader::load(const string& p_data /*= BaseUtil::emptyString*/)
 			}
 			else
 			{
-				string l_line = l_data.substr(linestart, lineend - linestart - 1);
+				const string::size_type l_len = lineend - linestart - (lineend > linestart && l_data[lineend - 1] == '\r' ? 1 : 0);
+				string l_line = l_data.substr(linestart, l_len);
 				addLine(l_line, l_IPTrust_log);
 				linestart = lineend + 1;
 			}
 		}
 	}
+	// both lists are replaced, the checks keep using the old ones until this point
+	g_ipTrustListAllow.publish();
+	g_ipTrustListBlock.publish();
 	l_IPTrust_log.step("parse IPTrust.ini done");
 }
 
@@ -151,7 +153,6 @@ bool PGLoader::check(uint32_t p_ip4)
 {
 	if (BOOLSETTING(ENABLE_IPTRUST))
 	{
-		CFlyFastLock(g_cs);
 		if (!g_ipTrustListBlock.empty())
 		{
 			if (g_ipTrustListBlock.checkIp(p_ip4))
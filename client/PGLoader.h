@@ -27,7 +27,7 @@ class PGLoader
 			return Util::getConfigPath() + "IPTrust.ini";
 		}
 	private:
-		static FastCriticalSection g_cs;
+		static FastCriticalSection g_cs; // serializes load(), check() reads the published tables
 		static IPList  g_ipTrustListAllow;
 		static IPList  g_ipTrustListBlock;
 };
@@ -28,6 +28,9 @@ std::unique_ptr<webrtc::RWLockWrapper> QueueItem::g_cs = std::unique_ptr<webrtc:
 std::unique_ptr<CriticalSection> QueueItem::g_cs = std::unique_ptr<CriticalSection>(new CriticalSection);
 #endif
 
+FastCriticalSection QueueItem::g_cs_dirty;
+std::vector<QueueItemPtr> QueueItem::g_dirty_items;
+
 const string g_dc_temp_extension = "dctmp";
 
 QueueItem::QueueItem(const string& aTarget, int64_t aSize, Priority aPriority, bool aAutoPriority, Flags::MaskType aFlag,
@@ -45,6 +48,7 @@ QueueItem::QueueItem(const string& aTarget, int64_t aSize, Priority aPriority, b
 	m_dirty_base(false),
 	m_dirty_source(false),
 	m_dirty_segment(false),
+	m_is_dirty_listed(false),
 	m_is_file_not_exist(false),
 //	m_is_failed(false),
 	m_block_size(0),
@@ -80,6 +84,27 @@ QueueItem::~QueueItem()
 #endif
 }
 //==========================================================================================
+void QueueItem::addToDirtyList()
+{
+	CFlyFastLock(g_cs_dirty);
+	if (!m_is_dirty_listed)
+	{
+		m_is_dirty_listed = true;
+		g_dirty_items.push_back(shared_from_this());
+	}
+}
+//==========================================================================================
+void QueueItem::takeDirtyItems(std::vector<QueueItemPtr>& p_items)
+{
+	CFlyFastLock(g_cs_dirty);
+	p_items.swap(g_dirty_items);
+	g_dirty_items.clear();
+	for (auto i = p_items.cbegin(); i != p_items.cend(); ++i)
+	{
+		(*i)->m_is_dirty_listed = false;
+	}
+}
+//==========================================================================================
 int16_t QueueItem::calcTransferFlag(bool& partial, bool& trusted, bool& untrusted, bool& tthcheck, bool& zdownload, bool& chunked, double& ratio) const
 {
 	int16_t segs = 0;
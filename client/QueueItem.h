@@ -57,7 +57,7 @@ class QueueItemDelegate
 		virtual void setDownloadItem(int64_t pos, int64_t size) = 0;
 };
 #endif
-class QueueItem : public Flags
+class QueueItem : public Flags, public std::enable_shared_from_this<QueueItem>
 {
 	public:
 		typedef std::unordered_map<string, QueueItemPtr> QIStringMap;
@@ -267,6 +267,10 @@ class QueueItem : public Flags
 			LogManager::message(__FUNCTION__ " p_dirty = " + Util::toString(p_dirty));
 #endif
 			m_dirty_base = p_dirty;
+			if (p_dirty)
+			{
+				addToDirtyList();
+			}
 		}
 		void resetDirtyAll()
 		{
@@ -292,6 +296,10 @@ class QueueItem : public Flags
 			}
 #endif
 			m_dirty_source = p_dirty;
+			if (p_dirty)
+			{
+				addToDirtyList();
+			}
 		}
 		void setDirtySegment(bool p_dirty)
 		{
@@ -302,7 +310,15 @@ class QueueItem : public Flags
 			}
 #endif
 			m_dirty_segment = p_dirty;
+			if (p_dirty)
+			{
+				addToDirtyList();
+			}
 		}
+		/// Puts the item on the list of the items to save, the dirty setters do it (and FileQueue::add for the new items)
+		void addToDirtyList();
+		/// Takes the items that have got dirty since the last call, QueueManager::saveQueue writes only them
+		static void takeDirtyItems(std::vector<QueueItemPtr>& p_items);
 		mutable FastCriticalSection m_fcs_download;
 		mutable FastCriticalSection m_fcs_segment;
 		void addDownload(const DownloadPtr& p_download);
@@ -367,6 +383,9 @@ class QueueItem : public Flags
 		bool m_dirty_base;
 		bool m_dirty_source;
 		bool m_dirty_segment;
+		bool m_is_dirty_listed; // under g_cs_dirty
+		static FastCriticalSection g_cs_dirty;
+		static std::vector<QueueItemPtr> g_dirty_items;
 		uint64_t m_block_size;
 		void calcBlockSize();
 	public:
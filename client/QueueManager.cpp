@@ -181,19 +181,28 @@ QueueItemPtr QueueManager::FileQueue::add(int64_t p_FlyQueueID,
 }
 bool QueueManager::FileQueue::is_queue_tth(const TTHValue& p_tth)
 {
-	WLock(*g_csFQ);
+	RLock(*g_csFQ);
 	auto l_count_tth = g_queue_tth_map.find(p_tth);
 	return l_count_tth != g_queue_tth_map.end();
 }
 
 void QueueManager::FileQueue::add(const QueueItemPtr& qi)
 {
-	WLock(*g_csFQ);
-	g_queue.insert(make_pair(qi->getTarget(), qi));
-	auto l_count_tth = g_queue_tth_map.insert(std::make_pair(qi->getTTH(), 1));
-	if (l_count_tth.second == false)
 	{
-		l_count_tth.first->second++;
+		WLock(*g_csFQ);
+		g_queue.insert(make_pair(qi->getTarget(), qi));
+		auto l_count_tth = g_queue_tth_map.insert(std::make_pair(qi->getTTH(), 1));
+		if (l_count_tth.second == false)
+		{
+			l_count_tth.first->second++;
+		}
+	}
+	// Listed only once it is in the queue: saveQueue skips the dirty items it can't find there.
+	// A new item is dirty since the constructor, a moved one may have been taken by saveQueue
+	// between remove_internal and here
+	if (qi->isDirtyAll())
+	{
+		qi->addToDirtyList();
 	}
 }
 void QueueManager::FileQueue::remove_internal(const QueueItemPtr& qi)
@@ -878,6 +887,7 @@ QueueManager::QueueManager() :
 
 QueueManager::~QueueManager() noexcept
 {
+	m_saver.waitShutdown();
 	dcassert(g_running_count == 0);
 #ifdef FLYLINKDC_USE_SHARED_FILE_CACHE
 	cleanSharedCache();
@@ -2694,14 +2704,26 @@ void QueueManager::saveQueue(bool p_force /* = false*/) noexcept
 	
 	CFlySegmentArray l_segment_array;
 	std::vector<QueueItemPtr> l_items;
+	std::vector<QueueItemPtr> l_dirty_items;
+	std::vector<QueueItemPtr> l_missing_items;
+	bool l_is_relisted = false; // the items listed again are saved on the next tick
+	// Only the items that have got dirty since the last save, not the whole queue
+	QueueItem::takeDirtyItems(l_dirty_items);
 	{
 		RLock(*QueueItem::g_cs);
 		{
 			{
 				RLock(*FileQueue::g_csFQ);
-				for (auto i = g_fileQueue.getQueueL().begin(); i != g_fileQueue.getQueueL().end(); ++i)
+				const auto& l_queue = g_fileQueue.getQueueL();
+				for (auto i = l_dirty_items.cbegin(); i != l_dirty_items.cend(); ++i)
 				{
-					auto& qi = i->second;
+					const auto& qi = *i;
+					const auto l_queue_item = l_queue.find(qi->getTarget());
+					if (l_queue_item == l_queue.end() || l_queue_item->second != qi)
+					{
+						l_missing_items.push_back(qi); // removed from the queue or being moved
+						continue;
+					}
 					if (!qi->isAnySet(QueueItem::FLAG_USER_LIST | QueueItem::FLAG_USER_GET_IP))
 					{
 						if (qi->getFlyQueueID() &&
@@ -2739,6 +2761,14 @@ void QueueManager::saveQueue(bool p_force /* = false*/) noexcept
 #endif
 				CFlylinkDBManager::getInstance()->merge_queue_all_items(l_items, l_is_disable_transaction);
 			}
+			for (auto i = l_items.cbegin(); i != l_items.cend(); ++i)
+			{
+				if ((*i)->isDirtyAll())
+				{
+					(*i)->addToDirtyList(); // not saved, the next save will try again
+					l_is_relisted = true;
+				}
+			}
 		}
 	}
 	//     +  -       
@@ -2766,9 +2796,24 @@ void QueueManager::saveQueue(bool p_force /* = false*/) noexcept
 		File::deleteFile(l_queueFile + ".bak");
 		g_is_exists_queueFile = false;
 	}
+	if (!l_missing_items.empty())
+	{
+		// An item that is back in the queue by now keeps its changes for the next save
+		RLock(*FileQueue::g_csFQ);
+		const auto& l_queue = g_fileQueue.getQueueL();
+		for (auto i = l_missing_items.cbegin(); i != l_missing_items.cend(); ++i)
+		{
+			const auto l_queue_item = l_queue.find((*i)->getTarget());
+			if (l_queue_item != l_queue.end() && l_queue_item->second == *i && (*i)->isDirtyAll())
+			{
+				(*i)->addToDirtyList();
+				l_is_relisted = true;
+			}
+		}
+	}
 	// Put this here to avoid very many saves tries when disk is full...
 	g_lastSave = GET_TICK();
-	g_dirty = false;
+	g_dirty = l_is_relisted;
 }
 
 class QueueLoader : public SimpleXMLReader::CallBack
@@ -3092,7 +3137,8 @@ void QueueManager::on(TimerManagerListener::Second, uint64_t aTick) noexcept
 #ifdef _DEBUG
 		LogManager::message("[!-> [Start] saveQueue lastSave = " + Util::toString(g_lastSave) + " aTick = " + Util::toString(aTick));
 #endif
-		saveQueue();
+		g_lastSave = aTick; // saveQueue sets it again when it is done
+		m_saver.addTask(true);
 	}
 	if (ClientManager::isBeforeShutdown())
 		return;
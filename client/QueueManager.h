@@ -289,6 +289,16 @@ class QueueManager : public Singleton<QueueManager>,
 				}
 		} m_mover;
 		
+		// Writes the dirty items off the timer thread
+		class QueueSaver : public BackgroundTaskExecuter<bool>
+		{
+			private:
+				void execute(const bool&)
+				{
+					saveQueue();
+				}
+		} m_saver;
+		
 		typedef vector<pair<QueueItem::SourceConstIter, const QueueItemPtr> > PFSSourceList;
 		
 		class Rechecker : public BackgroundTaskExecuter<string>
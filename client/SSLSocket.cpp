@@ -308,6 +308,11 @@ std::pair<bool, bool> SSLSocket::wait(uint64_t millis, bool checkRead, bool chec
 	return Socket::wait(millis, checkRead, checkWrite);
 }
 
+bool SSLSocket::hasPendingRead() const noexcept
+{
+	return ssl && SSL_pending(ssl) > 0;
+}
+
 bool SSLSocket::isTrusted()
 {
 	if (!ssl)
@@ -59,6 +59,7 @@ class SSLSocket : public Socket
 		virtual int read(void* aBuffer, int aBufLen) override;
 		virtual int write(const void* aBuffer, int aLen) override;
 		virtual std::pair<bool, bool> wait(uint64_t millis, bool checkRead, bool checkWrite) override;
+		virtual bool hasPendingRead() const noexcept override;
 		virtual void shutdown() noexcept override;
 		virtual void close() noexcept override;
 		
@@ -20,9 +20,11 @@
 #include "UploadManager.h"
 #include "ShareManager.h"
 #include "QueueManager.h"
+#include "CompatibilityManager.h"
 #include "StringTokenizer.h"
 #include "FinishedManager.h"
 #include "DebugManager.h"
+#include "NmdcParser.h"
 #include "../FlyFeatures/flyServer.h"
 
 
@@ -48,9 +50,16 @@ const char* SearchManager::getTypeStr(Search::TypeModes type)
 	return g_types[type];
 }
 
+FastCriticalSection SearchManager::g_cs_active_searches;
+std::unordered_map<const void*, uint32_t> SearchManager::g_active_searches;
+
 SearchManager::SearchManager()
 {
-
+	const size_t l_thread_count = std::max(size_t(1), std::min(CompatibilityManager::getProcessorsCount(), size_t(4)));
+	for (size_t i = 0; i < l_thread_count; ++i)
+	{
+		m_queue_threads.push_back(std::unique_ptr<UdpQueue>(new UdpQueue));
+	}
 }
 
 SearchManager::~SearchManager()
@@ -89,7 +98,7 @@ void SearchManager::listen()
 	{
 		socket.reset(new Socket);
 		socket->create(Socket::TYPE_UDP);
-		socket->setBlocking(true);
+		socket->setBlocking(false);
 		if (BOOLSETTING(AUTO_DETECT_CONNECTION))
 		{
 			g_search_port = socket->bind(0, BaseUtil::emptyString);
@@ -119,7 +128,10 @@ void SearchManager::disconnect(bool p_is_stop /*=true */)
 	if (socket.get())
 	{
 		stopThread();
-		m_queue_thread.shutdown();
+		for (auto i = m_queue_threads.cbegin(); i != m_queue_threads.cend(); ++i)
+		{
+			(*i)->shutdown();
+		}
 		socket->disconnect();
 		g_search_port = 0;
 		
@@ -132,33 +144,55 @@ void SearchManager::disconnect(bool p_is_stop /*=true */)
 }
 
 #define BUFSIZE 8192
+#define UDP_READ_BATCH 256
 int SearchManager::run()
 {
 	std::unique_ptr<uint8_t[]> buf(new uint8_t[BUFSIZE]);
 	int len;
 	sockaddr_in remoteAddr = { 0 };
-	m_queue_thread.start(0);
+	UdpQueue::PacketList l_batch;
+	l_batch.reserve(UDP_READ_BATCH);
+	for (auto i = m_queue_threads.cbegin(); i != m_queue_threads.cend(); ++i)
+	{
+		(*i)->start(0);
+		(*i)->setThreadPriority(Thread::LOW);
+	}
 	while (!isShutdown())
 	{
 		try
 		{
 			while (!isShutdown())
 			{
-				// @todo: remove this workaround for http://bugs.winehq.org/show_bug.cgi?id=22291
-				// if that's fixed by reverting to simpler while (read(...) > 0) {...} code.
-				//if (socket->wait(400, Socket::WAIT_READ) != Socket::WAIT_READ)
-				//{
-				//  continue; // [merge] https://github.com/eiskaltdcpp/eiskaltdcpp/commit/c8dcf444d17fffacb6797d14a57b102d653896d0
-				//}
-				if (isShutdown() || (len = socket->read(&buf[0], BUFSIZE, remoteAddr)) <= 0)
-					break;
-				const boost::asio::ip::address_v4 l_ip4(ntohl(remoteAddr.sin_addr.S_un.S_addr));
+				// The socket doesn't block: everything that is queued goes to UdpQueue in one batch
+				// (Winsock has no recvmmsg), then the thread sleeps until the next datagram.
+				len = socket->read(&buf[0], BUFSIZE, remoteAddr);
+				if (len > 0)
+				{
+					if (len > 4)
+					{
+						const boost::asio::ip::address_v4 l_ip4(ntohl(remoteAddr.sin_addr.S_un.S_addr));
 #ifdef _DEBUG
-				const string l_ip1 = l_ip4.to_string();
-				const string l_ip2 = inet_ntoa(remoteAddr.sin_addr);
-				dcassert(l_ip1 == l_ip2);
+						const string l_ip1 = l_ip4.to_string();
+						const string l_ip2 = inet_ntoa(remoteAddr.sin_addr);
+						dcassert(l_ip1 == l_ip2);
 #endif
-				onData(&buf[0], len, l_ip4);
+						l_batch.push_back(UdpQueue::Packet(string((const char*)&buf[0], len), l_ip4));
+					}
+					if (l_batch.size() < UDP_READ_BATCH)
+						continue;
+				}
+				if (!l_batch.empty())
+				{
+					++Socket::g_stats.m_udp_read.m_calls;
+					Socket::g_stats.m_udp_read.m_packets += l_batch.size();
+					addResults(l_batch);
+				}
+				if (len == 0)
+					break;
+				if (len < 0)
+				{
+					socket->wait(1000, true, false);
+				}
 			}
 		}
 		catch (const SocketException& e)
@@ -173,7 +207,7 @@ int SearchManager::run()
 			{
 				socket->disconnect();
 				socket->create(Socket::TYPE_UDP);
-				socket->setBlocking(true);
+				socket->setBlocking(false);
 				dcassert(g_search_port);
 				socket->bind(g_search_port, SETTING(BIND_ADDRESS));
 				if (failed)
@@ -207,8 +241,7 @@ int SearchManager::run()
 
 int SearchManager::UdpQueue::run()
 {
-	string x;
-	boost::asio::ip::address_v4 remoteIp;
+	deque<Packet> l_packets;
 	m_is_stop = false;
 	
 	while (true)
@@ -217,253 +250,290 @@ int SearchManager::UdpQueue::run()
 		if (m_is_stop)
 			break;
 			
+		// The reader hands the datagrams over in batches, one wake-up takes all of them
 		{
 			CFlyFastLock(m_cs);
-			if (m_resultList.empty()) continue;
-			
-			x = m_resultList.front().first;
-			remoteIp = m_resultList.front().second;
-			m_resultList.pop_front();
+			l_packets.swap(m_resultList);
 		}
-		dcassert(x.length() > 4);
-		if (x.length() <= 4)
+		// No pause between the packets: the unwanted results are dropped cheaply and the thread
+		// has a low priority, so the GUI doesn't suffer
+		for (auto i = l_packets.cbegin(); i != l_packets.cend() && !m_is_stop; ++i)
 		{
-			dcassert(0);
-			continue;
+			parse(i->first, i->second);
 		}
-		try {
-			if (x.compare(0, 4, "$SR ", 4) == 0)
+		l_packets.clear();
+	}
+	return 0;
+}
+
+void SearchManager::UdpQueue::parse(const string& x, const boost::asio::ip::address_v4& remoteIp)
+{
+	dcassert(x.length() > 4);
+	if (x.length() <= 4)
+	{
+		dcassert(0);
+		return;
+	}
+	try {
+		if (x.compare(0, 4, "$SR ", 4) == 0)
+		{
+			NmdcSearchResult l_sr;
+			if (!l_sr.parse(x))
 			{
-				string::size_type i = 4;
-				string::size_type j;
-				// Directories: $SR <nick><0x20><directory><0x20><free slots>/<total slots><0x05><Hubname><0x20>(<Hubip:port>)
-				// Files:       $SR <nick><0x20><filename><0x05><filesize><0x20><free slots>/<total slots><0x05><Hubname><0x20>(<Hubip:port>)
-				if ((j = x.find(' ', i)) == string::npos)
-				{
-					continue;
-				}
-				string nick = x.substr(i, j - i);
-				i = j + 1;
-				
-				// A file has 2 0x05, a directory only one
-				// const size_t cnt = count(x.begin() + j, x.end(), 0x05);
-				// C    2-.   
-				const auto l_find_05_first = x.find(0x05, j);
-				dcassert(l_find_05_first != string::npos);
-				if (l_find_05_first == string::npos)
-					continue;
-				const auto l_find_05_second = x.find(0x05, l_find_05_first + 1);
-				SearchResult::Types type = SearchResult::TYPE_FILE;
-				string file;
-				int64_t size = 0;
-				
-				if (l_find_05_first != string::npos && l_find_05_second == string::npos) // cnt == 1
-				{
-					// We have a directory...find the first space beyond the first 0x05 from the back
-					// (dirs might contain spaces as well...clever protocol, eh?)
-					type = SearchResult::TYPE_DIRECTORY;
-					// Get past the hubname that might contain spaces
-					j = l_find_05_first;
-					// Find the end of the directory info
-					if ((j = x.rfind(' ', j - 1)) == string::npos)
-					{
-						continue;
-					}
-					if (j < i + 1)
-					{
-						continue;
-					}
-					file = x.substr(i, j - i) + '\\';
-				}
-				else if (l_find_05_first != string::npos && l_find_05_second != string::npos) // cnt == 2
-				{
-					j = l_find_05_first;
-					file = x.substr(i, j - i);
-					i = j + 1;
-					if ((j = x.find(' ', i)) == string::npos)
-					{
-						continue;
-					}
-					size = Util::toInt64(x.substr(i, j - i));
-				}
-				i = j + 1;
-				
-				if ((j = x.find('/', i)) == string::npos)
-				{
-					continue;
-				}
-				uint8_t freeSlots = (uint8_t)Util::toInt(x.substr(i, j - i));
-				i = j + 1;
-				if ((j = x.find((char)5, i)) == string::npos)
-				{
-					continue;
-				}
-				uint8_t slots = (uint8_t)Util::toInt(x.substr(i, j - i));
-				i = j + 1;
-				if ((j = x.rfind(" (")) == string::npos)
-				{
-					continue;
-				}
-				string l_hub_name_or_tth = x.substr(i, j - i);
-				i = j + 2;
-				if ((j = x.rfind(')')) == string::npos)
-				{
-					continue;
-				}
+				return;
+			}
+			const bool l_isTTH = l_sr.isTTH();
+			const TTHValue l_tth_value = l_isTTH ? TTHValue(l_sr.getTTH().data(), 39) : TTHValue();
+			// NMDC has no search tokens, only the TTH tells whether the queue wants the result:
+			// an unwanted result is dropped before any field is copied
+			if (!SearchManager::isWantedResult(nullptr, l_isTTH ? &l_tth_value : nullptr))
+			{
+				return;
+			}
+			const SearchResult::Types type = l_sr.m_is_directory ? SearchResult::TYPE_DIRECTORY : SearchResult::TYPE_FILE;
+			if (!l_isTTH && type == SearchResult::TYPE_FILE)
+			{
+				return;
+			}
+			const int64_t size = l_sr.m_size;
+			const uint8_t freeSlots = l_sr.m_free_slots;
+			const uint8_t slots = l_sr.m_slots;
+			string nick(l_sr.m_nick);
+			string file(l_sr.m_file);
+			if (l_sr.m_is_directory)
+			{
+				file += '\\';
+			}
+			string l_hub_name_or_tth(l_sr.m_hub_name_or_tth);
+			
+			const string hubIpPort(l_sr.m_hub_ip_port);
+			const string url = ClientManager::findHub(hubIpPort);
+			const string l_encoding = ClientManager::findHubEncoding(url);
+			nick = Text::toUtf8(nick, l_encoding);
+			file = Text::toUtf8(file, l_encoding);
+			if (!l_isTTH)
+				l_hub_name_or_tth = Text::toUtf8(l_hub_name_or_tth, l_encoding);
 				
-				const string hubIpPort = x.substr(i, j - i);
-				const string url = ClientManager::findHub(hubIpPort);
-				const string l_encoding = ClientManager::findHubEncoding(url);
-				nick = Text::toUtf8(nick, l_encoding);
-				file = Text::toUtf8(file, l_encoding);
-				const bool l_isTTH = isTTHBase64(l_hub_name_or_tth);
-				if (!l_isTTH)
-					l_hub_name_or_tth = Text::toUtf8(l_hub_name_or_tth, l_encoding);
-					
-				UserPtr user = ClientManager::findUser(nick, url);
+			UserPtr user = ClientManager::findUser(nick, url);
+			if (!user)
+			{
+				user = ClientManager::findLegacyUser(nick, url);
 				if (!user)
 				{
-					user = ClientManager::findLegacyUser(nick, url);
-					if (!user)
-					{
-						continue;
-					}
+					return;
 				}
-				if (!remoteIp.is_unspecified())
-				{
-					user->setIP(remoteIp, true);
+			}
+			if (!remoteIp.is_unspecified())
+			{
+				user->setIP(remoteIp, true);
 #ifdef _DEBUG
-					//ClientManager::setIPUser(user, remoteIp); // TODO -    ?
+				//ClientManager::setIPUser(user, remoteIp); // TODO -    ?
 #endif
-					//      -    IP   ?
-				}
-				string tth;
-				if (l_isTTH)
-				{
-					tth = l_hub_name_or_tth.substr(4);
-				}
-				if (tth.empty() && type == SearchResult::TYPE_FILE)
-				{
-					dcassert(tth.empty() && type == SearchResult::TYPE_FILE);
-					continue;
-				}
-				
-				const TTHValue l_tth_value(tth);
-				auto sr = std::make_unique<SearchResult>(user, type, slots, freeSlots, size, file, BaseUtil::emptyString, url, remoteIp, l_tth_value, -1 /*0 == auto*/);
-				COMMAND_DEBUG("[Search-result] url = " + url + " remoteIp = " + remoteIp.to_string() + " file = " + file + " user = " + user->getLastNick(), DebugTask::CLIENT_IN, remoteIp.to_string());
-				SearchManager::getInstance()->fly_fire1(SearchManagerListener::SR(), sr);
+				//      -    IP   ?
+			}
+			auto sr = std::make_unique<SearchResult>(user, type, slots, freeSlots, size, file, BaseUtil::emptyString, url, remoteIp, l_tth_value, -1 /*0 == auto*/);
+			COMMAND_DEBUG("[Search-result] url = " + url + " remoteIp = " + remoteIp.to_string() + " file = " + file + " user = " + user->getLastNick(), DebugTask::CLIENT_IN, remoteIp.to_string());
+			SearchManager::getInstance()->fly_fire1(SearchManagerListener::SR(), sr);
 #ifdef FLYLINKDC_USE_COLLECT_STAT
-				CFlylinkDBManager::getInstance()->push_event_statistic("SearchManager::UdpQueue::run()", "$SR", x, remoteIp, "", url, tth);
+			CFlylinkDBManager::getInstance()->push_event_statistic("SearchManager::UdpQueue::run()", "$SR", x, remoteIp, "", url, l_isTTH ? l_hub_name_or_tth.substr(4) : BaseUtil::emptyString);
 #endif
+		}
+		else if (x.compare(1, 4, "RES ", 4) == 0 && x[x.length() - 1] == 0x0a)
+		{
+			AdcCommand c(x.substr(0, x.length() - 1));
+			if (c.getParamCount() == 0)
+				return;
+			const string cid = c.getParam(0);
+			if (cid.size() != 39)
+			{
+				dcassert(0);
+				return;
 			}
-			else if (x.compare(1, 4, "RES ", 4) == 0 && x[x.length() - 1] == 0x0a)
+			string l_value;
+			uint32_t l_token = 0;
+			const bool l_has_token = c.getParam("TO", 1, l_value);
+			if (l_has_token)
 			{
-				AdcCommand c(x.substr(0, x.length() - 1));
-				if (c.getParameters().empty())
-					continue;
-				const string cid = c.getParam(0);
-				if (cid.size() != 39)
-				{
-					dcassert(0);
-					continue;
-				}
-				UserPtr user = ClientManager::findUser(CID(cid));
-				if (!user)
-					continue;
-					
-				SearchManager::getInstance()->onRES(c, user, remoteIp);
-#ifdef FLYLINKDC_USE_COLLECT_STAT
-				CFlylinkDBManager::getInstance()->push_event_statistic("SearchManager::UdpQueue::run()", "RES", x, remoteIp, "", "", "");
-#endif
+				l_token = Util::toUInt32(l_value);
 			}
-			else if (x.compare(1, 4, "PSR ", 4) == 0 && x[x.length() - 1] == 0x0a)
+			const bool l_has_tth = c.getParam("TR", 1, l_value) && l_value.size() == 39;
+			const TTHValue l_tth(l_has_tth ? l_value : BaseUtil::emptyString);
+			if (!SearchManager::isWantedResult(l_has_token ? &l_token : nullptr, l_has_tth ? &l_tth : nullptr))
 			{
-				AdcCommand c(x.substr(0, x.length() - 1));
-				if (c.getParameters().empty())
-					continue;
-				const string cid = c.getParam(0);
-				if (cid.size() != 39)
-					continue;
-					
-				const UserPtr user = ClientManager::findUser(CID(cid));
-				// when user == NULL then it is probably NMDC user, check it later
+				return;
+			}
+			UserPtr user = ClientManager::findUser(CID(cid));
+			if (!user)
+				return;
 				
-				if (user)
-				{
-					SearchManager::getInstance()->onPSR(c, user, remoteIp);
+			SearchManager::getInstance()->onRES(c, user, remoteIp);
 #ifdef FLYLINKDC_USE_COLLECT_STAT
-					CFlylinkDBManager::getInstance()->push_event_statistic("SearchManager::UdpQueue::run()", "PSR", x, remoteIp, "", "", "");
+			CFlylinkDBManager::getInstance()->push_event_statistic("SearchManager::UdpQueue::run()", "RES", x, remoteIp, "", "", "");
+#endif
+		}
+		else if (x.compare(1, 4, "PSR ", 4) == 0 && x[x.length() - 1] == 0x0a)
+		{
+			AdcCommand c(x.substr(0, x.length() - 1));
+			if (c.getParamCount() == 0)
+				return;
+			const string cid = c.getParam(0);
+			if (cid.size() != 39)
+				return;
+				
+			const UserPtr user = ClientManager::findUser(CID(cid));
+			// when user == NULL then it is probably NMDC user, check it later
+			
+			if (user)
+			{
+				SearchManager::getInstance()->onPSR(c, user, remoteIp);
+#ifdef FLYLINKDC_USE_COLLECT_STAT
+				CFlylinkDBManager::getInstance()->push_event_statistic("SearchManager::UdpQueue::run()", "PSR", x, remoteIp, "", "", "");
 #endif
-				}
 			}
-			else if (x.compare(0, 15, "$FLY-TEST-PORT ", 15) == 0)
+		}
+		else if (x.compare(0, 15, "$FLY-TEST-PORT ", 15) == 0)
+		{
+			//dcassert(SettingsManager::g_TestUDPSearchLevel <= 1);
+			const auto l_magic = x.substr(15, 39);
+			if (ClientManager::getMyCID().toBase32() == l_magic)
 			{
-				//dcassert(SettingsManager::g_TestUDPSearchLevel <= 1);
-				const auto l_magic = x.substr(15, 39);
-				if (ClientManager::getMyCID().toBase32() == l_magic)
+				//LogManager::message("Test UDP port - OK!");
+				SettingsManager::g_TestUDPSearchLevel = CFlyServerJSON::setTestPortOK(SETTING(UDP_PORT), "udp");
+				auto l_ip = x.substr(15 + 39);
+				if (l_ip.size() && l_ip[l_ip.size() - 1] == '|')
 				{
-					//LogManager::message("Test UDP port - OK!");
-					SettingsManager::g_TestUDPSearchLevel = CFlyServerJSON::setTestPortOK(SETTING(UDP_PORT), "udp");
-					auto l_ip = x.substr(15 + 39);
-					if (l_ip.size() && l_ip[l_ip.size() - 1] == '|')
-					{
-						l_ip = l_ip.substr(0, l_ip.size() - 1);
-					}
-					SettingsManager::g_UDPTestExternalIP = l_ip;
-				}
-				else
-				{
-					SettingsManager::g_TestUDPSearchLevel = false;
-					CFlyServerJSON::pushError(57, "UDP Error magic value = " + l_magic);
+					l_ip = l_ip.substr(0, l_ip.size() - 1);
 				}
+				SettingsManager::g_UDPTestExternalIP = l_ip;
 			}
 			else
 			{
-				// ADC commands must end with \n
-				if (x[x.length() - 1] != 0x0a) {
-					dcassert(0);
-					dcdebug("Invalid UDP data received: %s (no newline)\n", x.c_str());
-					//CFlyServerJSON::pushError(88, "[UDP]Invalid UDP data received: %s (no newline): ip = " + remoteIp.to_string() + " x = [" + x + "]");
-					continue;
-				}
-				
-				if (!Text::validateUtf8(x)) {
-					dcassert(0);
-					dcdebug("UTF-8 validation failed for received UDP data: %s\n", x.c_str());
-					//CFlyServerJSON::pushError(87, "[UDP]UTF-8 validation failed for received UDP data: ip = " + remoteIp.to_string() + " x = [" + x + "]");
-					continue;
-				}
-				// TODO  respond(AdcCommand(x.substr(0, x.length()-1)));
+				SettingsManager::g_TestUDPSearchLevel = false;
+				CFlyServerJSON::pushError(57, "UDP Error magic value = " + l_magic);
 			}
 		}
-		catch (const ParseException& e)
+		else
 		{
-			dcassert(0);
-			CFlyServerJSON::pushError(86, "[UDP][ParseException]:" + e.getError() + " ip = " + remoteIp.to_string() + " x = [" + x + "]");
+			// ADC commands must end with \n
+			if (x[x.length() - 1] != 0x0a) {
+				dcassert(0);
+				dcdebug("Invalid UDP data received: %s (no newline)\n", x.c_str());
+				//CFlyServerJSON::pushError(88, "[UDP]Invalid UDP data received: %s (no newline): ip = " + remoteIp.to_string() + " x = [" + x + "]");
+				return;
+			}
+			
+			if (!Text::validateUtf8(x)) {
+				dcassert(0);
+				dcdebug("UTF-8 validation failed for received UDP data: %s\n", x.c_str());
+				//CFlyServerJSON::pushError(87, "[UDP]UTF-8 validation failed for received UDP data: ip = " + remoteIp.to_string() + " x = [" + x + "]");
+				return;
+			}
+			// TODO  respond(AdcCommand(x.substr(0, x.length()-1)));
 		}
-		
-		sleep(2);
 	}
-	return 0;
+	catch (const ParseException& e)
+	{
+		dcassert(0);
+		CFlyServerJSON::pushError(86, "[UDP][ParseException]:" + e.getError() + " ip = " + remoteIp.to_string() + " x = [" + x + "]");
+	}
 }
 
 void SearchManager::onData(const std::string& p_line)
 {
-	m_queue_thread.addResult(p_line, boost::asio::ip::address_v4());
+	UdpQueue::PacketList l_packets(1, UdpQueue::Packet(p_line, boost::asio::ip::address_v4()));
+	addResults(l_packets);
 }
 
-void SearchManager::onData(const uint8_t* buf, size_t aLen, const boost::asio::ip::address_v4& remoteIp)
+void SearchManager::addResults(UdpQueue::PacketList& p_packets)
 {
-	if (aLen > 4)
+	if (m_queue_threads.size() == 1)
 	{
-		const string x((char*)buf, aLen);
-		m_queue_thread.addResult(x, remoteIp);
+		m_queue_threads[0]->addResults(p_packets);
+		return;
 	}
-	else
+	std::vector<UdpQueue::PacketList> l_batches(m_queue_threads.size());
+	for (auto i = p_packets.begin(); i != p_packets.end(); ++i)
 	{
-		dcassert(0);
+		l_batches[getQueueIndex(i->first)].push_back(std::move(*i));
+	}
+	p_packets.clear();
+	for (size_t i = 0; i < l_batches.size(); ++i)
+	{
+		if (!l_batches[i].empty())
+		{
+			m_queue_threads[i]->addResults(l_batches[i]);
+		}
 	}
 }
+
+size_t SearchManager::getQueueIndex(const string& x) const
+{
+	// RES: the search token, the sender's CID for the auto search (token 0) and the other commands;
+	// $SR: the sender's nick, NMDC has no tokens
+	string::size_type l_start = 0;
+	string::size_type l_end = 0;
+	if (x.compare(0, 4, "$SR ", 4) == 0)
+	{
+		l_start = 4;
+		l_end = x.find(' ', l_start);
+	}
+	else if (x.size() > 5 && x[4] == ' ')
+	{
+		l_start = x.find(" TO", 5);
+		if (l_start != string::npos)
+		{
+			l_start += 3;
+			l_end = x.find_first_of(" \n", l_start);
+		}
+		if (l_start == string::npos || x.compare(l_start, l_end - l_start, "0") == 0)
+		{
+			l_start = 5;
+			l_end = l_start + 39;
+		}
+	}
+	l_end = std::min(l_end, x.size());
+	uint32_t l_hash = 2166136261U; // FNV-1a
+	for (auto i = l_start; i < l_end; ++i)
+	{
+		l_hash = (l_hash ^ uint8_t(x[i])) * 16777619U;
+	}
+	return l_hash % m_queue_threads.size();
+}
+
+bool SearchManager::isWantedResult(const uint32_t* p_token, const TTHValue* p_tth)
+{
+	{
+		CFlyFastLock(g_cs_active_searches);
+		if (!p_token)
+		{
+			if (!g_active_searches.empty())
+				return true;
+		}
+		else if (*p_token)
+		{
+			for (auto i = g_active_searches.cbegin(); i != g_active_searches.cend(); ++i)
+			{
+				if (i->second == *p_token)
+					return true;
+			}
+		}
+	}
+	// The auto search (token 0) and the sources of the queued files
+	return p_tth && QueueManager::is_queue_tth(*p_tth);
+}
+
+void SearchManager::setActiveSearch(const void* p_owner, uint32_t p_token)
+{
+	CFlyFastLock(g_cs_active_searches);
+	g_active_searches[p_owner] = p_token;
+}
+
+void SearchManager::removeActiveSearch(const void* p_owner)
+{
+	CFlyFastLock(g_cs_active_searches);
+	g_active_searches.erase(p_owner);
+}
+
 void SearchManager::search_auto(const string& p_tth)
 {
 	SearchParamOwner l_search_param;
@@ -490,30 +560,24 @@ void SearchManager::onRES(const AdcCommand& cmd, const UserPtr& from, const boos
 	string tth;
 	uint32_t l_token = -1; // 0 == auto
 	
-	for (auto i = cmd.getParameters().cbegin(); i != cmd.getParameters().cend(); ++i)
+	string l_value;
+	if (cmd.getParam("FN", 0, l_value))
 	{
-		const string& str = *i;
-		if (str.compare(0, 2, "FN", 2) == 0)
-		{
-			file = Util::toNmdcFile(str.substr(2));
-		}
-		else if (str.compare(0, 2, "SL", 2) == 0)
-		{
-			freeSlots = Util::toInt(str.substr(2));
-		}
-		else if (str.compare(0, 2, "SI", 2) == 0)
-		{
-			size = Util::toInt64(str.substr(2));
-		}
-		else if (str.compare(0, 2, "TR", 2) == 0)
-		{
-			tth = str.substr(2);
-		}
-		else if (str.compare(0, 2, "TO", 2) == 0)
-		{
-			l_token = Util::toUInt32(str.substr(2));
-			// dcassert(l_token);
-		}
+		file = Util::toNmdcFile(l_value);
+	}
+	if (cmd.getParam("SL", 0, l_value))
+	{
+		freeSlots = Util::toInt(l_value);
+	}
+	if (cmd.getParam("SI", 0, l_value))
+	{
+		size = Util::toInt64(l_value);
+	}
+	cmd.getParam("TR", 0, tth);
+	if (cmd.getParam("TO", 0, l_value))
+	{
+		l_token = Util::toUInt32(l_value);
+		// dcassert(l_token);
 	}
 	
 	if (!file.empty() && freeSlots != -1 && size != -1)
@@ -693,16 +757,19 @@ ClientManagerListener::SearchReply SearchManager::respond(const AdcCommand& adc,
 	{
 		string l_token;
 		adc.getParam("TO", 0, l_token);
+		vector<AdcCommand> l_commands;
+		l_commands.reserve(l_search_results.size());
 		for (auto i = l_search_results.cbegin(); i != l_search_results.cend(); ++i)
 		{
-			AdcCommand cmd(AdcCommand::CMD_RES, AdcCommand::TYPE_UDP);
+			l_commands.push_back(AdcCommand(AdcCommand::CMD_RES, AdcCommand::TYPE_UDP));
+			AdcCommand& cmd = l_commands.back();
 			i->toRES(cmd, AdcCommand::TYPE_UDP);
 			if (!l_token.empty())
 			{
 				cmd.addParam("TO", l_token);
 			}
-			ClientManager::send(cmd, from);
 		}
+		ClientManager::send(l_commands, from);
 		l_sr = ClientManagerListener::SEARCH_HIT;
 	}
 	return l_sr;
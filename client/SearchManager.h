@@ -62,10 +62,20 @@ class SearchManager : public Speaker<SearchManagerListener>, public Singleton<Se
 		void onPSR(const AdcCommand& cmd, UserPtr from, const boost::asio::ip::address_v4& remoteIp);
 		static void toPSR(AdcCommand& cmd, bool wantResponse, const string& myNick, const string& hubIpPort, const string& tth, const vector<uint16_t>& partialInfo);
 		
+		/**
+		 * The search (token) p_owner shows the results of. The UDP results of the other tokens
+		 * are dropped before they are parsed, unless their TTH is in the download queue.
+		 */
+		static void setActiveSearch(const void* p_owner, uint32_t p_token);
+		static void removeActiveSearch(const void* p_owner);
+		
 	private:
 		class UdpQueue: public Thread
 		{
 			public:
+				typedef std::pair<string, boost::asio::ip::address_v4> Packet;
+				typedef std::vector<Packet> PacketList;
+				
 				UdpQueue() : m_is_stop(false) {}
 				~UdpQueue()
 				{
@@ -79,22 +89,36 @@ class SearchManager : public Speaker<SearchManagerListener>, public Singleton<Se
 					m_resultList.clear();
 					m_search_semaphore.signal();
 				}
-				void addResult(const string& buf, const boost::asio::ip::address_v4& p_ip4)
+				/// Takes the packets away from p_packets
+				void addResults(PacketList& p_packets)
 				{
 					if (m_is_stop == false)
 					{
 						CFlyFastLock(m_cs);
-						m_resultList.push_back(std::make_pair(buf, p_ip4));
+						m_resultList.insert(m_resultList.end(), std::make_move_iterator(p_packets.begin()), std::make_move_iterator(p_packets.end()));
 					}
+					p_packets.clear();
 					m_search_semaphore.signal();
 				}
 				
 			private:
+				void parse(const string& x, const boost::asio::ip::address_v4& remoteIp);
+				
 				FastCriticalSection m_cs;
 				Semaphore m_search_semaphore;
-				deque<pair<string, boost::asio::ip::address_v4>> m_resultList;
+				deque<Packet> m_resultList;
 				volatile bool m_is_stop;
-		} m_queue_thread;
+		};
+		// The results are parsed in parallel, the results of one search (token) go to one thread
+		// so its listeners get them in order
+		std::vector<std::unique_ptr<UdpQueue>> m_queue_threads;
+		void addResults(UdpQueue::PacketList& p_packets);
+		size_t getQueueIndex(const string& x) const;
+		
+		/// @param p_token nullptr if the result has no token
+		static bool isWantedResult(const uint32_t* p_token, const TTHValue* p_tth);
+		static FastCriticalSection g_cs_active_searches;
+		static std::unordered_map<const void*, uint32_t> g_active_searches;
 		
 		std::unique_ptr<Socket> socket;
 		static uint16_t g_search_port;
@@ -105,7 +129,6 @@ class SearchManager : public Speaker<SearchManagerListener>, public Singleton<Se
 		int run() override;
 		
 		~SearchManager();
-		void onData(const uint8_t* buf, size_t aLen, const boost::asio::ip::address_v4& address);
 		void onData(const std::string& p_line);
 		
 		static string getPartsString(const PartsInfo& partsInfo);
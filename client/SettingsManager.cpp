@@ -423,6 +423,12 @@ static const char* g_settingTags[] =
 	"UseGPUInTTHComputing",
 	"TTHGPUDevNum",
 	"FavUsersSplitterPos",
+	"HashThreads",
+	"HashReadersPerDisk",
+	"HashReadBackend",
+	"TransmitFileMode",
+	"ShareMonitor",
+	"UploadCacheSize",
 	"SENTRY",
 };
 
@@ -1200,6 +1206,12 @@ void SettingsManager::setDefaults()
 	setDefault(REPORT_TO_USER_IF_OUTDATED_OS_DETECTED, TRUE);
 #endif
 	setDefault(TTH_GPU_DEV_NUM, -1);
+	setDefault(HASH_THREADS, 0); // 0 - by number of processors
+	setDefault(HASH_READERS_PER_DISK, 1);
+	setDefault(HASH_READ_BACKEND, 0); // 0 - overlapped unbuffered reads, 1 - mapped view, 2 - buffered File
+	setDefault(TRANSMIT_FILE_MODE, 1); // 0 - off, 1 - server editions of Windows only, 2 - always
+	setDefault(SHARE_MONITOR, true); // refresh the shared directories on change notifications
+	setDefault(UPLOAD_CACHE_SIZE, 64); // MiB of the hot upload content kept in memory, 0 - off
 	setSearchTypeDefaults();
 	// TODO - ãðóçèòü ýòî èç ñåòè è îòëîæåííî êîãäà ïîíàäîáèòñÿ.
 	Util::shrink_to_fit(&strDefaults[STR_FIRST], &strDefaults[STR_LAST]);
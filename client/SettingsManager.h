@@ -449,6 +449,12 @@ class SettingsManager : public Singleton<SettingsManager>, public Speaker<Settin
 		                  TTH_GPU_DEV_NUM,
 		                  //  USERS_TOP, USERS_BOTTOM, USERS_LEFT, USERS_RIGHT,
 		                  FAV_USERS_SPLITTER_POS,
+		                  HASH_THREADS,
+		                  HASH_READERS_PER_DISK,
+		                  HASH_READ_BACKEND,
+		                  TRANSMIT_FILE_MODE,
+		                  SHARE_MONITOR,
+		                  UPLOAD_CACHE_SIZE,
 		                  INT_LAST,
 		                  SETTINGS_LAST = INT_LAST
 		                };
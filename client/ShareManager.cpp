@@ -28,6 +28,7 @@
 #include "Wildcards.h"
 #include "HashBloom.h"
 #include "UploadManager.h"
+#include "UploadCache.h"
 #include "../FlyFeatures/flyServer.h"
 #include "../windows/resource.h"
 
@@ -45,8 +46,6 @@ std::unique_ptr<webrtc::RWLockWrapper> ShareManager::g_csShareCache = std::uniqu
 
 CriticalSection ShareManager::g_csTTHIndex;
 
-FastCriticalSection ShareManager::g_csPartialCache;
-std::unordered_map<string, std::pair<string, unsigned> > ShareManager::g_partial_list_cache;
 
 FastCriticalSection ShareManager::g_csTTHPathCache;
 std::unordered_map<TTHValue, std::pair<string, unsigned> > ShareManager::g_tth_path_cache;
@@ -64,12 +63,14 @@ int64_t ShareManager::g_CurrentShareSize = -1;
 bool ShareManager::g_is_initial = true;
 ShareManager::DirList ShareManager::g_list_directories;
 BloomFilter<5> ShareManager::g_bloom(1 << 20);
+ShareManager::SearchIndex ShareManager::g_search_index;
 unsigned ShareManager::g_cache_limit = 1000;
 FastCriticalSection ShareManager::g_csBot;
 std::unordered_map<string, unsigned> ShareManager::g_BotDetectMap;
 
-ShareManager::ShareManager() : xmlListLen(0), bzXmlListLen(0),
-	m_is_xmlDirty(true), m_is_forceXmlRefresh(false), m_is_refreshDirs(false), m_is_update(false), m_listN(0), m_count_sec(11),
+ShareManager::ShareManager() : xmlListLen(0), m_is_xml_root_valid(false), m_xml_list_generation(0), bzXmlListLen(0), m_is_xml_fragments_stale(false),
+	m_is_xmlDirty(true), m_is_refreshDirs(false), m_is_update(false), m_listN(0), m_count_sec(11),
+	m_monitor(DirectoryMonitor::create()), m_is_monitor_all(false), m_is_monitor_overflow(false), m_rescan_dir(nullptr),
 #ifdef FLYLINKDC_USE_ONLINE_SWEEP_DB
 	m_sweep_guard(false),
 #endif
@@ -77,7 +78,7 @@ ShareManager::ShareManager() : xmlListLen(0), bzXmlListLen(0),
 {
 	m_is_refreshing.clear();
 	m_updateXmlListInProcess.clear();
-	m_lastXmlUpdate = m_lastFullUpdate = GET_TICK();
+	m_lastFullUpdate = GET_TICK();
 #ifdef IRAINMAN_INCLUDE_HIDE_SHARE_MOD
 	const string emptyXmlName = getEmptyBZXmlFile();
 	if (!File::isExist(emptyXmlName))
@@ -331,7 +332,7 @@ string ShareManager::toVirtual(const TTHValue& tth)
 	{
 		return Transfer::g_user_list_name_bz;
 	}
-	else if (tth == xmlRoot)
+	else if (tth == getXmlRoot())
 	{
 		return Transfer::g_user_list_name;
 	}
@@ -389,7 +390,7 @@ TTHValue ShareManager::getTTH(const string& virtualFile) const
 	}
 	else if (virtualFile == Transfer::g_user_list_name)
 	{
-		return xmlRoot;
+		return getXmlRoot();
 	}
 	TTHValue l_tth;
 	findFileAndRealPath(virtualFile, l_tth, true);
@@ -398,26 +399,33 @@ TTHValue ShareManager::getTTH(const string& virtualFile) const
 
 MemoryInputStream* ShareManager::getTree(const string& virtualFile) const
 {
-	TigerTree tree;
-	__int64 l_block_size;
+	TTHValue l_tth;
 	if (virtualFile.compare(0, 4, "TTH/", 4) == 0)
 	{
-		if (!CFlylinkDBManager::getInstance()->get_tree(TTHValue(virtualFile.substr(4)), tree, l_block_size))
-			return 0;
+		l_tth = TTHValue(virtualFile.substr(4));
 	}
 	else
 	{
 		try
 		{
-			const TTHValue tth = getTTH(virtualFile);
-			CFlylinkDBManager::getInstance()->get_tree(tth, tree, l_block_size);
+			l_tth = getTTH(virtualFile);
 		}
 		catch (const Exception&)
 		{
 			return 0;
 		}
 	}
+	const UploadCache::Data l_cached = UploadCache::getTree(l_tth);
+	if (l_cached)
+	{
+		return new MemoryInputStream(*l_cached);
+	}
 	
+	TigerTree tree;
+	__int64 l_block_size;
+	if (!CFlylinkDBManager::getInstance()->get_tree(l_tth, tree, l_block_size))
+		return 0;
+		
 	ByteVector buf;
 	tree.getLeafData(buf);
 	if (buf.empty())
@@ -425,7 +433,9 @@ MemoryInputStream* ShareManager::getTree(const string& virtualFile) const
 		dcassert(0);
 		return nullptr; // https://github.com/zipper9/blacklink/commit/250ec97eb7ff201875bec9a6cea37602a9f143e3
 	}
-	return new MemoryInputStream(&buf[0], buf.size());
+	const auto l_leaves = std::make_shared<const string>(reinterpret_cast<const char*>(&buf[0]), buf.size());
+	UploadCache::putTree(l_tth, l_leaves);
+	return new MemoryInputStream(*l_leaves);
 }
 
 void ShareManager::getFileInfo(AdcCommand& cmd, const string& aFile)
@@ -436,7 +446,7 @@ void ShareManager::getFileInfo(AdcCommand& cmd, const string& aFile)
 		
 		cmd.addParam("FN", aFile);
 		cmd.addParam("SI", Util::toString(xmlListLen));
-		cmd.addParam("TR", xmlRoot.toBase32());
+		cmd.addParam("TR", getXmlRoot().toBase32());
 		return;
 	}
 	else if (aFile == Transfer::g_user_list_name_bz)
@@ -816,10 +826,12 @@ bool ShareManager::loadCache() noexcept
 #endif
 				
 				{
+					g_search_index.beginUpdate();
 					for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
 					{
 						updateIndicesDirL(**i);
 					}
+					g_search_index.endUpdate();
 				}
 			}
 			internalClearCache(true);
@@ -996,20 +1008,24 @@ void ShareManager::addDirectory(const string& realPath, const string& virtualNam
 			
 			{
 				__int64 l_path_id = 0;
-				Directory::Ptr dp = buildTreeL(l_path_id, realPath, Directory::Ptr(), p_is_job);
+				Directory::Ptr dp = buildRootL(l_path_id, realPath, p_is_job);
 				
 				const string vName = validateVirtual(virtualName);
 				dp->setNameAndLower(vName);
 				
 				g_shares.insert(std::make_pair(realPath, CFlyBaseDirItem(vName, l_path_id)));
+				const Directory::Ptr l_root = get_mergeL(dp);
 				{
 					CFlyLock(g_csTTHIndex);
-					updateIndicesDirL(*get_mergeL(dp));
+					g_search_index.beginUpdate();
+					updateIndicesDirL(*l_root);
+					g_search_index.endUpdate();
 				}
+				setDirtyL(*l_root);
 			}
 		}
-		setDirty();
 	}
+	updateMonitor();
 }
 void ShareManager::rebuildSkipList()
 {
@@ -1132,7 +1148,7 @@ void ShareManager::removeDirectory(const string& realPath)
 		{
 			if (stricmp(i->second.m_synonym, l_Name) == 0 && checkAttributs(i->first))
 			{
-				Directory::Ptr dp = buildTreeL(i->second.m_path_id, i->first, Directory::Ptr(), true);
+				Directory::Ptr dp = buildRootL(i->second.m_path_id, i->first, true);
 				dp->setNameAndLower(i->second.m_synonym);
 				{
 					get_mergeL(dp);
@@ -1142,7 +1158,8 @@ void ShareManager::removeDirectory(const string& realPath)
 		rebuildIndicesL(true);
 	}
 	internalCalcShareSize();
-	setDirty();
+	setXmlDirty(); // the roots readded above are new nodes with new streams
+	updateMonitor();
 }
 
 void ShareManager::renameDirectory(const string& realPath, const string& virtualName)
@@ -1218,35 +1235,217 @@ void ShareManager::internalCalcShareSize()
 	}
 }
 
-ShareManager::Directory::Ptr ShareManager::buildTreeL(__int64& p_path_id, const string& aName, const Directory::Ptr& aParent, bool p_is_job)
+static bool isVanishedDir(const CFlyRootSnapshot& p_snapshot, const string& p_lower_path, const string& p_lower_root)
+{
+	// Gone when the nearest listed ancestor did not list it; a directory that was met
+	// but not entered (excluded, hidden...) tells nothing about its subtree
+	string l_path = p_lower_path;
+	while (l_path.size() > p_lower_root.size())
+	{
+		const auto l_pos = l_path.rfind(PATH_SEPARATOR, l_path.size() - 2);
+		if (l_pos == string::npos)
+			return false;
+		l_path.resize(l_pos + 1);
+		const auto l_parent = p_snapshot.find(l_path);
+		if (l_parent == p_snapshot.end())
+			return false;
+		if (l_parent->second.m_is_listed)
+			return true;
+		if (l_parent->second.m_is_seen)
+			return false;
+	}
+	return false;
+}
+
+void ShareManager::collectSweep(CFlyShareScan& p_scan, const string& p_lower_root)
+{
+	for (auto i = p_scan.m_snapshot.cbegin(); i != p_scan.m_snapshot.cend(); ++i)
+	{
+		const CFlyRootDir& l_dir = i->second;
+		if (l_dir.m_is_listed)
+		{
+			for (auto j = l_dir.m_files.cbegin(); j != l_dir.m_files.cend(); ++j)
+			{
+				if (!j->second.m_is_seen)
+				{
+					p_scan.m_diff->m_sweep_files.push_back(CFlyShareDiff::File{ l_dir.m_path_id, j->first });
+				}
+			}
+		}
+		else if (!l_dir.m_is_seen && (!l_dir.m_files.empty() || p_scan.m_is_shallow) && isVanishedDir(p_scan.m_snapshot, i->first, p_lower_root))
+		{
+			p_scan.m_diff->m_sweep_dirs.push_back(l_dir.m_path_id);
+		}
+	}
+}
+
+ShareManager::Directory::Ptr ShareManager::buildRootL(__int64& p_path_id, const string& p_path, bool p_is_job)
+{
+	CFlyShareScan l_scan(p_is_job);
+	const string l_lower_root = Text::toLower(p_path);
+	// One query for the whole root instead of a load_dir per directory
+	CFlylinkDBManager::getInstance()->load_root_snapshot(l_lower_root, l_scan.m_snapshot);
+	if (p_path_id == 0)
+	{
+		const auto l_root = l_scan.m_snapshot.find(l_lower_root);
+		if (l_root != l_scan.m_snapshot.end())
+		{
+			p_path_id = l_root->second.m_path_id;
+		}
+		else
+		{
+			bool l_is_no_mediainfo = false;
+			p_path_id = CFlylinkDBManager::getInstance()->get_path_id(l_lower_root, !p_is_job, false, l_is_no_mediainfo, m_sweep_path);
+		}
+	}
+	Directory::Ptr l_dir = buildTreeL(l_scan, p_path_id, p_path, Directory::Ptr());
+	if (!ClientManager::isBeforeShutdown())
+	{
+		collectSweep(l_scan, l_lower_root);
+		CFlylinkDBManager::getInstance()->apply_share_diff(l_scan.m_diff);
+	}
+	updateLastSharedDate(l_scan.m_last_shared_date);
+	return l_dir;
+}
+
+void ShareManager::updateLastSharedDate(int64_t p_date)
+{
+	static FastCriticalSection g_cs_last_shared_date;
+	CFlyFastLock(g_cs_last_shared_date);
+	if (p_date > g_lastSharedDate)
+	{
+		g_lastSharedDate = p_date;
+	}
+}
+
+void ShareManager::RefreshWorker::build()
+{
+	for (auto i = m_roots.cbegin(); i != m_roots.cend(); ++i)
+	{
+		Directory::Ptr dp = m_share.buildRootL((*i)->m_path_id, (*i)->m_path, false);
+		dp->setNameAndLower((*i)->m_synonym);
+		m_result.push_back(dp);
+	}
+}
+
+int ShareManager::RefreshWorker::run()
+{
+	build();
+	return 0;
+}
+
+void ShareManager::buildRootsL(CFlyDirItemArray& p_directories, std::vector<Directory::Ptr>& p_new_dirs)
 {
+	// One worker per physical disk: two scans on one spindle only fight over the head
+	std::map<string, std::unique_ptr<RefreshWorker>> l_workers;
+	for (auto i = p_directories.begin(); i != p_directories.end(); ++i)
+	{
+		if (checkAttributs(i->m_path))
+		{
+			auto& l_worker = l_workers[HashManager::getDiskKey(i->m_path)];
+			if (!l_worker)
+			{
+				l_worker.reset(new RefreshWorker(*this));
+			}
+			l_worker->m_roots.push_back(&*i);
+		}
+	}
+	if (l_workers.size() == 1)
+	{
+		l_workers.begin()->second->build();
+	}
+	else
+	{
+		for (auto i = l_workers.begin(); i != l_workers.end(); ++i)
+		{
+			i->second->start(0, "ShareRefresh");
+		}
+		for (auto i = l_workers.begin(); i != l_workers.end(); ++i)
+		{
+			i->second->join();
+		}
+	}
+	// Keep the configured order of the roots, get_mergeL depends on it for equal virtual names
+	std::unordered_map<const CFlyDirItem*, Directory::Ptr> l_built;
+	for (auto i = l_workers.cbegin(); i != l_workers.cend(); ++i)
+	{
+		const auto& l_worker = *i->second;
+		for (size_t j = 0; j < l_worker.m_result.size(); ++j)
+		{
+			l_built[l_worker.m_roots[j]] = l_worker.m_result[j];
+		}
+	}
+	for (auto i = p_directories.cbegin(); i != p_directories.cend(); ++i)
+	{
+		const auto l_dir = l_built.find(&*i);
+		if (l_dir != l_built.end())
+		{
+			p_new_dirs.push_back(l_dir->second);
+		}
+	}
+}
 
-	bool p_is_no_mediainfo = false;
+ShareManager::Directory::Ptr ShareManager::buildTreeL(CFlyShareScan& p_scan, __int64 p_path_id, const string& aName, const Directory::Ptr& aParent,
+                                                      const Directory::DirectoryMap* p_reuse /*= nullptr */)
+{
+	const string l_lower_path = Text::toLower(aName);
+	CFlyRootDir* l_db_dir = nullptr;
+	{
+		const auto l_snapshot_dir = p_scan.m_snapshot.find(l_lower_path);
+		if (l_snapshot_dir != p_scan.m_snapshot.end())
+		{
+			l_db_dir = &l_snapshot_dir->second;
+			if (p_path_id == 0)
+			{
+				p_path_id = l_db_dir->m_path_id;
+			}
+		}
+	}
 	if (p_path_id == 0)
 	{
-		p_path_id = CFlylinkDBManager::getInstance()->get_path_id(Text::toLower(aName), !p_is_job, false, p_is_no_mediainfo, m_sweep_path);
+		// The base has not seen this directory yet
+		bool l_is_no_mediainfo = false;
+		p_path_id = CFlylinkDBManager::getInstance()->get_path_id(l_lower_path, !p_scan.m_is_job, false, l_is_no_mediainfo, m_sweep_path);
 	}
 	Directory::Ptr l_dir = Directory::create(Util::getLastDir(aName), aParent);
 	
 	auto l_lastFileIter = l_dir->m_share_files.begin();
 	
-	CFlyDirMap l_dir_map;
-	if (p_path_id)
-		CFlylinkDBManager::getInstance()->load_dir(p_path_id, l_dir_map, p_is_no_mediainfo);
+	CFlyDirMap l_new_dir_map;
+	CFlyDirMap& l_dir_map = l_db_dir ? l_db_dir->m_files : l_new_dir_map;
+	size_t l_count_entries = 0;
 	for (FileFindIter i(aName + '*'); !ClientManager::isBeforeShutdown() && i != FileFindIter::end; ++i)
 	{
+		++l_count_entries; // "." counts too: the directory could be read
 		if (i->isTemporary())
 			continue;
 		const string& l_file_name = i->getFileName();
 		if (l_file_name == Util::m_dot || l_file_name == Util::m_dot_dot || l_file_name.empty())
 			continue;
+		const string l_lower_name = Text::toLower(l_file_name);
+		// Everything still on disk is kept in the base, shared or not
+		if (i->isDirectory())
+		{
+			const auto l_sub_dir = p_scan.m_snapshot.find(l_lower_path + l_lower_name + PATH_SEPARATOR);
+			if (l_sub_dir != p_scan.m_snapshot.end())
+			{
+				l_sub_dir->second.m_is_seen = true;
+			}
+		}
+		else
+		{
+			const auto l_file = l_dir_map.find(l_lower_name);
+			if (l_file != l_dir_map.end())
+			{
+				l_file->second.m_is_seen = true;
+			}
+		}
 		if (i->isHidden() && !BOOLSETTING(SHARE_HIDDEN))
 			continue;
 		if (i->isSystem() && !BOOLSETTING(SHARE_SYSTEM))
 			continue;
 		if (i->isVirtual() && !BOOLSETTING(SHARE_VIRTUAL))
 			continue;
-		const string l_lower_name = Text::toLower(l_file_name);
 		if (i->isDirectory())
 		{
 			const string newName = aName + l_file_name + PATH_SEPARATOR;
@@ -1259,8 +1458,22 @@ ShareManager::Directory::Ptr ShareManager::buildTreeL(__int64& p_path_id, const
 			        && stricmp(newName, SETTING(LOG_DIRECTORY)) != 0
 			        && isShareFolder(newName))
 			{
-				__int64 l_path_id = 0;
-				l_dir->m_share_directories[l_file_name] = buildTreeL(l_path_id, newName, l_dir, p_is_job);
+				Directory::Ptr l_sub_dir;
+				if (p_reuse)
+				{
+					// A rescan of one directory keeps the subtrees it already has, their own events rescan them
+					const auto l_old_dir = p_reuse->find(l_file_name);
+					if (l_old_dir != p_reuse->end())
+					{
+						l_sub_dir = l_old_dir->second; // still in the tree, applyRescanL takes it over
+					}
+					else if (p_scan.m_is_shallow)
+					{
+						// A new subtree the base may know (moved back, unexcluded): its files spare the rehash
+						CFlylinkDBManager::getInstance()->load_root_snapshot(Text::toLower(newName), p_scan.m_snapshot);
+					}
+				}
+				l_dir->m_share_directories[l_file_name] = l_sub_dir ? l_sub_dir : buildTreeL(p_scan, 0, newName, l_dir);
 			}
 		}
 		else
@@ -1351,10 +1564,6 @@ ShareManager::Directory::Ptr ShareManager::buildTreeL(__int64& p_path_id, const
 				{
 					// LogManager::message("[!!!!!!!!][2] bool l_is_new_file = l_dir_item == l_dir_map.end(); l_lower_name = " + l_lower_name + " name = " + l_file_name);
 				}
-#ifdef FLYLINKDC_USE_ONLINE_SWEEP_DB
-				if (l_dir_item != l_dir_map.end())
-					l_dir_item_second.m_is_found = true;
-#endif
 				try
 				{
 					if (l_is_new_file)
@@ -1376,12 +1585,16 @@ ShareManager::Directory::Ptr ShareManager::buildTreeL(__int64& p_path_id, const
 						                                            );
 						auto f = const_cast<ShareManager::Directory::ShareFile*>(&(*l_lastFileIter));
 						f->initLowerName();
-						if (l_dir_item_second.m_StampShare > g_lastSharedDate)
+						if (l_dir_item_second.m_StampShare > p_scan.m_last_shared_date)
 						{
-							g_lastSharedDate = l_dir_item_second.m_StampShare;
+							p_scan.m_last_shared_date = l_dir_item_second.m_StampShare;
 						}
 						f->initMediainfo(l_dir_item_second.m_media_ptr);
 						l_dir_item_second.m_media_ptr = nullptr;
+						if (l_dir_item_second.m_recalc_ftype)
+						{
+							p_scan.m_diff->m_ftypes.push_back(CFlyShareDiff::FType{ p_path_id, l_dir_item->first, l_dir_item_second.m_ftype });
+						}
 					}
 				}
 				catch (const HashException&)
@@ -1390,10 +1603,11 @@ ShareManager::Directory::Ptr ShareManager::buildTreeL(__int64& p_path_id, const
 			}
 		}
 	}
-#ifdef FLYLINKDC_USE_ONLINE_SWEEP_DB
-	if (l_path_id && !m_sweep_guard)
-		CFlylinkDBManager::getInstance()->sweep_files(l_path_id, l_dir_map);
-#endif
+	if (l_db_dir && !ClientManager::isBeforeShutdown())
+	{
+		l_db_dir->m_is_seen = true;
+		l_db_dir->m_is_listed = l_count_entries != 0;
+	}
 	return l_dir;
 }
 
@@ -1545,6 +1759,7 @@ bool ShareManager::updateIndicesDirL(Directory& dir)
 			dcassert(Text::toLower(dir.getName()) == dir.getLowName());
 			g_bloom.add(dir.getLowName());
 		}
+		g_search_index.addDirectory(dir);
 		
 		for (auto i = dir.m_share_directories.cbegin(); i != dir.m_share_directories.cend(); ++i)
 		{
@@ -1580,6 +1795,7 @@ void ShareManager::rebuildIndicesL(bool p_is_clear_cache)
 			CFlyWriteLock(*g_csBloom);
 			g_bloom.clear();
 		}
+		g_search_index.clear();
 		if (p_is_clear_cache)
 		{
 			clear_partial_cache("");
@@ -1587,11 +1803,13 @@ void ShareManager::rebuildIndicesL(bool p_is_clear_cache)
 		}
 		{
 			CFlyLock(g_csTTHIndex);
+			g_search_index.beginUpdate();
 			for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
 			{
 				if (updateIndicesDirL(**i) == false)
 					break;
 			}
+			g_search_index.endUpdate();
 		}
 		g_isNeedsUpdateShareSize = true;
 	}
@@ -1618,11 +1836,232 @@ bool ShareManager::updateIndicesFileL(Directory& dir, const Directory::ShareFile
 		}
 		dcassert(Text::toLower(f.getName()) == f.getLowName());
 		g_bloom.add(f.getLowName());
+		g_search_index.addFile(f);
 		return true;
 	}
 	return false;
 }
 
+void ShareManager::removeIndicesFileL(const Directory::ShareFile& p_file)
+{
+	const auto j = g_tthIndex.find(p_file.getTTH());
+	if (j != g_tthIndex.end() && &*j->second == &p_file)
+	{
+		g_tthIndex.erase(j);
+	}
+	g_search_index.removeFile(p_file);
+	// The bloom filter can not forget, a false positive only costs a search
+}
+
+void ShareManager::removeIndicesDirL(const Directory& p_dir)
+{
+	g_search_index.removeDirectory(p_dir);
+	for (auto i = p_dir.m_share_directories.cbegin(); i != p_dir.m_share_directories.cend(); ++i)
+	{
+		removeIndicesDirL(*i->second); // Recursion
+	}
+	for (auto i = p_dir.m_share_files.cbegin(); i != p_dir.m_share_files.cend(); ++i)
+	{
+		removeIndicesFileL(*i);
+	}
+}
+
+// Tokens are split on ASCII punctuation and spaces, UTF-8 sequences stay inside a token
+static inline bool isTokenSeparator(char c)
+{
+	return uint8_t(c) < 0x80 && !isalnum(uint8_t(c));
+}
+
+static inline uint32_t getTrigram(const char* p)
+{
+	return uint32_t(uint8_t(p[0])) | uint32_t(uint8_t(p[1])) << 8 | uint32_t(uint8_t(p[2])) << 16;
+}
+
+void ShareManager::SearchIndex::clear()
+{
+	std::unordered_map<string, uint32_t>().swap(m_token_ids);
+	std::vector<const string*>().swap(m_tokens);
+	std::vector<Postings>().swap(m_postings);
+	std::unordered_map<uint32_t, std::vector<uint32_t>>().swap(m_trigrams);
+	m_unsorted.clear();
+}
+
+void ShareManager::SearchIndex::beginUpdate()
+{
+	dcassert(!m_is_bulk && m_unsorted.empty());
+	m_is_bulk = true;
+}
+
+template<class T> static void mergePostings(std::vector<T>& p_list, size_t p_sorted)
+{
+	std::sort(p_list.begin() + p_sorted, p_list.end());
+	std::inplace_merge(p_list.begin(), p_list.begin() + p_sorted, p_list.end());
+	p_list.erase(std::unique(p_list.begin(), p_list.end()), p_list.end());
+}
+
+void ShareManager::SearchIndex::endUpdate()
+{
+	dcassert(m_is_bulk);
+	m_is_bulk = false;
+	for (auto i = m_unsorted.cbegin(); i != m_unsorted.cend(); ++i)
+	{
+		Postings& l_postings = m_postings[*i];
+		mergePostings(l_postings.m_files, l_postings.m_sorted_files);
+		mergePostings(l_postings.m_dirs, l_postings.m_sorted_dirs);
+		l_postings.m_is_unsorted = false;
+	}
+	m_unsorted.clear();
+}
+
+void ShareManager::SearchIndex::addFile(const Directory::ShareFile& p_file)
+{
+	addName(p_file.getLowName(), &p_file, &Postings::m_files);
+}
+
+void ShareManager::SearchIndex::addDirectory(const Directory& p_dir)
+{
+	addName(p_dir.getLowName(), &p_dir, &Postings::m_dirs);
+}
+
+template<class T> void ShareManager::SearchIndex::addName(const string& p_low_name, const T* p_item, std::vector<const T*> Postings::* p_list)
+{
+	const char* l_end = p_low_name.data() + p_low_name.size();
+	for (const char* l_token = p_low_name.data(); l_token != l_end;)
+	{
+		if (isTokenSeparator(*l_token))
+		{
+			++l_token;
+			continue;
+		}
+		const char* l_token_end = std::find_if(l_token, l_end, isTokenSeparator);
+		const auto l_id = m_token_ids.insert(std::make_pair(string(l_token, l_token_end), uint32_t(m_tokens.size())));
+		if (l_id.second)
+		{
+			const string& l_name = l_id.first->first;
+			m_tokens.push_back(&l_name);
+			m_postings.resize(m_tokens.size());
+			for (size_t i = 0; i + 3 <= l_name.size(); ++i)
+			{
+				auto& l_ids = m_trigrams[getTrigram(l_name.data() + i)];
+				if (l_ids.empty() || l_ids.back() != l_id.first->second)
+					l_ids.push_back(l_id.first->second);
+			}
+		}
+		Postings& l_postings = m_postings[l_id.first->second];
+		auto& l_list = l_postings.*p_list;
+		if (m_is_bulk)
+		{
+			if (!l_postings.m_is_unsorted)
+			{
+				l_postings.m_sorted_files = uint32_t(l_postings.m_files.size());
+				l_postings.m_sorted_dirs = uint32_t(l_postings.m_dirs.size());
+				l_postings.m_is_unsorted = true;
+				m_unsorted.push_back(l_id.first->second);
+			}
+			if (l_list.empty() || l_list.back() != p_item) // the same token twice in one name
+				l_list.push_back(p_item);
+		}
+		else
+		{
+			const auto l_pos = std::lower_bound(l_list.begin(), l_list.end(), p_item);
+			if (l_pos == l_list.end() || *l_pos != p_item)
+				l_list.insert(l_pos, p_item);
+		}
+		l_token = l_token_end;
+	}
+}
+
+void ShareManager::SearchIndex::removeFile(const Directory::ShareFile& p_file)
+{
+	removeName(p_file.getLowName(), &p_file, &Postings::m_files);
+}
+
+void ShareManager::SearchIndex::removeDirectory(const Directory& p_dir)
+{
+	removeName(p_dir.getLowName(), &p_dir, &Postings::m_dirs);
+}
+
+// The tokens stay in the vocabulary, an empty postings list costs nothing to the search
+template<class T> void ShareManager::SearchIndex::removeName(const string& p_low_name, const T* p_item, std::vector<const T*> Postings::* p_list)
+{
+	dcassert(!m_is_bulk);
+	const char* l_end = p_low_name.data() + p_low_name.size();
+	for (const char* l_token = p_low_name.data(); l_token != l_end;)
+	{
+		if (isTokenSeparator(*l_token))
+		{
+			++l_token;
+			continue;
+		}
+		const char* l_token_end = std::find_if(l_token, l_end, isTokenSeparator);
+		const auto l_id = m_token_ids.find(string(l_token, l_token_end));
+		if (l_id != m_token_ids.end())
+		{
+			auto& l_list = m_postings[l_id->second].*p_list;
+			const auto l_item = std::lower_bound(l_list.begin(), l_list.end(), p_item);
+			if (l_item != l_list.end() && *l_item == p_item)
+			{
+				l_list.erase(l_item);
+			}
+		}
+		l_token = l_token_end;
+	}
+}
+
+bool ShareManager::SearchIndex::find(const string& p_pattern, FileList& p_files, DirectoryList& p_dirs) const
+{
+	// Any name containing the pattern contains its longest piece inside one token
+	const char* l_piece = nullptr;
+	size_t l_piece_len = 0;
+	const char* l_end = p_pattern.data() + p_pattern.size();
+	for (const char* i = p_pattern.data(); i != l_end;)
+	{
+		const char* j = std::find_if(i, l_end, isTokenSeparator);
+		if (size_t(j - i) > l_piece_len)
+		{
+			l_piece = i;
+			l_piece_len = j - i;
+		}
+		i = j == l_end ? j : j + 1;
+	}
+	if (l_piece_len < 3)
+		return false;
+		
+	const std::vector<uint32_t>* l_ids = nullptr;
+	for (size_t i = 0; i + 3 <= l_piece_len; ++i)
+	{
+		const auto l_trigram = m_trigrams.find(getTrigram(l_piece + i));
+		if (l_trigram == m_trigrams.end())
+			return true; // nothing contains it
+		if (!l_ids || l_trigram->second.size() < l_ids->size())
+			l_ids = &l_trigram->second;
+	}
+	const string l_piece_str(l_piece, l_piece_len);
+	for (auto i = l_ids->cbegin(); i != l_ids->cend(); ++i)
+	{
+		if (m_tokens[*i]->find(l_piece_str) != string::npos)
+		{
+			const Postings& l_postings = m_postings[*i];
+			p_files.insert(p_files.end(), l_postings.m_files.begin(), l_postings.m_files.end());
+			p_dirs.insert(p_dirs.end(), l_postings.m_dirs.begin(), l_postings.m_dirs.end());
+		}
+	}
+	return true;
+}
+
+void ShareManager::SearchIndex::addTree(const Directory& p_dir, FileList& p_files, DirectoryList& p_dirs)
+{
+	p_dirs.push_back(&p_dir);
+	for (auto i = p_dir.m_share_files.cbegin(); i != p_dir.m_share_files.cend(); ++i)
+	{
+		p_files.push_back(&*i);
+	}
+	for (auto i = p_dir.m_share_directories.cbegin(); i != p_dir.m_share_directories.cend(); ++i)
+	{
+		addTree(*i->second, p_files, p_dirs); // Recursion
+	}
+}
+
 void ShareManager::refresh_share(bool p_dirs /* = false */, bool aUpdate /* = true */) noexcept
 {
 	if (m_is_refreshing.test_and_set())
@@ -1725,7 +2164,12 @@ int ShareManager::run()
 		
 		LogManager::message(STRING(FILE_LIST_REFRESH_INITIATED));
 		m_lastFullUpdate = GET_TICK();
-		CFlylinkDBManager::getInstance()->scan_path(directories);
+		{
+			// The full scan covers whatever the monitor has reported so far
+			CFlyFastLock(m_cs_dirty_dirs);
+			m_dirty_dirs.clear();
+			m_is_monitor_overflow = false;
+		}
 		rebuildSkipList();
 		std::vector<Directory::Ptr> newDirs;
 		{
@@ -1736,15 +2180,7 @@ int ShareManager::run()
 			CFlyLock(g_csShare);
 #endif
 			
-			for (auto i = directories.begin(); i != directories.end(); ++i)
-			{
-				if (checkAttributs(i->m_path))
-				{
-					Directory::Ptr dp = buildTreeL(i->m_path_id, i->m_path, Directory::Ptr(), false);
-					dp->setNameAndLower(i->m_synonym);
-					newDirs.push_back(dp);
-				}
-			}
+			buildRootsL(directories, newDirs);
 		}
 		if (m_sweep_path)
 		{
@@ -1773,9 +2209,15 @@ int ShareManager::run()
 			}
 			rebuildIndicesL(false);
 		}
+		setXmlDirty();
 		internalCalcShareSize();
 		m_is_refreshDirs = false;
 		LogManager::message(STRING(FILE_LIST_REFRESH_FINISHED));
+		updateMonitor();
+	}
+	else
+	{
+		refreshDirtyDirs();
 	}
 	if (m_is_update)
 	{
@@ -1786,73 +2228,507 @@ int ShareManager::run()
 	return 0;
 }
 
-void ShareManager::getBloom(ByteVector& v, size_t k, size_t m, size_t h)
+void ShareManager::updateMonitor()
 {
-	dcdebug("Creating bloom filter, k=%u, m=%u, h=%u\n", unsigned(k), unsigned(m), unsigned(h));
-	HashBloom bloom;
-	bloom.reset(k, m, h);
+	StringList l_roots;
+	bool l_is_all = BOOLSETTING(SHARE_MONITOR);
+	if (l_is_all)
 	{
-		CFlyLock(g_csTTHIndex);
-		for (auto i = g_tthIndex.cbegin(); i != g_tthIndex.cend(); ++i)
+#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
+		CFlyReadLock(*g_csShare);
+#else
+		CFlyLock(g_csShare);
+#endif
+		std::unordered_map<string, unsigned> l_synonyms;
+		for (auto i = g_shares.cbegin(); i != g_shares.cend(); ++i)
 		{
-			bloom.add(i->first);
+			++l_synonyms[Text::toLower(i->second.m_synonym)];
+		}
+		for (auto i = g_shares.cbegin(); i != g_shares.cend(); ++i)
+		{
+			// A rescan rebuilds a directory from one real path, a merged virtual root has several
+			if (l_synonyms[Text::toLower(i->second.m_synonym)] == 1)
+				l_roots.push_back(i->first);
+			else
+				l_is_all = false;
 		}
 	}
-	bloom.copy_to(v);
+	CFlyLock(m_cs_monitor);
+	const StringList l_watched = m_monitor->getDirectories();
+	for (auto i = l_watched.cbegin(); i != l_watched.cend(); ++i)
+	{
+		if (std::find_if(l_roots.cbegin(), l_roots.cend(), [&](const string & p_root) {return stricmp(p_root, *i) == 0;}) == l_roots.cend())
+		{
+			m_monitor->removeDirectory(*i);
+		}
+	}
+	for (auto i = l_roots.cbegin(); i != l_roots.cend(); ++i)
+	{
+		if (!m_monitor->addDirectory(*i))
+		{
+			l_is_all = false;
+		}
+	}
+	m_is_monitor_all = l_is_all;
 }
 
-void ShareManager::generateXmlList()
+// The events of a directory come in bursts (a copy, an unpacked archive), it is rescanned after this quiet time
+static const uint64_t g_monitor_quiet_time = 3000;
+
+void ShareManager::collectMonitorEvents(uint64_t p_tick)
 {
-	if (m_updateXmlListInProcess.test_and_set())
+	DirectoryMonitor::EventList l_events;
+	m_monitor->takeEvents(l_events);
+	if (!l_events.empty() && BOOLSETTING(SHARE_MONITOR))
 	{
-		return;
+		const string l_ignored[] = { SETTING(TEMP_DOWNLOAD_DIRECTORY), Util::getConfigPath(), SETTING(LOG_DIRECTORY) };
+		CFlyFastLock(m_cs_dirty_dirs);
+		for (auto i = l_events.cbegin(); i != l_events.cend(); ++i)
+		{
+			if (i->m_action == DirectoryMonitor::ACTION_OVERFLOW)
+			{
+				LogManager::message("Share monitor: events lost for " + i->m_path + ", full refresh");
+				m_is_monitor_overflow = true;
+				continue;
+			}
+			bool l_is_ignored = false;
+			for (size_t j = 0; j < _countof(l_ignored) && !l_is_ignored; ++j)
+			{
+				l_is_ignored = !l_ignored[j].empty() && strnicmp(i->m_path, l_ignored[j], l_ignored[j].size()) == 0;
+			}
+			if (l_is_ignored)
+				continue;
+			// Any change of an entry changes the listing of its directory
+			const string l_dir = Util::getFilePath(i->m_path);
+			CFlyDirtyDir& l_dirty = m_dirty_dirs[Text::toLower(l_dir)];
+			l_dirty.m_path = l_dir;
+			l_dirty.m_tick = p_tick;
+		}
+	}
+	bool l_is_ready = m_is_monitor_overflow;
+	if (!l_is_ready)
+	{
+		CFlyFastLock(m_cs_dirty_dirs);
+		for (auto i = m_dirty_dirs.cbegin(); i != m_dirty_dirs.cend() && !l_is_ready; ++i)
+		{
+			l_is_ready = i->second.m_tick + g_monitor_quiet_time <= p_tick;
+		}
+	}
+	if (l_is_ready && !m_is_refreshing.test_and_set())
+	{
+		m_is_update = true;
+		m_is_refreshDirs = m_is_monitor_overflow;
+		join();
+		try
+		{
+			start(0);
+		}
+		catch (const ThreadException& e)
+		{
+			LogManager::message(STRING(FILE_LIST_REFRESH_FAILED) + ' ' + e.getError());
+			m_is_refreshing.clear();
+		}
+	}
+}
+
+ShareManager::Directory::Ptr ShareManager::findDirectoryUpL(string& p_path)
+{
+	// A new directory is not in the tree yet, neither is an excluded one: the nearest shared ancestor lists it
+	for (;;)
+	{
+		if (Directory::Ptr l_dir = getDirectoryL(p_path))
+			return l_dir;
+		if (p_path.size() < 2)
+			return nullptr;
+		const auto l_pos = p_path.rfind(PATH_SEPARATOR, p_path.size() - 2);
+		if (l_pos == string::npos)
+			return nullptr;
+		p_path.resize(l_pos + 1);
+	}
+}
+
+void ShareManager::refreshDirtyDirs()
+{
+	StringList l_paths;
+	{
+		CFlyFastLock(m_cs_dirty_dirs);
+		const uint64_t l_tick = GET_TICK();
+		for (auto i = m_dirty_dirs.begin(); i != m_dirty_dirs.end();)
+		{
+			if (i->second.m_tick + g_monitor_quiet_time <= l_tick)
+			{
+				l_paths.push_back(i->second.m_path);
+				i = m_dirty_dirs.erase(i);
+			}
+			else
+			{
+				++i;
+			}
+		}
+	}
+	if (l_paths.empty())
+		return;
+		
+	StringList l_virtual_paths;
+	std::unordered_set<const Directory*> l_done;
+	for (auto i = l_paths.begin(); i != l_paths.end() && !ClientManager::isBeforeShutdown(); ++i)
+	{
+		Directory::Ptr l_dir;
+		Directory::DirectoryMap l_old_dirs;
+		{
+#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
+			CFlyReadLock(*g_csShare);
+#else
+			CFlyLock(g_csShare);
+#endif
+			l_dir = findDirectoryUpL(*i);
+			if (!l_dir || !l_done.insert(l_dir.get()).second)
+				continue;
+			l_old_dirs = l_dir->m_share_directories;
+			m_rescan_dir = l_dir.get();
+		}
+		// The disk and the base are read without g_csShare: searches and uploads go on meanwhile
+		const Directory::Ptr l_new_dir = rescanDir(*i, l_old_dirs);
+		CFlyBusy l_busy(g_RebuildIndexes);
+#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
+		CFlyWriteLock(*g_csShare);
+#else
+		CFlyLock(g_csShare);
+#endif
+		m_rescan_dir = nullptr;
+		StringSet l_touched;
+		l_touched.swap(m_rescan_touched);
+		if (!l_new_dir)
+			break;
+		if (getDirectoryL(*i) != l_dir || l_dir->m_share_directories != l_old_dirs)
+		{
+			// The tree has changed under the scan (a share added or removed): the next round scans it again
+			CFlyFastLock(m_cs_dirty_dirs);
+			CFlyDirtyDir& l_dirty = m_dirty_dirs[Text::toLower(*i)];
+			l_dirty.m_path = *i;
+			l_dirty.m_tick = GET_TICK();
+		}
+		else
+		{
+			applyRescanL(*l_dir, *l_new_dir, l_touched);
+			setDirtyL(*l_dir);
+			l_virtual_paths.push_back(l_dir->getADCPathL());
+		}
+	}
+	if (l_virtual_paths.empty())
+		return;
+	// The partial lists of the changed directories and of their ancestors are stale now, the rest stays cached
+	for (auto i = l_virtual_paths.cbegin(); i != l_virtual_paths.cend(); ++i)
+	{
+		clear_partial_cache(*i);
+	}
+	clear_tth_path_cache();
+	internalClearCache(true);
+	internalCalcShareSize();
+}
+
+ShareManager::Directory::Ptr ShareManager::rescanDir(const string& p_path, const Directory::DirectoryMap& p_old_dirs)
+{
+	CFlyShareScan l_scan(false);
+	l_scan.m_is_shallow = true;
+	const string l_lower_path = Text::toLower(p_path);
+	CFlylinkDBManager::getInstance()->load_root_snapshot(l_lower_path, l_scan.m_snapshot, false);
+	{
+		const auto l_db_dir = l_scan.m_snapshot.find(l_lower_path);
+		if (l_db_dir != l_scan.m_snapshot.end())
+		{
+			CFlylinkDBManager::getInstance()->load_dir(l_db_dir->second.m_path_id, l_db_dir->second.m_files, false);
+		}
+	}
+	const Directory::Ptr l_new_dir = buildTreeL(l_scan, 0, p_path, Directory::Ptr(), &p_old_dirs);
+	if (ClientManager::isBeforeShutdown())
+		return Directory::Ptr();
+	collectSweep(l_scan, l_lower_path);
+	CFlylinkDBManager::getInstance()->apply_share_diff(l_scan.m_diff);
+	updateLastSharedDate(l_scan.m_last_shared_date);
+	return l_new_dir;
+}
+
+void ShareManager::applyRescanL(Directory& p_dir, const Directory& p_new_dir, const StringSet& p_touched)
+{
+	// Only the entries that differ from the new listing touch the indices: the postings of a common token are long
+	const auto isSameFile = [](const Directory::ShareFile & p_old, const Directory::ShareFile & p_new) -> bool
+	{
+		return p_old.getSize() == p_new.getSize() && p_old.getTS() == p_new.getTS() && p_old.getTTH() == p_new.getTTH();
+	};
+	CFlyLock(g_csTTHIndex);
+	for (auto i = p_dir.m_share_files.cbegin(); i != p_dir.m_share_files.cend();)
+	{
+		const auto l_new_file = p_new_dir.m_share_files.find(*i);
+		// A file TTHDone has put in meanwhile is newer than the listing
+		if ((l_new_file != p_new_dir.m_share_files.cend() && isSameFile(*i, *l_new_file)) ||
+		        p_touched.find(i->getName()) != p_touched.end())
+		{
+			++i;
+		}
+		else
+		{
+			removeIndicesFileL(*i);
+			i = p_dir.m_share_files.erase(i);
+		}
+	}
+	for (auto i = p_dir.m_share_directories.cbegin(); i != p_dir.m_share_directories.cend();)
+	{
+		const auto l_new_sub_dir = p_new_dir.m_share_directories.find(i->first);
+		if (l_new_sub_dir != p_new_dir.m_share_directories.cend() && l_new_sub_dir->second == i->second)
+		{
+			++i;
+		}
+		else
+		{
+			removeIndicesDirL(*i->second);
+			i = p_dir.m_share_directories.erase(i);
+		}
+	}
+	g_search_index.beginUpdate();
+	{
+		CFlyWriteLock(*g_csBloom);
+		for (auto i = p_new_dir.m_share_files.cbegin(); i != p_new_dir.m_share_files.cend(); ++i)
+		{
+			const auto l_file = p_dir.m_share_files.insert(*i);
+			if (l_file.second)
+			{
+				const_cast<Directory::ShareFile&>(*l_file.first).setParent(&p_dir);
+				updateIndicesFileL(p_dir, l_file.first);
+			}
+		}
+	}
+	for (auto i = p_new_dir.m_share_directories.cbegin(); i != p_new_dir.m_share_directories.cend(); ++i)
+	{
+		const auto l_sub_dir = p_dir.m_share_directories.insert(*i);
+		if (l_sub_dir.second)
+		{
+			l_sub_dir.first->second->setParent(&p_dir);
+			updateIndicesDirL(*l_sub_dir.first->second);
+		}
+	}
+	g_search_index.endUpdate();
+	// A file counts once per TTH, as updateIndicesFileL does
+	p_dir.m_size = 0;
+	for (auto i = p_dir.m_share_files.cbegin(); i != p_dir.m_share_files.cend(); ++i)
+	{
+		const auto j = g_tthIndex.find(i->getTTH());
+		if (j != g_tthIndex.end() && &*j->second == &*i)
+		{
+			p_dir.m_size += i->getSize();
+		}
+	}
+	g_isNeedsUpdateShareSize = true;
+}
+
+void ShareManager::getBloom(ByteVector& v, size_t k, size_t m, size_t h)
+{
+	dcdebug("Creating bloom filter, k=%u, m=%u, h=%u\n", unsigned(k), unsigned(m), unsigned(h));
+	HashBloom bloom;
+	bloom.reset(k, m, h);
+	{
+		CFlyLock(g_csTTHIndex);
+		for (auto i = g_tthIndex.cbegin(); i != g_tthIndex.cend(); ++i)
+		{
+			bloom.add(i->first);
+		}
+	}
+	bloom.copy_to(v);
+}
+
+// Counts what passes through: the uncompressed size of the list
+struct CountFilter
+{
+	CountFilter() : m_count(0)
+	{
+	}
+	void operator()(const void*, size_t p_len)
+	{
+		m_count += p_len;
+	}
+	int64_t m_count;
+};
+
+// Compressed blocks without a stream around them, the blocks of the list are joined into one stream
+template<class T> static int64_t writeBZBlocks(BZBlocks& p_bz, const T& p_writer)
+{
+	p_bz = BZBlocks();
+	ParallelBZStream l_bzipper(p_bz);
+	CalcOutputStream<CountFilter, false> l_xml(&l_bzipper);
+	p_writer(l_xml);
+	l_xml.flushBuffers(true);
+	return l_xml.getFilter().m_count;
+}
+
+void ShareManager::setDirtyL(const Directory& p_dir)
+{
+	const Directory* l_root = &p_dir;
+	while (l_root->getParent())
+	{
+		l_root = l_root->getParent();
+	}
+	{
+		CFlyFastLock(m_cs_xml_dirty_roots);
+		m_xml_dirty_roots.insert(l_root);
+	}
+	setXmlDirty();
+}
+
+TTHValue ShareManager::getXmlRoot() const
+{
+	string l_bz_xml_file;
+	unsigned l_generation;
+	{
+		CFlyLock(m_cs_xml_root);
+		if (m_is_xml_root_valid)
+			return xmlRoot;
+		l_bz_xml_file = getBZXmlFile();
+		l_generation = m_xml_list_generation;
+	}
+	// Only the compressed list is written, the uncompressed one is asked for seldom.
+	// It is decompressed without the lock, a list replaced meanwhile is not cached.
+	try
+	{
+		File l_file(l_bz_xml_file, File::READ, File::OPEN);
+		FilteredInputStream<UnBZFilter, false> l_xml(&l_file);
+		TTFilter l_tt;
+		std::unique_ptr<uint8_t[]> l_buf(new uint8_t[64 * 1024]);
+		for (;;)
+		{
+			size_t l_len = 64 * 1024;
+			const size_t l_size = l_xml.read(&l_buf[0], l_len);
+			if (l_size == 0)
+				break;
+			l_tt(&l_buf[0], l_size);
+		}
+		l_tt.getTree().finalize();
+		CFlyLock(m_cs_xml_root);
+		if (l_generation == m_xml_list_generation)
+		{
+			xmlRoot = l_tt.getTree().getRoot();
+			m_is_xml_root_valid = true;
+		}
+		return l_tt.getTree().getRoot();
+	}
+	catch (const Exception& e)
+	{
+		LogManager::message("Error calc TTH of " + l_bz_xml_file + " error = " + e.getError());
+	}
+	CFlyLock(m_cs_xml_root);
+	return xmlRoot;
+}
+
+void ShareManager::generateXmlList()
+{
+	if (m_updateXmlListInProcess.test_and_set())
+	{
+		return;
 	}
 	
-	if (m_is_forceXmlRefresh || (m_is_xmlDirty && (m_lastXmlUpdate + 15 * 60 * 1000 < GET_TICK() || m_lastXmlUpdate <= m_lastFullUpdate)))
+	if (m_is_xmlDirty)
 	{
 		CFlyLog l_creation_log("[Share cache creator]");
+		// What changes from now on is picked up by the next call
+		m_is_xmlDirty = false;
+		std::unordered_set<const Directory*> l_dirty_roots;
+		{
+			CFlyFastLock(m_cs_xml_dirty_roots);
+			l_dirty_roots.swap(m_xml_dirty_roots);
+		}
+		if (m_is_xml_fragments_stale)
+		{
+			m_is_xml_fragments_stale = false;
+			m_xml_fragments.clear();
+		}
 		m_listN++;
 		
 		try
 		{
-			string tmp2;
-			string indent;
-			
 			string newXmlName = Util::getConfigPath() + "files" + Util::toString(m_listN) + ".xml.bz2";
 			{
+				BZBlocks l_header;
+				BZBlocks l_footer;
+				int64_t l_xml_size = writeBZBlocks(l_header, [](OutputStream & p_xml)
+				{
+					p_xml.write(SimpleXML::utf8Header);
+					p_xml.write("<FileListing Version=\"1\" CID=\"" + ClientManager::getMyCID().toBase32() + "\" Base=\"/\" Generator=\"DC++ " DCVERSIONSTRING "\">\r\n");
+				});
+				l_xml_size += writeBZBlocks(l_footer, [](OutputStream & p_xml)
+				{
+					p_xml.write("</FileListing>");
+				});
+				
+				{
+					std::unordered_map<const Directory*, CFlyXmlFragment> l_fragments;
+					unsigned l_count_reused = 0;
+					{
+#ifdef FLYLINKDC_USE_RW_LOCK_SHARE
+						CFlyReadLock(*g_csShare);
+#else
+						CFlyLock(g_csShare);
+#endif
+						
+						for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
+						{
+							const Directory* l_dir = i->get();
+							CFlyXmlFragment& l_fragment = l_fragments[l_dir];
+							const auto l_old_fragment = m_xml_fragments.find(l_dir);
+							if (l_old_fragment != m_xml_fragments.end() && l_dirty_roots.find(l_dir) == l_dirty_roots.end())
+							{
+								l_fragment = std::move(l_old_fragment->second);
+								++l_count_reused;
+							}
+							else
+							{
+								l_fragment.m_dir = *i;
+								l_fragment.m_xml_size = writeBZBlocks(l_fragment.m_bz, [l_dir](OutputStream & p_xml)
+								{
+									string l_indent;
+									string l_tmp;
+									l_dir->toXmlL(p_xml, l_indent, l_tmp, true);
+								});
+							}
+						}
+					}
+					// Roots gone since the last list are dropped here
+					m_xml_fragments.swap(l_fragments);
+					l_creation_log.step("write dir. done, reused " + Util::toString(l_count_reused) + " of " + Util::toString(m_xml_fragments.size()));
+				}
+				
 				File f(newXmlName, File::WRITE, File::TRUNCATE | File::CREATE);
 				l_creation_log.step("open file done");
 				// We don't care about the leaves...
 				CalcOutputStream<TTFilter, false> bzTree(&f);
-				FilteredOutputStream<BZFilter, false> bzipper(&bzTree);
-				CountOutputStream<false> count(&bzipper);
-				CalcOutputStream<TTFilter, false> newXmlFile(&count);
-				l_creation_log.step("init packer done");
-				newXmlFile.write(SimpleXML::utf8Header);
-				newXmlFile.write("<FileListing Version=\"1\" CID=\"" + ClientManager::getMyCID().toBase32() + "\" Base=\"/\" Generator=\"DC++ " DCVERSIONSTRING "\">\r\n");
+				// One stream: DC++ and its forks stop reading at the first end of stream mark
+				BZBlocks l_list;
+				BZBlocks::writeHeader(&bzTree);
+				l_list.append(l_header);
 				{
 #ifdef FLYLINKDC_USE_RW_LOCK_SHARE
 					CFlyReadLock(*g_csShare);
 #else
 					CFlyLock(g_csShare);
 #endif
-					
+					// The order of g_list_directories, as the full serialization had it
 					for (auto i = g_list_directories.cbegin(); i != g_list_directories.cend(); ++i)
 					{
-						(*i)->toXmlL(newXmlFile, indent, tmp2, true);
+						const auto l_fragment = m_xml_fragments.find(i->get());
+						if (l_fragment != m_xml_fragments.end())
+						{
+							l_list.append(l_fragment->second.m_bz);
+							l_list.write(&bzTree);
+							l_xml_size += l_fragment->second.m_xml_size;
+						}
 					}
 				}
-				l_creation_log.step("write dir. done");
-				newXmlFile.write("</FileListing>");
-				newXmlFile.flushBuffers(true);
+				l_list.append(l_footer);
+				l_list.finish();
+				l_list.write(&bzTree);
+				bzTree.flushBuffers(true);
 				l_creation_log.step("close file");
 				
-				xmlListLen = count.getCount();
-				
-				newXmlFile.getFilter().getTree().finalize();
+				xmlListLen = l_xml_size;
 				bzTree.getFilter().getTree().finalize();
-				
-				xmlRoot = newXmlFile.getFilter().getTree().getRoot();
 				bzXmlRoot = bzTree.getFilter().getTree().getRoot();
 			}
 			
@@ -1876,7 +2752,12 @@ void ShareManager::generateXmlList()
 				// Ignore, this is for caching only...
 			}
 			bzXmlRef = unique_ptr<File>(new File(newXmlName, File::READ, File::OPEN));
-			setBZXmlFile(newXmlName);
+			{
+				CFlyLock(m_cs_xml_root);
+				setBZXmlFile(newXmlName);
+				m_is_xml_root_valid = false;
+				++m_xml_list_generation;
+			}
 			bzXmlListLen = File::getSize(newXmlName);
 		}
 		catch (const Exception&)
@@ -1885,10 +2766,6 @@ void ShareManager::generateXmlList()
 			// No new file lists...
 		}
 		
-		m_is_xmlDirty = false;
-		m_is_forceXmlRefresh = false;
-		m_lastXmlUpdate = GET_TICK();
-		
 		l_creation_log.step("Clean old cache");
 		const StringList l_ToDelete = File::findFiles(Util::getConfigPath(), "files*.xml.bz2", false);
 		const auto l_bz_xml_file = getBZXmlFile();
@@ -1930,18 +2807,10 @@ MemoryInputStream* ShareManager::generatePartialList(const string& dir, bool rec
 		return new MemoryInputStream(xml);
 	}
 #endif
-	if (recurse == false)
+	const UploadCache::Data l_cached = UploadCache::getPartialList(dir, recurse);
+	if (l_cached)
 	{
-		CFlyFastLock(g_csPartialCache);
-		auto i = g_partial_list_cache.find(dir);
-		if (i != g_partial_list_cache.end())
-		{
-			i->second.second++;
-#ifdef FLYLINKDC_BETA
-			// LogManager::message("Use partial file list cache: " + dir + " count = " + Util::toString(i->second.second));
-#endif // FLYLINKDC_BETA
-			return new MemoryInputStream(i->second.first);
-		}
+		return new MemoryInputStream(*l_cached);
 	}
 	StringOutputStream sos(xml);
 	
@@ -2011,12 +2880,6 @@ MemoryInputStream* ShareManager::generatePartialList(const string& dir, bool rec
 	}
 	
 	xml += "</FileListing>";
-	if (recurse == false)
-	{
-		CFlyFastLock(g_csPartialCache);
-		auto& i = g_partial_list_cache[dir];
-		i.first = xml;
-	}
 	
 #ifdef _DEBUG
 	std::ofstream l_fs;
@@ -2030,7 +2893,9 @@ MemoryInputStream* ShareManager::generatePartialList(const string& dir, bool rec
 		//dcassert(0);
 	}
 #endif
-	return new MemoryInputStream(xml);
+	const auto l_list = std::make_shared<const string>(std::move(xml));
+	UploadCache::putPartialList(dir, recurse, l_list);
+	return new MemoryInputStream(*l_list);
 }
 
 #define LITERAL(n) n, sizeof(n)-1
@@ -2409,12 +3274,11 @@ Search::TypeModes ShareManager::getFType(const string& aFileName, bool p_include
 
 /**
  * Alright, the main point here is that when searching, a search string is most often found in
- * the filename, not directory name, so we want to make that case faster. Also, we want to
- * avoid changing StringLists unless we absolutely have to --> this should only be done if a string
- * has been matched in the directory name. This new stringlist should also be used in all descendants,
- * but not the parents...
+ * the filename, not directory name, so we want to make that case faster. All terms are found with
+ * one pass of the MultiStringSearch automaton, p_include holds the bits of the terms not yet matched:
+ * a term found in the directory name is cleared for all descendants, but not the parents...
  */
-void ShareManager::Directory::search(SearchResultList& aResults, StringSearch::List& aStrings, const SearchParamBase& p_search_param) const noexcept
+void ShareManager::Directory::search(SearchResultList& aResults, const MultiStringSearch& p_matcher, MultiStringSearch::Mask p_include, const SearchParamBase& p_search_param) const noexcept
 {
 	if (ClientManager::isBeforeShutdown())
 		return;
@@ -2422,44 +3286,8 @@ void ShareManager::Directory::search(SearchResultList& aResults, StringSearch::L
 	if (!hasType(p_search_param.m_file_type))
 		return;
 		
-	StringSearch::List* cur = &aStrings;
-	unique_ptr<StringSearch::List> newStr;
-	
-	// Find any matches in the directory name
-#ifdef FLYLINKDC_USE_COLLECT_STAT
-	int l_count_find = 0;
-#endif
-	for (auto k = aStrings.cbegin(); k != aStrings.cend(); ++k)
-	{
-#ifdef FLYLINKDC_USE_COLLECT_STAT
-		{
-			string l_tth;
-			const auto l_tth_pos = (*k).getPattern().find("TTH:");
-			if (l_tth_pos != string::npos)
-				l_tth = (*k).getPattern().c_str() + l_tth_pos + 7;
-			CFlylinkDBManager::getInstance()->push_event_statistic("ShareManager::Directory::search",
-			"find-" + Util::toString(++l_count_find),
-			(*k).getPattern(),
-			"",
-			"",
-			p_search_param.m_client->getHubUrlAndIP(),
-			l_tth);
-		}
-#endif
-		if (k->matchLower(getLowName())) // http://flylinkdc.blogspot.com/2010/08/1.html
-		{
-			if (!newStr.get())
-			{
-				newStr = std::make_unique<StringSearch::List>(aStrings);
-			}
-			newStr->erase(remove(newStr->begin(), newStr->end(), *k), newStr->end());
-		}
-	}
-	
-	if (newStr.get() != 0)
-	{
-		cur = newStr.get();
-	}
+	// Find any matches in the directory name, they are satisfied for all descendants
+	p_include &= ~p_matcher.matchLower(getLowName());
 	
 #ifdef _DEBUG
 //	char l_buf[1000] = {0};
@@ -2467,7 +3295,7 @@ void ShareManager::Directory::search(SearchResultList& aResults, StringSearch::L
 //	LogManager::message(l_buf);
 #endif
 	const bool sizeOk = (p_search_param.m_size_mode != Search::SIZE_ATLEAST) || (p_search_param.m_size == 0);
-	if ((cur->empty()) &&
+	if ((p_include == 0) &&
 	        (((p_search_param.m_file_type == Search::TYPE_ANY) && sizeOk) || (p_search_param.m_file_type == Search::TYPE_DIRECTORY)))
 	{
 // We satisfied all the search words! Add the directory...(NMDC searches don't support directory size)
@@ -2500,12 +3328,7 @@ void ShareManager::Directory::search(SearchResultList& aResults, StringSearch::L
 #endif
 				continue;
 			}
-			auto j = cur->begin();
-			for (; j != cur->end() && j->matchLower(i->getLowName()); ++j)
-			{
-			}
-			
-			if (j != cur->end())
+			if ((p_matcher.matchLower(i->getLowName()) & p_include) != p_include)
 			{
 				continue;
 			}
@@ -2525,7 +3348,7 @@ void ShareManager::Directory::search(SearchResultList& aResults, StringSearch::L
 	}
 	for (auto l = m_share_directories.cbegin(); l != m_share_directories.cend() && aResults.size() < p_search_param.m_max_results; ++l)
 	{
-		l->second->search(aResults, *cur, p_search_param); //TODO - Hot point
+		l->second->search(aResults, p_matcher, p_include, p_search_param); //TODO - Hot point
 	}
 }
 bool ShareManager::search_tth(const TTHValue& p_tth, SearchResultList& aResults, bool p_is_check_parent)
@@ -2720,9 +3543,13 @@ void ShareManager::search(SearchResultList& aResults, const SearchParam& p_searc
 #else
 		CFlyLock(g_csShare);
 #endif
-		for (auto j = g_list_directories.cbegin(); j != g_list_directories.cend() && aResults.size() < p_search_param.m_max_results; ++j)
+		const MultiStringSearch l_matcher(ssl);
+		if (!searchIndexL(aResults, ssl, l_matcher, p_search_param))
 		{
-			(*j)->search(aResults, ssl, p_search_param);
+			for (auto j = g_list_directories.cbegin(); j != g_list_directories.cend() && aResults.size() < p_search_param.m_max_results; ++j)
+			{
+				(*j)->search(aResults, l_matcher, l_matcher.getMask(), p_search_param);
+			}
 		}
 	}
 	//    -          - .
@@ -2741,7 +3568,7 @@ inline static uint16_t toCode(char a, char b)
 	return (uint16_t)a | ((uint16_t)b) << 8;
 }
 
-ShareManager::AdcSearch::AdcSearch(const StringList& params) : m_includePtr(&m_includeX), m_gt(0),
+ShareManager::AdcSearch::AdcSearch(const StringList& params) : m_include_mask(0), m_exclude_mask(0), m_gt(0),
 	m_lt(std::numeric_limits<int64_t>::max()), m_hasRoot(false), m_isDirectory(false)
 {
 	for (auto i = params.cbegin(); i != params.cend(); ++i)
@@ -2755,7 +3582,7 @@ ShareManager::AdcSearch::AdcSearch(const StringList& params) : m_includePtr(&m_i
 		{
 			m_hasRoot = true;
 			m_root = TTHValue(p.substr(2));
-			return;
+			break;
 		}
 		else if (toCode('A', 'N') == cmd)
 		{
@@ -2795,16 +3622,15 @@ ShareManager::AdcSearch::AdcSearch(const StringList& params) : m_includePtr(&m_i
 			m_isDirectory = (p[2] == '2');
 		}
 	}
-}
-
-bool ShareManager::AdcSearch::isExcluded(const string& str)
-{
+	for (auto i = m_includeX.cbegin(); i != m_includeX.cend(); ++i)
+	{
+		m_include_mask |= m_matcher.add(*i);
+	}
 	for (auto i = m_exclude.cbegin(); i != m_exclude.cend(); ++i)
 	{
-		if (i->match(str))
-			return true;
+		m_exclude_mask |= m_matcher.add(*i);
 	}
-	return false;
+	m_matcher.compile();
 }
 
 bool ShareManager::AdcSearch::hasExt(const string& name)
@@ -2824,36 +3650,20 @@ bool ShareManager::AdcSearch::hasExt(const string& name)
 	return false;
 }
 
-void ShareManager::Directory::search(SearchResultList& aResults, AdcSearch& aStrings, StringList::size_type maxResults) const noexcept
+void ShareManager::Directory::search(SearchResultList& aResults, AdcSearch& aStrings, MultiStringSearch::Mask p_include, StringList::size_type maxResults) const noexcept
 {
 	if (ClientManager::isBeforeShutdown())
 		return;
 		
-	const StringSearch::List* cur = aStrings.m_includePtr;
-	StringSearch::List* old = aStrings.m_includePtr;
-	
-	unique_ptr<StringSearch::List> newStr;
-	
 	// Find any matches in the directory name
-	for (auto k = cur->cbegin(); k != cur->cend(); ++k)
-	{
-		if (k->matchLower(getLowName()) && !aStrings.isExcluded(getName())) // http://flylinkdc.blogspot.com/2010/08/1.html
-		{
-			if (!newStr.get())
-			{
-				newStr = std::make_unique<StringSearch::List>(*cur);
-			}
-			newStr->erase(remove(newStr->begin(), newStr->end(), *k), newStr->end());
-		}
-	}
-	
-	if (newStr.get() != 0)
+	const MultiStringSearch::Mask l_found = aStrings.m_matcher.matchLower(getLowName());
+	if (!aStrings.isExcluded(l_found))
 	{
-		cur = newStr.get();
+		p_include &= ~l_found;
 	}
 	
 	const bool sizeOk = (aStrings.m_gt == 0);
-	if (cur->empty() && aStrings.m_exts.empty() && sizeOk)
+	if (p_include == 0 && aStrings.m_exts.empty() && sizeOk)
 	{
 // We satisfied all the search words! Add the directory...
 		const SearchResultCore l_sr(SearchResult::TYPE_DIRECTORY, getDirSizeFast(), getFullName(), TTHValue(), -1  /*token*/);
@@ -2875,14 +3685,11 @@ void ShareManager::Directory::search(SearchResultList& aResults, AdcSearch& aStr
 				continue;
 			}
 			
-			if (aStrings.isExcluded(i->getName()))
+			const MultiStringSearch::Mask l_file_found = aStrings.m_matcher.matchLower(i->getLowName()); // http://flylinkdc.blogspot.com/2010/08/1.html
+			if (aStrings.isExcluded(l_file_found))
 				continue;
 				
-			StringSearch::List::const_iterator j = cur->begin();
-			for (; j != cur->end() && j->matchLower(i->getLowName()); ++j) // http://flylinkdc.blogspot.com/2010/08/1.html
-				;   // Empty
-				
-			if (j != cur->end())
+			if ((l_file_found & p_include) != p_include)
 				continue;
 				
 			// Check file type...
@@ -2901,9 +3708,8 @@ void ShareManager::Directory::search(SearchResultList& aResults, AdcSearch& aStr
 	
 	for (auto l = m_share_directories.cbegin(); l != m_share_directories.cend() && aResults.size() < maxResults && !ClientManager::isBeforeShutdown(); ++l)
 	{
-		l->second->search(aResults, aStrings, maxResults);
+		l->second->search(aResults, aStrings, p_include, maxResults);
 	}
-	aStrings.m_includePtr = old;
 }
 
 void ShareManager::search_max_result(SearchResultList& aResults, const StringList& params, StringList::size_type maxResults, StringSearch::List& reguest) noexcept
@@ -2935,11 +3741,152 @@ void ShareManager::search_max_result(SearchResultList& aResults, const StringLis
 #else
 		CFlyLock(g_csShare);
 #endif
-		for (auto j = g_list_directories.cbegin(); j != g_list_directories.cend() && aResults.size() < maxResults && !ClientManager::isBeforeShutdown(); ++j)
+		if (!searchIndexL(aResults, srch, maxResults))
+		{
+			for (auto j = g_list_directories.cbegin(); j != g_list_directories.cend() && aResults.size() < maxResults && !ClientManager::isBeforeShutdown(); ++j)
+			{
+				(*j)->search(aResults, srch, srch.m_include_mask, maxResults);
+			}
+		}
+	}
+}
+
+bool ShareManager::getSearchCandidatesL(const StringSearch::List& p_patterns, SearchIndex::FileList& p_files, SearchIndex::DirectoryList& p_dirs)
+{
+	// Only the most selective pattern is looked up, the others are checked on its candidates
+	bool l_is_found = false;
+	SearchIndex::FileList l_files;
+	SearchIndex::DirectoryList l_dirs;
+	for (auto k = p_patterns.cbegin(); k != p_patterns.cend(); ++k)
+	{
+		l_files.clear();
+		l_dirs.clear();
+		if (!g_search_index.find(k->getPattern(), l_files, l_dirs))
+			continue;
+		// A matched directory brings its whole subtree
+		if (!l_is_found || l_files.size() + l_dirs.size() * 64 < p_files.size() + p_dirs.size() * 64)
+		{
+			p_files.swap(l_files);
+			p_dirs.swap(l_dirs);
+			l_is_found = true;
+		}
+	}
+	if (l_is_found && !p_dirs.empty())
+	{
+		SearchIndex::DirectoryList l_roots;
+		l_roots.swap(p_dirs);
+		std::sort(l_roots.begin(), l_roots.end());
+		l_roots.erase(std::unique(l_roots.begin(), l_roots.end()), l_roots.end());
+		for (auto i = l_roots.cbegin(); i != l_roots.cend(); ++i)
+		{
+			SearchIndex::addTree(**i, p_files, p_dirs);
+		}
+		std::sort(p_dirs.begin(), p_dirs.end());
+		p_dirs.erase(std::unique(p_dirs.begin(), p_dirs.end()), p_dirs.end());
+	}
+	std::sort(p_files.begin(), p_files.end());
+	p_files.erase(std::unique(p_files.begin(), p_files.end()), p_files.end());
+	return l_is_found;
+}
+
+bool ShareManager::isMatchAllL(const MultiStringSearch& p_matcher, MultiStringSearch::Mask p_include, MultiStringSearch::Mask p_exclude,
+                               MultiStringSearch::Mask p_found, const Directory* p_dir)
+{
+	// As in Directory::search a term may be found in the file name or in any parent directory,
+	// the name of an excluded directory does not count
+	for (const Directory* d = p_dir; d && (p_found & p_include) != p_include; d = d->getParent())
+	{
+		const MultiStringSearch::Mask l_found = p_matcher.matchLower(d->getLowName());
+		if ((l_found & p_exclude) == 0)
+		{
+			p_found |= l_found;
+		}
+	}
+	return (p_found & p_include) == p_include;
+}
+
+bool ShareManager::searchIndexL(SearchResultList& aResults, const StringSearch::List& p_patterns, const MultiStringSearch& p_matcher, const SearchParamBase& p_search_param)
+{
+	SearchIndex::FileList l_files;
+	SearchIndex::DirectoryList l_dirs;
+	if (!getSearchCandidatesL(p_patterns, l_files, l_dirs))
+		return false;
+		
+	const bool sizeOk = (p_search_param.m_size_mode != Search::SIZE_ATLEAST) || (p_search_param.m_size == 0);
+	if (((p_search_param.m_file_type == Search::TYPE_ANY) && sizeOk) || (p_search_param.m_file_type == Search::TYPE_DIRECTORY))
+	{
+		for (auto i = l_dirs.cbegin(); i != l_dirs.cend() && aResults.size() < p_search_param.m_max_results; ++i)
+		{
+			const Directory* d = *i;
+			if (d->hasType(p_search_param.m_file_type) && isMatchAllL(p_matcher, p_matcher.getMask(), 0, 0, d))
+			{
+				const SearchResultCore l_sr(SearchResult::TYPE_DIRECTORY, 0, d->getFullName(), TTHValue(), -1 /*token*/);
+				aResults.push_back(l_sr);
+				incHits();
+			}
+		}
+	}
+	if (p_search_param.m_file_type != Search::TYPE_DIRECTORY)
+	{
+		for (auto i = l_files.cbegin(); i != l_files.cend() && aResults.size() < p_search_param.m_max_results; ++i)
 		{
-			(*j)->search(aResults, srch, maxResults);
+			const Directory::ShareFile* f = *i;
+			if (p_search_param.m_size_mode == Search::SIZE_ATLEAST && p_search_param.m_size > f->getSize())
+				continue;
+			if (p_search_param.m_size_mode == Search::SIZE_ATMOST && p_search_param.m_size < f->getSize())
+				continue;
+			if (!f->getParent()->hasType(p_search_param.m_file_type))
+				continue;
+			if (isMatchAllL(p_matcher, p_matcher.getMask(), 0, p_matcher.matchLower(f->getLowName()), f->getParent()) && checkType(f->getName(), p_search_param.m_file_type))
+			{
+				const SearchResultCore l_sr(SearchResult::TYPE_FILE, f->getSize(), f->getParent()->getFullName() + f->getName(), f->getTTH(), -1 /*token*/);
+				aResults.push_back(l_sr);
+				incHits();
+			}
 		}
 	}
+	return true;
+}
+
+bool ShareManager::searchIndexL(SearchResultList& aResults, AdcSearch& aStrings, StringList::size_type maxResults)
+{
+	SearchIndex::FileList l_files;
+	SearchIndex::DirectoryList l_dirs;
+	if (!getSearchCandidatesL(aStrings.m_includeX, l_files, l_dirs))
+		return false;
+		
+	if (aStrings.m_exts.empty() && aStrings.m_gt == 0)
+	{
+		for (auto i = l_dirs.cbegin(); i != l_dirs.cend() && aResults.size() < maxResults; ++i)
+		{
+			const Directory* d = *i;
+			if (isMatchAllL(aStrings.m_matcher, aStrings.m_include_mask, aStrings.m_exclude_mask, 0, d))
+			{
+				const SearchResultCore l_sr(SearchResult::TYPE_DIRECTORY, d->getDirSizeFast(), d->getFullName(), TTHValue(), -1 /*token*/);
+				aResults.push_back(l_sr);
+				incHits();
+			}
+		}
+	}
+	if (!aStrings.m_isDirectory)
+	{
+		for (auto i = l_files.cbegin(); i != l_files.cend() && aResults.size() < maxResults; ++i)
+		{
+			const Directory::ShareFile* f = *i;
+			if (f->getSize() < aStrings.m_gt || f->getSize() > aStrings.m_lt)
+				continue;
+			const MultiStringSearch::Mask l_found = aStrings.m_matcher.matchLower(f->getLowName());
+			if (aStrings.isExcluded(l_found))
+				continue;
+			if (isMatchAllL(aStrings.m_matcher, aStrings.m_include_mask, aStrings.m_exclude_mask, l_found, f->getParent()) && aStrings.hasExt(f->getName()))
+			{
+				const SearchResultCore l_sr(SearchResult::TYPE_FILE, f->getSize(), f->getParent()->getFullName() + f->getName(), f->getTTH(), -1 /*token*/);
+				aResults.push_back(l_sr);
+				incHits();
+			}
+		}
+	}
+	return true;
 }
 
 ShareManager::Directory::Ptr ShareManager::getDirectoryL(const string& fname)
@@ -3025,6 +3972,10 @@ void ShareManager::on(HashManagerListener::TTHDone, const string& fname, const T
 			if (Directory::Ptr d = getDirectoryL(fname)) // TODO  p_path_id    ?
 			{
 				const string l_file_name = Util::getFileName(fname);
+				if (d.get() == m_rescan_dir)
+				{
+					m_rescan_touched.insert(l_file_name);
+				}
 				const auto i = d->findFileIterL(l_file_name);
 				if (i != d->m_share_files.end())
 				{
@@ -3062,8 +4013,7 @@ void ShareManager::on(HashManagerListener::TTHDone, const string& fname, const T
 						}
 					}
 				}
-				setDirty();
-				m_is_forceXmlRefresh = true;
+				setDirtyL(*d);
 			}
 		}
 	}
@@ -3075,27 +4025,13 @@ void ShareManager::on(HashManagerListener::TTHDone, const string& fname, const T
 
 void ShareManager::clear_partial_cache(string p_path)
 {
-	CFlyFastLock(g_csPartialCache);
-	bool l_is_clear = true;
 	if (!p_path.empty())
 	{
 		Text::replace_all(p_path, "\\", "/");
-		for (auto i = g_partial_list_cache.begin(); i != g_partial_list_cache.end();)
-		{
-			if (p_path.find(i->first) != string::npos)
-			{
-				l_is_clear = false;
-				g_partial_list_cache.erase(i->first);
-				i = g_partial_list_cache.begin();
-				continue;
-			}
-			++i;
-		}
-	}
-	if (l_is_clear)
-	{
-		g_partial_list_cache.clear();
+		if (UploadCache::removePartialLists(p_path))
+			return;
 	}
+	UploadCache::removePartialLists(BaseUtil::emptyString);
 }
 
 void ShareManager::on(TimerManagerListener::Second, uint64_t tick) noexcept
@@ -3104,11 +4040,12 @@ void ShareManager::on(TimerManagerListener::Second, uint64_t tick) noexcept
 	{
 		CFlylinkDBManager::getInstance()->flush_hash();
 	}
+	collectMonitorEvents(tick);
 }
 
 void ShareManager::on(TimerManagerListener::Minute, uint64_t tick) noexcept
 {
-	if (SETTING(AUTO_REFRESH_TIME) > 0)
+	if (SETTING(AUTO_REFRESH_TIME) > 0 && !(m_is_monitor_all && BOOLSETTING(SHARE_MONITOR)))
 	{
 		if (m_lastFullUpdate + SETTING(AUTO_REFRESH_TIME) * 60 * 1000 < tick)
 		{
@@ -28,6 +28,8 @@
 #include "BloomFilter.h"
 #include "Pointer.h"
 #include "CFlylinkDBManager.h"
+#include "DirectoryMonitor.h"
+#include "BZUtils.h"
 
 #define FLYLINKDC_USE_RW_LOCK_SHARE
 
@@ -75,10 +77,11 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		TTHValue getTTH(const string& virtualFile) const;
 		
 		void refresh_share(bool dirs = false, bool aUpdate = true) noexcept;
+		/// Anything may have changed (a setting of the list too): the whole list is written anew
 		void setDirty()
 		{
-			m_is_xmlDirty = true;
-			g_isNeedsUpdateShareSize = true;
+			m_is_xml_fragments_stale = true;
+			setXmlDirty();
 		}
 		void setPurgeTTH()
 		{
@@ -326,8 +329,8 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 					return m_size;
 				}
 				
-				void search(SearchResultList& aResults, StringSearch::List& aStrings, const SearchParamBase& p_search_param) const noexcept;
-				void search(SearchResultList& aResults, AdcSearch& aStrings, StringList::size_type maxResults) const noexcept;
+				void search(SearchResultList& aResults, const MultiStringSearch& p_matcher, MultiStringSearch::Mask p_include, const SearchParamBase& p_search_param) const noexcept;
+				void search(SearchResultList& aResults, AdcSearch& aStrings, MultiStringSearch::Mask p_include, StringList::size_type maxResults) const noexcept;
 				
 				void toXmlL(OutputStream& xmlFile, string& indent, string& tmp2, bool fullList) const;
 				void filesToXmlL(OutputStream& xmlFile, string& indent, string& tmp2) const;
@@ -362,12 +365,18 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		{
 			explicit AdcSearch(const StringList& params);
 			
-			bool isExcluded(const string& str);
+			bool isExcluded(MultiStringSearch::Mask p_found) const
+			{
+				return (p_found & m_exclude_mask) != 0;
+			}
 			bool hasExt(const string& name);
 			
-			StringSearch::List* m_includePtr;
 			StringSearch::List m_includeX;
 			StringSearch::List m_exclude;
+			// All include and exclude terms, one pass over a name finds both
+			MultiStringSearch m_matcher;
+			MultiStringSearch::Mask m_include_mask;
+			MultiStringSearch::Mask m_exclude_mask;
 			StringList m_exts;
 			StringList m_noExts;
 			
@@ -379,15 +388,92 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 			bool m_isDirectory;
 		};
 		
+		/**
+		 * Inverted index over the lower-cased name tokens of all shared files and directories.
+		 * Search patterns are substrings, so a pattern is looked up by its longest piece without
+		 * separators: a trigram index over the token vocabulary gives every token containing that
+		 * piece, and the union of their postings is the candidate set, which is then verified with
+		 * StringSearch exactly as Directory::search does. Protected by g_csShare.
+		 */
+		class SearchIndex
+		{
+			public:
+				typedef std::vector<const Directory::ShareFile*> FileList;
+				typedef std::vector<const Directory*> DirectoryList;
+				
+				SearchIndex() : m_is_bulk(false)
+				{
+				}
+				void clear();
+				/// A whole tree is added between these: the postings are appended and merged once at the end
+				void beginUpdate();
+				void endUpdate();
+				void addFile(const Directory::ShareFile& p_file);
+				void addDirectory(const Directory& p_dir);
+				void removeFile(const Directory::ShareFile& p_file);
+				void removeDirectory(const Directory& p_dir);
+				/// @return false if the pattern is too short to be looked up, the tree has to be walked then
+				bool find(const string& p_pattern, FileList& p_files, DirectoryList& p_dirs) const;
+				static void addTree(const Directory& p_dir, FileList& p_files, DirectoryList& p_dirs);
+				
+			private:
+				struct Postings
+				{
+					Postings() : m_sorted_files(0), m_sorted_dirs(0), m_is_unsorted(false)
+					{
+					}
+					// Sorted by address: a removal finds its item by binary search
+					FileList m_files;
+					DirectoryList m_dirs;
+					uint32_t m_sorted_files; // the sorted heads while a bulk update appends
+					uint32_t m_sorted_dirs;
+					bool m_is_unsorted;
+				};
+				template<class T> void addName(const string& p_low_name, const T* p_item, std::vector<const T*> Postings::* p_list);
+				template<class T> void removeName(const string& p_low_name, const T* p_item, std::vector<const T*> Postings::* p_list);
+				
+				std::unordered_map<string, uint32_t> m_token_ids;
+				std::vector<const string*> m_tokens; // keys of m_token_ids by id
+				std::vector<Postings> m_postings;    // by token id
+				std::unordered_map<uint32_t, std::vector<uint32_t>> m_trigrams; // token ids by trigram
+				std::vector<uint32_t> m_unsorted; // token ids appended to since beginUpdate
+				bool m_is_bulk;
+		};
+		
 		
 		int64_t xmlListLen;
-		TTHValue xmlRoot;
+		mutable TTHValue xmlRoot; // of the uncompressed list, calculated on demand by getXmlRoot()
+		mutable bool m_is_xml_root_valid;
+		mutable CriticalSection m_cs_xml_root;
+		unsigned m_xml_list_generation; // counts the files behind getBZXmlFile(), under m_cs_xml_root
 		int64_t bzXmlListLen;
 		TTHValue bzXmlRoot;
 		std::unique_ptr<File> bzXmlRef;
+		TTHValue getXmlRoot() const;
+		
+		/**
+		 * files.xml.bz2 is one bzip2 stream joined from compressed blocks: the header, the blocks of every root directory
+		 * and the footer. The blocks of a root are compressed again only when something under it has changed,
+		 * a root that is a new node (refresh, added share) gets its blocks anyway.
+		 */
+		struct CFlyXmlFragment
+		{
+			Directory::Ptr m_dir; // keeps the key alive
+			BZBlocks m_bz;
+			int64_t m_xml_size;
+		};
+		std::unordered_map<const Directory*, CFlyXmlFragment> m_xml_fragments; // owned by generateXmlList
+		std::unordered_set<const Directory*> m_xml_dirty_roots;
+		FastCriticalSection m_cs_xml_dirty_roots;
+		bool m_is_xml_fragments_stale;
+		void setXmlDirty()
+		{
+			m_is_xmlDirty = true;
+			g_isNeedsUpdateShareSize = true;
+		}
+		void setDirtyL(const Directory& p_dir);
 		
 		bool m_is_xmlDirty;
-		bool m_is_forceXmlRefresh; /// bypass the 15-minutes guard
 		bool m_is_refreshDirs;
 		bool m_is_update;
 		friend BufferedSocket;
@@ -398,14 +484,11 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		std::atomic_flag m_is_refreshing;
 		std::atomic_flag m_updateXmlListInProcess;
 		
-		uint64_t m_lastXmlUpdate;
 		uint64_t m_lastFullUpdate;
 		
 		static CriticalSection g_csTTHIndex;
 		static FastCriticalSection g_csBot;
 		
-		static FastCriticalSection g_csPartialCache;
-		static std::unordered_map<string, std::pair<string, unsigned>> g_partial_list_cache;
 		static void clear_partial_cache(string p_path);
 		
 		static FastCriticalSection g_csTTHPathCache;
@@ -458,11 +541,75 @@ class ShareManager : public Singleton<ShareManager>, private Thread, private Tim
 		static int64_t g_CurrentShareSize;
 		static bool g_ignoreFileSizeHFS;
 		static BloomFilter<5> g_bloom;
+		static SearchIndex g_search_index;
+		
+		static bool getSearchCandidatesL(const StringSearch::List& p_patterns, SearchIndex::FileList& p_files, SearchIndex::DirectoryList& p_dirs);
+		static bool isMatchAllL(const MultiStringSearch& p_matcher, MultiStringSearch::Mask p_include, MultiStringSearch::Mask p_exclude,
+		                        MultiStringSearch::Mask p_found, const Directory* p_dir);
+		static bool searchIndexL(SearchResultList& aResults, const StringSearch::List& p_patterns, const MultiStringSearch& p_matcher, const SearchParamBase& p_search_param);
+		static bool searchIndexL(SearchResultList& aResults, AdcSearch& aStrings, StringList::size_type maxResults);
 		
 		string findFileAndRealPath(const string& virtualFile, TTHValue& p_tth, bool p_is_fetch_tth) const;
 		void checkShutdown(const string& virtualFile) const;
 		
-		Directory::Ptr buildTreeL(__int64& p_path_id, const string& p_path, const Directory::Ptr& p_parent, bool p_is_job);
+		// One root refresh: the bulk-loaded fly_file snapshot of the root and the changes found against it
+		struct CFlyShareScan
+		{
+			explicit CFlyShareScan(bool p_is_job) : m_diff(std::make_shared<CFlyShareDiff>()), m_last_shared_date(0), m_is_job(p_is_job), m_is_shallow(false)
+			{
+			}
+			CFlyRootSnapshot m_snapshot;
+			std::shared_ptr<CFlyShareDiff> m_diff;
+			int64_t m_last_shared_date;
+			const bool m_is_job;
+			bool m_is_shallow; // the snapshot has the files of the scanned directory only
+		};
+		// Builds the roots of one physical disk, the refresh runs one of these per disk
+		class RefreshWorker : public Thread
+		{
+			public:
+				explicit RefreshWorker(ShareManager& p_share) : m_share(p_share)
+				{
+				}
+				void build();
+				std::vector<CFlyDirItem*> m_roots;
+				std::vector<Directory::Ptr> m_result;
+			private:
+				int run() override;
+				ShareManager& m_share;
+		};
+		friend class RefreshWorker;
+		Directory::Ptr buildRootL(__int64& p_path_id, const string& p_path, bool p_is_job);
+		void buildRootsL(CFlyDirItemArray& p_directories, std::vector<Directory::Ptr>& p_new_dirs);
+		Directory::Ptr buildTreeL(CFlyShareScan& p_scan, __int64 p_path_id, const string& p_path, const Directory::Ptr& p_parent,
+		                          const Directory::DirectoryMap* p_reuse = nullptr);
+		static void collectSweep(CFlyShareScan& p_scan, const string& p_lower_root);
+		static void updateLastSharedDate(int64_t p_date);
+		
+		// Incremental refresh: the monitored roots report changes, only the directories they name are rescanned
+		std::unique_ptr<DirectoryMonitor> m_monitor;
+		CriticalSection m_cs_monitor;
+		struct CFlyDirtyDir
+		{
+			string m_path;
+			uint64_t m_tick; // of the last event, the directory is rescanned once it settles down
+		};
+		typedef std::unordered_map<string, CFlyDirtyDir> CFlyDirtyDirMap; // by the lower path
+		CFlyDirtyDirMap m_dirty_dirs;
+		FastCriticalSection m_cs_dirty_dirs;
+		bool m_is_monitor_all; // every root is monitored, the periodic refresh is not needed
+		bool m_is_monitor_overflow;
+		void updateMonitor();
+		void collectMonitorEvents(uint64_t p_tick);
+		void refreshDirtyDirs();
+		static Directory::Ptr findDirectoryUpL(string& p_path);
+		Directory::Ptr rescanDir(const string& p_path, const Directory::DirectoryMap& p_old_dirs);
+		void applyRescanL(Directory& p_dir, const Directory& p_new_dir, const StringSet& p_touched);
+		// The directory being rescanned without g_csShare and the files TTHDone has touched in it meanwhile, under g_csShare
+		const Directory* m_rescan_dir;
+		StringSet m_rescan_touched;
+		static void removeIndicesFileL(const Directory::ShareFile& p_file);
+		static void removeIndicesDirL(const Directory& p_dir);
 #ifdef FLYLINKDC_USE_ONLINE_SWEEP_DB
 		bool m_sweep_guard;
 #endif
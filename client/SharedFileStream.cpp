@@ -20,6 +20,7 @@
 #include "stdinc.h"
 #include "SharedFileStream.h"
 #include "ClientManager.h"
+#include "TimerManager.h"
 #include "../FlyFeatures/flyServer.h"
 
 FastCriticalSection SharedFileStream::g_shares_file_cs;
@@ -29,7 +30,7 @@ SharedFileStream::SharedFileHandleMap SharedFileStream::g_rwpool;
 
 SharedFileHandle::SharedFileHandle(const string& aPath, int aAccess, int aMode) :
 	m_ref_cnt(1), m_path(aPath), m_mode(aMode), m_access(aAccess), m_last_file_size(0),
-	m_map_file(INVALID_HANDLE_VALUE), m_map_file_ptr(nullptr), m_is_map_file_error(false)
+	m_map_file(INVALID_HANDLE_VALUE), m_map_file_ptr(nullptr), m_is_map_file_error(false), m_read_ahead_counter(0)
 {
 }
 void SharedFileHandle::CloseMapFile()
@@ -53,12 +54,207 @@ void SharedFileHandle::CloseMapFile()
 }
 SharedFileHandle::~SharedFileHandle()
 {
+	{
+		CFlyFastLock(m_read_ahead_cs);
+		for (size_t i = 0; i < READ_AHEAD_STREAMS; ++i)
+		{
+			dcassert(!m_read_ahead[i].m_is_busy);
+			for (size_t j = 0; j < 2; ++j)
+			{
+				auto& l_block = m_read_ahead[i].m_blocks[j];
+				if (l_block.m_is_pending)
+				{
+					::CancelIoEx(m_file.getHandle(), &l_block.m_ov);
+					completeReadAhead(l_block, true);
+				}
+				if (l_block.m_ov.hEvent)
+				{
+					::CloseHandle(l_block.m_ov.hEvent);
+				}
+			}
+		}
+	}
 	CloseMapFile();
 }
 
+bool SharedFileHandle::isReadAheadPendingL(const ReadAheadStream& p_stream) const
+{
+	return p_stream.m_blocks[0].m_is_pending || p_stream.m_blocks[1].m_is_pending;
+}
+
+void SharedFileHandle::reclaimReadAheadL(ReadAheadStream& p_stream, uint64_t p_now)
+{
+	// Nobody else completes the read of a reader that has gone away or seeked elsewhere
+	dcassert(!p_stream.m_is_busy);
+	const bool l_is_expired = p_now - p_stream.m_last_tick > READ_AHEAD_IDLE_TIME;
+	for (size_t j = 0; j < 2; ++j)
+	{
+		auto& l_block = p_stream.m_blocks[j];
+		if (l_block.m_is_pending)
+		{
+			if (l_is_expired)
+			{
+				// Not waited for under the lock: the cancelled read is collected by the next poll
+				::CancelIoEx(m_file.getHandle(), &l_block.m_ov);
+			}
+			completeReadAhead(l_block, false);
+		}
+	}
+}
+
+void SharedFileHandle::completeReadAhead(ReadAheadBlock& p_block, bool p_is_wait)
+{
+	dcassert(p_block.m_is_pending);
+	DWORD l_size = 0;
+	if (::GetOverlappedResult(m_file.getHandle(), &p_block.m_ov, &l_size, p_is_wait ? TRUE : FALSE))
+	{
+		p_block.m_size = l_size;
+		p_block.m_is_pending = false;
+	}
+	else if (::GetLastError() != ERROR_IO_INCOMPLETE)
+	{
+		// EOF, an error or cancelled: the reader goes to the file
+		p_block.m_pos = -1;
+		p_block.m_size = 0;
+		p_block.m_is_pending = false;
+	}
+}
+
+void SharedFileHandle::startReadAhead(ReadAheadStream& p_stream, int64_t p_pos)
+{
+	// The block of p_pos and the next one, the blocks behind p_pos are reused
+	const int64_t l_first = p_pos / READ_AHEAD_BLOCK * READ_AHEAD_BLOCK;
+	for (int64_t l_pos = l_first; l_pos < l_first + 2 * READ_AHEAD_BLOCK && l_pos < m_last_file_size; l_pos += READ_AHEAD_BLOCK)
+	{
+		if (p_stream.m_blocks[0].m_pos == l_pos || p_stream.m_blocks[1].m_pos == l_pos)
+			continue;
+		ReadAheadBlock* l_block = nullptr;
+		for (size_t j = 0; j < 2; ++j)
+		{
+			if (!p_stream.m_blocks[j].m_is_pending && p_stream.m_blocks[j].m_pos < l_first)
+			{
+				l_block = &p_stream.m_blocks[j];
+				break;
+			}
+		}
+		if (!l_block)
+			break;
+		if (!l_block->m_data)
+		{
+			l_block->m_ov.hEvent = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+			if (!l_block->m_ov.hEvent)
+				break;
+			l_block->m_data.reset(new uint8_t[READ_AHEAD_BLOCK]);
+		}
+		LARGE_INTEGER l_offset;
+		l_offset.QuadPart = l_pos;
+		l_block->m_ov.Offset = l_offset.LowPart;
+		l_block->m_ov.OffsetHigh = l_offset.HighPart;
+		l_block->m_pos = l_pos;
+		l_block->m_size = 0;
+		DWORD l_size = 0;
+		if (::ReadFile(m_file.getHandle(), l_block->m_data.get(), DWORD(std::min<int64_t>(READ_AHEAD_BLOCK, m_last_file_size - l_pos)), &l_size, &l_block->m_ov))
+		{
+			// Straight from the cache
+			l_block->m_size = l_size;
+		}
+		else if (::GetLastError() == ERROR_IO_PENDING)
+		{
+			l_block->m_is_pending = true;
+		}
+		else
+		{
+			l_block->m_pos = -1;
+			break;
+		}
+	}
+}
+
+bool SharedFileHandle::readAhead(void* p_buf, size_t& p_len, int64_t p_pos)
+{
+	// The partial files of the downloads are written at the same time, they are read directly
+	if (m_access != File::READ || p_len == 0)
+		return false;
+	ReadAheadStream* l_stream = nullptr;
+	{
+		CFlyFastLock(m_read_ahead_cs);
+		for (size_t i = 0; i < READ_AHEAD_STREAMS; ++i)
+		{
+			if (m_read_ahead[i].m_next_pos == p_pos && !m_read_ahead[i].m_is_busy)
+			{
+				l_stream = &m_read_ahead[i];
+				break;
+			}
+		}
+		if (!l_stream)
+		{
+			// A new reader or a seek: it takes the stream that has been idle the longest
+			const uint64_t l_now = GET_TICK();
+			for (size_t i = 0; i < READ_AHEAD_STREAMS; ++i)
+			{
+				auto& l_item = m_read_ahead[i];
+				if (l_item.m_is_busy)
+					continue;
+				if (isReadAheadPendingL(l_item))
+				{
+					reclaimReadAheadL(l_item, l_now);
+				}
+				if (!isReadAheadPendingL(l_item) && (!l_stream || l_item.m_last_use < l_stream->m_last_use))
+				{
+					l_stream = &l_item;
+				}
+			}
+			if (l_stream)
+			{
+				l_stream->m_next_pos = p_pos + p_len;
+				l_stream->m_hits = 0;
+				l_stream->m_last_use = ++m_read_ahead_counter;
+				l_stream->m_last_tick = l_now;
+				l_stream->m_blocks[0].m_pos = -1;
+				l_stream->m_blocks[1].m_pos = -1;
+			}
+			return false;
+		}
+		l_stream->m_last_use = ++m_read_ahead_counter;
+		l_stream->m_last_tick = GET_TICK();
+		if (++l_stream->m_hits < READ_AHEAD_MIN_HITS)
+		{
+			l_stream->m_next_pos = p_pos + p_len;
+			return false;
+		}
+		l_stream->m_is_busy = true;
+	}
+	// The stream is ours until m_is_busy is reset: the copy and the next ReadFile
+	// don't hold up the other readers of the file
+	bool l_is_served = false;
+	for (size_t j = 0; j < 2; ++j)
+	{
+		auto& l_block = l_stream->m_blocks[j];
+		if (l_block.m_is_pending)
+		{
+			completeReadAhead(l_block, false);
+		}
+		if (!l_is_served && !l_block.m_is_pending && l_block.m_pos != -1 && l_block.m_pos <= p_pos && p_pos < l_block.m_pos + l_block.m_size)
+		{
+			// A short read at the end of the block, the next one starts in the other block
+			p_len = size_t(std::min<int64_t>(p_len, l_block.m_pos + l_block.m_size - p_pos));
+			memcpy(p_buf, l_block.m_data.get() + (p_pos - l_block.m_pos), p_len);
+			l_is_served = true;
+		}
+	}
+	startReadAhead(*l_stream, p_pos + p_len);
+	{
+		CFlyFastLock(m_read_ahead_cs);
+		l_stream->m_next_pos = p_pos + p_len;
+		l_stream->m_is_busy = false;
+	}
+	return l_is_served;
+}
+
 void SharedFileHandle::init(int64_t p_file_size)
 {
-	m_file.init(Text::toT(m_path), m_access, m_mode, true);
+	// Overlapped: every stream reads and writes at its own offset, nobody waits for a shared file pointer
+	m_file.init(Text::toT(m_path), m_access, m_mode | File::OVERLAPPED, true);
 	m_last_file_size = m_file.getSize();
 	if (p_file_size == 0 && m_last_file_size > 0)
 	{
@@ -234,7 +430,6 @@ size_t SharedFileStream::write(const void* p_buf, size_t p_len)
 #ifdef _DEBUG
 	//LogManager::message("SharedFileStream::write buf = " + Util::toString(int(buf)) + " len " + Util::toString(len));
 #endif
-	CFlyFastLock(m_sfh->m_cs);
 #ifdef _DEBUG
 	{
 		/*
@@ -246,17 +441,17 @@ size_t SharedFileStream::write(const void* p_buf, size_t p_len)
 		*/
 	}
 #endif
+	// The segments never overlap, only the size is shared
 	if (m_sfh->m_map_file_ptr)
 	{
 		memcpy(m_sfh->m_map_file_ptr + m_pos, p_buf, p_len);
-		m_pos += p_len;
 	}
 	else
 	{
-		m_sfh->m_file.setPos(m_pos);
-		m_sfh->m_file.write(p_buf, p_len);
-		m_pos += p_len;
+		m_sfh->m_file.writeAt(p_buf, p_len, m_pos);
 	}
+	m_pos += p_len;
+	CFlyFastLock(m_sfh->m_cs);
 	if (m_sfh->m_last_file_size < m_pos)
 	{
 		dcassert(0);
@@ -267,13 +462,14 @@ size_t SharedFileStream::write(const void* p_buf, size_t p_len)
 
 size_t SharedFileStream::read(void* p_buf, size_t& p_len)
 {
-	CFlyFastLock(m_sfh->m_cs);
 #ifdef _DEBUG
 	//LogManager::message("SharedFileStream::read buf = " + Util::toString(buf) + " len " + Util::toString(len));
 #endif
 	
-	m_sfh->m_file.setPos(m_pos);
-	p_len = m_sfh->m_file.read(p_buf, p_len);
+	if (!m_sfh->readAhead(p_buf, p_len, m_pos))
+	{
+		p_len = m_sfh->m_file.readAt(p_buf, p_len, m_pos);
+	}
 	m_pos += p_len;
 	return p_len;
 }
@@ -289,6 +485,22 @@ int64_t SharedFileStream::getFileSize()
 }
 */
 
+bool SharedFileStream::getFileRange(HANDLE& p_file, int64_t& p_pos, int64_t& p_left)
+{
+	CFlyFastLock(m_sfh->m_cs);
+	if (!m_sfh->m_file.isOpen())
+		return false;
+	p_file = m_sfh->m_file.getHandle();
+	p_pos = m_pos;
+	p_left = m_sfh->m_last_file_size - m_pos;
+	return true;
+}
+
+void SharedFileStream::skipFileRange(int64_t p_len)
+{
+	m_pos += p_len;
+}
+
 int64_t SharedFileStream::getFastFileSize()
 {
 	CFlyFastLock(m_sfh->m_cs);
@@ -338,7 +550,6 @@ size_t SharedFileStream::flushBuffers(bool aForce)
 
 void SharedFileStream::setPos(int64_t p_pos)
 {
-	CFlyFastLock(m_sfh->m_cs);
 #ifdef _DEBUG
 	//LogManager::message("SharedFileStream::setPos aPos = " +  Util::toString(aPos));
 #endif
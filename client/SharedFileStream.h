@@ -35,6 +35,9 @@ struct SharedFileHandle
 		SharedFileHandle(const string& aPath, int aAccess, int aMode);
 		~SharedFileHandle();
 		void init(int64_t p_file_size);
+		/// Serves up to p_len bytes at p_pos from the readahead of a sequential reader
+		/// @return false if the caller has to read the file by itself
+		bool readAhead(void* p_buf, size_t& p_len, int64_t p_pos);
 		
 		FastCriticalSection m_cs;
 		File  m_file;
@@ -48,6 +51,49 @@ struct SharedFileHandle
 		bool m_is_map_file_error;
 	private:
 		void CloseMapFile();
+		
+		// Every sequential reader of the file (up to READ_AHEAD_STREAMS of them, a popular file
+		// is uploaded to 50+ peers at once) gets two blocks: the next block is read in the background
+		// while the reader consumes the current one. The buffers are allocated on the first readahead.
+		enum
+		{
+			READ_AHEAD_STREAMS = 64,
+			READ_AHEAD_BLOCK = 256 * 1024,
+			READ_AHEAD_MIN_HITS = 2, // sequential reads before the readahead starts
+			READ_AHEAD_IDLE_TIME = 30 * 1000 // ms, the pending read of a stream idle for longer is cancelled
+		};
+		struct ReadAheadBlock
+		{
+			ReadAheadBlock() : m_pos(-1), m_size(0), m_is_pending(false)
+			{
+				memzero(&m_ov, sizeof(m_ov));
+			}
+			std::unique_ptr<uint8_t[]> m_data;
+			OVERLAPPED m_ov;
+			int64_t m_pos;
+			DWORD m_size;
+			bool m_is_pending;
+		};
+		struct ReadAheadStream
+		{
+			ReadAheadStream() : m_next_pos(-1), m_hits(0), m_last_use(0), m_last_tick(0), m_is_busy(false)
+			{
+			}
+			int64_t m_next_pos;
+			unsigned m_hits;
+			uint64_t m_last_use;
+			uint64_t m_last_tick;
+			bool m_is_busy; // a reader owns m_blocks and works on them without m_read_ahead_cs
+			ReadAheadBlock m_blocks[2];
+		};
+		bool isReadAheadPendingL(const ReadAheadStream& p_stream) const;
+		void reclaimReadAheadL(ReadAheadStream& p_stream, uint64_t p_now);
+		void completeReadAhead(ReadAheadBlock& p_block, bool p_is_wait);
+		void startReadAhead(ReadAheadStream& p_stream, int64_t p_pos);
+		
+		FastCriticalSection m_read_ahead_cs; // the table of the streams only
+		ReadAheadStream m_read_ahead[READ_AHEAD_STREAMS];
+		uint64_t m_read_ahead_counter;
 };
 
 class SharedFileStream : public IOStream
@@ -75,6 +121,8 @@ class SharedFileStream : public IOStream
 		static void delete_file(const std::string& p_file);
 		static void check_before_destoy();
 		void setPos(int64_t aPos) override;
+		bool getFileRange(HANDLE& p_file, int64_t& p_pos, int64_t& p_left) override;
+		void skipFileRange(int64_t p_len) override;
 	private:
 		std::shared_ptr<SharedFileHandle> m_sfh;
 		int64_t m_pos;
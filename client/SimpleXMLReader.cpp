@@ -21,10 +21,11 @@
 #include "SimpleXMLReader.h"
 #include "SimpleXML.h"
 
-inline static bool isSpace(int c)
-{
-	return c == 0x20 || c == 0x09 || c == 0x0d || c == 0x0a;
-}
+#include "XmlScan.h"
+
+using XmlScan::isSpace;
+using XmlScan::findFirstOf;
+using XmlScan::skipSpaces;
 
 inline static bool inRange(int c, int a, int b)
 {
@@ -98,7 +99,7 @@ bool SimpleXMLReader::error(const char* e)
 	throw SimpleXMLException(Util::toString(pos) + ": " + e);
 }
 
-string SimpleXMLReader::CallBack::getAttrib(StringPairList& attribs, const string& name, size_t hint)
+const string& SimpleXMLReader::CallBack::getAttrib(StringPairList& attribs, const string& name, size_t hint)
 {
 	hint = std::min(hint, attribs.size());
 	
@@ -106,7 +107,7 @@ string SimpleXMLReader::CallBack::getAttrib(StringPairList& attribs, const strin
 	if (i == attribs.end())
 	{
 		i = find_if(attribs.begin(), attribs.begin() + hint, CompareFirst<string, string>(name));
-		return i == (attribs.begin() + hint) ? string() : i->second;
+		return i == (attribs.begin() + hint) ? BaseUtil::emptyString : i->second;
 	}
 	else
 	{
@@ -229,6 +230,11 @@ bool SimpleXMLReader::elementAttr()
 	int c = charAt(0);
 	if (isNameStartChar(c))
 	{
+		if (elementAttrFast())
+		{
+			return true;
+		}
+		
 		attribs.emplace_back(StringPair()); // Hot point - 10%
 		append(attribs.back().first, MAX_NAME_SIZE, c); // MAX_NAME_SIZE - 260
 		
@@ -241,6 +247,47 @@ bool SimpleXMLReader::elementAttr()
 	return false;
 }
 
+/// Whole Name="Value" in the buffer without entities (<File Name=".." Size=".." TTH=".."/> of a file list):
+/// taken in one step instead of going through the states char by char
+bool SimpleXMLReader::elementAttrFast()
+{
+	const char* l_begin = buf.data() + bufPos;
+	const size_t l_size = bufSize();
+	size_t l_eq = 1;
+	while (l_eq < l_size && isNameChar(l_begin[l_eq]))
+	{
+		++l_eq;
+	}
+	if (l_eq + 1 >= l_size || l_begin[l_eq] != '=' || l_eq > MAX_NAME_SIZE)
+	{
+		return false;
+	}
+	const char l_quote = l_begin[l_eq + 1];
+	if (l_quote != '"' && l_quote != '\'')
+	{
+		return false;
+	}
+	const size_t l_value = l_eq + 2;
+	const size_t l_len = findFirstOf(l_begin + l_value, l_size - l_value, l_quote, '&', l_quote);
+	if (l_value + l_len >= l_size || l_begin[l_value + l_len] != l_quote || l_len > MAX_VALUE_SIZE)
+	{
+		return false;
+	}
+	
+	attribs.emplace_back(StringPair());
+	auto& l_attr = attribs.back();
+	l_attr.first.assign(l_begin, l_eq);
+	l_attr.second.assign(l_begin + l_value, l_len);
+	if (!encoding.empty() && encoding != Text::g_utf8)
+	{
+		l_attr.second = Text::toUtf8(l_attr.second, encoding);
+	}
+	// the separator before the next attribute, the state stays STATE_ELEMENT_ATTR
+	const size_t l_end = l_value + l_len + 1;
+	advancePos(l_end + skipSpaces(l_begin + l_end, l_size - l_end));
+	return true;
+}
+
 bool SimpleXMLReader::elementAttrName()
 {
 	size_t i = 0;
@@ -277,12 +324,11 @@ bool SimpleXMLReader::elementAttrName()
 
 bool SimpleXMLReader::elementAttrValue()
 {
-	size_t i = 0;
-	for (size_t iend = bufSize(); i < iend; ++i)
+	const char l_quote = state == STATE_ELEMENT_ATTR_VALUE_APOS ? '\'' : '"';
+	const size_t i = findFirstOf(buf.data() + bufPos, bufSize(), l_quote, '&', l_quote);
+	if (i < bufSize())
 	{
-		const int c = charAt(i);
-		
-		if ((state == STATE_ELEMENT_ATTR_VALUE_APOS && c == '\'') || (state == STATE_ELEMENT_ATTR_VALUE_QUOT && c == '"'))
+		if (charAt(i) == l_quote)
 		{
 			append(attribs.back().second, MAX_VALUE_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
 			
@@ -295,7 +341,7 @@ bool SimpleXMLReader::elementAttrValue()
 			advancePos(i + 1);
 			return true;
 		}
-		else if (c == '&')
+		else
 		{
 			append(attribs.back().second, MAX_VALUE_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
 			advancePos(i);
@@ -441,21 +487,24 @@ bool SimpleXMLReader::comment()
 {
 	while (bufSize() > 0)
 	{
-		int c = charAt(0);
+		// skip to the next '-'
+		const size_t l_dash = findFirstOf(buf.data() + bufPos, bufSize(), '-', '-', '-');
+		advancePos(l_dash);
+		if (bufSize() == 0)
+		{
+			break;
+		}
 		
 		// TODO We shouldn't allow ---> to end a comment
-		if (c == '-')
+		if (!needChars(3))
 		{
-			if (!needChars(3))
-			{
-				return true;
-			}
-			if (charAt(1) == '-' && charAt(2) == '>')
-			{
-				state = STATE_CONTENT;
-				advancePos(3);
-				return true;
-			}
+			return true;
+		}
+		if (charAt(1) == '-' && charAt(2) == '>')
+		{
+			state = STATE_CONTENT;
+			advancePos(3);
+			return true;
 		}
 		
 		advancePos(1);
@@ -468,21 +517,23 @@ bool SimpleXMLReader::cdata()
 {
 	while (bufSize() > 0)
 	{
-		int c = charAt(0);
+		// skip to the next ']'
+		const size_t l_bracket = findFirstOf(buf.data() + bufPos, bufSize(), ']', ']', ']');
+		advancePos(l_bracket);
+		if (bufSize() == 0)
+		{
+			break;
+		}
 		
-		// TODO We shouldn't allow ---> to end a comment
-		if (c == ']')
+		if (!needChars(2))
 		{
-			if (!needChars(2))
-			{
-				return true;
-			}
-			if (charAt(1) == ']')
-			{
-				state = STATE_CONTENT;
-				advancePos(2);
-				return true;
-			}
+			return true;
+		}
+		if (charAt(1) == ']')
+		{
+			state = STATE_CONTENT;
+			advancePos(2);
+			return true;
 		}
 		
 		advancePos(1);
@@ -608,9 +659,11 @@ bool SimpleXMLReader::content()
 		return entref(value);
 	}
 	
-	append(value, MAX_VALUE_SIZE, c);
+	// the text up to the next markup or entity
+	const size_t l_len = findFirstOf(buf.data() + bufPos, bufSize(), '<', '&', '<');
+	append(value, MAX_VALUE_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + l_len);
 	
-	advancePos(1);
+	advancePos(l_len);
 	
 	return true;
 }
@@ -669,19 +722,17 @@ bool SimpleXMLReader::skipSpace(bool store)
 	{
 		return true;
 	}
-	bool skipped = false;
-	int c;
-	while (needChars(1) && isSpace(c = charAt(0)))
+	const size_t l_len = skipSpaces(buf.data() + bufPos, bufSize());
+	if (l_len == 0)
 	{
-		if (store)
-		{
-			append(value, MAX_VALUE_SIZE, c);
-		}
-		advancePos();
-		skipped = true;
+		return false;
 	}
-	
-	return skipped;
+	if (store)
+	{
+		append(value, MAX_VALUE_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + l_len);
+	}
+	advancePos(l_len);
+	return true;
 }
 
 
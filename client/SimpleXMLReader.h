@@ -36,7 +36,7 @@ class SimpleXMLReader
 				virtual void endTag(const std::string& name, const std::string& data) = 0;
 				
 			protected:
-				static std::string getAttrib(StringPairList& attribs, const std::string& name, size_t hint);
+				static const std::string& getAttrib(StringPairList& attribs, const std::string& name, size_t hint);
 		};
 		
 		explicit SimpleXMLReader(CallBack* callback);
@@ -174,6 +174,7 @@ class SimpleXMLReader
 		bool elementEndSimple();
 		bool elementEndComplex();
 		bool elementAttr();
+		bool elementAttrFast();
 		bool elementAttrName();
 		bool elementAttrValue();
 		
@@ -23,6 +23,7 @@
 #include "ResourceManager.h"
 #include "CompatibilityManager.h"
 #include <iphlpapi.h>
+#include <mswsock.h>
 
 #include "../FlyFeatures/flyServer.h"
 
@@ -582,7 +583,7 @@ int Socket::write(const void* aBuffer, int aLen)
 * Sends data, will block until all data has been sent or an exception occurs
 * @param aBuffer Buffer with data
 * @param aLen Data length
-* @throw SocketExcpetion Send failed.
+* @throw SocketException Send failed.
 */
 int Socket::writeTo(const string& aAddr, uint16_t aPort, const void* aBuffer, int aLen, bool proxy)
 {
@@ -693,9 +694,96 @@ int Socket::writeTo(const string& aAddr, uint16_t aPort, const void* aBuffer, in
 		g_stats.m_udp.totalUp += sent;
 	else
 		g_stats.m_tcp.totalUp += sent;
+	++g_stats.m_udp_write.m_calls;
+	++g_stats.m_udp_write.m_packets;
 	return sent;
 }
 
+bool Socket::isTransmitFileEnabled()
+{
+	switch (SETTING(TRANSMIT_FILE_MODE))
+	{
+		case 0:
+			return false;
+		case 1:
+			// Client editions of Windows run only two TransmitFile/TransmitPackets calls at a time and queue the rest
+			return CompatibilityManager::getOsType() != VER_NT_WORKSTATION;
+		default:
+			return true;
+	}
+}
+
+static LPFN_TRANSMITPACKETS findTransmitPackets(SOCKET p_sock)
+{
+	LPFN_TRANSMITPACKETS l_transmit_packets = nullptr;
+	GUID l_guid = WSAID_TRANSMITPACKETS;
+	DWORD l_size = 0;
+	if (::WSAIoctl(p_sock, SIO_GET_EXTENSION_FUNCTION_POINTER, &l_guid, sizeof(l_guid), &l_transmit_packets, sizeof(l_transmit_packets), &l_size, NULL, NULL) != 0)
+		return nullptr;
+	return l_transmit_packets;
+}
+
+void Socket::writeBatchTo(const string& aIp, uint16_t aPort, const StringList& p_packets)
+{
+	if (m_sock == INVALID_SOCKET)
+	{
+		create(TYPE_UDP);
+		setSocketOpt(SO_SNDTIMEO, 250);
+	}
+	dcassert(m_type == TYPE_UDP);
+	// All the UDP sockets share the provider, so one lookup does
+	static const LPFN_TRANSMITPACKETS l_transmit_packets = findTransmitPackets(m_sock);
+	if (p_packets.size() < 2 || !l_transmit_packets || !isTransmitFileEnabled() ||
+	        SETTING(OUTGOING_CONNECTIONS) == SettingsManager::OUTGOING_SOCKS5)
+	{
+		for (auto i = p_packets.cbegin(); i != p_packets.cend(); ++i)
+		{
+			writeTo(aIp, aPort, *i);
+		}
+		return;
+	}
+	if (aIp.empty() || aPort == 0)
+	{
+		throw SocketException(EADDRNOTAVAIL);
+	}
+	sockaddr_in l_addr = { 0 };
+	l_addr.sin_family = AF_INET;
+	l_addr.sin_port = htons(aPort);
+	l_addr.sin_addr.s_addr = inet_addr(resolve(aIp).c_str());
+	
+	std::vector<TRANSMIT_PACKETS_ELEMENT> l_elements(p_packets.size());
+	uint64_t l_size = 0;
+	for (size_t i = 0; i < p_packets.size(); ++i)
+	{
+		// EOP keeps every element a datagram of its own
+		l_elements[i].dwElFlags = TP_ELEMENT_MEMORY | TP_ELEMENT_EOP;
+		l_elements[i].cLength = ULONG(p_packets[i].size());
+		l_elements[i].pBuffer = const_cast<char*>(p_packets[i].data());
+		l_size += p_packets[i].size();
+	}
+	check(::connect(m_sock, (struct sockaddr*) &l_addr, sizeof(l_addr)));
+	const BOOL l_is_ok = l_transmit_packets(m_sock, &l_elements[0], DWORD(l_elements.size()), 0, NULL, TF_USE_DEFAULT_WORKER);
+	const int l_error = l_is_ok ? 0 : getLastError();
+	// A zero address dissolves the association, writeTo works to any address again
+	sockaddr_in l_any = { 0 };
+	l_any.sin_family = AF_INET;
+	::connect(m_sock, (struct sockaddr*) &l_any, sizeof(l_any));
+	if (!l_is_ok)
+	{
+		// Some layered providers don't do TransmitPackets on UDP: one sendto per packet then,
+		// a packet that did go out twice is only a duplicate search result
+		dcdebug("Socket::writeBatchTo TransmitPackets error = %d\n", l_error);
+		for (auto i = p_packets.cbegin(); i != p_packets.cend(); ++i)
+		{
+			writeTo(aIp, aPort, *i);
+		}
+		return;
+	}
+	g_stats.m_udp.totalUp += l_size;
+	++g_stats.m_udp_write.m_calls;
+	g_stats.m_udp_write.m_packets += p_packets.size();
+}
+
 /**
  * Blocks until timeout is reached one of the specified conditions have been fulfilled
  * @param millis Max milliseconds to block.
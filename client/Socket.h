@@ -80,6 +80,7 @@ class SocketException : public Exception
 };
 
 class ServerSocket;
+class TokenBucket;
 
 class Socket
 {
@@ -106,13 +107,13 @@ class Socket
 		};
 		
 		Socket() : m_sock(INVALID_SOCKET), connected(false)
-			, m_maxSpeed(0), m_currentBucket(0)
+			, m_maxSpeed(0)
 			, m_type(TYPE_TCP), port(0)
 			, m_proto(PROTO_DEFAULT)
 		{
 		}
 		Socket(const string& aIp, uint16_t aPort) : m_sock(INVALID_SOCKET), connected(false)
-			, m_maxSpeed(0), m_currentBucket(0)
+			, m_maxSpeed(0)
 			, m_type(TYPE_TCP)
 			, m_proto(PROTO_DEFAULT)
 		{
@@ -150,7 +151,7 @@ class Socket
 		 * Sends data, will block until all data has been sent or an exception occurs
 		 * @param aBuffer Buffer with data
 		 * @param aLen Data length
-		 * @throw SocketExcpetion Send failed.
+		 * @throw SocketException Send failed.
 		 */
 		int writeAll(const void* aBuffer, int aLen, uint64_t timeout = 0);
 		virtual int write(const void* aBuffer, int aLen);
@@ -164,6 +165,12 @@ class Socket
 			dcassert(aData.length());
 			return writeTo(aIp, aPort, aData.data(), (int)aData.length());
 		}
+		/**
+		 * Sends every packet as a datagram of its own to one address. Without the proxy the whole batch
+		 * goes out with one TransmitPackets call on the temporarily connected socket, if isTransmitFileEnabled().
+		 * @throw SocketException Send failed.
+		 */
+		void writeBatchTo(const string& aIp, uint16_t aPort, const StringList& p_packets);
 		virtual void shutdown() noexcept;
 		virtual void close() noexcept;
 		void disconnect() noexcept;
@@ -197,6 +204,11 @@ class Socket
 		int readAll(void* aBuffer, int aBufLen, uint64_t timeout = 0);
 		
 		virtual std::pair<bool, bool> wait(uint64_t millis, bool checkRead, bool checkWrite);
+		/** Data that was already pulled off the wire and will not show up in poll() */
+		virtual bool hasPendingRead() const noexcept
+		{
+			return false;
+		}
 		bool isConnected()
 		{
 			return connected;
@@ -283,6 +295,8 @@ class Socket
 		/** When socks settings are updated, this has to be called... */
 		static void socksUpdated();
 		static string getRemoteHost(const string& aIp);
+		/// TransmitFile and TransmitPackets by TRANSMIT_FILE_MODE, mode 1 turns them on for the server editions only
+		static bool isTransmitFileEnabled();
 		
 		GETSET(string, ip, Ip);
 		GETSET(uint16_t, port, Port);
@@ -291,12 +305,19 @@ class Socket
 		Protocol m_proto;
 		
 		GETSET(int64_t, m_maxSpeed, MaxSpeed);
-		GETSET(int64_t, m_currentBucket, CurrentBucket);
-		void updateSocketBucket(unsigned int p_numberOfUserConnection)
+		// upload bucket of the remote user (see ThrottleManager::getUserUploadBucket), nullptr - only the global limit
+		const std::shared_ptr<TokenBucket>& getUploadBucket() const
+		{
+			return m_upload_bucket;
+		}
+		void setUploadBucket(const std::shared_ptr<TokenBucket>& p_bucket)
 		{
-			m_currentBucket = getMaxSpeed() / p_numberOfUserConnection;
+			m_upload_bucket = p_bucket;
 		}
 		
+	private:
+		std::shared_ptr<TokenBucket> m_upload_bucket;
+		
 	protected:
 		socket_t getSock() const;
 		
@@ -311,11 +332,21 @@ class Socket
 			{
 			}
 		};
+		struct BatchStatsItem
+		{
+			uint64_t m_calls;
+			uint64_t m_packets;
+			BatchStatsItem() : m_calls(0), m_packets(0)
+			{
+			}
+		};
 		struct Stats
 		{
 			StatsItem m_tcp;
 			StatsItem m_udp;
 			StatsItem m_ssl;
+			BatchStatsItem m_udp_read; // datagrams handed over per wake-up of the reader
+			BatchStatsItem m_udp_write; // datagrams per send call
 		};
 		
 		static string g_udpServer;
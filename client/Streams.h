@@ -82,6 +82,16 @@ class InputStream
 		virtual size_t read(void* p_buf, size_t& p_len) = 0;
 		/* This only works for file streams */
 		virtual void setPos(int64_t /*p_pos*/) { }
+		/**
+		 * For streams that pass a file through unchanged: the file handle, the offset of the next read
+		 * and the number of bytes the stream will still give. Lets BufferedSocket send them with TransmitFile.
+		 */
+		virtual bool getFileRange(HANDLE& /*p_file*/, int64_t& /*p_pos*/, int64_t& /*p_left*/)
+		{
+			return false;
+		}
+		/* Moves past p_len bytes that were sent straight from the file */
+		virtual void skipFileRange(int64_t /*p_len*/) { }
 		
 		virtual void clean_stream()
 		{
@@ -157,6 +167,19 @@ class LimitedInputStream : public InputStream
 			maxBytes -= x;
 			return x;
 		}
+		bool getFileRange(HANDLE& p_file, int64_t& p_pos, int64_t& p_left) override
+		{
+			if (!s->getFileRange(p_file, p_pos, p_left))
+				return false;
+			p_left = std::min(p_left, maxBytes);
+			return true;
+		}
+		void skipFileRange(int64_t p_len) override
+		{
+			dcassert(p_len <= maxBytes);
+			maxBytes -= p_len;
+			s->skipFileRange(p_len);
+		}
 		void clean_stream() override
 		{
 			s = nullptr;
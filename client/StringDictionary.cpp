@@ -0,0 +1,77 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include "stdinc.h"
+#include "StringDictionary.h"
+
+StringDictionary::StringDictionary() : m_next_id(1)
+{
+	for (size_t i = 0; i < g_max_chunks; ++i)
+	{
+		m_chunks[i].store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+StringDictionary::~StringDictionary()
+{
+	for (size_t i = 0; i < g_max_chunks; ++i)
+	{
+		delete[] m_chunks[i].load(std::memory_order_relaxed);
+	}
+}
+
+StringDictionary::Slot* StringDictionary::getChunk(Id p_id)
+{
+	auto& l_chunk = m_chunks[p_id >> g_chunk_bits];
+	Slot* l_result = l_chunk.load(std::memory_order_acquire);
+	if (!l_result)
+	{
+		CFlyFastLock(m_cs_chunks);
+		l_result = l_chunk.load(std::memory_order_relaxed);
+		if (!l_result)
+		{
+			l_result = new Slot[g_chunk_size];
+			for (size_t i = 0; i < g_chunk_size; ++i)
+			{
+				l_result[i].store(nullptr, std::memory_order_relaxed);
+			}
+			l_chunk.store(l_result, std::memory_order_release);
+		}
+	}
+	return l_result;
+}
+
+StringDictionary::Id StringDictionary::intern(const string& p_val)
+{
+	if (p_val.empty())
+		return 0;
+	Shard& l_shard = m_shards[std::hash<string>()(p_val) % g_shards];
+	CFlyFastLock(l_shard.m_cs);
+	const auto l_found = l_shard.m_index.find(p_val);
+	if (l_found != l_shard.m_index.end())
+		return l_found->second;
+	const Id l_id = m_next_id.fetch_add(1, std::memory_order_relaxed);
+	if (l_id >= g_max_chunks * g_chunk_size)
+	{
+		dcassert(0);
+		return 0;
+	}
+	const auto l_item = l_shard.m_index.insert(std::make_pair(p_val, l_id));
+	dcassert(l_item.second);
+	getChunk(l_id)[l_id & (g_chunk_size - 1)].store(&l_item.first->first, std::memory_order_release);
+	return l_id;
+}
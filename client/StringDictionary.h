@@ -0,0 +1,76 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_STRING_DICTIONARY_H
+#define DCPLUSPLUS_DCPP_STRING_DICTIONARY_H
+
+#include <atomic>
+#include "BaseUtil.h"
+#include "CFlyThread.h"
+
+/**
+ * Append-only intern table: equal strings get the same id for the lifetime of the process.
+ * get() takes no lock, an id is published only after its string is in place.
+ * intern() locks one of g_shards shards chosen by the hash of the value.
+ * Id 0 is the empty string, also returned when the table is full (64M distinct values).
+ */
+class StringDictionary
+{
+	public:
+		typedef uint32_t Id;
+		
+		StringDictionary();
+		~StringDictionary();
+		
+		Id intern(const string& p_val);
+		const string& get(Id p_id) const
+		{
+			if (p_id == 0)
+				return BaseUtil::emptyString;
+			const auto l_chunk = m_chunks[p_id >> g_chunk_bits].load(std::memory_order_acquire);
+			dcassert(l_chunk);
+			return *l_chunk[p_id & (g_chunk_size - 1)].load(std::memory_order_acquire);
+		}
+		size_t size() const
+		{
+			return m_next_id.load(std::memory_order_relaxed) - 1;
+		}
+		
+	private:
+		static const unsigned g_shards = 64;
+		static const unsigned g_chunk_bits = 14;
+		static const size_t g_chunk_size = size_t(1) << g_chunk_bits;
+		static const size_t g_max_chunks = 4096;
+		typedef std::atomic<const string*> Slot;
+		
+		struct Shard
+		{
+			FastCriticalSection m_cs;
+			std::unordered_map<string, Id> m_index; // the keys are the stored strings, nodes never move
+		};
+		Shard m_shards[g_shards];
+		std::atomic<Id> m_next_id;
+		FastCriticalSection m_cs_chunks;
+		std::atomic<Slot*> m_chunks[g_max_chunks];
+		
+		Slot* getChunk(Id p_id);
+};
+
+#endif // !defined(DCPLUSPLUS_DCPP_STRING_DICTIONARY_H)
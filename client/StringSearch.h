@@ -29,7 +29,7 @@
  * one pattern against many strings (currently Quick Search, a variant of
  * Boyer-Moore. Code based on "A very fast substring search algorithm" by
  * D. Sunday).
- * @todo Perhaps find an algo suitable for matching multiple substrings.
+ * @see MultiStringSearch for matching several substrings in one pass.
  */
 class StringSearch
 {
@@ -127,6 +127,173 @@ class StringSearch
 		}
 };
 
+/**
+ * Aho-Corasick automaton over several patterns: a single pass over a lower-cased text
+ * tells which of the patterns it contains. Each pattern gets one bit of the returned mask,
+ * patterns after the first MAX_PATTERNS get no bit and are ignored.
+ * Bytes that occur in no pattern share one input class, so the transition table stays small.
+ */
+class MultiStringSearch
+{
+	public:
+		typedef uint64_t Mask;
+		static const size_t MAX_PATTERNS = 64;
+		
+		MultiStringSearch() : m_class_count(1), m_mask(0), m_empty_mask(0)
+		{
+			memzero(m_class, sizeof(m_class));
+		}
+		explicit MultiStringSearch(const StringSearch::List& p_patterns) : m_class_count(1), m_mask(0), m_empty_mask(0)
+		{
+			memzero(m_class, sizeof(m_class));
+			for (auto i = p_patterns.cbegin(); i != p_patterns.cend(); ++i)
+			{
+				add(*i);
+			}
+			compile();
+		}
+		
+		/** @return the bit of the pattern, 0 if there is no room for it */
+		Mask add(const string& p_pattern)
+		{
+			if (m_patterns.size() == MAX_PATTERNS)
+			{
+				return 0;
+			}
+			const Mask l_bit = Mask(1) << m_patterns.size();
+			m_patterns.push_back(Text::toLower(p_pattern));
+			m_mask |= l_bit;
+			return l_bit;
+		}
+		Mask add(const StringSearch& p_search)
+		{
+			return add(p_search.getPattern());
+		}
+		void clear()
+		{
+			m_patterns.clear();
+			m_table.clear();
+			m_output.clear();
+			memzero(m_class, sizeof(m_class));
+			m_class_count = 1;
+			m_mask = 0;
+			m_empty_mask = 0;
+		}
+		bool empty() const
+		{
+			return m_patterns.empty();
+		}
+		/** Bits of all added patterns */
+		Mask getMask() const
+		{
+			return m_mask;
+		}
+		/** Builds the automaton, call after the last add() */
+		void compile()
+		{
+			m_class_count = 1;
+			memzero(m_class, sizeof(m_class));
+			m_empty_mask = 0;
+			for (auto i = m_patterns.cbegin(); i != m_patterns.cend(); ++i)
+			{
+				for (auto c = i->cbegin(); c != i->cend(); ++c)
+				{
+					uint16_t& l_class = m_class[uint8_t(*c)];
+					if (l_class == 0)
+					{
+						l_class = uint16_t(m_class_count++);
+					}
+				}
+			}
+			// Trie, a missing edge is 0 since no pattern leads back to the root
+			m_table.assign(m_class_count, 0);
+			m_output.assign(1, 0);
+			for (size_t i = 0; i < m_patterns.size(); ++i)
+			{
+				uint32_t l_state = 0;
+				for (auto c = m_patterns[i].cbegin(); c != m_patterns[i].cend(); ++c)
+				{
+					uint32_t& l_next = m_table[l_state * m_class_count + m_class[uint8_t(*c)]];
+					if (l_next == 0)
+					{
+						l_next = uint32_t(m_output.size());
+						m_output.push_back(0);
+						m_table.resize(m_table.size() + m_class_count, 0);
+					}
+					l_state = m_table[l_state * m_class_count + m_class[uint8_t(*c)]]; // m_table may have moved
+				}
+				m_output[l_state] |= Mask(1) << i;
+				if (l_state == 0)
+				{
+					m_empty_mask |= Mask(1) << i; // an empty pattern is found in every text
+				}
+			}
+			// Breadth first, turn the trie into a DFA following the failure links
+			std::vector<uint32_t> l_fail(m_output.size(), 0);
+			std::vector<uint32_t> l_queue;
+			l_queue.reserve(m_output.size());
+			for (size_t c = 0; c < m_class_count; ++c)
+			{
+				if (m_table[c])
+				{
+					l_queue.push_back(m_table[c]);
+				}
+			}
+			for (size_t q = 0; q < l_queue.size(); ++q)
+			{
+				const uint32_t l_state = l_queue[q];
+				m_output[l_state] |= m_output[l_fail[l_state]];
+				for (size_t c = 0; c < m_class_count; ++c)
+				{
+					uint32_t& l_next = m_table[l_state * m_class_count + c];
+					const uint32_t l_fail_next = m_table[l_fail[l_state] * m_class_count + c];
+					if (l_next)
+					{
+						l_fail[l_next] = l_fail_next;
+						l_queue.push_back(l_next);
+					}
+					else
+					{
+						l_next = l_fail_next;
+					}
+				}
+			}
+		}
+		/** @return bits of the patterns found in the text */
+		Mask matchLower(const string& aText) const noexcept
+		{
+			dcassert(Text::toLower(aText) == aText);
+			dcassert(!m_table.empty() || m_patterns.empty());
+			Mask l_found = m_empty_mask;
+			if (m_table.empty())
+			{
+				return l_found;
+			}
+			const uint8_t* p = (const uint8_t*)aText.data();
+			const uint8_t* end = p + aText.size();
+			for (uint32_t l_state = 0; p != end; ++p)
+			{
+				l_state = m_table[l_state * m_class_count + m_class[*p]];
+				l_found |= m_output[l_state];
+			}
+			return l_found;
+		}
+		Mask match(const string& aText) const noexcept
+		{
+			string lower;
+			Text::toLower(aText, lower);
+			return matchLower(lower);
+		}
+	private:
+		StringList m_patterns;
+		std::vector<uint32_t> m_table;  // [state * m_class_count + class] -> state
+		std::vector<Mask> m_output;     // patterns ending in the state, failure links included
+		uint16_t m_class[256];
+		size_t m_class_count;
+		Mask m_mask;
+		Mask m_empty_mask;
+};
+
 #endif // DCPLUSPLUS_DCPP_STRING_SEARCH_H
 
 /**
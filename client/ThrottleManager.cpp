@@ -21,27 +21,106 @@
 
 #include "DownloadManager.h"
 #include "UploadManager.h"
+#include "FavoriteManager.h"
+#include "ClientManager.h"
 
-#include <boost/date_time/posix_time/posix_time.hpp>
-#ifdef FLYLINKDC_USE_BOOST_LOCK
-// #include <boost/thread/condition_variable.hpp>
-// #include <boost/thread.hpp>
-// #include <boost/detail/lightweight_mutex.hpp>
-#endif
+TokenBucket::TokenBucket(const std::shared_ptr<TokenBucket>& p_parent) : m_limit(0), m_last_refill(0), m_parent(p_parent)
+{
+	for (unsigned i = 0; i < SHARDS; ++i)
+	{
+		m_shards[i].m_tokens = 0;
+	}
+}
+
+bool TokenBucket::isLimited() const
+{
+	return m_limit > 0 || (m_parent && m_parent->isLimited());
+}
+
+void TokenBucket::refill()
+{
+	const uint64_t l_now = GET_TICK();
+	uint64_t l_last = m_last_refill.load(std::memory_order_relaxed);
+	if (l_now < l_last + REFILL_INTERVAL)
+		return;
+	// only the thread that moves the mark adds the tokens for the elapsed time
+	if (!m_last_refill.compare_exchange_strong(l_last, l_now))
+		return;
+		
+	const int64_t l_limit = m_limit;
+	const int64_t l_elapsed = int64_t(std::min(l_now - l_last, BURST));
+	const int64_t l_add = l_limit * l_elapsed / 1000;
+	const int64_t l_cap = std::max(l_limit * int64_t(BURST) / 1000 / SHARDS, int64_t(1));
+	for (unsigned i = 0; i < SHARDS; ++i)
+	{
+		const int64_t l_share = l_add / SHARDS + (int64_t(i) < l_add % SHARDS ? 1 : 0);
+		auto& l_tokens = m_shards[i].m_tokens;
+		int64_t l_have = l_tokens.load(std::memory_order_relaxed);
+		while (!l_tokens.compare_exchange_weak(l_have, std::min(l_have + l_share, l_cap), std::memory_order_relaxed))
+		{
+		}
+	}
+}
+
+size_t TokenBucket::takeLocal(size_t p_len)
+{
+	refill();
+	// own core's shard first, then whatever the others have left
+	const unsigned l_first = getShard();
+	for (unsigned i = 0; i < SHARDS; ++i)
+	{
+		auto& l_tokens = m_shards[(l_first + i) % SHARDS].m_tokens;
+		int64_t l_have = l_tokens.load(std::memory_order_relaxed);
+		while (l_have > 0)
+		{
+			const int64_t l_take = std::min(l_have, int64_t(p_len));
+			if (l_tokens.compare_exchange_weak(l_have, l_have - l_take, std::memory_order_relaxed))
+				return size_t(l_take);
+		}
+	}
+	return 0;
+}
 
-#define CONDWAIT_TIMEOUT        250
+size_t TokenBucket::take(size_t p_len)
+{
+	size_t l_granted = m_limit > 0 ? takeLocal(p_len) : p_len;
+	if (l_granted && m_parent)
+	{
+		const size_t l_parent_granted = m_parent->take(l_granted);
+		if (l_parent_granted < l_granted && m_limit > 0)
+		{
+			m_shards[getShard()].m_tokens += int64_t(l_granted - l_parent_granted);
+		}
+		l_granted = l_parent_granted;
+	}
+	return l_granted;
+}
+
+void TokenBucket::giveBack(size_t p_len)
+{
+	if (m_limit > 0)
+	{
+		m_shards[getShard()].m_tokens += int64_t(p_len);
+	}
+	if (m_parent)
+	{
+		m_parent->giveBack(p_len);
+	}
+}
 
-ThrottleManager::ThrottleManager(void) : downTokens(0), upTokens(0), downLimit(0), upLimit(0)
+ThrottleManager::ThrottleManager(void) : m_down_bucket(std::make_shared<TokenBucket>()), m_up_bucket(std::make_shared<TokenBucket>())
 {
 }
 
 ThrottleManager::~ThrottleManager(void)
 {
 	TimerManager::getInstance()->removeListener(this);
-	
-	// release conditional variables on exit
-	downCond.notify_all();
-	upCond.notify_all();
+}
+
+void ThrottleManager::waitForTokens()
+{
+	// buckets are refilled from the clock, nothing to be woken up by
+	Thread::sleep(DWORD(TokenBucket::REFILL_INTERVAL));
 }
 
 /*
@@ -49,34 +128,25 @@ ThrottleManager::~ThrottleManager(void)
  */
 int ThrottleManager::read(Socket* sock, void* buffer, size_t len)
 {
-	const size_t downs = downLimit ? DownloadManager::getDownloadCount() : 0;
-	if (downLimit == 0 || downs == 0)
+	const size_t downs = m_down_bucket->isLimited() ? DownloadManager::getDownloadCount() : 0;
+	if (downs == 0)
 		return sock->read(buffer, len);
 		
-	boost::unique_lock<boost::mutex> lock(downMutex);
-	
-	if (downTokens > 0)
+	const size_t slice = std::max(getDownloadLimitInBytes() / downs, size_t(1));
+	const size_t l_granted = m_down_bucket->take(std::min(len, slice));
+	if (l_granted == 0)
 	{
-		const size_t slice = getDownloadLimitInBytes() / downs;
-		size_t readSize = std::min(slice, std::min(len, downTokens));
-		
-		// read from socket
-		readSize = sock->read(buffer, readSize);
-		
-		if (readSize > 0)
-			downTokens -= readSize;
-			
-		// next code can't be in critical section, so we must unlock here
-		lock.unlock();
-		
-		// give a chance to other transfers to get a token
-		Thread::yield();
-		return readSize;
+		waitForTokens();
+		return -1;  // from BufferedSocket: -1 = retry, 0 = connection close
 	}
 	
-	// no tokens, wait for them
-	downCond.timed_wait(lock, boost::posix_time::millisec(CONDWAIT_TIMEOUT));
-	return -1;  // from BufferedSocket: -1 = retry, 0 = connection close
+	// read from socket
+	const int readSize = sock->read(buffer, l_granted);
+	if (readSize < int(l_granted))
+	{
+		m_down_bucket->giveBack(l_granted - std::max(readSize, 0));
+	}
+	return readSize;
 }
 
 /*
@@ -85,57 +155,87 @@ int ThrottleManager::read(Socket* sock, void* buffer, size_t len)
  */
 int ThrottleManager::write(Socket* p_sock, const void* p_buffer, size_t& p_len)
 {
-	const auto currentMaxSpeed = p_sock->getMaxSpeed();
-	if (currentMaxSpeed < 0) // SU
+	if (!acquireUpload(p_sock, p_len))
+		return 0;   // from BufferedSocket: -1 = failed, 0 = retry
+		
+	// write to socket
+	const int sent = p_sock->write(p_buffer, p_len);
+	
+	// -1 is retried with the same data outside of the throttling, so its tokens stay spent
+	if (sent > 0 && size_t(sent) < p_len && p_sock->getMaxSpeed() >= 0)
 	{
-		// write to socket
-		const int sent = p_sock->write(p_buffer, p_len);
-		return sent;
+		const auto& l_bucket = p_sock->getUploadBucket();
+		(l_bucket ? l_bucket : m_up_bucket)->giveBack(p_len - sent);
 	}
-	else if (currentMaxSpeed > 0) // individual
+	return sent;
+}
+
+bool ThrottleManager::acquireUpload(Socket* p_sock, size_t& p_len)
+{
+	if (p_sock->getMaxSpeed() < 0) // SU
 	{
-		// Apply individual restriction to the user if it is
-		const int64_t l_currentBucket = p_sock->getCurrentBucket();
-		p_len = std::min(p_len, static_cast<size_t>(l_currentBucket));
-		p_sock->setCurrentBucket(l_currentBucket - p_len);
-		
-		// write to socket
-		const int sent = p_sock->write(p_buffer, p_len);
-		return sent;
+		return true;
+	}
+	// user bucket (individual limit) -> hub bucket -> global bucket
+	const auto& l_user_bucket = p_sock->getUploadBucket();
+	TokenBucket* l_bucket = l_user_bucket ? l_user_bucket.get() : m_up_bucket.get();
+	if (!l_bucket->isLimited())
+	{
+		return true;
+	}
+	
+	const size_t ups = UploadManager::getUploadCount();
+	if (ups && m_up_bucket->getLimit() > 0)
+	{
+		// share of the global limit, so that one transfer can't drain the bucket for the others
+		p_len = std::min(p_len, std::max(getUploadLimitInBytes() / ups, size_t(1)));
 	}
-	else // general
+	p_len = l_bucket->take(p_len);
+	if (p_len == 0)
+	{
+		// no tokens, wait for them
+		waitForTokens();
+		return false;
+	}
+	return true;
+}
+
+std::shared_ptr<TokenBucket> ThrottleManager::getUserUploadBucket(const CID& p_cid, const string& p_hub_url)
+{
+	CFlyFastLock(m_cs);
+	auto& l_user = m_user_buckets[p_cid];
+	auto l_bucket = l_user.lock();
+	if (!l_bucket)
 	{
-		if (upLimit == 0 || UploadManager::getUploadCount() == 0)
+		std::shared_ptr<TokenBucket> l_parent = m_up_bucket;
+		const FavoriteHubEntry* l_hub = p_hub_url.empty() ? nullptr : FavoriteManager::getFavoriteHubEntry(p_hub_url);
+		if (l_hub && l_hub->getUploadLimit() > 0)
 		{
-			const int sent = p_sock->write(p_buffer, p_len);
-			return sent;
+			auto& l_hub_weak = m_hub_buckets[p_hub_url];
+			l_parent = l_hub_weak.lock();
+			if (!l_parent)
+			{
+				l_parent = std::make_shared<TokenBucket>(m_up_bucket);
+				l_hub_weak = l_parent;
+			}
+			l_parent->setLimit(int64_t(l_hub->getUploadLimit()) * 1024);
 		}
-		
-		boost::unique_lock<boost::mutex> lock(upMutex);
-		if (upTokens > 0)
+		l_bucket = std::make_shared<TokenBucket>(l_parent);
+		l_user = l_bucket;
+	}
+	return l_bucket;
+}
+
+void ThrottleManager::setUserUploadLimit(const CID& p_cid, int64_t p_limit)
+{
+	CFlyFastLock(m_cs);
+	const auto i = m_user_buckets.find(p_cid);
+	if (i != m_user_buckets.end())
+	{
+		if (const auto l_bucket = i->second.lock())
 		{
-			const size_t ups = UploadManager::getUploadCount();
-			const size_t slice = getUploadLimitInBytes() / (ups ? ups : 1);
-			p_len = std::min(slice, std::min(p_len, upTokens));
-			
-			// Pour buckets of the calculated number of bytes,
-			// but as a real restriction on the specified number of bytes
-			upTokens -= p_len;
-			
-			// next code can't be in critical section, so we must unlock here
-			lock.unlock();
-			
-			// write to socket
-			const int sent = p_sock->write(p_buffer, p_len);
-			
-			// give a chance to other transfers to get a token
-			Thread::yield();
-			return sent;
+			l_bucket->setLimit(p_limit);
 		}
-		
-		// no tokens, wait for them
-		upCond.timed_wait(lock, boost::posix_time::millisec(CONDWAIT_TIMEOUT));
-		return 0;   // from BufferedSocket: -1 = failed, 0 = retry
 	}
 }
 
@@ -146,28 +246,37 @@ void ThrottleManager::on(TimerManagerListener::Second, uint64_t /*aTick*/) noexc
 		return;
 	if (!BOOLSETTING(THROTTLE_ENABLE))
 	{
-		downLimit = 0;
-		upLimit = 0;
-		return;
-	}
-	// readd tokens
-	if (downLimit > 0)
-	{
-		boost::lock_guard<boost::mutex> lock(downMutex);
-		downTokens = downLimit;
-		downCond.notify_all();
-	}
-	
-	if (upLimit > 0)
-	{
-		boost::lock_guard<boost::mutex> lock(upMutex);
-		upTokens = upLimit;
-		upCond.notify_all();
+		setDownloadLimit(0);
+		setUploadLimit(0);
 	}
 }
 
 void ThrottleManager::on(TimerManagerListener::Minute, uint64_t /*aTick*/) noexcept
 {
+	{
+		CFlyFastLock(m_cs);
+		for (auto i = m_user_buckets.begin(); i != m_user_buckets.end();)
+		{
+			if (i->second.expired())
+				i = m_user_buckets.erase(i);
+			else
+				++i;
+		}
+		for (auto i = m_hub_buckets.begin(); i != m_hub_buckets.end();)
+		{
+			if (const auto l_bucket = i->second.lock())
+			{
+				// pick up changes of the favorite hub limit
+				const FavoriteHubEntry* l_hub = FavoriteManager::getFavoriteHubEntry(i->first);
+				l_bucket->setLimit(l_hub ? int64_t(l_hub->getUploadLimit()) * 1024 : 0);
+				++i;
+			}
+			else
+			{
+				i = m_hub_buckets.erase(i);
+			}
+		}
+	}
 	if (!BOOLSETTING(THROTTLE_ENABLE))
 		return;
 		
@@ -22,13 +22,63 @@
 #ifndef _THROTTLEMANAGER_H
 #define _THROTTLEMANAGER_H
 
+#include <atomic>
 #include "Socket.h"
 #include "TimerManager.h"
-#include <boost/thread/condition_variable.hpp>
+#include "CID.h"
+
+/**
+ * Lock-free token bucket: http://en.wikipedia.org/wiki/Token_bucket
+ * Tokens are spread over per-core shards, so concurrent transfers don't fight over one cache line,
+ * and are refilled from the elapsed time every REFILL_INTERVAL instead of once a second.
+ * Tokens are taken from the whole parent chain (user -> hub -> global), which gives hierarchical shaping.
+ */
+class TokenBucket
+{
+	public:
+		static const uint64_t REFILL_INTERVAL = 50; // ms
+		
+		explicit TokenBucket(const std::shared_ptr<TokenBucket>& p_parent = nullptr);
+		
+		/** Bytes per second, 0 - unlimited (only the parents limit) */
+		void setLimit(int64_t p_limit)
+		{
+			m_limit = p_limit;
+		}
+		int64_t getLimit() const
+		{
+			return m_limit;
+		}
+		bool isLimited() const;
+		
+		/** @return Granted bytes, up to p_len, 0 if the bucket or one of its parents is empty */
+		size_t take(size_t p_len);
+		/** Returns tokens that were taken but not used */
+		void giveBack(size_t p_len);
+		
+	private:
+		static const unsigned SHARDS = 8;
+		static const uint64_t BURST = 200; // ms of traffic a bucket may save up
+		
+		struct alignas(64) Shard
+		{
+			std::atomic<int64_t> m_tokens;
+		};
+		Shard m_shards[SHARDS];
+		std::atomic<int64_t> m_limit;
+		std::atomic<uint64_t> m_last_refill;
+		const std::shared_ptr<TokenBucket> m_parent;
+		
+		void refill();
+		size_t takeLocal(size_t p_len);
+		static unsigned getShard()
+		{
+			return ::GetCurrentProcessorNumber() % SHARDS;
+		}
+};
 
 /**
  * Manager for throttling traffic flow speed.
- * Inspired by Token Bucket algorithm: http://en.wikipedia.org/wiki/Token_bucket
  */
 class ThrottleManager :
 	public Singleton<ThrottleManager>, private TimerManagerListener
@@ -46,22 +96,33 @@ class ThrottleManager :
 		 */
 		int write(Socket* sock, const void* buffer, size_t& len);
 		
+		/*
+		 * Takes upload tokens for up to len bytes without writing (for sends the OS does itself)
+		 * Returns false when there were no tokens and the caller has to retry, it has waited for the next refill then
+		 */
+		bool acquireUpload(Socket* sock, size_t& len);
+		
+		/*
+		 * Sleeps until the buckets are refilled next
+		 */
+		static void waitForTokens();
+		
 		/*
 		 * Returns current download limit.
 		 */
 		size_t getDownloadLimitInKBytes() const
 		{
-			return downLimit / 1024;
+			return getDownloadLimitInBytes() / 1024;
 		}
 		
 		size_t getDownloadLimitInBytes() const
 		{
-			return downLimit;
+			return size_t(m_down_bucket->getLimit());
 		}
 		
 		void setDownloadLimit(size_t p_NewDownLimit)
 		{
-			downLimit = p_NewDownLimit * 1024;
+			m_down_bucket->setLimit(int64_t(p_NewDownLimit) * 1024);
 		}
 		
 		/*
@@ -69,19 +130,26 @@ class ThrottleManager :
 		 */
 		size_t getUploadLimitInKBytes() const
 		{
-			return upLimit / 1024;
+			return getUploadLimitInBytes() / 1024;
 		}
 		
 		size_t getUploadLimitInBytes() const
 		{
-			return upLimit;
+			return size_t(m_up_bucket->getLimit());
 		}
 		
 		void setUploadLimit(size_t p_NewUploadLimit)
 		{
-			upLimit = p_NewUploadLimit * 1024;
+			m_up_bucket->setLimit(int64_t(p_NewUploadLimit) * 1024);
 		}
 		
+		/*
+		 * Upload bucket of a user, child of the hub bucket (favorite hub UploadLimit) or of the global one.
+		 * Shared by all connections of the user, the limit is set with setUserUploadLimit.
+		 */
+		std::shared_ptr<TokenBucket> getUserUploadBucket(const CID& p_cid, const string& p_hub_url);
+		void setUserUploadLimit(const CID& p_cid, int64_t p_limit);
+		
 		void updateLimits();
 		
 		void startup()
@@ -90,17 +158,12 @@ class ThrottleManager :
 			updateLimits();
 		}
 	private:
-		// download limiter
-		size_t             downLimit;
-		size_t                     downTokens;
-		boost::condition_variable   downCond;
-		boost::mutex                downMutex;
-		
-		// upload limiter
-		size_t             upLimit;
-		size_t                     upTokens;
-		boost::condition_variable   upCond;
-		boost::mutex                upMutex;
+		const std::shared_ptr<TokenBucket> m_down_bucket;
+		const std::shared_ptr<TokenBucket> m_up_bucket;
+		
+		FastCriticalSection m_cs; // only for the child maps, not on the transfer path
+		std::unordered_map<CID, std::weak_ptr<TokenBucket>> m_user_buckets;
+		std::unordered_map<string, std::weak_ptr<TokenBucket>> m_hub_buckets;
 		
 		friend class Singleton<ThrottleManager>;
 		
@@ -113,4 +176,4 @@ class ThrottleManager :
 		void on(TimerManagerListener::Second, uint64_t aTick) noexcept override;
 };
 
-#endif  // _THROTTLEMANAGER_H
\ No newline at end of file
+#endif  // _THROTTLEMANAGER_H
@@ -44,6 +44,10 @@
 #define TIGER_ARCH64
 #endif
 
+#if !defined(TIGER_BIG_ENDIAN) && (defined(_M_X64) || defined(__amd64__) || defined(__x86_64__))
+#define TIGER_USE_MULTI_BUFFER
+#endif
+
 #define PASSES 3
 
 #define t1 (table)
@@ -260,6 +264,205 @@ uint8_t* TigerHash::finalize()
 	return getResult();
 }
 
+// Multi-buffer engine: the 1 KiB leaves of a Tiger tree are independent,
+// so four of them are hashed at once, one per 64-bit AVX2 lane.
+#ifdef TIGER_USE_MULTI_BUFFER
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#define TIGER_AVX2_TARGET
+static inline void tiger_cpuid(int function, int subfunction, int cpuInfo[4])
+{
+	__cpuidex(cpuInfo, function, subfunction);
+}
+static inline uint64_t tiger_xgetbv()
+{
+	return _xgetbv(0);
+}
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#define TIGER_AVX2_TARGET __attribute__((target("avx2")))
+static inline void tiger_cpuid(int function, int subfunction, int cpuInfo[4])
+{
+	__cpuid_count(function, subfunction, cpuInfo[0], cpuInfo[1], cpuInfo[2], cpuInfo[3]);
+}
+static inline uint64_t tiger_xgetbv()
+{
+	uint32_t eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (uint64_t(edx) << 32) | eax;
+}
+#endif
+
+static bool isAVX2Supported()
+{
+	int cpuInfo[4];
+	tiger_cpuid(0, 0, cpuInfo);
+	if (cpuInfo[0] < 7)
+		return false;
+	tiger_cpuid(1, 0, cpuInfo);
+	// OSXSAVE and AVX, the OS must also save the YMM registers
+	if ((cpuInfo[2] & (1 << 27 | 1 << 28)) != (1 << 27 | 1 << 28))
+		return false;
+	if ((tiger_xgetbv() & 6) != 6)
+		return false;
+	tiger_cpuid(7, 0, cpuInfo);
+	return (cpuInfo[1] & (1 << 5)) != 0;
+}
+
+static const bool g_is_avx2 = isAVX2Supported();
+
+#define mb_sbox(t, c, n) _mm256_i64gather_epi64((const long long*)(t), _mm256_and_si256(_mm256_srli_epi64(c, (n) * 8), l_byte_mask), 8)
+
+#define mb_mul(b, mul) \
+	((mul) == 5 ? _mm256_add_epi64(_mm256_slli_epi64(b, 2), b) : \
+	 (mul) == 7 ? _mm256_sub_epi64(_mm256_slli_epi64(b, 3), b) : \
+	 _mm256_add_epi64(_mm256_slli_epi64(b, 3), b))
+
+#define mb_round(a,b,c,x,mul) \
+	c = _mm256_xor_si256(c, x); \
+	a = _mm256_sub_epi64(a, _mm256_xor_si256(_mm256_xor_si256(mb_sbox(t1, c, 0), mb_sbox(t2, c, 2)), \
+	                                         _mm256_xor_si256(mb_sbox(t3, c, 4), mb_sbox(t4, c, 6)))); \
+	b = _mm256_add_epi64(b, _mm256_xor_si256(_mm256_xor_si256(mb_sbox(t4, c, 1), mb_sbox(t3, c, 3)), \
+	                                         _mm256_xor_si256(mb_sbox(t2, c, 5), mb_sbox(t1, c, 7)))); \
+	b = mb_mul(b, mul);
+
+#define mb_pass(a,b,c,mul) \
+	mb_round(a,b,c,x0,mul) \
+	mb_round(b,c,a,x1,mul) \
+	mb_round(c,a,b,x2,mul) \
+	mb_round(a,b,c,x3,mul) \
+	mb_round(b,c,a,x4,mul) \
+	mb_round(c,a,b,x5,mul) \
+	mb_round(a,b,c,x6,mul) \
+	mb_round(b,c,a,x7,mul)
+
+#define mb_not(x) _mm256_xor_si256(x, l_ones)
+
+#define mb_key_schedule \
+	x0 = _mm256_sub_epi64(x0, _mm256_xor_si256(x7, l_key_a5)); \
+	x1 = _mm256_xor_si256(x1, x0); \
+	x2 = _mm256_add_epi64(x2, x1); \
+	x3 = _mm256_sub_epi64(x3, _mm256_xor_si256(x2, _mm256_slli_epi64(mb_not(x1), 19))); \
+	x4 = _mm256_xor_si256(x4, x3); \
+	x5 = _mm256_add_epi64(x5, x4); \
+	x6 = _mm256_sub_epi64(x6, _mm256_xor_si256(x5, _mm256_srli_epi64(mb_not(x4), 23))); \
+	x7 = _mm256_xor_si256(x7, x6); \
+	x0 = _mm256_add_epi64(x0, x7); \
+	x1 = _mm256_sub_epi64(x1, _mm256_xor_si256(x0, _mm256_slli_epi64(mb_not(x7), 19))); \
+	x2 = _mm256_xor_si256(x2, x1); \
+	x3 = _mm256_add_epi64(x3, x2); \
+	x4 = _mm256_sub_epi64(x4, _mm256_xor_si256(x3, _mm256_srli_epi64(mb_not(x2), 23))); \
+	x5 = _mm256_xor_si256(x5, x4); \
+	x6 = _mm256_add_epi64(x6, x5); \
+	x7 = _mm256_sub_epi64(x7, _mm256_xor_si256(x6, l_key_01));
+
+#define mb_compress \
+	{ \
+		const __m256i aa = a, bb = b, cc = c; \
+		mb_pass(a,b,c,5) \
+		mb_key_schedule \
+		mb_pass(c,a,b,7) \
+		mb_key_schedule \
+		mb_pass(b,c,a,9) \
+		a = _mm256_xor_si256(a, aa); \
+		b = _mm256_sub_epi64(b, bb); \
+		c = _mm256_add_epi64(c, cc); \
+	}
+
+// Message word of four leaves which lie LEAF_SIZE bytes apart
+#define mb_word(p) _mm256_i64gather_epi64((const long long*)(p), l_leaf_offset, 1)
+
+TIGER_AVX2_TARGET void TigerHash::hashLeaves4(const uint8_t* p_data, uint8_t* p_out)
+{
+	const __m256i l_byte_mask = _mm256_set1_epi64x(0xFF);
+	const __m256i l_ones = _mm256_set1_epi64x(-1);
+	const __m256i l_key_a5 = _mm256_set1_epi64x(_ULL(0xA5A5A5A5A5A5A5A5));
+	const __m256i l_key_01 = _mm256_set1_epi64x(_ULL(0x0123456789ABCDEF));
+	const __m256i l_leaf_offset = _mm256_set_epi64x(3 * LEAF_SIZE, 2 * LEAF_SIZE, LEAF_SIZE, 0);
+	
+	__m256i a = _mm256_set1_epi64x(_ULL(0x0123456789ABCDEF));
+	__m256i b = _mm256_set1_epi64x(_ULL(0xFEDCBA9876543210));
+	__m256i c = _mm256_set1_epi64x(_ULL(0xF096A5B4C3B2E187));
+	__m256i x0, x1, x2, x3, x4, x5, x6, x7;
+	
+	// A leaf is hashed as 0x00 | data, so the message is shifted by one byte.
+	x0 = _mm256_slli_epi64(mb_word(p_data), 8);
+	x1 = mb_word(p_data + 7);
+	x2 = mb_word(p_data + 15);
+	x3 = mb_word(p_data + 23);
+	x4 = mb_word(p_data + 31);
+	x5 = mb_word(p_data + 39);
+	x6 = mb_word(p_data + 47);
+	x7 = mb_word(p_data + 55);
+	mb_compress
+	
+	for (size_t l_pos = BLOCK_SIZE - 1; l_pos + BLOCK_SIZE <= LEAF_SIZE; l_pos += BLOCK_SIZE)
+	{
+		const uint8_t* p = p_data + l_pos;
+		x0 = mb_word(p);
+		x1 = mb_word(p + 8);
+		x2 = mb_word(p + 16);
+		x3 = mb_word(p + 24);
+		x4 = mb_word(p + 32);
+		x5 = mb_word(p + 40);
+		x6 = mb_word(p + 48);
+		x7 = mb_word(p + 56);
+		mb_compress
+	}
+	
+	// Last byte of the leaf, the 0x01 padding and the length in bits
+	x0 = _mm256_or_si256(_mm256_srli_epi64(mb_word(p_data + LEAF_SIZE - 8), 56), _mm256_set1_epi64x(0x0100));
+	x1 = x2 = x3 = x4 = x5 = x6 = _mm256_setzero_si256();
+	x7 = _mm256_set1_epi64x((LEAF_SIZE + 1) << 3);
+	mb_compress
+	
+	uint64_t l_res[3][4];
+	_mm256_storeu_si256((__m256i*)l_res[0], a);
+	_mm256_storeu_si256((__m256i*)l_res[1], b);
+	_mm256_storeu_si256((__m256i*)l_res[2], c);
+	for (size_t i = 0; i < 4; ++i, p_out += BYTES)
+	{
+		const uint64_t l_hash[3] = { l_res[0][i], l_res[1][i], l_res[2][i] };
+		memcpy(p_out, l_hash, BYTES);
+	}
+}
+
+#endif // TIGER_USE_MULTI_BUFFER
+
+void TigerHash::hashLeaves(const uint8_t* p_data, size_t p_count, uint8_t* p_out)
+{
+	size_t i = 0;
+#ifdef TIGER_USE_MULTI_BUFFER
+	if (g_is_avx2)
+	{
+		for (; i + 4 <= p_count; i += 4)
+		{
+			hashLeaves4(p_data + i * LEAF_SIZE, p_out + i * BYTES);
+		}
+	}
+#endif
+	const uint8_t l_zero = 0;
+	for (; i < p_count; ++i)
+	{
+		TigerHash h;
+		h.update(&l_zero, 1);
+		h.update(p_data + i * LEAF_SIZE, LEAF_SIZE);
+		memcpy(p_out + i * BYTES, h.finalize(), BYTES);
+	}
+}
+
+size_t TigerHash::getLeafLanes()
+{
+#ifdef TIGER_USE_MULTI_BUFFER
+	return g_is_avx2 ? 4 : 1;
+#else
+	return 1;
+#endif
+}
+
 const uint64_t TigerHash::table[4 * 256] =
 {
 	_ULL(0x02AAB17CF7E90C5E)   /*    0 */,    _ULL(0xAC424B03E243A8EC)   /*    1 */,
@@ -42,6 +42,8 @@ class TigerHash
 		/** Hash size in bytes */
 		static const size_t BITS = 192;
 		static const size_t BYTES = BITS / 8;
+		/** Size of a Tiger tree base leaf */
+		static const size_t LEAF_SIZE = 1024;
 		
 		TigerHash() : pos(0)
 		{
@@ -63,6 +65,15 @@ class TigerHash
 		{
 			return (uint8_t*) res;
 		}
+		
+		/**
+		 * Calculates the leaf hashes Tiger(0x00 | leaf) of p_count consecutive
+		 * LEAF_SIZE leaves into p_out (p_count * BYTES). Uses the multi-buffer
+		 * engine when the CPU supports it.
+		 */
+		static void hashLeaves(const uint8_t* p_data, size_t p_count, uint8_t* p_out);
+		/** Number of leaves the multi-buffer engine hashes at once (1 - scalar code only). */
+		static size_t getLeafLanes();
 	private:
 		enum { BLOCK_SIZE = 512 / 8 };
 		/** 512 bit blocks for the compress function */
@@ -77,6 +88,7 @@ class TigerHash
 #if 0
 		void tigerCompress(const uint64_t* data, uint64_t state[3]);
 #endif
+		static void hashLeaves4(const uint8_t* p_data, uint8_t* p_out);
 		
 };
 
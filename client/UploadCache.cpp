@@ -0,0 +1,364 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+
+#include "UploadCache.h"
+#include "File.h"
+#include "SettingsManager.h"
+
+FastCriticalSection UploadCache::g_cs;
+UploadCache::EntryList UploadCache::g_lru;
+std::unordered_map<UploadCache::Key, UploadCache::EntryList::iterator, UploadCache::KeyHash> UploadCache::g_index;
+std::vector<uint8_t> UploadCache::g_sketch;
+size_t UploadCache::g_sketch_mask = 0;
+size_t UploadCache::g_sketch_additions = 0;
+int64_t UploadCache::g_size = 0;
+int64_t UploadCache::g_max_size = 0;
+UploadCache::Stats UploadCache::g_stats = {0};
+
+uint64_t UploadCache::hashKey(const Key& p_key)
+{
+	uint64_t l_hash;
+	memcpy(&l_hash, p_key.m_tth.data, sizeof(l_hash));
+	l_hash ^= uint64_t(p_key.m_offset) * 0x9E3779B97F4A7C15ULL;
+	l_hash ^= l_hash >> 33;
+	l_hash *= 0xFF51AFD7ED558CCDULL;
+	l_hash ^= l_hash >> 33;
+	return l_hash;
+}
+
+UploadCache::Key UploadCache::getListKey(const string& p_dir, bool p_is_recursive)
+{
+	TigerHash l_tiger;
+	l_tiger.update(p_dir.data(), p_dir.size());
+	return Key(TTHValue(l_tiger.finalize()), p_is_recursive ? OFFSET_LIST_RECURSIVE : OFFSET_LIST);
+}
+
+int64_t UploadCache::getMaxSize()
+{
+	return std::max(0, SETTING(UPLOAD_CACHE_SIZE)) * int64_t(1024 * 1024);
+}
+
+void UploadCache::setMaxSizeL(int64_t p_max_size, EntryList& p_evicted)
+{
+	if (p_max_size == g_max_size)
+		return;
+	g_max_size = p_max_size;
+	while (g_size > g_max_size)
+	{
+		g_size -= g_lru.back().m_size;
+		g_index.erase(g_lru.back().m_key);
+		p_evicted.splice(p_evicted.end(), g_lru, std::prev(g_lru.end()));
+	}
+	if (g_max_size == 0)
+	{
+		std::vector<uint8_t>().swap(g_sketch);
+		g_sketch_mask = 0;
+		g_sketch_additions = 0;
+		return;
+	}
+	// A few counters per block the cache can hold keep the collisions rare
+	size_t l_width = SKETCH_MIN_WIDTH;
+	while (l_width < size_t(g_max_size / BLOCK_SIZE) * 16)
+	{
+		l_width <<= 1;
+	}
+	if (l_width != g_sketch_mask + 1)
+	{
+		g_sketch.assign(l_width * SKETCH_DEPTH, 0);
+		g_sketch_mask = l_width - 1;
+		g_sketch_additions = 0;
+	}
+}
+
+void UploadCache::touchL(uint64_t p_hash)
+{
+	if (g_sketch.empty())
+		return;
+	const size_t l_width = g_sketch_mask + 1;
+	const uint32_t l_hash1 = uint32_t(p_hash);
+	const uint32_t l_hash2 = uint32_t(p_hash >> 32) | 1;
+	for (size_t i = 0; i < SKETCH_DEPTH; ++i)
+	{
+		uint8_t& l_counter = g_sketch[i * l_width + ((l_hash1 + i * l_hash2) & g_sketch_mask)];
+		if (l_counter < SKETCH_MAX_COUNTER)
+			++l_counter;
+	}
+	// Aging: the old popularity fades out, the sample is about the width of a row
+	if (++g_sketch_additions >= l_width)
+	{
+		for (auto i = g_sketch.begin(); i != g_sketch.end(); ++i)
+		{
+			*i >>= 1;
+		}
+		g_sketch_additions /= 2;
+	}
+}
+
+unsigned UploadCache::estimateL(uint64_t p_hash)
+{
+	if (g_sketch.empty())
+		return 0;
+	const size_t l_width = g_sketch_mask + 1;
+	const uint32_t l_hash1 = uint32_t(p_hash);
+	const uint32_t l_hash2 = uint32_t(p_hash >> 32) | 1;
+	unsigned l_frequency = SKETCH_MAX_COUNTER;
+	for (size_t i = 0; i < SKETCH_DEPTH; ++i)
+	{
+		l_frequency = std::min<unsigned>(l_frequency, g_sketch[i * l_width + ((l_hash1 + i * l_hash2) & g_sketch_mask)]);
+	}
+	return l_frequency;
+}
+
+UploadCache::Data UploadCache::get(const Key& p_key, bool p_is_touch)
+{
+	const int64_t l_max_size = getMaxSize();
+	EntryList l_evicted; // freed out of the lock
+	CFlyFastLock(g_cs);
+	setMaxSizeL(l_max_size, l_evicted);
+	if (p_is_touch)
+	{
+		touchL(hashKey(p_key));
+	}
+	const auto i = g_index.find(p_key);
+	if (i == g_index.end())
+	{
+		++g_stats.m_misses;
+		return Data();
+	}
+	g_lru.splice(g_lru.begin(), g_lru, i->second);
+	++g_stats.m_hits;
+	g_stats.m_hit_bytes += i->second->m_data->size();
+	return i->second->m_data;
+}
+
+void UploadCache::put(const Key& p_key, const Data& p_data, const string& p_dir)
+{
+	const int64_t l_max_size = getMaxSize();
+	EntryList l_evicted; // freed out of the lock
+	CFlyFastLock(g_cs);
+	setMaxSizeL(l_max_size, l_evicted);
+	const int64_t l_size = int64_t(p_data->size() + p_dir.size() + ENTRY_OVERHEAD);
+	if (l_size > g_max_size / 8)
+	{
+		++g_stats.m_rejected;
+		return;
+	}
+	if (g_index.find(p_key) != g_index.end())
+		return; // another upload has read it meanwhile
+	// TinyLFU admission: the candidate evicts only the entries that were asked for less often
+	const unsigned l_frequency = estimateL(hashKey(p_key));
+	auto l_victim = g_lru.end();
+	int64_t l_free = g_max_size - g_size;
+	while (l_free < l_size)
+	{
+		--l_victim;
+		if (estimateL(hashKey(l_victim->m_key)) >= l_frequency)
+		{
+			++g_stats.m_rejected;
+			return;
+		}
+		l_free += l_victim->m_size;
+	}
+	for (auto i = l_victim; i != g_lru.end(); ++i)
+	{
+		g_size -= i->m_size;
+		g_index.erase(i->m_key);
+	}
+	l_evicted.splice(l_evicted.end(), g_lru, l_victim, g_lru.end());
+	g_lru.push_front(Entry(p_key, p_data, p_dir));
+	g_index.insert(std::make_pair(p_key, g_lru.begin()));
+	g_size += l_size;
+}
+
+bool UploadCache::touchFileRange(const TTHValue& p_tth, int64_t p_start, int64_t p_size)
+{
+	const int64_t l_max_size = getMaxSize();
+	if (l_max_size == 0 || p_size <= 0)
+		return false;
+	const int64_t l_first = p_start / BLOCK_SIZE;
+	const int64_t l_last = std::min((p_start + p_size - 1) / BLOCK_SIZE, l_first + MAX_TOUCH_BLOCKS - 1);
+	bool l_is_hot = false;
+	EntryList l_evicted; // freed out of the lock
+	CFlyFastLock(g_cs);
+	setMaxSizeL(l_max_size, l_evicted);
+	for (int64_t i = l_first; i <= l_last; ++i)
+	{
+		const Key l_key(p_tth, i);
+		const uint64_t l_hash = hashKey(l_key);
+		touchL(l_hash);
+		if (!l_is_hot)
+		{
+			l_is_hot = estimateL(l_hash) >= HOT_MIN_FREQUENCY || g_index.find(l_key) != g_index.end();
+		}
+	}
+	return l_is_hot;
+}
+
+UploadCache::Data UploadCache::getBlock(const TTHValue& p_tth, int64_t p_block, bool p_is_touch, bool& p_is_hot)
+{
+	const Key l_key(p_tth, p_block);
+	const uint64_t l_hash = hashKey(l_key);
+	CFlyFastLock(g_cs);
+	if (p_is_touch)
+	{
+		touchL(l_hash);
+	}
+	const auto i = g_index.find(l_key);
+	if (i == g_index.end())
+	{
+		++g_stats.m_misses;
+		p_is_hot = estimateL(l_hash) >= HOT_MIN_FREQUENCY;
+		return Data();
+	}
+	g_lru.splice(g_lru.begin(), g_lru, i->second);
+	++g_stats.m_hits;
+	g_stats.m_hit_bytes += i->second->m_data->size();
+	p_is_hot = true;
+	return i->second->m_data;
+}
+
+void UploadCache::putBlock(const TTHValue& p_tth, int64_t p_block, const Data& p_data)
+{
+	put(Key(p_tth, p_block), p_data, Util::emptyString);
+}
+
+UploadCache::Data UploadCache::getTree(const TTHValue& p_tth)
+{
+	return get(Key(p_tth, OFFSET_TREE), true);
+}
+
+void UploadCache::putTree(const TTHValue& p_tth, const Data& p_data)
+{
+	put(Key(p_tth, OFFSET_TREE), p_data, Util::emptyString);
+}
+
+UploadCache::Data UploadCache::getPartialList(const string& p_dir, bool p_is_recursive)
+{
+	return get(getListKey(p_dir, p_is_recursive), true);
+}
+
+void UploadCache::putPartialList(const string& p_dir, bool p_is_recursive, const Data& p_data)
+{
+	put(getListKey(p_dir, p_is_recursive), p_data, p_dir);
+}
+
+bool UploadCache::removePartialLists(const string& p_path)
+{
+	EntryList l_evicted; // freed out of the lock
+	CFlyFastLock(g_cs);
+	for (auto i = g_lru.begin(); i != g_lru.end();)
+	{
+		if ((i->m_key.m_offset == OFFSET_LIST || i->m_key.m_offset == OFFSET_LIST_RECURSIVE) &&
+		        (p_path.empty() || p_path.find(i->m_dir) != string::npos))
+		{
+			g_size -= i->m_size;
+			g_index.erase(i->m_key);
+			l_evicted.splice(l_evicted.end(), g_lru, i++);
+		}
+		else
+		{
+			++i;
+		}
+	}
+	return !l_evicted.empty();
+}
+
+UploadCache::Stats UploadCache::getStats()
+{
+	CFlyFastLock(g_cs);
+	Stats l_stats = g_stats;
+	l_stats.m_size = g_size;
+	l_stats.m_max_size = g_max_size;
+	l_stats.m_count = g_index.size();
+	return l_stats;
+}
+
+UploadCacheStream::UploadCacheStream(File* p_file, const TTHValue& p_tth, int64_t p_pos, int64_t p_file_size) :
+	m_file(p_file), m_tth(p_tth), m_pos(p_pos), m_file_size(p_file_size), m_block(-1),
+	m_touched_end(p_pos / UploadCache::BLOCK_SIZE + UploadCache::MAX_TOUCH_BLOCKS)
+{
+}
+
+UploadCacheStream::~UploadCacheStream()
+{
+}
+
+size_t UploadCacheStream::read(void* p_buf, size_t& p_len)
+{
+	const int64_t l_block = m_pos / UploadCache::BLOCK_SIZE;
+	if (m_pos >= m_file_size)
+	{
+		p_len = 0;
+		return 0;
+	}
+	if (l_block != m_block)
+	{
+		// touchFileRange has counted the first blocks of the request already
+		bool l_is_hot = false;
+		m_data = UploadCache::getBlock(m_tth, l_block, l_block >= m_touched_end, l_is_hot);
+		if (!m_data && l_is_hot)
+		{
+			m_data = loadBlock(l_block);
+		}
+		m_block = l_block;
+	}
+	if (!m_data)
+	{
+		// A cold block: only what is asked for, up to the end of the block
+		const int64_t l_block_end = std::min<int64_t>((l_block + 1) * UploadCache::BLOCK_SIZE, m_file_size);
+		p_len = m_file->readAt(p_buf, size_t(std::min<int64_t>(p_len, l_block_end - m_pos)), m_pos);
+		m_pos += p_len;
+		return p_len;
+	}
+	const size_t l_offset = size_t(m_pos - l_block * UploadCache::BLOCK_SIZE);
+	if (l_offset >= m_data->size())
+	{
+		// The file is shorter than it was when the upload started
+		p_len = 0;
+		return 0;
+	}
+	p_len = std::min(p_len, m_data->size() - l_offset);
+	memcpy(p_buf, m_data->data() + l_offset, p_len);
+	m_pos += p_len;
+	return p_len;
+}
+
+UploadCache::Data UploadCacheStream::loadBlock(int64_t p_block)
+{
+	const int64_t l_start = p_block * UploadCache::BLOCK_SIZE;
+	const size_t l_size = size_t(std::min<int64_t>(UploadCache::BLOCK_SIZE, m_file_size - l_start));
+	std::shared_ptr<string> l_data = std::make_shared<string>(l_size, '\0');
+	size_t l_done = 0;
+	while (l_done < l_size)
+	{
+		const size_t l_read = m_file->readAt(&(*l_data)[l_done], l_size - l_done, l_start + l_done);
+		if (l_read == 0)
+			break;
+		l_done += l_read;
+	}
+	if (l_done == l_size)
+	{
+		UploadCache::putBlock(m_tth, p_block, l_data);
+	}
+	else
+	{
+		// The file has changed since it was hashed, such a block is not what the TTH stands for
+		l_data->resize(l_done);
+	}
+	return l_data;
+}
@@ -0,0 +1,174 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_UPLOAD_CACHE_H
+#define DCPLUSPLUS_DCPP_UPLOAD_CACHE_H
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include "CFlyThread.h"
+#include "HashValue.h"
+#include "TigerHash.h"
+#include "Streams.h"
+
+class File;
+
+/**
+ * Memory cache of the upload content that is asked for again and again: blocks of the shared files
+ * by (TTH, block number), TTH leaves and partial file lists. The size is bounded by UPLOAD_CACHE_SIZE.
+ * An entry gets in only if its key was asked for more often than the entries it would evict (TinyLFU:
+ * the frequencies come from a count-min sketch that is halved periodically), so one pass over a large
+ * file doesn't flush the popular blocks.
+ */
+class UploadCache
+{
+	public:
+		enum
+		{
+			BLOCK_SIZE = 256 * 1024,
+			HOT_MIN_FREQUENCY = 2, // recent requests of a block before it is cached
+			MAX_TOUCH_BLOCKS = 64 // blocks counted by touchFileRange, UploadCacheStream counts the rest as it gets there
+		};
+		typedef std::shared_ptr<const string> Data;
+		struct Stats
+		{
+			uint64_t m_hits;
+			uint64_t m_misses;
+			uint64_t m_hit_bytes;
+			uint64_t m_rejected;
+			int64_t m_size;
+			int64_t m_max_size;
+			size_t m_count;
+		};
+		
+		/**
+		 * Counts a request of the first MAX_TOUCH_BLOCKS blocks of [p_start, p_start + p_size).
+		 * @return true if one of them is cached or popular enough to be, the range is read through
+		 *         UploadCacheStream then; a plain File (and TransmitFile) serves it better otherwise
+		 */
+		static bool touchFileRange(const TTHValue& p_tth, int64_t p_start, int64_t p_size);
+		/// @param p_is_hot Set if the block is cached or asked for often enough to be put
+		static Data getBlock(const TTHValue& p_tth, int64_t p_block, bool p_is_touch, bool& p_is_hot);
+		static void putBlock(const TTHValue& p_tth, int64_t p_block, const Data& p_data);
+		
+		static Data getTree(const TTHValue& p_tth);
+		static void putTree(const TTHValue& p_tth, const Data& p_data);
+		
+		static Data getPartialList(const string& p_dir, bool p_is_recursive);
+		static void putPartialList(const string& p_dir, bool p_is_recursive, const Data& p_data);
+		/// Drops the lists of the directories that p_path is in, all the lists if p_path is empty
+		/// @return false if nothing was dropped
+		static bool removePartialLists(const string& p_path);
+		
+		static Stats getStats();
+		
+	private:
+		enum
+		{
+			OFFSET_TREE = -1,
+			OFFSET_LIST = -2,
+			OFFSET_LIST_RECURSIVE = -3,
+			ENTRY_OVERHEAD = 128,
+			SKETCH_DEPTH = 4,
+			SKETCH_MIN_WIDTH = 4096,
+			SKETCH_MAX_COUNTER = 15
+		};
+		struct Key
+		{
+			Key(const TTHValue& p_tth, int64_t p_offset) : m_tth(p_tth), m_offset(p_offset)
+			{
+			}
+			bool operator==(const Key& p_key) const
+			{
+				return m_offset == p_key.m_offset && m_tth == p_key.m_tth;
+			}
+			TTHValue m_tth; // TTH of the directory name for the partial lists
+			int64_t m_offset; // block number or OFFSET_*
+		};
+		struct KeyHash
+		{
+			size_t operator()(const Key& p_key) const
+			{
+				return size_t(hashKey(p_key));
+			}
+		};
+		struct Entry
+		{
+			Entry(const Key& p_key, const Data& p_data, const string& p_dir) : m_key(p_key), m_data(p_data), m_dir(p_dir),
+				m_size(int64_t(p_data->size() + p_dir.size() + ENTRY_OVERHEAD))
+			{
+			}
+			Key m_key;
+			Data m_data;
+			string m_dir; // partial lists only
+			int64_t m_size;
+		};
+		typedef std::list<Entry> EntryList;
+		
+		static uint64_t hashKey(const Key& p_key);
+		static Key getListKey(const string& p_dir, bool p_is_recursive);
+		static Data get(const Key& p_key, bool p_is_touch);
+		static void put(const Key& p_key, const Data& p_data, const string& p_dir);
+		static int64_t getMaxSize();
+		static void setMaxSizeL(int64_t p_max_size, EntryList& p_evicted);
+		static void touchL(uint64_t p_hash);
+		static unsigned estimateL(uint64_t p_hash);
+		
+		static FastCriticalSection g_cs;
+		static EntryList g_lru; // the most recently used first
+		static std::unordered_map<Key, EntryList::iterator, KeyHash> g_index;
+		static std::vector<uint8_t> g_sketch; // SKETCH_DEPTH rows of saturating counters
+		static size_t g_sketch_mask;
+		static size_t g_sketch_additions;
+		static int64_t g_size;
+		static int64_t g_max_size;
+		static Stats g_stats;
+};
+
+/**
+ * Reads a range of a shared file through UploadCache: the hot blocks are read whole and cached,
+ * the cold ones are read from the file as asked and never evict anything.
+ * Owns the file.
+ */
+class UploadCacheStream : public InputStream
+{
+	public:
+		UploadCacheStream(File* p_file, const TTHValue& p_tth, int64_t p_pos, int64_t p_file_size);
+		~UploadCacheStream();
+		
+		size_t read(void* p_buf, size_t& p_len) override;
+		void setPos(int64_t p_pos) override
+		{
+			m_pos = p_pos;
+		}
+		
+	private:
+		UploadCache::Data loadBlock(int64_t p_block);
+		
+		std::unique_ptr<File> m_file;
+		const TTHValue m_tth;
+		int64_t m_pos;
+		const int64_t m_file_size;
+		int64_t m_block;
+		UploadCache::Data m_data; // the block at m_block, null if the block is cold
+		const int64_t m_touched_end; // the blocks from here on are counted by the stream
+};
+
+#endif // !defined(DCPLUSPLUS_DCPP_UPLOAD_CACHE_H)
@@ -29,6 +29,7 @@
 #include "IPGrant.h"
 #include "../FlyFeatures/flyServer.h"
 #include "SharedFileStream.h"
+#include "UploadCache.h"
 
 STANDARD_EXCEPTION(BZ2Exception);
 
@@ -286,19 +287,35 @@ void UploadManager::decodeBZ2(const uint8_t* is, size_t sz, string& os) {
 	
 	os.clear();
 	
-	while ((err = BZ2_bzDecompress(&bs)) == BZ_OK) {
-		if (bs.avail_in == 0 && bs.avail_out > 0) { // error: BZ_UNEXPECTED_EOF
-			BZ2_bzDecompressEnd(&bs);
-			throw BZ2Exception(STRING(DECOMPRESSION_ERROR));
+	for (;;) {
+		while ((err = BZ2_bzDecompress(&bs)) == BZ_OK) {
+			if (bs.avail_in == 0 && bs.avail_out > 0) { // error: BZ_UNEXPECTED_EOF
+				BZ2_bzDecompressEnd(&bs);
+				throw BZ2Exception(STRING(DECOMPRESSION_ERROR));
+			}
+			os.append(&buf[0], bufsize - bs.avail_out);
+			bs.avail_out = bufsize;
+			bs.next_out = &buf[0];
 		}
-		os.append(&buf[0], bufsize - bs.avail_out);
+		
+		if (err == BZ_STREAM_END)
+			os.append(&buf[0], bufsize - bs.avail_out);
+			
+		if (err != BZ_STREAM_END || bs.avail_in == 0)
+			break;
+			
+		// Concatenated streams: the own file list is written as one stream per shared root
+		char* l_next_in = bs.next_in;
+		const unsigned l_avail_in = bs.avail_in;
+		BZ2_bzDecompressEnd(&bs);
+		if (BZ2_bzDecompressInit(&bs, 0, 0) != BZ_OK)
+			throw BZ2Exception(STRING(DECOMPRESSION_ERROR));
+		bs.next_in = l_next_in;
+		bs.avail_in = l_avail_in;
 		bs.avail_out = bufsize;
 		bs.next_out = &buf[0];
 	}
 	
-	if (err == BZ_STREAM_END)
-		os.append(&buf[0], bufsize - bs.avail_out);
-		
 	BZ2_bzDecompressEnd(&bs);
 	
 	if (err < 0) {
@@ -448,8 +465,16 @@ bool UploadManager::prepareFile(UserConnection* aSource, const string& aType, co
 				
 				l_is_free = l_is_free || (sz <= (int64_t)(SETTING(SET_MINISLOT_SIZE) * 1024));
 				
-				f->setPos(start);
-				is = f;
+				// The popular ranges go from memory, the rest straight from the file (TransmitFile)
+				if (l_is_tth && UploadCache::touchFileRange(l_tth, start, size))
+				{
+					is = new UploadCacheStream(f, l_tth, start, sz);
+				}
+				else
+				{
+					f->setPos(start);
+					is = f;
+				}
 				if ((start + size) < sz)
 				{
 					is = new LimitedInputStream<true>(is, size);
@@ -803,18 +828,6 @@ void UploadManager::decreaseUserConnectionAmountL(const UserPtr& p_user)
 		}
 	}
 }
-unsigned int UploadManager::getUserConnectionAmountL(const UserPtr& p_user)
-{
-	dcassert(!ClientManager::isBeforeShutdown());
-	const auto i = g_uploadsPerUser.find(p_user);
-	if (i != g_uploadsPerUser.end())
-	{
-		return i->second;
-	}
-	
-	dcassert(0);
-	return 1;
-}
 
 void UploadManager::removeUpload(UploadPtr& aUpload, bool delay)
 {
@@ -1432,7 +1445,6 @@ void UploadManager::on(TimerManagerListener::Second, uint64_t aTick) noexcept
 					l_tickList.push_back(l_td);
 					u->tick(aTick);
 				}
-				u->getUserConnection()->getSocket()->updateSocketBucket(getUserConnectionAmountL(u->getUser()));
 				l_currentSpeed += u->getRunningAverage();
 			}
 			g_runningAverage = l_currentSpeed;
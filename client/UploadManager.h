@@ -218,7 +218,6 @@ class UploadManager : private ClientManagerListener, private UserConnectionListe
 		
 		static void increaseUserConnectionAmountL(const UserPtr& p_user);
 		static void decreaseUserConnectionAmountL(const UserPtr& p_user);
-		static unsigned int getUserConnectionAmountL(const UserPtr& p_user);
 		
 		int m_lastFreeSlots; // amount of free slots at the previous minute
 		
@@ -28,7 +28,7 @@
 #include "../FlyFeatures/flyServer.h"
 
 
-std::unique_ptr<webrtc::RWLockWrapper> Identity::g_rw_cs = std::unique_ptr<webrtc::RWLockWrapper> (webrtc::RWLockWrapper::CreateRWLock());
+StringDictionary Identity::g_dictionary;
 
 #ifdef _DEBUG
 #define DISALLOW(a, b) { uint16_t tag1 = TAG(name[0], name[1]); uint16_t tag2 = TAG(a, b); dcassert(tag1 != tag2); }
@@ -41,9 +41,6 @@ std::atomic<int> User::g_user_counts(0);
 std::atomic<int> OnlineUser::g_online_user_counts(0);
 #endif
 
-Identity::StringDictionaryReductionPointers Identity::g_infoDic;
-Identity::StringDictionaryIndex Identity::g_infoDicIndex;
-
 #ifdef FLYLINKDC_USE_LASTIP_AND_USER_RATIO
 
 User::User(const CID& p_CID, const string& p_nick, uint32_t p_hub_id) : m_cid(p_CID),
@@ -678,67 +675,37 @@ string Identity::getStringParam(const char* name) const
 	}
 #endif
 	
+	uint32_t l_dic_value;
 	switch (*(short*)name)
 	{
 		case TAG('A', 'P'):
-		{
-			const auto l_dic_value = getDicAP();
-			if (l_dic_value > 0)
-			{
-				const string l_value = getDicVal(l_dic_value);
-#ifdef FLYLINKDC_USE_GATHER_IDENTITY_STAT
-				CFlylinkDBManager::getInstance()->identity_get(name, l_value); // TODO    g_rw_cs
-#endif
-				return l_value;
-			}
-			else
-			{
-				return BaseUtil::emptyString;
-			}
-		}
+			l_dic_value = getDicAP();
+			break;
 		case TAG('V', 'E'):
-		{
-			const auto l_dic_value = getDicVE();
-			if (l_dic_value > 0)
-			{
-				const string l_value = getDicVal(l_dic_value);
-#ifdef FLYLINKDC_USE_GATHER_IDENTITY_STAT
-				CFlylinkDBManager::getInstance()->identity_get(name, l_value); // TODO    g_rw_cs
-#endif
-				return l_value;
-			}
-			else
-			{
-				return BaseUtil::emptyString;
-			}
-		}
-		case TAG('E', 'M'):
-		{
-			if (!getNotEmptyStringBit(EM))
-			{
-#ifdef FLYLINKDC_USE_GATHER_IDENTITY_STAT
-				CFlylinkDBManager::getInstance()->identity_get(name, "");
-#endif
-				return BaseUtil::emptyString;
-			}
+			l_dic_value = getDicVE();
 			break;
-		}
 		case TAG('D', 'E'):
-		{
-			if (!getNotEmptyStringBit(DE))
-			{
-#ifdef FLYLINKDC_USE_GATHER_IDENTITY_STAT
-				CFlylinkDBManager::getInstance()->identity_get(name, "");
-#endif
-				return BaseUtil::emptyString;
-			}
+			l_dic_value = getDicDE();
+			break;
+		case TAG('E', 'M'):
+			l_dic_value = getDicEM();
+			break;
+		default:
+			l_dic_value = uint32_t(-1);
 			break;
-		}
 	};
+	if (l_dic_value != uint32_t(-1))
+	{
+		const string& l_value = g_dictionary.get(l_dic_value);
+#ifdef FLYLINKDC_USE_GATHER_IDENTITY_STAT
+		CFlylinkDBManager::getInstance()->identity_get(name, l_value);
+#endif
+		return l_value;
+	}
 	
 	{
 		CFlyFastLock(m_si_fcs);
-		const auto i = m_stringInfo.find(*(short*)name);
+		const auto i = findStringInfoL(*(short*)name);
 #ifdef FLYLINKDC_USE_PROFILER_CS
 		l_lock.m_add_log_info = "[get] name = ";
 		l_lock.m_add_log_info += string(name) + string(i == m_stringInfo.end() ? " [ not_found! ]" : "[ " + i->second + " ]" + " Nick = " + getNick());
@@ -753,45 +720,6 @@ string Identity::getStringParam(const char* name) const
 	}
 	return BaseUtil::emptyString;
 }
-uint32_t Identity::mergeDicId(const string& p_val)
-{
-	if (p_val.empty())
-		return 0;
-	{
-		CFlyReadLock(*g_rw_cs);
-#ifdef FLYLINKDC_USE_PROFILER_CS
-		l_lock.m_add_log_info = "p_val = ";
-		l_lock.m_add_log_info += p_val + " Nick = " + getNick();
-#endif
-		auto l_find_ro = g_infoDicIndex.find(p_val);
-		if (l_find_ro != g_infoDicIndex.end())
-		{
-			return l_find_ro->second;
-		}
-	}
-	CFlyWriteLock(*g_rw_cs);
-	auto l_find = g_infoDicIndex.insert(make_pair(p_val, uint16_t(g_infoDic.size() + 1)));
-	if (l_find.second == true) //    ?
-	{
-		g_infoDic.push_back(p_val);   //      
-	}
-	return l_find.first->second;
-}
-
-string Identity::getDicVal(uint16_t p_index)
-{
-	dcassert(p_index > 0 && p_index <= g_infoDic.size());
-	if (p_index > 0)
-	{
-		CFlyReadLock(*g_rw_cs);
-		return g_infoDic[p_index - 1];
-	}
-	else
-	{
-		return BaseUtil::emptyString;
-	}
-}
-
 void Identity::setStringParam(const char* name, const string& val)
 {
 	CHECK_GET_SET_COMMAND();
@@ -820,81 +748,68 @@ void Identity::setStringParam(const char* name, const string& val)
 #ifdef FLYLINKDC_USE_GATHER_IDENTITY_STAT
 	CFlylinkDBManager::getInstance()->identity_set(name, val);
 #endif
-	bool l_is_processing_stringInfo_map = true;
+	switch (*(short*)name)
+	{
+		case TAG('A', 'P'):
+			setDicAP(g_dictionary.intern(val));
+			return;
+		case TAG('V', 'E'):
+			setDicVE(g_dictionary.intern(val));
+			return;
+		case TAG('D', 'E'):
+			setDicDE(g_dictionary.intern(val));
+			return;
+		case TAG('E', 'M'):
+			setDicEM(g_dictionary.intern(val));
+			return;
+	}
+	CFlyFastLock(m_si_fcs);
+#ifdef FLYLINKDC_USE_PROFILER_CS
+	l_lock.m_add_log_info = "[set] name = ";
+	l_lock.m_add_log_info += string(name) + string(val.empty() ? " val.empty()" : val);
+#endif
+	const auto i = std::lower_bound(m_stringInfo.begin(), m_stringInfo.end(), *(short*)name, [](const InfMap::value_type & p_item, short p_tag)
+	{
+		return p_item.first < p_tag;
+	});
+	const bool l_is_found = i != m_stringInfo.end() && i->first == *(short*)name;
 	if (val.empty())
 	{
-		switch (*(short*)name) // TODO: move to instantly method
+		if (l_is_found)
 		{
-			case TAG('E', 'M'):
-			{
-				l_is_processing_stringInfo_map = getNotEmptyStringBit(EM); // TODO    
-				setNotEmptyStringBit(EM, false);
-				break;
-			}
-			case TAG('D', 'E'):
-			{
-				l_is_processing_stringInfo_map = getNotEmptyStringBit(DE);  // TODO    
-				setNotEmptyStringBit(DE, false);
-				break;
-			}
+			m_stringInfo.erase(i);
 		}
 	}
-	bool l_is_skip_string_map = false;
-	if (l_is_processing_stringInfo_map)
+	else if (l_is_found)
 	{
-		{
-			switch (*(short*)name)
-			{
-				case TAG('A', 'P'):
-				{
-					setDicAP(mergeDicId(val));
-					l_is_skip_string_map = true;
-					break;
-				}
-				case TAG('V', 'E'):
-				{
-					setDicVE(mergeDicId(val));
-					l_is_skip_string_map = true;
-					break;
-				}
-				case TAG('E', 'M'):
-				{
-					setNotEmptyStringBit(EM, !val.empty());
-					break;
-				}
-				case TAG('D', 'E'):
-				{
-					setNotEmptyStringBit(DE, !val.empty());
-					break;
-				}
-			}
-		}
-		if (l_is_skip_string_map == false)
-		{
-			CFlyFastLock(m_si_fcs);
-#ifdef FLYLINKDC_USE_PROFILER_CS
-			l_lock.m_add_log_info = "[set] name = ";
-			l_lock.m_add_log_info += string(name) + string(val.empty() ? " val.empty()" : val);
-#endif
-			if (val.empty())
-			{
-				m_stringInfo.erase(*(short*)name);
-			}
-			else
-			{
-				m_stringInfo[*(short*)name] = val;
-			}
-		}
+		i->second = val;
 	}
 	else
 	{
-		//   m_stringInfo  
-		//      ?
+		m_stringInfo.insert(i, std::make_pair(*(short*)name, val));
 	}
 }
 
+Identity::InfMap::const_iterator Identity::findStringInfoL(short p_tag) const
+{
+	const auto i = std::lower_bound(m_stringInfo.cbegin(), m_stringInfo.cend(), p_tag, [](const InfMap::value_type & p_item, short p_value)
+	{
+		return p_item.first < p_value;
+	});
+	return i != m_stringInfo.cend() && i->first == p_tag ? i : m_stringInfo.cend();
+}
+
 Identity::~Identity()
 {
+	m_table->release(m_slot);
+}
+
+OnlineUser::OnlineUser(const UserPtr& p_user, ClientBase& p_client, uint32_t p_sid)
+	: m_identity(p_user, p_sid, p_client.getUserTable()), m_client(p_client), m_is_first_find(true)
+{
+#ifdef _DEBUG
+	g_online_user_counts++;
+#endif
 }
 
 void FavoriteUser::update(const OnlineUser& info)
@@ -1229,14 +1144,14 @@ string Identity::getSupports() const
 }
 
 string Identity::getCountry() const  {
-	const auto l_country =  dcpp::GeoManager::getInstance()->getCountry(m_ip.to_string());
+	const auto l_country =  dcpp::GeoManager::getInstance()->getCountry(getIpRAW().to_string());
 	return l_country;
 }
 
 string Identity::getIpAsString() const
 {
-	if (!m_ip.is_unspecified())
-		return m_ip.to_string();
+	if (isIPValid())
+		return getIpRAW().to_string();
 	else
 	{
 		if (isUseIP6())
@@ -1250,7 +1165,7 @@ string Identity::getIpAsString() const
 			else
 			{
 				dcassert(0);
-				return m_ip.to_string();
+				return getIpRAW().to_string();
 			}
 		}
 	}
@@ -1260,21 +1175,23 @@ void Identity::setIp(const string& p_ip) // "I4"
 	if (!p_ip.empty())
 	{
 		boost::system::error_code ec;
+		boost::asio::ip::address_v4 l_addr;
 		if (p_ip[0] == ' ' || p_ip[p_ip.size() - 1] == ' ')
 		{
 			///dcassert(0);
 			string l_ip = p_ip;
 			Text::trim(l_ip);
-			m_ip = boost::asio::ip::address_v4::from_string(l_ip, ec);
+			l_addr = boost::asio::ip::address_v4::from_string(l_ip, ec);
 		}
 		else
 		{
-			m_ip = boost::asio::ip::address_v4::from_string(p_ip, ec);
+			l_addr = boost::asio::ip::address_v4::from_string(p_ip, ec);
 		}
+		m_table->setIp(m_slot, l_addr.to_ulong());
 		dcassert(!ec);
 		if (!ec)
 		{
-			getUser()->setIP(m_ip, true);
+			getUser()->setIP(l_addr, true);
 		}
 		else
 		{
@@ -1290,7 +1207,7 @@ void Identity::setIp(const string& p_ip) // "I4"
 }
 bool Identity::isFantomIP() const
 {
-	if (m_ip.is_unspecified())
+	if (!isIPValid())
 	{
 		if (isUseIP6())
 			return false;
@@ -24,6 +24,7 @@
 #include "QueueManager.h"
 #include "PGLoader.h"
 #include "IpGuard.h"
+#include "ThrottleManager.h"
 #include "../FlyFeatures/flyServer.h"
 
 const string UserConnection::FEATURE_MINISLOTS = "MiniSlots";
@@ -613,6 +614,7 @@ void UserConnection::setUser(const UserPtr& aUser)
 	}
 	else
 	{
+		socket->setUploadBucket(ThrottleManager::getInstance()->getUserUploadBucket(aUser->getCID(), getHintedUser().hint));
 		int limit;
 		FavoriteUser::MaskType l_flags;
 		if (FavoriteManager::getFavUserParam(aUser, l_flags, limit))
@@ -638,6 +640,11 @@ void UserConnection::setUploadLimit(int lim)
 		default:
 			socket->setMaxSpeed(lim * 1024);
 	}
+	if (getUser())
+	{
+		// the limit is shared by all connections of the user
+		ThrottleManager::getInstance()->setUserUploadLimit(getUser()->getCID(), lim > 0 ? int64_t(lim) * 1024 : 0);
+	}
 }
 
 void UserConnection::maxedOut(size_t queue_position)
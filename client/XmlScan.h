@@ -0,0 +1,116 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#pragma once
+
+
+#ifndef DCPLUSPLUS_DCPP_XML_SCAN_H
+#define DCPLUSPLUS_DCPP_XML_SCAN_H
+
+#include <cstddef>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define FLYLINKDC_XML_USE_SSE2
+#include <emmintrin.h>
+#include <intrin.h>
+#endif
+
+/**
+ * Scanners for the runs between markup used by SimpleXMLReader: 16 bytes are checked at once,
+ * the rest byte by byte. All of them return n if nothing was found.
+ * The scalar versions are public so that test-console can compare both paths.
+ */
+namespace XmlScan
+{
+inline bool isSpace(int c)
+{
+	return c == 0x20 || c == 0x09 || c == 0x0d || c == 0x0a;
+}
+
+/// Index of the first a, b or c, starting at i
+inline size_t findFirstOfScalar(const char* p, size_t n, char a, char b, char c, size_t i = 0)
+{
+	for (; i < n; ++i)
+	{
+		if (p[i] == a || p[i] == b || p[i] == c)
+			return i;
+	}
+	return n;
+}
+
+/// Index of the first non-space character, starting at i
+inline size_t skipSpacesScalar(const char* p, size_t n, size_t i = 0)
+{
+	for (; i < n; ++i)
+	{
+		if (!isSpace(p[i]))
+			return i;
+	}
+	return n;
+}
+
+/// Index of the first a, b or c
+inline size_t findFirstOf(const char* p, size_t n, char a, char b, char c)
+{
+	size_t i = 0;
+#ifdef FLYLINKDC_XML_USE_SSE2
+	const __m128i l_a = _mm_set1_epi8(a);
+	const __m128i l_b = _mm_set1_epi8(b);
+	const __m128i l_c = _mm_set1_epi8(c);
+	for (; i + 16 <= n; i += 16)
+	{
+		const __m128i l_data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+		const __m128i l_eq = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(l_data, l_a), _mm_cmpeq_epi8(l_data, l_b)), _mm_cmpeq_epi8(l_data, l_c));
+		if (const unsigned l_mask = unsigned(_mm_movemask_epi8(l_eq)))
+		{
+			unsigned long l_bit;
+			_BitScanForward(&l_bit, l_mask);
+			return i + l_bit;
+		}
+	}
+#endif
+	return findFirstOfScalar(p, n, a, b, c, i);
+}
+
+/// Index of the first non-space character
+inline size_t skipSpaces(const char* p, size_t n)
+{
+	size_t i = 0;
+#ifdef FLYLINKDC_XML_USE_SSE2
+	const __m128i l_space = _mm_set1_epi8(0x20);
+	const __m128i l_tab = _mm_set1_epi8(0x09);
+	const __m128i l_cr = _mm_set1_epi8(0x0d);
+	const __m128i l_lf = _mm_set1_epi8(0x0a);
+	for (; i + 16 <= n; i += 16)
+	{
+		const __m128i l_data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+		const __m128i l_eq = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(l_data, l_space), _mm_cmpeq_epi8(l_data, l_tab)),
+		                                  _mm_or_si128(_mm_cmpeq_epi8(l_data, l_cr), _mm_cmpeq_epi8(l_data, l_lf)));
+		const unsigned l_mask = ~unsigned(_mm_movemask_epi8(l_eq)) & 0xFFFF;
+		if (l_mask)
+		{
+			unsigned long l_bit;
+			_BitScanForward(&l_bit, l_mask);
+			return i + l_bit;
+		}
+	}
+#endif
+	return skipSpacesScalar(p, n, i);
+}
+}
+
+#endif // DCPLUSPLUS_DCPP_XML_SCAN_H
@@ -22,44 +22,77 @@
  */
 
 #include "stdinc.h"
+#include "iplist.h"
+
+void IPRangeTable::build()
+{
+	std::stable_sort(m_pending.begin(), m_pending.end(), [](const Range & a, const Range & b)
+	{
+		return a.m_start < b.m_start;
+	});
+	m_starts.clear();
+	m_stops.clear();
+	m_values.clear();
+	m_starts.reserve(m_pending.size());
+	m_stops.reserve(m_pending.size());
+	m_values.reserve(m_pending.size());
+	for (auto i = m_pending.cbegin(); i != m_pending.cend(); ++i)
+	{
+		uint32_t l_start = i->m_start;
+		if (!m_starts.empty())
+		{
+			uint32_t& l_last_stop = m_stops.back();
+			if (l_start <= l_last_stop || l_start == l_last_stop + 1)
+			{
+				if (i->m_stop <= l_last_stop)
+				{
+					continue; // inside the previous one
+				}
+				if (i->m_value == m_values.back())
+				{
+					l_last_stop = i->m_stop; // overlapping or adjacent
+					continue;
+				}
+				// another value: only the part past the previous range
+				l_start = std::max(l_start, l_last_stop + 1);
+			}
+		}
+		m_starts.push_back(l_start);
+		m_stops.push_back(i->m_stop);
+		m_values.push_back(i->m_value);
+	}
+	std::vector<Range>().swap(m_pending);
+	m_starts.shrink_to_fit();
+	m_stops.shrink_to_fit();
+	m_values.shrink_to_fit();
+}
 
 #ifdef FLYLINKDC_USE_IPFILTER
 #include "socket.h"
-#include "iplist.h"
 #include "ResourceManager.h"
 #include "ClientManager.h"
 
-IPList::IPList()
+IPList::IPList() : m_table(std::make_shared<IPRangeTable>())
 {
-	// Initialize IP mask list and create IPArrayList into the ipRangeList
-	uint32_t l_mask = 0x00000000;
-	for (uint32_t level = 1; level < 33; ++level)
-	{
-		l_mask = (l_mask >> 1) | 0x80000000;
-		m_maskList[ l_mask ] =  level ;
-		m_ipRangeList.emplace_back(IPList::IPArrayList(l_mask));
-	}
 }
 
 IPList::~IPList()
 {
 }
 
-
 uint32_t IPList::add(const std::string& IPNumber)
 {
 	const uint32_t ip = Socket::convertIP4(IPNumber);
 	if (ip == INADDR_NONE || ip == 0)
 		return IP_ERROR;
-	add(ip);
+	addRange(ip, ip);
 	return NO_IP_ERROR;
 }
 
-void IPList::add(uint32_t ip)
+static bool isContiguousMask(uint32_t p_mask)
 {
-	if (ip == INADDR_NONE || ip == 0)
-		return;
-	addRangeListAndSort(ip, 31);
+	const uint32_t l_host = ~p_mask;
+	return (l_host & (l_host + 1)) == 0;
 }
 
 uint32_t IPList::add(const std::string& IPNumber, const std::string& Mask)
@@ -68,57 +101,24 @@ uint32_t IPList::add(const std::string& IPNumber, const std::string& Mask)
 	const uint32_t umask = Socket::convertIP4(Mask);
 	if (ip == INADDR_NONE || ip == 0)
 		return IP_ERROR;
-	if (umask == INADDR_NONE || umask == 0)
+	if (umask == 0 || !isContiguousMask(umask))
 		return MASK_ERROR;
-	add(ip, umask);
+	addRange(ip & umask, ip | ~umask);
 	return NO_IP_ERROR;
 }
 
-void IPList::add(uint32_t ip, uint32_t umask)
-{
-	if (ip == INADDR_NONE && umask == INADDR_NONE)
-		return;
-		
-	const auto it = m_maskList.find(umask);
-	if (it != m_maskList.end())
-	{
-		const  uint32_t Level = it->second;
-		if (Level)
-		{
-			ip = ip & umask;
-			addRangeListAndSort(ip, Level - 1);
-		}
-	}
-}
-
 uint32_t IPList::add(const std::string& IPNumber, uint32_t maskLevel)
 {
 	const uint32_t ip = Socket::convertIP4(IPNumber);
-	const uint32_t umask = getMaskByLevel(maskLevel);
-	
 	if (ip == INADDR_NONE || ip == 0)
 		return IP_ERROR;
-	if (umask == INADDR_NONE || umask == 0)
+	if (maskLevel == 0 || maskLevel > 32)
 		return MASK_ERROR;
-	add(ip, umask);
+	const uint32_t umask = maskLevel == 32 ? 0xFFFFFFFF : ~(0xFFFFFFFF >> maskLevel);
+	addRange(ip & umask, ip | ~umask);
 	return NO_IP_ERROR;
 }
 
-uint32_t IPList::getMaskByLevel(uint32_t maskLevel)
-{
-	uint32_t umask = INADDR_NONE;
-//	CFlyFastLock(m_cs);     (  )
-	for (auto it = m_maskList.begin(); it != m_maskList.end(); ++it)
-	{
-		if (it->second == maskLevel)
-		{
-			umask = it->first;
-			break;
-		}
-	}
-	return umask;
-}
-
 uint32_t IPList::addRange(const std::string& fromIP, const std::string& toIP)
 {
 	const uint32_t ufromIP = Socket::convertIP4(fromIP);
@@ -128,67 +128,18 @@ uint32_t IPList::addRange(const std::string& fromIP, const std::string& toIP)
 		return START_IP_ERROR;
 	if (utoIP == INADDR_NONE || utoIP == 0)
 		return END_IP_ERROR;
+	if (ufromIP > utoIP)
+		return START_GREATE_THEN_END_RANGE_ERROR;
 		
-	return addRange(ufromIP, utoIP);
+	addRange(ufromIP, utoIP);
+	return ufromIP == utoIP ? START_AND_END_EQUAL : NO_IP_ERROR;
 }
 
 uint32_t IPList::addRange(uint32_t fromIP, uint32_t toIP)
 {
-	if (fromIP > toIP)
-	{
-		return START_GREATE_THEN_END_RANGE_ERROR;
-	}
-	if (fromIP == toIP)
-	{
-		add(fromIP);
-		return START_AND_END_EQUAL;
-	}
-	else
-	{
-		uint32_t diff = toIP - fromIP;
-		int diffLevel = 1;
-		uint32_t range = 0x80000000;
-		if (diff < 256)
-		{
-			diffLevel = 24;
-			range = 0x00000100;
-		}
-		while (range > diff)
-		{
-			range = range >> 1;
-			diffLevel++;
-		}
-		
-		uint32_t mask = getMaskByLevel(diffLevel);
-		
-		uint32_t minIP = fromIP & mask;
-		if (minIP < fromIP) minIP += range;
-		if (minIP > fromIP)
-		{
-			addRange(fromIP, minIP - 1);
-			fromIP = minIP;
-		}
-		if (fromIP == toIP)
-		{
-			add(fromIP);
-		}
-		else
-		{
-			if ((minIP + (range - 1)) <= toIP)
-			{
-				add(minIP, mask);
-				fromIP = minIP + range;
-			}
-			if (fromIP == toIP)
-			{
-				add(toIP);
-			}
-			else
-			{
-				if (fromIP < toIP) addRange(fromIP, toIP);
-			}
-		}
-	}
+	dcassert(fromIP <= toIP);
+	CFlyFastLock(m_cs);
+	m_builder.add(fromIP, toIP);
 	return NO_IP_ERROR;
 }
 
@@ -288,7 +239,8 @@ void IPList::addData(const std::string& Data, CFlyLog& p_log)
 		}
 		else
 		{
-			const string line = Data.substr(linestart, lineend - linestart - 1);
+			const string::size_type l_len = lineend - linestart - (lineend > linestart && Data[lineend - 1] == '\r' ? 1 : 0);
+			const string line = Data.substr(linestart, l_len);
 			if (!line.empty())
 			{
 				addLine(line, p_log);
@@ -296,44 +248,35 @@ void IPList::addData(const std::string& Data, CFlyLog& p_log)
 			linestart = lineend + 1;
 		}
 	}
+	publish();
 }
-void IPList::addRangeListAndSort(uint32_t p_ip, uint32_t p_level)
+void IPList::publish()
 {
-	dcassert(!ClientManager::isBeforeShutdown());
-	CFlyFastLock(m_cs);
-	m_ipRangeList[p_level].add(p_ip);
-	if (std::find(m_usedList.begin(), m_usedList.end(), p_level) == m_usedList.end())
+	auto l_table = std::make_shared<IPRangeTable>();
 	{
-		m_usedList.push_back(p_level);
-		std::sort(m_usedList.begin(), m_usedList.end());
+		CFlyFastLock(m_cs);
+		std::swap(*l_table, m_builder);
 	}
+	l_table->build();
+	std::atomic_store(&m_table, std::shared_ptr<const IPRangeTable>(std::move(l_table)));
 }
 
-bool IPList::checkIp(UINT32 ip)
+bool IPList::checkIp(uint32_t ip) const
 {
-	bool found = false;
 	dcassert(!ClientManager::isBeforeShutdown());
-	if (!ClientManager::isBeforeShutdown())
-	{
-		size_t i = 0;
-		CFlyFastLock(m_cs);
-		while (!found && i < m_usedList.size())
-		{
-			found = m_ipRangeList[m_usedList[i]].check(ip); // TODO: Please optimize my searching faster than brute force search!
-			i++;
-		}
-	}
-	return found;
+	if (ClientManager::isBeforeShutdown())
+		return false;
+	const auto l_table = std::atomic_load(&m_table);
+	return l_table->find(ip);
 }
 
 void IPList::clear()
 {
-	CFlyFastLock(m_cs);
-	for (size_t i = 0; i < m_usedList.size(); i++)
 	{
-		m_ipRangeList[m_usedList[i]].clear();
+		CFlyFastLock(m_cs);
+		m_builder = IPRangeTable();
 	}
-	m_usedList.clear();
+	std::atomic_store(&m_table, std::shared_ptr<const IPRangeTable>(std::make_shared<IPRangeTable>()));
 }
 
 #endif // FLYLINKDC_USE_IPFILTER
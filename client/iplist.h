@@ -26,65 +26,79 @@
 #ifndef IPLIST_H
 #define IPLIST_H
 
-#ifdef FLYLINKDC_USE_IPFILTER
-
 #include <vector>
-#include <map>
-#include <algorithm>
+#include <memory>
 #include "CFlyThread.h"
 
 class CFlyLog;
 
-class IPList
+/**
+ * Immutable table of IPv4 ranges: built once per load from sorted and merged intervals,
+ * then only read - lookups are a branch-free binary search, O(log n).
+ * Owners keep it in a shared_ptr and swap a new table in with std::atomic_store.
+ */
+class IPRangeTable
 {
-		// TODO: needs review :(
-		// Please optimize my searching faster than brute force search!
+	public:
+		/** Builder, the ranges may come in any order and overlap */
+		void add(uint32_t p_start, uint32_t p_stop, uint32_t p_value = 0)
+		{
+			m_pending.push_back(Range(p_start, p_stop, p_value));
+		}
+		/** Sorts and merges the added ranges, the earlier value wins where they overlap */
+		void build();
+		
+		bool find(uint32_t p_ip, uint32_t* p_value = nullptr) const
+		{
+			const size_t l_count = m_starts.size();
+			if (l_count == 0)
+				return false;
+			// last start <= p_ip, the compiler turns the ternary into cmov
+			const uint32_t* l_base = m_starts.data();
+			size_t l_len = l_count;
+			while (l_len > 1)
+			{
+				const size_t l_half = l_len / 2;
+				l_base = l_base[l_half] <= p_ip ? l_base + l_half : l_base;
+				l_len -= l_half;
+			}
+			const size_t l_index = l_base - m_starts.data();
+			if (*l_base > p_ip || m_stops[l_index] < p_ip)
+				return false;
+			if (p_value)
+				*p_value = m_values[l_index];
+			return true;
+		}
+		size_t size() const
+		{
+			return m_starts.size();
+		}
+		bool empty() const
+		{
+			return m_starts.empty();
+		}
 	private:
-		class IPArrayList
+		struct Range
 		{
-			private:
-				std::vector< uint32_t > m_ipNumList;
-				uint32_t m_ipmask;
-				
-			public:
-				explicit IPArrayList(uint32_t p_mask)
-					: m_ipmask(p_mask)
-				{
-				}
-				
-				void add(uint32_t p_IPNum)
-				{
-					m_ipNumList.push_back(p_IPNum & m_ipmask);
-					std::sort(m_ipNumList.begin(), m_ipNumList.end());
-				}
-				
-				bool check(uint32_t p_IPNum)
-				{
-					bool found;
-					if (!m_ipNumList.empty())
-					{
-						p_IPNum = p_IPNum & m_ipmask;
-						//found = ipNumList.BinarySearch(IPNum) >= 0;
-						found = std::find(m_ipNumList.begin(), m_ipNumList.end(), p_IPNum) != m_ipNumList.end(); // TODO: Please optimize my searching faster than brute force search!
-					}
-					else
-					{
-						found = false;
-					}
-					return found;
-				}
-				
-				void clear()
-				{
-					m_ipNumList.clear();
-				}
-				
-				uint32_t getMask()
-				{
-					return m_ipmask;
-				}
+			uint32_t m_start;
+			uint32_t m_stop;
+			uint32_t m_value;
+			Range(uint32_t p_start, uint32_t p_stop, uint32_t p_value) : m_start(p_start), m_stop(p_stop), m_value(p_value)
+			{
+			}
 		};
-		
+		std::vector<Range> m_pending;
+		// struct of arrays: the search only touches the starts
+		std::vector<uint32_t> m_starts;
+		std::vector<uint32_t> m_stops;
+		std::vector<uint32_t> m_values;
+};
+
+#ifdef FLYLINKDC_USE_IPFILTER
+
+class IPList
+{
+	private:
 		enum IP_ERROR_STATE
 		{
 			NO_IP_ERROR = 0,
@@ -97,37 +111,31 @@ class IPList
 			LAST
 		};
 		
-		std::vector<IPArrayList> m_ipRangeList;
-		std::map<uint32_t, uint32_t> m_maskList;
-		std::vector< uint32_t > m_usedList;
-		FastCriticalSection m_cs;
+		std::shared_ptr<const IPRangeTable> m_table; // the published ranges, read without locks
+		IPRangeTable m_builder; // ranges added since the last publish()
+		FastCriticalSection m_cs; // only for m_builder
 		
-		static uint32_t parseIP(const std::string& IPNumber);
-		uint32_t getMaskByLevel(uint32_t maskLevel);
 		uint32_t add(const std::string& IPNumber);
-		void add(uint32_t ip);
-		
 		uint32_t add(const std::string& IPNumber, const std::string& Mask);
-		void add(uint32_t ip, uint32_t umask);
 		uint32_t add(const std::string& IPNumber, uint32_t maskLevel);
-		
-		uint32_t addRange(uint32_t fromIP, uint32_t toIP);
 		uint32_t addRange(const std::string& fromIP, const std::string& toIP);
-		void addRangeListAndSort(uint32_t p_ip, uint32_t p_level);
-		string translateIPError(int32_t& p_errorCode);
+		uint32_t addRange(uint32_t fromIP, uint32_t toIP);
 		
 	public:
 		IPList();
 		~IPList();
-		bool empty()
+		bool empty() const
 		{
-			CFlyFastLock(m_cs);
-			return m_usedList.empty();
+			const auto l_table = std::atomic_load(&m_table);
+			return l_table->empty();
 		}
+		/** Adds to the pending ranges, they are looked up only after publish() */
 		void addLine(std::string Line, CFlyLog& p_log);
+		/** Replaces the list with the lines of Data */
 		void addData(const std::string& Data, CFlyLog& p_log);
+		void publish();
 		
-		bool checkIp(uint32_t ip);
+		bool checkIp(uint32_t ip) const;
 		
 		void clear();
 };
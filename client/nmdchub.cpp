@@ -19,6 +19,7 @@
 #include "stdinc.h"
 
 #include "NmdcHub.h"
+#include "NmdcParser.h"
 #include "ShareManager.h"
 #include "CryptoManager.h"
 #include "ThrottleManager.h"
@@ -35,6 +36,7 @@ uint8_t NmdcHub::g_version_fly_info = 33;
 
 NmdcHub::NmdcHub(const string& aHubURL, bool p_is_secure, bool p_is_auto_connect) :
 	Client(aHubURL, '|', p_is_secure, p_is_auto_connect, Socket::PROTO_NMDC),
+	m_users(*m_user_table),
 	m_supportFlags(0),
 	m_modeChar(0),
 	m_version_fly_info(0),
@@ -97,10 +99,10 @@ void NmdcHub::resetAntivirusInfo()
 {
 #ifdef FLYLINKDC_USE_ANTIVIRUS_DB
 	CFlyReadLock(*m_cs);
-	for (auto i = m_users.cbegin(); i != m_users.cend(); ++i)
+	m_users.forEach([](const OnlineUserPtr & p_user)
 	{
-		i->second->getIdentity().resetAntivirusInfo();
-	}
+		p_user->getIdentity().resetAntivirusInfo();
+	});
 #else
 	dcassert(0);
 #endif
@@ -110,13 +112,9 @@ void NmdcHub::refreshUserList(bool refreshOnly)
 	if (refreshOnly)
 	{
 		OnlineUserList v;
-		v.reserve(m_users.size());
 		{
 			CFlyReadLock(*m_cs);
-			for (auto i = m_users.cbegin(); i != m_users.cend(); ++i)
-			{
-				v.push_back(i->second);
-			}
+			m_users.getUsers(v);
 		}
 		fire_user_updated(v);
 	}
@@ -186,41 +184,33 @@ OnlineUserPtr NmdcHub::getUser(const string& aNick, bool p_hub, bool p_first_loa
 		CFlyWriteLock(*m_cs);
 		if (p_hub)
 		{
-			dcassert(m_users.count(aNick) == 0);
-			ou = m_users.insert(make_pair(aNick, getHubOnlineUser())).first->second;
+			dcassert(!m_users.find(aNick));
+			ou = getHubOnlineUser();
 			dcassert(ou->getIdentity().getNick() == aNick);
 			ou->getIdentity().setNick(aNick);
+			m_users.insert(aNick, ou);
 		}
 		else if (aNick == getMyNick())
 		{
-//			dcassert(m_users.count(aNick) == 0);
-			auto l_item = m_users.insert(make_pair(aNick, getMyOnlineUser()));
-			if (l_item.second == false)
-			{
-				dcassert(l_item.first->second->getIdentity().getNick() == aNick);
-				return l_item.first->second;
-			}
-			else
+			const auto l_found = m_users.insert(aNick, getMyOnlineUser());
+			if (l_found)
 			{
-				ou = l_item.first->second;
-				dcassert(ou->getIdentity().getNick() == aNick);
+				dcassert(l_found->getIdentity().getNick() == aNick);
+				return l_found;
 			}
+			ou = getMyOnlineUser();
 		}
 		else
 		{
-			auto l_item = m_users.insert(make_pair(aNick, OnlineUserPtr()));
-			if (l_item.second == true)
+			const auto l_found = m_users.find(aNick);
+			if (l_found)
 			{
-				UserPtr p = ClientManager::getUser(aNick, getHubUrl(), getHubID());
-				ou = std::make_shared<OnlineUser>(p, *this, 0);
-				ou->getIdentity().setNick(aNick);
-				l_item.first->second = ou;
-			}
-			else
-			{
-				dcassert(l_item.first->second->getIdentity().getNick() == aNick);
-				return l_item.first->second;
+				return l_found;
 			}
+			UserPtr p = ClientManager::getUser(aNick, getHubUrl(), getHubID());
+			ou = std::make_shared<OnlineUser>(p, *this, 0);
+			ou->getIdentity().setNick(aNick);
+			m_users.insert(aNick, ou);
 		}
 	}
 	if (!ou->getUser()->getCID().isZero())
@@ -243,11 +233,10 @@ void NmdcHub::supports(const StringList& feat)
 OnlineUserPtr NmdcHub::findUser(const string& aNick) const
 {
 	CFlyReadLock(*m_cs);
-	const auto& i = m_users.find(aNick);
 #ifdef FLYLINKDC_USE_PROFILER_CS
 	//l_lock.m_add_log_info = " User = " + aNick;
 #endif
-	return i == m_users.end() ? OnlineUserPtr() : i->second;
+	return m_users.find(aNick);
 }
 
 void NmdcHub::putUser(const string& aNick)
@@ -258,13 +247,10 @@ void NmdcHub::putUser(const string& aNick)
 #ifdef FLYLINKDC_USE_EXT_JSON_GUARD
 		m_ext_json_deferred.erase(aNick);
 #endif
-		const auto& i = m_users.find(aNick);
-		if (i == m_users.end())
+		ou = m_users.erase(aNick);
+		if (!ou)
 			return;
-		auto l_bytes_shared = i->second->getIdentity().getBytesShared();
-		ou = i->second;
-		m_users.erase(i);
-		decBytesSharedL(l_bytes_shared);
+		decBytesSharedL(ou->getIdentity().getBytesShared());
 #ifdef FLYLINKDC_USE_ANTIVIRUS_DB
 		{
 			CFlyFastLock(m_cs_virus);
@@ -294,10 +280,10 @@ void NmdcHub::clearUsers()
 	}
 	else
 	{
-		NickMap u2;
+		OnlineUserList u2;
 		{
 			CFlyWriteLock(*m_cs);
-			u2.swap(m_users);
+			m_users.clear(&u2);
 #ifdef FLYLINKDC_USE_EXT_JSON_GUARD
 			m_ext_json_deferred.clear();
 #endif
@@ -305,10 +291,10 @@ void NmdcHub::clearUsers()
 		}
 		for (auto i = u2.cbegin(); i != u2.cend(); ++i)
 		{
-			//i->second->getIdentity().setBytesShared(0);
-			if (!i->second->getUser()->getCID().isZero())
+			//(*i)->getIdentity().setBytesShared(0);
+			if (!(*i)->getUser()->getCID().isZero())
 			{
-				ClientManager::getInstance()->putOffline(i->second);
+				ClientManager::getInstance()->putOffline(*i);
 			}
 			else
 			{
@@ -476,7 +462,7 @@ void NmdcHub::NmdcSearch(const SearchParam& p_search_param)
 		{
 			try
 			{
-				Socket udp;
+				StringList l_packets;
 				for (auto i = l_search_results.cbegin(); i != l_search_results.cend(); ++i)
 				{
 					const string l_sr = i->toSR(*this);
@@ -489,9 +475,14 @@ void NmdcHub::NmdcSearch(const SearchParam& p_search_param)
 					}
 					else
 					{
-						sendUDPSR(udp, p_search_param.m_seeker, l_sr, this);
+						l_packets.push_back(l_sr);
 					}
 				}
+				if (!l_packets.empty())
+				{
+					Socket udp;
+					sendUDPSR(udp, p_search_param.m_seeker, l_packets, this);
+				}
 			}
 			catch (Exception& e)
 			{
@@ -515,7 +506,7 @@ void NmdcHub::NmdcSearch(const SearchParam& p_search_param)
 	ClientManager::getInstance()->fireIncomingSearch(p_search_param.m_seeker, p_search_param.m_filter, l_re);
 }
 //=================================================================================================
-void NmdcHub::sendUDPSR(Socket& p_udp, const string& p_seeker, const string& p_sr, const Client* p_client) // const CFlySearchItem& p_result, const Client* p_client
+void NmdcHub::sendUDPSR(Socket& p_udp, const string& p_seeker, const StringList& p_sr, const Client* p_client) // const CFlySearchItem& p_result, const Client* p_client
 {
 	try
 	{
@@ -526,8 +517,12 @@ void NmdcHub::sendUDPSR(Socket& p_udp, const string& p_seeker, const string& p_s
 //		LogManager::message("NmdcHub::sendUDPSR - p_seeker = " + p_seeker);
 #endif
 		//dcassert(l_ip == Socket::resolve(l_ip));
-		p_udp.writeTo(l_ip, l_port, p_sr);
-		COMMAND_DEBUG("[Active-Search]" + p_sr, DebugTask::CLIENT_OUT, l_ip + ':' + Util::toString(l_port));
+		// All the results for one seeker go out in one batch
+		p_udp.writeBatchTo(l_ip, l_port, p_sr);
+		for (auto i = p_sr.cbegin(); i != p_sr.cend(); ++i)
+		{
+			COMMAND_DEBUG("[Active-Search]" + *i, DebugTask::CLIENT_OUT, l_ip + ':' + Util::toString(l_port));
+		}
 #ifdef FLYLINKDC_USE_COLLECT_STAT
 		const string l_sr = *p_result.m_toSRCommand;
 		string l_tth;
@@ -734,20 +729,20 @@ void NmdcHub::searchParse(const string& param, bool p_is_passive)
 	}
 }
 //==========================================================================================
-void NmdcHub::revConnectToMeParse(const string& param)
+void NmdcHub::revConnectToMeParse(std::string_view p_param)
 {
 	if (state != STATE_NORMAL)
 	{
 		return;
 	}
 	
-	string::size_type j = param.find(' ');
-	if (j == string::npos)
+	const auto j = p_param.find(' ');
+	if (j == std::string_view::npos)
 	{
 		return;
 	}
 	
-	OnlineUserPtr u = findUser(param.substr(0, j));
+	OnlineUserPtr u = findUser(toUtf8(string(p_param.substr(0, j))));
 	if (!u)
 		return;
 		
@@ -784,11 +779,9 @@ void NmdcHub::revConnectToMeParse(const string& param)
 	
 }
 //==========================================================================================
-void NmdcHub::connectToMeParse(const string& param)
+void NmdcHub::connectToMeParse(std::string_view p_param)
 {
-	string senderNick;
-	string port;
-	string server;
+	NmdcConnectToMe l_ctm;
 	while (true)
 	{
 		if (state != STATE_NORMAL)
@@ -796,59 +789,23 @@ void NmdcHub::connectToMeParse(const string& param)
 			dcassert(0);
 			break;
 		}
-		string::size_type i = param.find(' ');
-		string::size_type j;
-		if (i == string::npos || (i + 1) >= param.size())
-		{
-			dcassert(0);
-			break;
-		}
-		i++;
-		j = param.find(':', i);
-		if (j == string::npos)
-		{
-			dcassert(0);
-			break;
-		}
-		server = param.substr(i, j - i);
-		if (j + 1 >= param.size())
+		if (!l_ctm.parse(p_param))
 		{
 			dcassert(0);
 			break;
 		}
-		
-		i = param.find(' ', j + 1);
-		if (i == string::npos)
-		{
-			port = param.substr(j + 1);
-		}
-		else
-		{
-			senderNick = param.substr(i + 1);
-			port = param.substr(j + 1, i - j - 1);
-		}
-		
-		bool secure = false;
-		if (port[port.size() - 1] == 'S')
-		{
-			port.erase(port.size() - 1);
-			if (CryptoManager::TLSOk())
-			{
-				secure = true;
-			}
-		}
+		const string server(l_ctm.m_server);
+		const bool secure = l_ctm.m_is_secure && CryptoManager::TLSOk();
 		
 		if (BOOLSETTING(ALLOW_NAT_TRAVERSAL))
 		{
-			if (port[port.size() - 1] == 'N')
+			if (l_ctm.m_nat == 'N')
 			{
-				if (senderNick.empty())
+				if (l_ctm.m_sender_nick.empty())
 					break;
 					
-				port.erase(port.size() - 1);
-				
 				// Trigger connection attempt sequence locally ...
-				ConnectionManager::getInstance()->nmdcConnect(server, static_cast<uint16_t>(Util::toInt(port)), m_client_sock->getLocalPort(),
+				ConnectionManager::getInstance()->nmdcConnect(server, l_ctm.m_port, m_client_sock->getLocalPort(),
 				                                              BufferedSocket::NAT_CLIENT, getMyNick(), getHubUrl(),
 				                                              getEncoding(),
 				                                              secure);
@@ -860,16 +817,15 @@ void NmdcHub::connectToMeParse(const string& param)
 				}
 				else
 				{
-					send("$ConnectToMe " + fromUtf8(senderNick) + ' ' + getLocalIp() + ':' + Util::toString(m_client_sock->getLocalPort()) + (secure ? "RS|" : "R|"));
+					// The sender nick is still in the hub encoding
+					send("$ConnectToMe " + string(l_ctm.m_sender_nick) + ' ' + getLocalIp() + ':' + Util::toString(m_client_sock->getLocalPort()) + (secure ? "RS|" : "R|"));
 				}
 				break;
 			}
-			else if (port[port.size() - 1] == 'R')
+			else if (l_ctm.m_nat == 'R')
 			{
-				port.erase(port.size() - 1);
-				
 				// Trigger connection attempt sequence locally
-				ConnectionManager::getInstance()->nmdcConnect(server, static_cast<uint16_t>(Util::toInt(port)), m_client_sock->getLocalPort(),
+				ConnectionManager::getInstance()->nmdcConnect(server, l_ctm.m_port, m_client_sock->getLocalPort(),
 				                                              BufferedSocket::NAT_SERVER, getMyNick(), getHubUrl(),
 				                                              getEncoding(),
 				                                              secure);
@@ -877,18 +833,15 @@ void NmdcHub::connectToMeParse(const string& param)
 			}
 		}
 		
-		if (port.empty())
-			break;
-			
 		// For simplicity, we make the assumption that users on a hub have the same character encoding
-		ConnectionManager::getInstance()->nmdcConnect(server, static_cast<uint16_t>(Util::toInt(port)), getMyNick(), getHubUrl(),
+		ConnectionManager::getInstance()->nmdcConnect(server, l_ctm.m_port, getMyNick(), getHubUrl(),
 		                                              getEncoding(),
 		                                              secure);
 		break; // Âñå ÎÊ òóò áðåê õîðîøèé
 	}
 #ifdef FLYLINKDC_USE_COLLECT_STAT
 	const string l_hub = getHubUrl();
-	CFlylinkDBManager::getInstance()->push_dc_command_statistic(l_hub.empty() ? "-" : l_hub, param, server, port, senderNick);
+	CFlylinkDBManager::getInstance()->push_dc_command_statistic(l_hub.empty() ? "-" : l_hub, string(p_param), string(l_ctm.m_server), Util::toString(l_ctm.m_port), toUtf8(string(l_ctm.m_sender_nick)));
 #endif
 }
 //==========================================================================================
@@ -1532,11 +1485,7 @@ void NmdcHub::opListParse(const string& param)
 void NmdcHub::getUserList(OnlineUserList& p_list) const
 {
 	CFlyReadLock(*m_cs);
-	p_list.reserve(m_users.size());
-	for (auto i = m_users.cbegin(); i != m_users.cend(); ++i)
-	{
-		p_list.push_back(i->second);
-	}
+	m_users.getUsers(p_list);
 }
 //==========================================================================================
 void NmdcHub::AutodetectInit()
@@ -1697,9 +1646,13 @@ void NmdcHub::onLine(const string& aLine)
 		return;
 	}
 	
-	string cmd;
+	const NmdcCommand l_command(aLine);
+	const string cmd(l_command.m_name);
+	// These are parsed from the raw line, only the fields that are kept get converted
+	const bool l_is_raw_param = l_command.m_type == NmdcCommand::CMD_CONNECT_TO_ME ||
+	                            l_command.m_type == NmdcCommand::CMD_REV_CONNECT_TO_ME ||
+	                            l_command.m_type == NmdcCommand::CMD_SR;
 	string param;
-	string::size_type x = aLine.find(' ');
 	bool l_is_search  = false;
 	bool l_is_passive = false;
 #ifdef _DEBUG
@@ -1708,15 +1661,10 @@ void NmdcHub::onLine(const string& aLine)
 //				l_is_passive = false;
 //			}
 #endif
-	if (x == string::npos)
+	if (l_command.m_is_param && !l_is_raw_param)
 	{
-		cmd = aLine.substr(1);
-	}
-	else
-	{
-		cmd = aLine.substr(1, x - 1);
-		param = toUtf8(aLine.substr(x + 1));
-		l_is_search = cmd == "Search"; // TODO - ýòîãî áîëüøå íå áóäåò - ïîõåðèòü
+		param = toUtf8(string(l_command.m_param));
+		l_is_search = l_command.m_type == NmdcCommand::CMD_SEARCH;
 		if (l_is_search && ClientManager::isStartup() == false)
 		{
 			if (getHideShare())
@@ -1748,317 +1696,354 @@ void NmdcHub::onLine(const string& aLine)
 #endif
 		}
 	}
-	if (l_is_search == false && isFloodCommand(cmd, param) == true)
+	if (l_is_search == false && isFloodCommand(cmd, l_is_raw_param ? l_command.m_param : std::string_view(param)) == true)
 	{
 		return;
 	}
 #ifdef FLYLINKDC_USE_COLLECT_STAT
 	{
+		const string l_param = l_is_raw_param ? string(l_command.m_param) : param;
 		string l_tth;
-		const auto l_tth_pos = param.find("TTH:");
+		const auto l_tth_pos = l_param.find("TTH:");
 		if (l_tth_pos != string::npos)
-			l_tth = param.substr(l_tth_pos + 4, 39);
-		CFlylinkDBManager::getInstance()->push_event_statistic("command-nmdc", cmd, param, getIpAsString(), "", getHubUrlAndIP(), l_tth);
+			l_tth = l_param.substr(l_tth_pos + 4, 39);
+		CFlylinkDBManager::getInstance()->push_event_statistic("command-nmdc", cmd, l_param, getIpAsString(), "", getHubUrlAndIP(), l_tth);
 	}
 #endif
 	
 	bool bMyInfoCommand = false;
-	if (l_is_search && ClientManager::isStartup() == false)
+	switch (l_command.m_type)
 	{
-		dcassert(0);  // Èñïîëüçóåì void NmdcHub::on(BufferedSocketListener::SearchArrayFile
-		searchParse(param, l_is_passive);
-	}
-	else if (cmd == "MyINFO")
-	{
-		bMyInfoCommand = true;
-		myInfoParse(param);
-	}
+		case NmdcCommand::CMD_SEARCH:
+		{
+			if (l_is_search && ClientManager::isStartup() == false)
+			{
+				dcassert(0);  // Èñïîëüçóåì void NmdcHub::on(BufferedSocketListener::SearchArrayFile
+				searchParse(param, l_is_passive);
+			}
+			break;
+		}
+		case NmdcCommand::CMD_MY_INFO:
+		{
+			bMyInfoCommand = true;
+			myInfoParse(param);
+			break;
+		}
 #ifdef FLYLINKDC_USE_EXT_JSON
-	else if (cmd == "ExtJSON")
-	{
-		//bMyInfoCommand = false;
-		extJSONParse(param);
-	}
+		case NmdcCommand::CMD_EXT_JSON:
+		{
+			//bMyInfoCommand = false;
+			extJSONParse(param);
+			break;
+		}
 #endif
-	else if (cmd == "Quit")
-	{
-		if (!param.empty())
+		case NmdcCommand::CMD_QUIT:
 		{
-			putUser(param);
+			if (!param.empty())
+			{
+				putUser(param);
+			}
+			else
+			{
+				//dcassert(0);
+			}
+			break;
 		}
-		else
+		case NmdcCommand::CMD_CONNECT_TO_ME:
 		{
-			//dcassert(0);
+			connectToMeParse(l_command.m_param);
+			return;
 		}
-	}
-	else if (cmd == "ConnectToMe")
-	{
-		connectToMeParse(param);
-		return;
-	}
-	else if (cmd == "RevConnectToMe")
-	{
-		revConnectToMeParse(param);
-	}
-	else if (cmd == "SR")
-	{
-		SearchManager::getInstance()->onSearchResult(aLine);
-	}
-	else if (cmd == "HubName")
-	{
-		hubNameParse(param);
-	}
-	else if (cmd == "Supports")
-	{
-		supportsParse(param);
-	}
-	else if (cmd == "UserCommand")
-	{
-		userCommandParse(param);
-	}
-	else if (cmd == "Lock")
-	{
-		lockParse(aLine); // aLine!
-	}
-	else if (cmd == "Hello")
-	{
-		helloParse(param);
-	}
-	else if (cmd == "ForceMove")
-	{
-		dcassert(m_client_sock);
-		if (m_client_sock)
-			m_client_sock->disconnect(false);
-		fly_fire2(ClientListener::Redirect(), this, param);
-	}
-	else if (cmd == "HubIsFull")
-	{
-		fly_fire1(ClientListener::HubFull(), this);
-	}
-	else if (cmd == "ValidateDenide")        // Mind the spelling...
-	{
-		dcassert(m_client_sock);
-		if (m_client_sock)
-			m_client_sock->disconnect(false);
-		fly_fire(ClientListener::NickTaken());
-		//m_count_validate_denide++;
-	}
-	else if (cmd == "UserIP")
-	{
-		userIPParse(param);
-	}
-	else if (cmd == "BotList")
-	{
-		botListParse(param);
-	}
-	else if (cmd == "NickList") // TODO - óáèòü
-	{
-		nickListParse(param);
-	}
-	else if (cmd == "OpList")
-	{
-		opListParse(param);
-	}
-	else if (cmd == "To:")
-	{
-		toParse(param);
-	}
-	else if (cmd == "GetPass")
-	{
-	
-		getUser(getMyNick(), false, false); // [!] use OnlineUserPtr, don't delete this line.
-		setRegistered(); // [!]
-		// setMyIdentity(ou->getIdentity()); [-]
-		processingPassword(); // [!]
+		case NmdcCommand::CMD_REV_CONNECT_TO_ME:
+		{
+			revConnectToMeParse(l_command.m_param);
+			break;
+		}
+		case NmdcCommand::CMD_SR:
+		{
+			SearchManager::getInstance()->onSearchResult(aLine);
+			break;
+		}
+		case NmdcCommand::CMD_HUB_NAME:
+		{
+			hubNameParse(param);
+			break;
+		}
+		case NmdcCommand::CMD_SUPPORTS:
+		{
+			supportsParse(param);
+			break;
+		}
+		case NmdcCommand::CMD_USER_COMMAND:
+		{
+			userCommandParse(param);
+			break;
+		}
+		case NmdcCommand::CMD_LOCK:
+		{
+			lockParse(aLine); // aLine!
+			break;
+		}
+		case NmdcCommand::CMD_HELLO:
+		{
+			helloParse(param);
+			break;
+		}
+		case NmdcCommand::CMD_FORCE_MOVE:
+		{
+			dcassert(m_client_sock);
+			if (m_client_sock)
+				m_client_sock->disconnect(false);
+			fly_fire2(ClientListener::Redirect(), this, param);
+			break;
+		}
+		case NmdcCommand::CMD_HUB_IS_FULL:
+		{
+			fly_fire1(ClientListener::HubFull(), this);
+			break;
+		}
+		case NmdcCommand::CMD_VALIDATE_DENIDE:        // Mind the spelling...
+		{
+			dcassert(m_client_sock);
+			if (m_client_sock)
+				m_client_sock->disconnect(false);
+			fly_fire(ClientListener::NickTaken());
+			//m_count_validate_denide++;
+			break;
+		}
+		case NmdcCommand::CMD_USER_IP:
+		{
+			userIPParse(param);
+			break;
+		}
+		case NmdcCommand::CMD_BOT_LIST:
+		{
+			botListParse(param);
+			break;
+		}
+		case NmdcCommand::CMD_NICK_LIST: // TODO - óáèòü
+		{
+			nickListParse(param);
+			break;
+		}
+		case NmdcCommand::CMD_OP_LIST:
+		{
+			opListParse(param);
+			break;
+		}
+		case NmdcCommand::CMD_TO:
+		{
+			toParse(param);
+			break;
+		}
+		case NmdcCommand::CMD_GET_PASS:
+		{
 		
-	}
-	else if (cmd == "BadPass")
-	{
-		setPassword(BaseUtil::emptyString);
-	}
-	else if (cmd == "ZOn")
-	{
-		dcassert(0); // Îáðàáîòêó ZOn ïåðåíåñ â BufferedSocket ÷òîáû íå çâàòü ëèøíèé Listener
-	}
-	else if (cmd == "HubTopic")
-	{
+			getUser(getMyNick(), false, false); // [!] use OnlineUserPtr, don't delete this line.
+			setRegistered(); // [!]
+			// setMyIdentity(ou->getIdentity()); [-]
+			processingPassword(); // [!]
+			
+			break;
+		}
+		case NmdcCommand::CMD_BAD_PASS:
+		{
+			setPassword(BaseUtil::emptyString);
+			break;
+		}
+		case NmdcCommand::CMD_ZON:
+		{
+			dcassert(0); // Îáðàáîòêó ZOn ïåðåíåñ â BufferedSocket ÷òîáû íå çâàòü ëèøíèé Listener
+			break;
+		}
+		case NmdcCommand::CMD_HUB_TOPIC:
+		{
 #ifdef FLYLINKDC_SUPPORT_HUBTOPIC
-		fly_fire2(ClientListener::HubTopic(), this, param);
+			fly_fire2(ClientListener::HubTopic(), this, param);
 #endif
-	}
-	else if (cmd == "LogedIn")
-	{
-		messageYouHaweRightOperatorOnThisHub();
-	}
-	else if (cmd == "UserComman" || cmd == "myinfo")
-	{
-		// Ãäå-òî îøèáêà â ïëàãèíå - ìíîãî ñïàìà èäåò íà ñåðâåð - îòðóáèë íàõðåí
-		const string l_message = "NmdcHub::onLine first unknown command! hub = [" + getHubUrl() + "], command = [" + cmd + "], param = [" + param + "]";
-		LogManager::message(l_message);
-	}
-	else if (cmd == "BadNick")
-	{
-	
-		/*
-		$BadNick TooLong 64        -- íèê ñëèøêîì äëèííûé, ìàêñèìàëüíàÿ äîïóñòèìàÿ äëèíà íèêà 64 ñèìâîëà     (ôëàé ñ÷èòàåò ñêîëüêî ó íåãî â íèêå ñèìâîëîâ è óáèðàåò ëèøíèå, òàê ÷òîá îñòàëîñü ìàêñèìóì 64)
-		$BadNick TooShort 3        -- íèê ñëèøêîì êîðîòêèé, ìèíèìàëüíàÿ äîïóñòèìàÿ äëèíà íèêà 3 ñèìâîëà     (ôëàé ñ÷èòàåò ñêîëüêî ó íåãî â íèêå ñèìâîëîâ è äîáàâëÿåò íåõâàòàþùèå, òàê ÷òîá áûëî ìèíèìóì 3)
-		$BadNick BadPrefix        -- ó íèêà ëèøíèé ïðåôèêñ, õàá õî÷åò íèê áåç ïðåôèêñà      (ôëàé óáåðàåò âñå ïðåôèêñû èç íèêà)
-		$BadNick BadPrefix [ISP1] [ISP2]        -- ó íèêà íåõâàòàåò ïðåôèêñà, õàá õî÷åò íèê ñ ïðåôèêñîì [ISP1] èëè [ISP2]      (ôëàé äîáàâëÿåò ñëó÷àéíûé èç ïåðå÷èñëåíûõ ïðåôèêñîâ ê íèêó)
-		$BadNick BadChar 32 36        -- íèê ñîäåðæèò çàïðåùåííûå õàáîì ñèìâîëû, õàá õî÷åò íèê â êîòîðîì íå áóäåò ïåðå÷èñëåíûõ ñèìâîëîâ      (ôëàé óáèðàåò èç íèêà âñå ïåðå÷èñëåíûå áàéòû ñèìâîëîâ)
-		*/
-		dcassert(m_client_sock);
-		if (m_client_sock)
-			m_client_sock->disconnect(false);
+			break;
+		}
+		case NmdcCommand::CMD_LOGED_IN:
 		{
-			if (m_nick_rule)
-			{
-				auto l_nick = getMyNick();
-				m_nick_rule->convert_nick(l_nick);
-				setMyNick(l_nick);
+			messageYouHaweRightOperatorOnThisHub();
+			break;
+		}
+		case NmdcCommand::CMD_BROKEN:
+		{
+			// Ãäå-òî îøèáêà â ïëàãèíå - ìíîãî ñïàìà èäåò íà ñåðâåð - îòðóáèë íàõðåí
+			const string l_message = "NmdcHub::onLine first unknown command! hub = [" + getHubUrl() + "], command = [" + cmd + "], param = [" + param + "]";
+			LogManager::message(l_message);
+			break;
+		}
+		case NmdcCommand::CMD_BAD_NICK:
+		{
+		
+			/*
+			$BadNick TooLong 64        -- íèê ñëèøêîì äëèííûé, ìàêñèìàëüíàÿ äîïóñòèìàÿ äëèíà íèêà 64 ñèìâîëà     (ôëàé ñ÷èòàåò ñêîëüêî ó íåãî â íèêå ñèìâîëîâ è óáèðàåò ëèøíèå, òàê ÷òîá îñòàëîñü ìàêñèìóì 64)
+			$BadNick TooShort 3        -- íèê ñëèøêîì êîðîòêèé, ìèíèìàëüíàÿ äîïóñòèìàÿ äëèíà íèêà 3 ñèìâîëà     (ôëàé ñ÷èòàåò ñêîëüêî ó íåãî â íèêå ñèìâîëîâ è äîáàâëÿåò íåõâàòàþùèå, òàê ÷òîá áûëî ìèíèìóì 3)
+			$BadNick BadPrefix        -- ó íèêà ëèøíèé ïðåôèêñ, õàá õî÷åò íèê áåç ïðåôèêñà      (ôëàé óáåðàåò âñå ïðåôèêñû èç íèêà)
+			$BadNick BadPrefix [ISP1] [ISP2]        -- ó íèêà íåõâàòàåò ïðåôèêñà, õàá õî÷åò íèê ñ ïðåôèêñîì [ISP1] èëè [ISP2]      (ôëàé äîáàâëÿåò ñëó÷àéíûé èç ïåðå÷èñëåíûõ ïðåôèêñîâ ê íèêó)
+			$BadNick BadChar 32 36        -- íèê ñîäåðæèò çàïðåùåííûå õàáîì ñèìâîëû, õàá õî÷åò íèê â êîòîðîì íå áóäåò ïåðå÷èñëåíûõ ñèìâîëîâ      (ôëàé óáèðàåò èç íèêà âñå ïåðå÷èñëåíûå áàéòû ñèìâîëîâ)
+			*/
+			dcassert(m_client_sock);
+			if (m_client_sock)
+				m_client_sock->disconnect(false);
+			{
+				if (m_nick_rule)
+				{
+					auto l_nick = getMyNick();
+					m_nick_rule->convert_nick(l_nick);
+					setMyNick(l_nick);
+				}
 			}
+			fly_fire(ClientListener::NickTaken());
+			//m_count_validate_denide++;
+			break;
 		}
-		fly_fire(ClientListener::NickTaken());
-		//m_count_validate_denide++;
-	}
-	else if (cmd == "SearchRule")
-	{
-		const StringTokenizer<string> l_nick_rule(param, "$$", 4);
-		const StringList& sl = l_nick_rule.getTokens();
-		for (auto it = sl.cbegin(); it != sl.cend(); ++it)
+		case NmdcCommand::CMD_SEARCH_RULE:
 		{
-			auto l_pos = it->find(' ');
-			if (l_pos != string::npos && l_pos < it->size() + 1)
+			const StringTokenizer<string> l_nick_rule(param, "$$", 4);
+			const StringList& sl = l_nick_rule.getTokens();
+			for (auto it = sl.cbegin(); it != sl.cend(); ++it)
 			{
-				const string l_key = it->substr(0, l_pos);
-				if (l_key == "Int")
+				auto l_pos = it->find(' ');
+				if (l_pos != string::npos && l_pos < it->size() + 1)
 				{
-					auto l_int = Util::toInt(it->substr(l_pos + 1));
-					if (l_int > 0)
+					const string l_key = it->substr(0, l_pos);
+					if (l_key == "Int")
 					{
-						setSearchInterval(l_int * 1000, true);
+						auto l_int = Util::toInt(it->substr(l_pos + 1));
+						if (l_int > 0)
+						{
+							setSearchInterval(l_int * 1000, true);
+						}
 					}
-				}
-				if (l_key == "IntPas")
-				{
-					auto l_int = Util::toInt(it->substr(l_pos + 1));
-					if (l_int > 0)
+					if (l_key == "IntPas")
 					{
-						setSearchIntervalPassive(l_int * 1000, true);
+						auto l_int = Util::toInt(it->substr(l_pos + 1));
+						if (l_int > 0)
+						{
+							setSearchIntervalPassive(l_int * 1000, true);
+						}
 					}
 				}
 			}
+			break;
 		}
-	}
-	else if (cmd == "NickRule")
-	{
-		m_nick_rule = std::unique_ptr<CFlyNickRule>(new CFlyNickRule);
-		const StringTokenizer<string> l_nick_rule(param, "$$", 4);
-		const StringList& sl = l_nick_rule.getTokens();
-		for (auto it = sl.cbegin(); it != sl.cend(); ++it)
+		case NmdcCommand::CMD_NICK_RULE:
 		{
-			auto l_pos = it->find(' ');
-			if (l_pos != string::npos && l_pos < it->size() + 1)
+			m_nick_rule = std::unique_ptr<CFlyNickRule>(new CFlyNickRule);
+			const StringTokenizer<string> l_nick_rule(param, "$$", 4);
+			const StringList& sl = l_nick_rule.getTokens();
+			for (auto it = sl.cbegin(); it != sl.cend(); ++it)
 			{
-				const string l_key = it->substr(0, l_pos);
-				if (l_key == "Min")
+				auto l_pos = it->find(' ');
+				if (l_pos != string::npos && l_pos < it->size() + 1)
 				{
-					unsigned l_nick_rule_min = Util::toInt(it->substr(l_pos + 1));
-					if (l_nick_rule_min > 64)
+					const string l_key = it->substr(0, l_pos);
+					if (l_key == "Min")
 					{
-						CFlyServerJSON::pushError(81, "Error value NickRule Min = " + it->substr(l_pos + 1) +
-						                          " replace: 64" + "Hub = " + getHubUrl());
-						l_nick_rule_min = 64;
-						disconnect(false);
-						dcassert(0);
+						unsigned l_nick_rule_min = Util::toInt(it->substr(l_pos + 1));
+						if (l_nick_rule_min > 64)
+						{
+							CFlyServerJSON::pushError(81, "Error value NickRule Min = " + it->substr(l_pos + 1) +
+							                          " replace: 64" + "Hub = " + getHubUrl());
+							l_nick_rule_min = 64;
+							disconnect(false);
+							dcassert(0);
+						}
+						m_nick_rule->m_nick_rule_min = l_nick_rule_min;
 					}
-					m_nick_rule->m_nick_rule_min = l_nick_rule_min;
-				}
-				else if (l_key == "Max")
-				{
-					unsigned l_nick_rule_max = Util::toInt(it->substr(l_pos + 1));
-					if (l_nick_rule_max > 200)
+					else if (l_key == "Max")
 					{
-						CFlyServerJSON::pushError(81, "Error value NickRule Max = " + it->substr(l_pos + 1) +
-						                          " replace: 200" + "Hub = " + getHubUrl());
-						l_nick_rule_max = 200;
-						disconnect(false);
-						//dcassert(0);
+						unsigned l_nick_rule_max = Util::toInt(it->substr(l_pos + 1));
+						if (l_nick_rule_max > 200)
+						{
+							CFlyServerJSON::pushError(81, "Error value NickRule Max = " + it->substr(l_pos + 1) +
+							                          " replace: 200" + "Hub = " + getHubUrl());
+							l_nick_rule_max = 200;
+							disconnect(false);
+							//dcassert(0);
+						}
+						m_nick_rule->m_nick_rule_max = l_nick_rule_max;
 					}
-					m_nick_rule->m_nick_rule_max = l_nick_rule_max;
-				}
-				else if (l_key == "Char")
-				{
-					const StringTokenizer<string> l_char(it->substr(l_pos + 1), " ");
-					const StringList& l = l_char.getTokens();
-					for (auto j = l.cbegin(); j != l.cend(); ++j)
+					else if (l_key == "Char")
 					{
-						if (!j->empty())
+						const StringTokenizer<string> l_char(it->substr(l_pos + 1), " ");
+						const StringList& l = l_char.getTokens();
+						for (auto j = l.cbegin(); j != l.cend(); ++j)
 						{
-							m_nick_rule->m_invalid_char.push_back(uint8_t(Util::toInt(*j)));
+							if (!j->empty())
+							{
+								m_nick_rule->m_invalid_char.push_back(uint8_t(Util::toInt(*j)));
+							}
 						}
 					}
-				}
-				else if (l_key == "Pref")
-				{
-					const StringTokenizer<string> l_pref(it->substr(l_pos + 1), " ");
-					const StringList& l = l_pref.getTokens();
-					for (auto j = l.cbegin(); j != l.cend(); ++j)
+					else if (l_key == "Pref")
 					{
-						if (!j->empty())
+						const StringTokenizer<string> l_pref(it->substr(l_pos + 1), " ");
+						const StringList& l = l_pref.getTokens();
+						for (auto j = l.cbegin(); j != l.cend(); ++j)
 						{
-							m_nick_rule->m_prefix.push_back(*j);
+							if (!j->empty())
+							{
+								m_nick_rule->m_prefix.push_back(*j);
+							}
 						}
 					}
 				}
+				else
+				{
+					dcassert(0);
+				}
 			}
-			else
+			if (m_supportFlags & SUPPORTS_NICKRULE)
 			{
-				dcassert(0);
+				if (m_nick_rule)
+				{
+					string l_nick = getMyNick();
+					const string l_fly_nick = getRandomTempNick();
+					if (!l_fly_nick.empty())
+					{
+						l_nick = l_fly_nick;
+					}
+					m_nick_rule->convert_nick(l_nick);
+					setMyNick(l_nick);
+					
+					// Òóò ïîêà íå ïàøåò.
+					//OnlineUserPtr ou = getUser(l_nick, false, true);
+					//sendValidateNick(ou->getIdentity().getNick());
+				}
 			}
+			break;
 		}
-		if (m_supportFlags & SUPPORTS_NICKRULE)
+		case NmdcCommand::CMD_GET_HUB_URL:
 		{
-			if (m_nick_rule)
-			{
-				string l_nick = getMyNick();
-				const string l_fly_nick = getRandomTempNick();
-				if (!l_fly_nick.empty())
+			send("$MyHubURL " + getHubUrl() + "|");
+			break;
+		}
+		default:
+		{
+			//dcassert(0);
+			dcdebug("NmdcHub::onLine Unknown command %s\n", aLine.c_str());
+			string l_message;
+			{
+				CFlyFastLock(g_unknown_cs);
+				g_unknown_command_array[getHubUrl()][cmd]++;
+				auto& l_item = g_unknown_command[cmd + "[" + getHubUrl() + "]"];
+				l_item.second++;
+				if (l_item.first.empty())
 				{
-					l_nick = l_fly_nick;
+					l_item.first = aLine;
+					l_message = "NmdcHub::onLine first unknown command! hub = [" + getHubUrl() + "], command = [" + cmd + "], param = [" + param + "]";
 				}
-				m_nick_rule->convert_nick(l_nick);
-				setMyNick(l_nick);
-				
-				// Òóò ïîêà íå ïàøåò.
-				//OnlineUserPtr ou = getUser(l_nick, false, true);
-				//sendValidateNick(ou->getIdentity().getNick());
 			}
-		}
-	}
-	else if (cmd == "GetHubURL")
-	{
-		send("$MyHubURL " + getHubUrl() + "|");
-	}
-	else
-	{
-		//dcassert(0);
-		dcdebug("NmdcHub::onLine Unknown command %s\n", aLine.c_str());
-		string l_message;
-		{
-			CFlyFastLock(g_unknown_cs);
-			g_unknown_command_array[getHubUrl()][cmd]++;
-			auto& l_item = g_unknown_command[cmd + "[" + getHubUrl() + "]"];
-			l_item.second++;
-			if (l_item.first.empty())
+			if (!l_message.empty())
 			{
-				l_item.first = aLine;
-				l_message = "NmdcHub::onLine first unknown command! hub = [" + getHubUrl() + "], command = [" + cmd + "], param = [" + param + "]";
+				LogManager::message(l_message + " Raw = " + aLine);
+				CFlyServerJSON::pushError(24, "NmdcHub::onLine first unknown command:" + l_message);
 			}
-		}
-		if (!l_message.empty())
-		{
-			LogManager::message(l_message + " Raw = " + aLine);
-			CFlyServerJSON::pushError(24, "NmdcHub::onLine first unknown command:" + l_message);
+			break;
 		}
 	}
 	processAutodetect(bMyInfoCommand);
@@ -2787,19 +2772,17 @@ void NmdcHub::myInfoParse(const string& param)
 {
 	if (ClientManager::isBeforeShutdown())
 		return;
-	string::size_type i = 5;
-	string::size_type j = param.find(' ', i);
-	if (j == string::npos || j == i)
+	NmdcMyInfo l_info;
+	if (!l_info.parse(param))
 		return;
-	const string l_nick = param.substr(i, j - i);
-	
-	dcassert(!l_nick.empty())
-	if (l_nick.empty())
+#ifdef FLYLINKDC_USE_CHECK_CHANGE_MYINFO
+	// Offset of a field in param
+	const auto l_pos = [&param](std::string_view p_field)
 	{
-		dcassert(0);
-		return;
-	}
-	i = j + 1;
+		return string::size_type(p_field.data() - param.data());
+	};
+#endif
+	const string l_nick(l_info.m_nick);
 	
 	OnlineUserPtr ou = getUser(l_nick, false, m_bLastMyInfoCommand == DIDNT_GET_YET_FIRST_MYINFO); // Ïðè ïåðâîì êîííåêòå èñêëþ÷àåì ïîèñê
 	ou->getUser()->setFlag(User::IS_MYINFO);
@@ -2826,18 +2809,14 @@ void NmdcHub::myInfoParse(const string& param)
 #endif
 	}
 #endif // FLYLINKDC_USE_CHECK_CHANGE_MYINFO
-	j = param.find('$', i);
-	dcassert(j != string::npos)
-	if (j == string::npos)
-		return;
 	bool l_is_only_desc_change = false;
 #ifdef FLYLINKDC_USE_CHECK_CHANGE_MYINFO
 	if (!l_my_info_before_change.empty())
 	{
-		const string::size_type l_pos_begin_tag = param.find('<', i);
+		const string::size_type l_pos_begin_tag = param.find('<', l_pos(l_info.m_description));
 		if (l_pos_begin_tag != string::npos)
 		{
-			const string::size_type l_pos_begin_tag_old = l_my_info_before_change.find('<', i);
+			const string::size_type l_pos_begin_tag_old = l_my_info_before_change.find('<', l_pos(l_info.m_description));
 			if (l_pos_begin_tag_old != string::npos)
 			{
 			
@@ -2854,51 +2833,29 @@ void NmdcHub::myInfoParse(const string& param)
 		}
 	}
 #endif // FLYLINKDC_USE_CHECK_CHANGE_MYINFO 
-	string tmpDesc = unescape(param.substr(i, j - i));
-	// Look for a tag...
-	if (!tmpDesc.empty() && tmpDesc[tmpDesc.size() - 1] == '>')
+	if (l_info.m_is_tag)
 	{
-		const string::size_type x = tmpDesc.rfind('<');
-		if (x != string::npos)
+		if (!l_info.m_tag.empty() && l_is_only_desc_change == false)
 		{
-			// Hm, we have something...disassemble it...
-			//dcassert(tmpDesc.length() > x + 2)
-			if (tmpDesc.length() > x + 2 && l_is_only_desc_change == false)
-			{
-				const string l_tag = tmpDesc.substr(x + 1, tmpDesc.length() - x - 2);
-				bool l_is_version_change = true;
+			const string l_tag(l_info.m_tag);
+			bool l_is_version_change = true;
 #ifdef FLYLINKDC_USE_CHECK_CHANGE_TAG
-				if (ou->isTagUpdate(l_tag, l_is_version_change))
+			if (ou->isTagUpdate(l_tag, l_is_version_change))
 #endif
-				{
-					updateFromTag(ou->getIdentity(), l_tag, l_is_version_change); // òÿæåëàÿ îïåðàöèÿ ñ òîêåíàìè. TODO - îïòèìèçíóòü
-					//if (!ou->m_tag_old.empty())
-					//  ou->m_tag_old = l_tag;
-				}
-				//ou->m_tag_old = l_tag;
+			{
+				updateFromTag(ou->getIdentity(), l_tag, l_is_version_change); // òÿæåëàÿ îïåðàöèÿ ñ òîêåíàìè. TODO - îïòèìèçíóòü
 			}
-			ou->getIdentity().setDescription(tmpDesc.erase(x));
 		}
 	}
-	else
+	else if (l_info.m_mode == 'A')
 	{
-		ou->getIdentity().setDescription(tmpDesc); //
-		dcassert(param.size() > (j + 2)); //
-		if (param.size() > j + 3)
-		{
-			if (param[j] == '$')
-			{
-				if (param[j + 1] == 'A')
-				{
-					ou->getIdentity().getUser()->unsetFlag(User::NMDC_FILES_PASSIVE | User::NMDC_SEARCH_PASSIVE);
-				}
-				else if (param[j + 1] == 'P')
-				{
-					ou->getIdentity().getUser()->setFlag(User::NMDC_FILES_PASSIVE | User::NMDC_SEARCH_PASSIVE);
-				}
-			}
-		}
+		ou->getIdentity().getUser()->unsetFlag(User::NMDC_FILES_PASSIVE | User::NMDC_SEARCH_PASSIVE);
+	}
+	else if (l_info.m_mode == 'P')
+	{
+		ou->getIdentity().getUser()->setFlag(User::NMDC_FILES_PASSIVE | User::NMDC_SEARCH_PASSIVE);
 	}
+	ou->getIdentity().setDescription(unescape(string(l_info.m_description)));
 #ifdef FLYLINKDC_USE_CHECK_CHANGE_MYINFO
 	if (l_is_only_desc_change && !ClientManager::isBeforeShutdown())
 	{
@@ -2907,47 +2864,31 @@ void NmdcHub::myInfoParse(const string& param)
 	}
 #endif // FLYLINKDC_USE_CHECK_CHANGE_MYINFO 
 	
-	i = j + 3;
-	j = param.find('$', i);
-	if (j == string::npos)
+	if (l_info.m_fields < NmdcMyInfo::FIELDS_CONNECTION)
 		return;
-		
-		
-	if (i == j || j - i - 1 == 0)
+	if (l_info.m_connection.empty())
 	{
 		// No connection = bot...
 		ou->getIdentity().setBot();
-		NmdcSupports::setStatus(ou->getIdentity(), param[j - 1]);
+		NmdcSupports::setStatus(ou->getIdentity(), l_info.m_status);
 	}
 	else
 	{
-		NmdcSupports::setStatus(ou->getIdentity(), param[j - 1], param.substr(i, j - i - 1));
+		NmdcSupports::setStatus(ou->getIdentity(), l_info.m_status, string(l_info.m_connection));
 	}
 	
-	
-	i = j + 1;
-	j = param.find('$', i);
-	
-	if (j == string::npos)
+	if (l_info.m_fields < NmdcMyInfo::FIELDS_EMAIL)
 		return;
-	if (j != i)
-	{
-		ou->getIdentity().setEmail(unescape(param.substr(i, j - i)));
-	}
-	else
-	{
-		ou->getIdentity().setEmail(BaseUtil::emptyString);
-	}
+	ou->getIdentity().setEmail(l_info.m_email.empty() ? BaseUtil::emptyString : unescape(string(l_info.m_email)));
 	
-	i = j + 1;
-	j = param.find('$', i);
-	if (j == string::npos)
+	if (l_info.m_fields < NmdcMyInfo::FIELDS_SHARE)
 		return;
 #ifdef FLYLINKDC_USE_CHECK_CHANGE_MYINFO
 	// Ïðîâåðèì ÷òî ìåíÿåòñ òîëüêî øàðà
 	bool l_is_change_only_share = false;
 	if (!l_my_info_before_change.empty())
 	{
+		const auto i = l_pos(l_info.m_share);
 		if (i < l_my_info_before_change.size())
 		{
 			if (strcmp(param.c_str() + i, l_my_info_before_change.c_str() + i) != 0)
@@ -2966,7 +2907,7 @@ void NmdcHub::myInfoParse(const string& param)
 	}
 #endif // FLYLINKDC_USE_CHECK_CHANGE_MYINFO
 	
-	auto l_share_size = Util::toInt64(param.c_str() + i); // Èíîãäà øàðà áûâàåò == -1 http://www.flickr.com/photos/96019675@N02/9732534452/
+	auto l_share_size = l_info.getShare(); // Èíîãäà øàðà áûâàåò == -1 http://www.flickr.com/photos/96019675@N02/9732534452/
 	if (l_share_size < 0)
 	{
 		l_share_size = 0;
@@ -3080,7 +3021,8 @@ void NmdcHub::on(BufferedSocketListener::SearchArrayTTH, CFlySearchArrayTTH& p_s
 		}
 		static int g_id_search_array = 0;
 		g_id_search_array++;
-		unique_ptr<Socket> l_udp;
+		// Results are collected per seeker: an auto-search sweep asks us for many TTHs at once
+		std::unordered_map<string, StringList> l_replies;
 		for (auto i = p_search_array.begin(); i != p_search_array.end(); ++i)
 		{
 			if (i->m_toSRCommand)
@@ -3114,11 +3056,7 @@ void NmdcHub::on(BufferedSocketListener::SearchArrayTTH, CFlySearchArrayTTH& p_s
 						COMMAND_DEBUG("[~][" + Util::toString(g_id_search_array) + "]$SR [SkipUDP-TTH] " + *i->m_toSRCommand, DebugTask::HUB_IN, getIpPort());
 						continue;
 					}
-					if (!l_udp)
-					{
-						l_udp = std::unique_ptr<Socket>(new Socket);
-					}
-					sendUDPSR(*l_udp, i->m_search, *i->m_toSRCommand, this);
+					l_replies[i->m_search].push_back(*i->m_toSRCommand);
 				}
 				COMMAND_DEBUG("[+][" + Util::toString(g_id_search_array) + "]$Search " + i->m_search + " F?T?0?9?TTH:" + i->m_tth.toBase32(), DebugTask::HUB_IN, getIpPort());
 			}
@@ -3127,6 +3065,14 @@ void NmdcHub::on(BufferedSocketListener::SearchArrayTTH, CFlySearchArrayTTH& p_s
 				COMMAND_DEBUG("[-][" + Util::toString(g_id_search_array) + "]$Search" + i->m_search + " F?T?0?9?TTH:" + i->m_tth.toBase32(), DebugTask::HUB_IN, getIpPort());
 			}
 		}
+		if (!l_replies.empty())
+		{
+			Socket l_udp;
+			for (auto i = l_replies.cbegin(); i != l_replies.cend(); ++i)
+			{
+				sendUDPSR(l_udp, i->first, i->second, this);
+			}
+		}
 	}
 }
 
@@ -3205,22 +3151,23 @@ void NmdcHub::RequestConnectionForAutodetect()
 			{
 			
 				CFlyReadLock(*m_cs);
-				for (auto i = m_users.cbegin(); i != m_users.cend() && m_iRequestCount < c_MAX_CONNECTION_REQUESTS_COUNT; ++i)
+				m_users.forEach([&](const OnlineUserPtr & p_user)
 				{
-					if (i->second->getIdentity().isBot() ||
-					        i->second->getUser()->getFlags() & User::NMDC_FILES_PASSIVE ||
-					        i->second->getUser()->getFlags() & User::NMDC_SEARCH_PASSIVE ||
-					        i->first == getMyNick())
-						continue;
+					if (m_iRequestCount >= c_MAX_CONNECTION_REQUESTS_COUNT ||
+					        p_user->getIdentity().isBot() ||
+					        p_user->getUser()->getFlags() & User::NMDC_FILES_PASSIVE ||
+					        p_user->getUser()->getFlags() & User::NMDC_SEARCH_PASSIVE ||
+					        p_user->getIdentity().getNick() == getMyNick())
+						return;
 					// TODO optimize:
 					// request for connection from users with fastest connection, or operators
-					connectToMe(*i->second, ExpectedMap::REASON_DETECT_CONNECTION);
+					connectToMe(*p_user, ExpectedMap::REASON_DETECT_CONNECTION);
 #ifdef _DEBUG
-					dcdebug("[!!!!!!!!!!!!!!] AutoDetect connectToMe! Nick = %s Hub = %s\r\n", i->first.c_str(), + getHubUrl().c_str());
-					LogManager::message("AutoDetect connectToMe - Nick = " + i->first + " Hub = " + getHubUrl());
+					dcdebug("[!!!!!!!!!!!!!!] AutoDetect connectToMe! Nick = %s Hub = %s\r\n", p_user->getIdentity().getNick().c_str(), + getHubUrl().c_str());
+					LogManager::message("AutoDetect connectToMe - Nick = " + p_user->getIdentity().getNick() + " Hub = " + getHubUrl());
 #endif
 					++m_iRequestCount;
-				}
+				});
 			}
 		}
 	}
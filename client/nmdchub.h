@@ -104,9 +104,7 @@ class NmdcHub : public Client, private Flags
 		// Used to detect end of connection to hub sequence (after gettinf list of users)
 		enum DefinedMeyInfoState {DIDNT_GET_YET_FIRST_MYINFO, FIRST_MYINFO, ALREADY_GOT_MYINFO};
 		
-		typedef std::unordered_map<string, OnlineUserPtr> NickMap;
-		
-		NickMap  m_users;
+		HubUserTable& m_users; // the nick index of m_user_table, guarded by m_cs
 		string   m_lastMyInfo;
 		string   m_lastExtJSONInfo;
 		string   m_lastExtJSONSupport;
@@ -230,7 +228,7 @@ class NmdcHub : public Client, private Flags
 #endif
 		                );
 		                
-		static void sendUDPSR(Socket& p_udp, const string& p_seeker, const string& p_sr, const Client* p_client);
+		static void sendUDPSR(Socket& p_udp, const string& p_seeker, const StringList& p_sr, const Client* p_client);
 		void NmdcSearch(const SearchParam& p_search_param);
 		string calcExternalIP() const;
 		void revConnectToMe(const OnlineUser& aUser);
@@ -245,8 +243,8 @@ class NmdcHub : public Client, private Flags
 #endif // FLYLINKDC_USE_EXT_JSON_GUARD
 #endif
 		void searchParse(const string& param, bool p_is_passive);
-		void connectToMeParse(const string& param);
-		void revConnectToMeParse(const string& param);
+		void connectToMeParse(std::string_view p_param);
+		void revConnectToMeParse(std::string_view p_param);
 		void hubNameParse(const string& param);
 		void supportsParse(const string& param);
 		void userCommandParse(const string& param);
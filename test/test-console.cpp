@@ -20,7 +20,11 @@
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 #include <limits>
+#include <random>
 #include "../client/CFlyThread.h"
+#include "../client/NmdcParser.h"
+#include "../client/XmlScan.h"
+#include "../client/TigerHash.h"
 #include "cperformance.h"
 #include "cycle.h"
 
@@ -750,8 +754,248 @@ unsigned long Ip2Num_fly(const string &ip)
     return 0;
 }
 
+// Replay of a recorded hub login: the raw stream of the hub with the '|' separators,
+// test-console nmdc <file>. The lines are cycled up to 50k $MyINFO.
+int test_nmdc_parser(const boost::filesystem::path& p_file)
+{
+	boost::iostreams::mapped_file_source l_file(p_file);
+	const std::string_view l_data(l_file.data(), l_file.size());
+	std::vector<std::string_view> l_lines;
+	size_t l_count_myinfo = 0;
+	for (size_t i = 0, j; i < l_data.size(); i = j + 1)
+	{
+		j = l_data.find('|', i);
+		if (j == std::string_view::npos)
+			j = l_data.size();
+		if (j > i && l_data[i] == '$')
+		{
+			l_lines.push_back(l_data.substr(i, j - i));
+			if (l_lines.back().compare(0, 8, "$MyINFO ") == 0)
+				++l_count_myinfo;
+		}
+	}
+	if (l_count_myinfo == 0)
+	{
+		std::cout << "No $MyINFO in " << p_file << std::endl;
+		return 1;
+	}
+	const size_t l_max_myinfo = 50000;
+	const size_t l_rounds = (l_max_myinfo + l_count_myinfo - 1) / l_count_myinfo;
+	
+	// The old way: substr for the command and every field
+	size_t l_sum[2] = {0};
+	ticks start = getticks();
+	for (size_t r = 0; r < l_rounds; ++r)
+	{
+		for (auto i = l_lines.cbegin(); i != l_lines.cend(); ++i)
+		{
+			const string l_line(*i);
+			const auto x = l_line.find(' ');
+			const string cmd = x == string::npos ? l_line.substr(1) : l_line.substr(1, x - 1);
+			if (cmd != "MyINFO")
+				continue;
+			const string param = l_line.substr(x + 1);
+			auto j = param.find(' ', 5);
+			if (j == string::npos)
+				continue;
+			const string l_nick = param.substr(5, j - 5);
+			auto k = j + 1;
+			j = param.find('$', k);
+			if (j == string::npos)
+				continue;
+			const string l_desc = param.substr(k, j - k);
+			k = j + 3;
+			j = param.find('$', k);
+			if (j == string::npos)
+				continue;
+			const string l_connection = param.substr(k, j - k - 1);
+			k = j + 1;
+			j = param.find('$', k);
+			if (j == string::npos)
+				continue;
+			const string l_email = param.substr(k, j - k);
+			k = j + 1;
+			j = param.find('$', k);
+			if (j == string::npos)
+				continue;
+			l_sum[0] += l_nick.size() + l_desc.size() + l_connection.size() + l_email.size() + _atoi64(param.substr(k, j - k).c_str());
+		}
+	}
+	printf("nmdc substr = %f\r\n", elapsed(getticks(), start));
+	
+	start = getticks();
+	for (size_t r = 0; r < l_rounds; ++r)
+	{
+		for (auto i = l_lines.cbegin(); i != l_lines.cend(); ++i)
+		{
+			const NmdcCommand l_command(*i);
+			if (l_command.m_type != NmdcCommand::CMD_MY_INFO)
+				continue;
+			NmdcMyInfo l_info;
+			if (!l_info.parse(l_command.m_param) || l_info.m_fields != NmdcMyInfo::FIELDS_SHARE)
+				continue;
+			l_sum[1] += l_info.m_nick.size() + l_info.m_description.size() + l_info.m_connection.size() + l_info.m_email.size() + l_info.getShare();
+		}
+	}
+	printf("nmdc string_view = %f\r\n", elapsed(getticks(), start));
+	// Tags are cut from the description by the parser only, the sums differ by them
+	printf("lines = %u $MyINFO = %u sum[0] = %I64u sum[1] = %I64u\r\n", unsigned(l_lines.size() * l_rounds), unsigned(l_count_myinfo * l_rounds), uint64_t(l_sum[0]), uint64_t(l_sum[1]));
+	return 0;
+}
+
+// Walks a files.xml the way SimpleXMLReader does: text runs up to '<', tag and attribute names,
+// spaces and quoted values. Returns the number of attribute values.
+template<bool p_sse2>
+static size_t scan_xml(const char* p, size_t n)
+{
+	size_t l_values = 0;
+	size_t i = 0;
+	while (i < n)
+	{
+		i += p_sse2 ? XmlScan::findFirstOf(p + i, n - i, '<', '&', '<') : XmlScan::findFirstOfScalar(p + i, n - i, '<', '&', '<');
+		if (i >= n)
+			break;
+		++i;
+		while (i < n && p[i] != '>')
+		{
+			i += p_sse2 ? XmlScan::skipSpaces(p + i, n - i) : XmlScan::skipSpacesScalar(p + i, n - i);
+			const size_t l_eq = XmlScan::findFirstOfScalar(p, n, '=', '>', '>', i);
+			if (l_eq >= n || p[l_eq] == '>')
+			{
+				i = l_eq;
+				break;
+			}
+			const char l_quote = p[l_eq + 1];
+			i = l_eq + 2;
+			i += p_sse2 ? XmlScan::findFirstOf(p + i, n - i, l_quote, '&', l_quote) : XmlScan::findFirstOfScalar(p + i, n - i, l_quote, '&', l_quote);
+			++i;
+			++l_values;
+		}
+		++i;
+	}
+	return l_values;
+}
+
+int test_xml_parser(size_t p_count)
+{
+	// A files.xml in the shape ShareManager writes it: 100 files per directory
+	std::string l_xml = "<?xml version=\"1.0\" encoding=\"utf-8\" standalone=\"yes\"?>\r\n"
+	                    "<FileListing Version=\"1\" CID=\"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\" Base=\"/\" Generator=\"test-console\">\r\n";
+	l_xml.reserve(p_count * 130);
+	char l_buf[256];
+	for (size_t i = 0; i < p_count; ++i)
+	{
+		if (i % 100 == 0)
+		{
+			if (i)
+				l_xml += "\t</Directory>\r\n";
+			sprintf_s(l_buf, "\t<Directory Name=\"Directory number %u\">\r\n", unsigned(i / 100));
+			l_xml += l_buf;
+		}
+		sprintf_s(l_buf, "\t\t<File Name=\"Some shared file with a long name %u.mkv\" Size=\"%u\" TTH=\"%039u\"/>\r\n", unsigned(i), unsigned(i * 1021), unsigned(i));
+		l_xml += l_buf;
+	}
+	l_xml += "\t</Directory>\r\n</FileListing>\r\n";
+	
+	ticks start = getticks();
+	const size_t l_sse2 = scan_xml<true>(l_xml.data(), l_xml.size());
+	printf("xml sse2 = %f\r\n", elapsed(getticks(), start));
+	
+	start = getticks();
+	const size_t l_scalar = scan_xml<false>(l_xml.data(), l_xml.size());
+	printf("xml scalar = %f\r\n", elapsed(getticks(), start));
+	printf("entries = %u size = %u values sse2 = %u scalar = %u\r\n", unsigned(p_count), unsigned(l_xml.size()), unsigned(l_sse2), unsigned(l_scalar));
+	return l_sse2 == l_scalar ? 0 : 1;
+}
+
+// The multi-buffer leaf hash against the scalar Tiger(0x00 | leaf) on random and edge-pattern leaves,
+// with counts that are not a multiple of the lanes and an unaligned buffer: test-console tiger
+int test_tiger_leaves()
+{
+	// The scalar code is the reference for the rest, it is checked against the known answer first
+	static const uint8_t l_abc[TigerHash::BYTES] =
+	{
+		0x2A, 0xAB, 0x14, 0x84, 0xE8, 0xC1, 0x58, 0xF2, 0xBF, 0xB8, 0xC5, 0xFF,
+		0x41, 0xB5, 0x7A, 0x52, 0x51, 0x29, 0x13, 0x1C, 0x95, 0x7B, 0x5F, 0x93
+	};
+	TigerHash l_kat;
+	l_kat.update("abc", 3);
+	if (memcmp(l_kat.finalize(), l_abc, TigerHash::BYTES) != 0)
+	{
+		printf("tiger: Tiger(\"abc\") differs from the known answer\r\n");
+		return 1;
+	}
+	const size_t l_leaf = TigerHash::LEAF_SIZE;
+	const size_t l_max_count = 13;
+	std::vector<uint8_t> l_buf(l_max_count * l_leaf + 1);
+	std::vector<uint8_t> l_hashes(l_max_count * TigerHash::BYTES);
+	std::mt19937 l_rand(20170101);
+	unsigned l_errors = 0;
+	for (size_t l_offset = 0; l_offset < 2; ++l_offset)
+	{
+		uint8_t* l_data = l_buf.data() + l_offset;
+		for (int l_pattern = 0; l_pattern < 6; ++l_pattern)
+		{
+			for (size_t i = 0; i < l_max_count * l_leaf; ++i)
+			{
+				switch (l_pattern)
+				{
+					case 0:
+						l_data[i] = uint8_t(l_rand());
+						break;
+					case 1:
+						l_data[i] = 0;
+						break;
+					case 2:
+						l_data[i] = 0xFF;
+						break;
+					case 3:
+						l_data[i] = uint8_t(i);
+						break;
+					case 4: // the leaves differ in the first byte only, it is shifted into the first block
+						l_data[i] = i % l_leaf == 0 ? uint8_t(i / l_leaf + 1) : 0x5A;
+						break;
+					case 5: // and in the last byte only, it goes to the padding block
+						l_data[i] = i % l_leaf == l_leaf - 1 ? uint8_t(i / l_leaf + 1) : 0xA5;
+						break;
+				}
+			}
+			for (size_t l_count = 1; l_count <= l_max_count; ++l_count)
+			{
+				TigerHash::hashLeaves(l_data, l_count, l_hashes.data());
+				for (size_t j = 0; j < l_count; ++j)
+				{
+					const uint8_t l_zero = 0;
+					TigerHash h;
+					h.update(&l_zero, 1);
+					h.update(l_data + j * l_leaf, l_leaf);
+					if (memcmp(h.finalize(), l_hashes.data() + j * TigerHash::BYTES, TigerHash::BYTES) != 0)
+					{
+						printf("tiger: offset %u pattern %d count %u leaf %u differs\r\n", unsigned(l_offset), l_pattern, unsigned(l_count), unsigned(j));
+						++l_errors;
+					}
+				}
+			}
+		}
+	}
+	printf("tiger lanes = %u errors = %u\r\n", unsigned(TigerHash::getLeafLanes()), l_errors);
+	return l_errors ? 1 : 0;
+}
+
 int _tmain(int argc, _TCHAR* argv[])
 {
+	if (argc > 1 && _tcscmp(argv[1], _T("tiger")) == 0)
+	{
+		return test_tiger_leaves();
+	}
+	if (argc > 2 && _tcscmp(argv[1], _T("nmdc")) == 0)
+	{
+		return test_nmdc_parser(argv[2]);
+	}
+	if (argc > 1 && _tcscmp(argv[1], _T("xml")) == 0)
+	{
+		return test_xml_parser(argc > 2 ? _tstoi(argv[2]) : 3000000);
+	}
     string aa = "xxxxxx";
     aa += 'a';
     auto l = aa.find("a");
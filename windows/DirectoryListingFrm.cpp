@@ -522,8 +522,7 @@ FileImage::TypeDirectoryImages DirectoryListingFrame::GetTypeDirectory(const Dir
 	//     
 	for (auto i = dir->m_files.cbegin(); i != dir->m_files.cend(); ++i)
 	{
-		const string& nameFile = (*i)->getName();
-		if (FileImage::isDvdFile(nameFile))
+		if (FileImage::isDvdFile((*i)->getNameView()))
 		{
 			return FileImage::DIR_DVD; //  DVD
 		}
@@ -554,8 +553,7 @@ void DirectoryListingFrame::changeDir(DirectoryListing::Directory* p_dir)
 		for (auto i = p_dir->directories.cbegin(); i != p_dir->directories.cend(); ++i)
 		{
 			ItemInfo* ii = new ItemInfo(*i);
-			const auto& l_name = (*i)->getName();
-			if (!l_cur_selected_item_name.empty() && l_name == l_cur_selected_item_name)
+			if (!l_cur_selected_item_name.empty() && (*i)->getNameView() == l_cur_selected_item_name)
 			{
 				l_last_item = ii;
 			}
@@ -564,8 +562,7 @@ void DirectoryListingFrame::changeDir(DirectoryListing::Directory* p_dir)
 		for (auto j = p_dir->m_files.cbegin(); j != p_dir->m_files.cend(); ++j)
 		{
 			ItemInfo* ii = new ItemInfo(*j);
-			const auto& l_name = (*j)->getName();
-			if (!l_cur_selected_item_name.empty() && l_name == l_cur_selected_item_name)
+			if (!l_cur_selected_item_name.empty() && (*j)->getNameView() == l_cur_selected_item_name)
 			{
 				l_last_item = ii;
 			}
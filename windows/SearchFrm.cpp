@@ -1141,6 +1141,7 @@ void SearchFrame::onEnter()
 			++si;
 		}
 		m_search_param.m_token = Util::rand();
+		SearchManager::setActiveSearch(this, m_search_param.m_token);
 	}
 	s = s.substr(0, max(s.size(), static_cast<tstring::size_type>(1)) - 1);
 	
@@ -2501,6 +2502,7 @@ LRESULT SearchFrame::onClose(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/
 			ClientManager::getInstance()->removeListener(this);
 		}
 		SearchManager::getInstance()->removeListener(this);
+		SearchManager::removeActiveSearch(this);
 		g_search_frames.erase(m_hWnd);
 #ifdef FLYLINKDC_USE_MEDIAINFO_SERVER
 		waitForFlyServerStop();
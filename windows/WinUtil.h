@@ -22,6 +22,7 @@
 #pragma once
 
 #include <functional>
+#include <string_view>
 
 #include <Richedit.h>
 #include <atlctrls.h>
@@ -1030,7 +1031,7 @@ struct FileImage : public BaseImageList
 		}
 		
 		//     ,     dvd
-		static bool isDvdFile(const string& nameFile)
+		static bool isDvdFile(std::string_view nameFile)
 		{
 			//   dvd   (8    , 3   )
 			if (nameFile.length() == 12)
@@ -301,7 +301,7 @@ size_t DCLSTGenDlg::PackAndSave()
 	try
 	{
 		unique_ptr<OutputStream> outFilePtr(new File(_mNameDCLST, File::WRITE, File::TRUNCATE | File::CREATE, false));
-		FilteredOutputStream<BZFilter, false> outFile(outFilePtr.get());
+		ParallelBZOutputStream<false> outFile(outFilePtr.get());
 		outSize += outFile.write(_xml.c_str(), _xml.size());
 		outSize += outFile.flushBuffers(true);
 	}